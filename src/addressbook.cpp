@@ -21,6 +21,7 @@
 std::mutex AddressBook::m_Mutex;
 bool AddressBook::m_CacheEncrypt = true;
 std::string AddressBook::m_Pass;
+std::string AddressBook::m_CacheKey;
 std::set<std::string> AddressBook::m_MsgIds;
 std::map<std::string, uint32_t> AddressBook::m_Addresses;
 
@@ -32,6 +33,11 @@ void AddressBook::Init(const bool p_CacheEncrypt, const std::string& p_Pass)
 
   InitCacheDir();
 
+  if (m_CacheEncrypt)
+  {
+    m_CacheKey = Crypto::GetCacheKey(GetAddressCacheDir(), m_Pass);
+  }
+
   m_MsgIds = Deserialize<std::set<std::string>>(ReadCacheFile(GetMsgIdsCachePath()));
   m_Addresses = Deserialize<std::map<std::string, uint32_t>>(ReadCacheFile(GetAddressesCachePath()));
 }
@@ -126,7 +132,23 @@ std::string AddressBook::ReadCacheFile(const std::string &p_Path)
 {
   if (m_CacheEncrypt)
   {
-    return Crypto::AESDecrypt(Util::ReadFile(p_Path), m_Pass);
+    const std::string& data = Util::ReadFile(p_Path);
+    std::string str;
+    if (Crypto::IsAESGCM(data))
+    {
+      Crypto::AESGCMDecrypt(data, m_CacheKey, str);
+    }
+    else if (!data.empty())
+    {
+      // re-encrypt data written by earlier versions
+      str = Crypto::AESDecrypt(data, m_Pass);
+      if (!str.empty())
+      {
+        WriteCacheFile(p_Path, str);
+      }
+    }
+
+    return str;
   }
   else
   {
@@ -138,7 +160,7 @@ void AddressBook::WriteCacheFile(const std::string &p_Path, const std::string &p
 {
   if (m_CacheEncrypt)
   {
-    Util::WriteFile(p_Path, Crypto::AESEncrypt(p_Str, m_Pass));
+    Util::WriteFile(p_Path, Crypto::AESGCMEncrypt(p_Str, m_CacheKey));
   }
   else
   {
@@ -36,6 +36,7 @@ private:
   static std::mutex m_Mutex;
   static bool m_CacheEncrypt;
   static std::string m_Pass;
+  static std::string m_CacheKey;
   static std::set<std::string> m_MsgIds;
   static std::map<std::string, uint32_t> m_Addresses;
 };
@@ -9,10 +9,18 @@
 
 #include <libetpan/libetpan.h>
 
+#include "htmlconvert.h"
 #include "log.h"
 #include "loghelp.h"
+#include "serialized.h"
 #include "util.h"
 
+// increment when the parsed data format or the parsing itself changes
+static const uint32_t s_ParsedDataVersion = 1;
+
+// increment when the structure data format changes
+static const uint32_t s_StructureDataVersion = 1;
+
 void Body::SetData(const std::string &p_Data)
 {
   m_Data = p_Data;
@@ -24,10 +32,119 @@ std::string Body::GetData() const
   return m_Data;
 }
 
-std::string Body::GetTextPlain()
+std::string Body::GetParsedData()
 {
   Parse();
 
+  // parts are stored as locations in the raw data, except the plain text part and parts
+  // without a location, which are stored decoded
+  Serialized serialized;
+  serialized << s_ParsedDataVersion << Util::GetHtmlConvertCmd();
+  serialized << m_TextPlainIndex << m_TextHtmlIndex << m_TextFromHtml;
+  serialized << static_cast<uint64_t>(m_Parts.size());
+  for (auto& part : m_Parts)
+  {
+    auto locationIt = m_PartLocations.find(part.first);
+    const bool isDecoded = (part.first == m_TextPlainIndex) ||
+      (locationIt == m_PartLocations.end());
+
+    serialized << part.first << part.second.m_MimeType << part.second.m_Filename;
+    serialized << part.second.m_ContentId << static_cast<uint32_t>(isDecoded);
+    if (isDecoded)
+    {
+      LoadPart(part.first);
+      serialized << part.second.m_Data;
+    }
+    else
+    {
+      const PartLocation& partLocation = locationIt->second;
+      serialized << static_cast<uint64_t>(partLocation.m_Offset);
+      serialized << static_cast<uint64_t>(partLocation.m_Length);
+      serialized << partLocation.m_Encoding << partLocation.m_Charset;
+    }
+  }
+
+  serialized << static_cast<uint64_t>(m_Parts.size());
+
+  return serialized.ToString();
+}
+
+bool Body::SetParsedData(const std::string& p_ParsedData)
+{
+  Serialized serialized;
+  serialized.FromString(p_ParsedData);
+
+  uint32_t version = 0;
+  std::string htmlConvertCmd;
+  serialized >> version >> htmlConvertCmd;
+  if ((version != s_ParsedDataVersion) || (htmlConvertCmd != Util::GetHtmlConvertCmd()))
+  {
+    return false;
+  }
+
+  ssize_t textPlainIndex = -1;
+  ssize_t textHtmlIndex = -1;
+  std::string textFromHtml;
+  uint64_t count = 0;
+  serialized >> textPlainIndex >> textHtmlIndex >> textFromHtml >> count;
+
+  std::map<ssize_t, Part> parts;
+  std::map<ssize_t, PartLocation> partLocations;
+  std::set<ssize_t> unloadedParts;
+  for (uint64_t i = 0; (i < count) && (i < p_ParsedData.size()); ++i)
+  {
+    ssize_t index = 0;
+    Part part;
+    uint32_t isDecoded = 0;
+    serialized >> index >> part.m_MimeType >> part.m_Filename >> part.m_ContentId >> isDecoded;
+    if (isDecoded)
+    {
+      serialized >> part.m_Data;
+    }
+    else
+    {
+      PartLocation partLocation;
+      uint64_t offset = 0;
+      uint64_t length = 0;
+      serialized >> offset >> length >> partLocation.m_Encoding >> partLocation.m_Charset;
+      if ((offset > m_Data.size()) || (length > (m_Data.size() - offset)))
+      {
+        return false;
+      }
+
+      partLocation.m_Offset = offset;
+      partLocation.m_Length = length;
+      partLocations[index] = partLocation;
+      unloadedParts.insert(index);
+    }
+
+    parts[index] = part;
+  }
+
+  uint64_t endCount = 0;
+  serialized >> endCount;
+  if ((endCount != count) || (parts.size() != count))
+  {
+    return false;
+  }
+
+  m_Parts = parts;
+  m_PartLocations = partLocations;
+  m_UnloadedParts = unloadedParts;
+  m_TextPlainIndex = textPlainIndex;
+  m_TextHtmlIndex = textHtmlIndex;
+  m_TextFromHtml = textFromHtml;
+  m_PartsParsed = true;
+  m_Parsed = true;
+
+  return true;
+}
+
+std::string Body::GetTextPlain()
+{
+  ParseParts();
+  LoadPart(m_TextPlainIndex);
+
   if ((m_TextPlainIndex != -1) && m_Parts.count(m_TextPlainIndex))
   {
     return m_Parts.at(m_TextPlainIndex).m_Data;
@@ -40,7 +157,8 @@ std::string Body::GetTextPlain()
 
 std::string Body::GetTextHtml()
 {
-  Parse();
+  ParseParts();
+  LoadPart(m_TextHtmlIndex);
 
   if ((m_TextHtmlIndex != -1) && m_Parts.count(m_TextHtmlIndex))
   {
@@ -76,12 +194,203 @@ std::string Body::GetText()
 std::map<ssize_t, Part> Body::GetParts()
 {
   Parse();
+  while (!m_UnloadedParts.empty())
+  {
+    LoadPart(*m_UnloadedParts.begin());
+  }
+
   return m_Parts;
 }
 
+void Body::SetStructure(const std::vector<PartSection>& p_Sections)
+{
+  // parts of a partially fetched message are indexed by their position in the structure,
+  // and remain empty until their section data is set
+  m_Data.clear();
+  m_Parts.clear();
+  m_PartLocations.clear();
+  m_UnloadedParts.clear();
+  m_TextPlainIndex = -1;
+  m_TextHtmlIndex = -1;
+  m_TextFromHtml.clear();
+  m_Sections = p_Sections;
+
+  for (size_t i = 0; i < m_Sections.size(); ++i)
+  {
+    const PartSection& section = m_Sections.at(i);
+    Part part;
+    part.m_MimeType = section.m_MimeType;
+    part.m_Filename = Util::MimeToUtf8(section.m_Filename);
+    part.m_ContentId = section.m_ContentId;
+    part.m_Fetched = false;
+    m_Parts[i] = part;
+
+    // named text parts are attachments, not the message text
+    if (section.m_Filename.empty())
+    {
+      if ((m_TextPlainIndex == -1) && (section.m_MimeType == "text/plain"))
+      {
+        m_TextPlainIndex = i;
+      }
+
+      if ((m_TextHtmlIndex == -1) && (section.m_MimeType == "text/html"))
+      {
+        m_TextHtmlIndex = i;
+      }
+    }
+  }
+
+  m_PartsParsed = true;
+  m_Parsed = false;
+}
+
+std::string Body::GetStructureData() const
+{
+  Serialized serialized;
+  serialized << s_StructureDataVersion << static_cast<uint64_t>(m_Sections.size());
+  for (auto& section : m_Sections)
+  {
+    serialized << section.m_Section << section.m_MimeType << section.m_Filename;
+    serialized << section.m_ContentId << section.m_Charset << section.m_Encoding;
+    serialized << section.m_Size;
+  }
+
+  serialized << static_cast<uint64_t>(m_Sections.size());
+
+  return serialized.ToString();
+}
+
+bool Body::SetStructureData(const std::string& p_StructureData)
+{
+  Serialized serialized;
+  serialized.FromString(p_StructureData);
+
+  uint32_t version = 0;
+  uint64_t count = 0;
+  serialized >> version >> count;
+  if (version != s_StructureDataVersion)
+  {
+    return false;
+  }
+
+  std::vector<PartSection> sections;
+  for (uint64_t i = 0; (i < count) && (i < p_StructureData.size()); ++i)
+  {
+    PartSection section;
+    serialized >> section.m_Section >> section.m_MimeType >> section.m_Filename;
+    serialized >> section.m_ContentId >> section.m_Charset >> section.m_Encoding;
+    serialized >> section.m_Size;
+    sections.push_back(section);
+  }
+
+  uint64_t endCount = 0;
+  serialized >> endCount;
+  if ((endCount != count) || (sections.size() != count) || sections.empty())
+  {
+    return false;
+  }
+
+  SetStructure(sections);
+
+  return true;
+}
+
+const std::vector<PartSection>& Body::GetSections() const
+{
+  return m_Sections;
+}
+
+bool Body::SetSectionData(ssize_t p_Index, const std::string& p_Data)
+{
+  auto partIt = m_Parts.find(p_Index);
+  if ((p_Index < 0) || (p_Index >= (ssize_t)m_Sections.size()) || (partIt == m_Parts.end()))
+  {
+    return false;
+  }
+
+  PartSection& section = m_Sections.at(p_Index);
+  size_t index = 0;
+  if (!DecodePart(p_Data.c_str(), p_Data.size(), section.m_Encoding, section.m_MimeType,
+                  section.m_Charset, partIt->second.m_Data, index))
+  {
+    return false;
+  }
+
+  partIt->second.m_Fetched = true;
+  if (p_Index == m_TextHtmlIndex)
+  {
+    m_TextFromHtml.clear();
+    m_Parsed = false;
+  }
+
+  return true;
+}
+
+bool Body::SetSectionPath(ssize_t p_Index, const std::string& p_Path)
+{
+  auto partIt = m_Parts.find(p_Index);
+  if ((p_Index < 0) || (p_Index >= (ssize_t)m_Sections.size()) || (partIt == m_Parts.end()))
+  {
+    return false;
+  }
+
+  partIt->second.m_Data.clear();
+  partIt->second.m_Path = p_Path;
+  partIt->second.m_Fetched = true;
+
+  return true;
+}
+
+bool Body::IsPartial() const
+{
+  return !m_Sections.empty();
+}
+
+std::set<ssize_t> Body::GetTextParts() const
+{
+  std::set<ssize_t> textParts;
+  if (m_TextPlainIndex != -1)
+  {
+    textParts.insert(m_TextPlainIndex);
+  }
+
+  if (m_TextHtmlIndex != -1)
+  {
+    textParts.insert(m_TextHtmlIndex);
+  }
+
+  return textParts;
+}
+
+std::set<ssize_t> Body::GetUnfetchedParts() const
+{
+  std::set<ssize_t> unfetchedParts;
+  for (auto& part : m_Parts)
+  {
+    if (!part.second.m_Fetched)
+    {
+      unfetchedParts.insert(part.first);
+    }
+  }
+
+  return unfetchedParts;
+}
+
 void Body::Parse()
 {
   if (!m_Parsed)
+  {
+    ParseParts();
+    ParseHtml();
+
+    m_Parsed = true;
+  }
+}
+
+void Body::ParseParts()
+{
+  // mime parts only, without the external html conversion
+  if (!m_PartsParsed)
   {
     struct mailmime* mime = NULL;
     size_t current_index = 0;
@@ -93,9 +402,7 @@ void Body::Parse()
       mailmime_free(mime);
     }
 
-    ParseHtml();
-
-    m_Parsed = true;
+    m_PartsParsed = true;
   }
 }
 
@@ -103,12 +410,20 @@ void Body::ParseHtml()
 {
   if ((m_TextHtmlIndex != -1) && m_Parts.count(m_TextHtmlIndex))
   {
+    LoadPart(m_TextHtmlIndex);
     const std::string& textHtml = m_Parts.at(m_TextHtmlIndex).m_Data;
+    const std::string& htmlConvertCmd = Util::GetHtmlConvertCmd();
+    if (htmlConvertCmd.empty())
+    {
+      m_TextFromHtml = HtmlConvert::ToText(textHtml);
+      return;
+    }
+
     const std::string& textHtmlPath = Util::GetTempFilename(".html");
     Util::WriteFile(textHtmlPath, textHtml);
 
     const std::string& textFromHtmlPath = Util::GetTempFilename(".txt");
-    const std::string& command = Util::GetHtmlConvertCmd() + std::string(" ") + textHtmlPath +
+    const std::string& command = htmlConvertCmd + std::string(" ") + textHtmlPath +
         std::string(" 2> /dev/null > ") + textFromHtmlPath;
     int rv = system(command.c_str());
     if (rv == 0)
@@ -259,48 +574,29 @@ void Body::ParseMimeData(mailmime* p_Mime, std::string p_MimeType)
   {
     case MAILMIME_DATA_TEXT:
       {
+        const char* textData = data->dt_data.dt_text.dt_data;
+        const size_t textLength = data->dt_data.dt_text.dt_length;
         size_t index = 0;
-        char* parsedStr = NULL;
-        size_t parsedLen = 0;
-        int rv = mailmime_part_parse(data->dt_data.dt_text.dt_data,
-                                     data->dt_data.dt_text.dt_length, &index,
-                                     data->dt_encoding, &parsedStr, &parsedLen);
-        
-        if (rv == MAILIMF_NO_ERROR)
+        Part part;
+        if (DecodePart(textData, textLength, data->dt_encoding, p_MimeType, charset,
+                       part.m_Data, index))
         {
-          Part part;
-
-          if (!charset.empty() && (charset != "utf-8"))
-          {
-            char* convStr = NULL;
-            size_t convLen = 0;
-            if ((charconv_buffer("utf-8", charset.c_str(), parsedStr, parsedLen, &convStr, &convLen) == MAIL_CHARCONV_NO_ERROR) &&
-                (convStr != NULL))
-            {
-              part.m_Data = std::string(convStr, convLen);
-              charconv_buffer_free(convStr);
-            }
-            else
-            {
-              LOG_ERROR("cannot convert %s to utf-8", charset.c_str());
-            }
-          }
-
-          if (parsedStr != NULL)
-          {
-            if (part.m_Data.empty())
-            {
-              part.m_Data = std::string(parsedStr, parsedLen);
-            }
-
-            mmap_string_unref(parsedStr);
-          }
-
           part.m_MimeType = p_MimeType;
           part.m_Filename = Util::MimeToUtf8(filename);
           part.m_ContentId = contentId;
           m_Parts[index] = part;
-          
+
+          if ((textData >= m_Data.c_str()) &&
+              ((textData + textLength) <= (m_Data.c_str() + m_Data.size())))
+          {
+            PartLocation partLocation;
+            partLocation.m_Offset = textData - m_Data.c_str();
+            partLocation.m_Length = textLength;
+            partLocation.m_Encoding = data->dt_encoding;
+            partLocation.m_Charset = charset;
+            m_PartLocations[index] = partLocation;
+          }
+
           if ((m_TextPlainIndex == -1) && (p_MimeType == "text/plain"))
           {
             m_TextPlainIndex = index;
@@ -322,6 +618,69 @@ void Body::ParseMimeData(mailmime* p_Mime, std::string p_MimeType)
   }
 }
 
+void Body::LoadPart(ssize_t p_Index)
+{
+  if (m_UnloadedParts.erase(p_Index) == 0) return;
+
+  auto partIt = m_Parts.find(p_Index);
+  auto locationIt = m_PartLocations.find(p_Index);
+  if ((partIt != m_Parts.end()) && (locationIt != m_PartLocations.end()))
+  {
+    PartLocation& partLocation = locationIt->second;
+    size_t index = 0;
+    DecodePart(m_Data.c_str() + partLocation.m_Offset, partLocation.m_Length,
+               partLocation.m_Encoding, partIt->second.m_MimeType, partLocation.m_Charset,
+               partIt->second.m_Data, index);
+  }
+}
+
+bool Body::DecodePart(const char* p_Data, size_t p_Length, int p_Encoding,
+                      const std::string& p_MimeType, std::string& p_Charset,
+                      std::string& p_Decoded, size_t& p_Index)
+{
+  char* parsedStr = NULL;
+  size_t parsedLen = 0;
+  int rv = mailmime_part_parse(p_Data, p_Length, &p_Index, p_Encoding, &parsedStr, &parsedLen);
+  if (rv != MAILIMF_NO_ERROR)
+  {
+    return false;
+  }
+
+  p_Decoded.clear();
+  if (parsedStr != NULL)
+  {
+    if (p_Charset.empty() && (p_MimeType == "text/html"))
+    {
+      p_Charset = HtmlConvert::GetCharset(std::string(parsedStr, parsedLen));
+    }
+
+    if (!p_Charset.empty() && (p_Charset != "utf-8"))
+    {
+      char* convStr = NULL;
+      size_t convLen = 0;
+      if ((charconv_buffer("utf-8", p_Charset.c_str(), parsedStr, parsedLen, &convStr, &convLen) == MAIL_CHARCONV_NO_ERROR) &&
+          (convStr != NULL))
+      {
+        p_Decoded = std::string(convStr, convLen);
+        charconv_buffer_free(convStr);
+      }
+      else
+      {
+        LOG_ERROR("cannot convert %s to utf-8", p_Charset.c_str());
+      }
+    }
+
+    if (p_Decoded.empty())
+    {
+      p_Decoded = std::string(parsedStr, parsedLen);
+    }
+
+    mmap_string_unref(parsedStr);
+  }
+
+  return true;
+}
+
 void Body::RemoveInvalidHeaders()
 {
   if (m_Data.find("From ", 0) == 0)
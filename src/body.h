@@ -8,7 +8,9 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 struct Part
 {
@@ -16,6 +18,20 @@ struct Part
   std::string m_Data;
   std::string m_Filename;
   std::string m_ContentId;
+  std::string m_Path; // set when data is held in a file instead of m_Data
+  bool m_Fetched = true;
+};
+
+// message part as described by the imap body structure, for parts fetched separately
+struct PartSection
+{
+  std::string m_Section;
+  std::string m_MimeType;
+  std::string m_Filename;
+  std::string m_ContentId;
+  std::string m_Charset;
+  int m_Encoding = 0;
+  uint32_t m_Size = 0;
 };
 
 class Body
@@ -23,24 +39,54 @@ class Body
 public:
   void SetData(const std::string& p_Data);
   std::string GetData() const;
+  std::string GetParsedData();
+  bool SetParsedData(const std::string& p_ParsedData);
   std::string GetTextPlain();
   std::string GetTextHtml();
   std::string GetTextFromHtml();
   std::string GetText();
   std::map<ssize_t, Part> GetParts();
 
+  void SetStructure(const std::vector<PartSection>& p_Sections);
+  std::string GetStructureData() const;
+  bool SetStructureData(const std::string& p_StructureData);
+  const std::vector<PartSection>& GetSections() const;
+  bool SetSectionData(ssize_t p_Index, const std::string& p_Data);
+  bool SetSectionPath(ssize_t p_Index, const std::string& p_Path);
+  bool IsPartial() const;
+  std::set<ssize_t> GetTextParts() const;
+  std::set<ssize_t> GetUnfetchedParts() const;
+
 private:
+  // location of an undecoded part within the raw message data
+  struct PartLocation
+  {
+    size_t m_Offset = 0;
+    size_t m_Length = 0;
+    int m_Encoding = 0;
+    std::string m_Charset;
+  };
+
   void Parse();
+  void ParseParts();
   void ParseHtml();
   void ParseMime(struct mailmime* p_Mime);
   void ParseMimeData(struct mailmime* p_Mime, std::string p_MimeType);
+  void LoadPart(ssize_t p_Index);
+  static bool DecodePart(const char* p_Data, size_t p_Length, int p_Encoding,
+                         const std::string& p_MimeType, std::string& p_Charset,
+                         std::string& p_Decoded, size_t& p_Index);
   void RemoveInvalidHeaders();
   
 private:
   std::string m_Data;
 
   bool m_Parsed = false;
+  bool m_PartsParsed = false;
   std::map<ssize_t, Part> m_Parts;
+  std::map<ssize_t, PartLocation> m_PartLocations;
+  std::set<ssize_t> m_UnloadedParts;
+  std::vector<PartSection> m_Sections;
   ssize_t m_TextPlainIndex = -1;
   ssize_t m_TextHtmlIndex = -1;
   std::string m_TextFromHtml;
@@ -0,0 +1,316 @@
+// composebuffer.cpp
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "composebuffer.h"
+
+#include <algorithm>
+
+#include "wraplayout.h"
+
+ComposeBuffer::ComposeBuffer()
+{
+  SetText(L"");
+}
+
+ComposeBuffer::~ComposeBuffer()
+{
+}
+
+void ComposeBuffer::SetText(const std::wstring& p_Text)
+{
+  m_Lines.clear();
+  size_t pos = 0;
+  while (true)
+  {
+    size_t newlinePos = p_Text.find(L'\n', pos);
+    Line line;
+    line.m_Text = p_Text.substr(pos, (newlinePos != std::wstring::npos) ?
+                                (newlinePos - pos) : std::wstring::npos);
+    m_Lines.push_back(line);
+    if (newlinePos == std::wstring::npos) break;
+
+    pos = newlinePos + 1;
+  }
+
+  SetCursorStart();
+}
+
+std::wstring ComposeBuffer::GetText() const
+{
+  std::wstring text;
+  for (size_t i = 0; i < m_Lines.size(); ++i)
+  {
+    if (i > 0)
+    {
+      text += L"\n";
+    }
+
+    text += m_Lines[i].m_Text;
+  }
+
+  return text;
+}
+
+std::wstring ComposeBuffer::GetWrappedText()
+{
+  std::wstring text;
+  for (size_t i = 0; i < m_Lines.size(); ++i)
+  {
+    const Wraps& wraps = GetWraps(i);
+    for (size_t j = 0; j < wraps.size(); ++j)
+    {
+      if ((i > 0) || (j > 0))
+      {
+        text += L"\n";
+      }
+
+      text += m_Lines[i].m_Text.substr(wraps[j].first, wraps[j].second);
+    }
+  }
+
+  return text;
+}
+
+bool ComposeBuffer::IsEmpty() const
+{
+  return (m_Lines.size() == 1) && m_Lines[0].m_Text.empty();
+}
+
+void ComposeBuffer::SetLineLength(unsigned p_LineLength)
+{
+  p_LineLength = std::max(p_LineLength, 1u);
+  if (p_LineLength != m_LineLength)
+  {
+    m_LineLength = p_LineLength;
+    for (auto& line : m_Lines)
+    {
+      line.m_Wrapped = false;
+    }
+  }
+}
+
+void ComposeBuffer::GetWrappedLines(size_t p_Offset, size_t p_Count,
+                                    std::vector<std::wstring>& p_Lines)
+{
+  size_t wrapLine = 0;
+  for (size_t i = 0; (i < m_Lines.size()) && (p_Lines.size() < p_Count); ++i)
+  {
+    const Wraps& wraps = GetWraps(i);
+    if ((wrapLine + wraps.size()) <= p_Offset)
+    {
+      wrapLine += wraps.size();
+      continue;
+    }
+
+    for (size_t j = 0; (j < wraps.size()) && (p_Lines.size() < p_Count); ++j, ++wrapLine)
+    {
+      if (wrapLine < p_Offset) continue;
+
+      p_Lines.push_back(m_Lines[i].m_Text.substr(wraps[j].first, wraps[j].second));
+    }
+  }
+}
+
+void ComposeBuffer::GetCursor(int& p_WrapLine, int& p_WrapPos)
+{
+  size_t wrapLine = 0;
+  for (size_t i = 0; i < m_Line; ++i)
+  {
+    wrapLine += GetWraps(i).size();
+  }
+
+  const size_t wrapIndex = GetWrapIndex(m_Line, m_Col);
+  p_WrapLine = wrapLine + wrapIndex;
+  p_WrapPos = m_Col - GetWraps(m_Line).at(wrapIndex).first;
+}
+
+void ComposeBuffer::SetCursorStart()
+{
+  m_Line = 0;
+  m_Col = 0;
+}
+
+bool ComposeBuffer::IsCursorStart() const
+{
+  return (m_Line == 0) && (m_Col == 0);
+}
+
+void ComposeBuffer::Insert(wchar_t p_Char)
+{
+  std::wstring& text = m_Lines[m_Line].m_Text;
+  if (p_Char == L'\n')
+  {
+    Line line;
+    line.m_Text = text.substr(m_Col);
+    text.erase(m_Col);
+    EditLine(m_Line);
+    m_Lines.insert(m_Lines.begin() + m_Line + 1, line);
+    ++m_Line;
+    m_Col = 0;
+  }
+  else
+  {
+    text.insert(m_Col++, 1, p_Char);
+    EditLine(m_Line);
+  }
+}
+
+void ComposeBuffer::Backspace()
+{
+  if (IsCursorStart()) return;
+
+  MoveLeft();
+  Delete();
+}
+
+void ComposeBuffer::Delete()
+{
+  std::wstring& text = m_Lines[m_Line].m_Text;
+  if (m_Col < text.size())
+  {
+    text.erase(m_Col, 1);
+    EditLine(m_Line);
+  }
+  else if ((m_Line + 1) < m_Lines.size())
+  {
+    text += m_Lines[m_Line + 1].m_Text;
+    m_Lines.erase(m_Lines.begin() + m_Line + 1);
+    EditLine(m_Line);
+  }
+}
+
+void ComposeBuffer::DeleteLine()
+{
+  // delete to and including end of line
+  std::wstring& text = m_Lines[m_Line].m_Text;
+  text.erase(m_Col);
+  if ((m_Line + 1) < m_Lines.size())
+  {
+    text += m_Lines[m_Line + 1].m_Text;
+    m_Lines.erase(m_Lines.begin() + m_Line + 1);
+  }
+
+  EditLine(m_Line);
+}
+
+void ComposeBuffer::MoveLeft()
+{
+  if (m_Col > 0)
+  {
+    --m_Col;
+  }
+  else if (m_Line > 0)
+  {
+    --m_Line;
+    m_Col = m_Lines[m_Line].m_Text.size();
+  }
+}
+
+void ComposeBuffer::MoveRight()
+{
+  if (m_Col < m_Lines[m_Line].m_Text.size())
+  {
+    ++m_Col;
+  }
+  else if ((m_Line + 1) < m_Lines.size())
+  {
+    ++m_Line;
+    m_Col = 0;
+  }
+}
+
+bool ComposeBuffer::MoveUp()
+{
+  const size_t wrapIndex = GetWrapIndex(m_Line, m_Col);
+  const size_t wrapPos = m_Col - GetWraps(m_Line).at(wrapIndex).first;
+  if (wrapIndex > 0)
+  {
+    m_Col = GetWrapCol(m_Line, wrapIndex - 1, wrapPos);
+  }
+  else if (m_Line > 0)
+  {
+    --m_Line;
+    m_Col = GetWrapCol(m_Line, GetWraps(m_Line).size() - 1, wrapPos);
+  }
+  else
+  {
+    return false;
+  }
+
+  return true;
+}
+
+void ComposeBuffer::MoveDown()
+{
+  const size_t wrapIndex = GetWrapIndex(m_Line, m_Col);
+  const size_t wrapPos = m_Col - GetWraps(m_Line).at(wrapIndex).first;
+  if ((wrapIndex + 1) < GetWraps(m_Line).size())
+  {
+    m_Col = GetWrapCol(m_Line, wrapIndex + 1, wrapPos);
+  }
+  else if ((m_Line + 1) < m_Lines.size())
+  {
+    ++m_Line;
+    m_Col = GetWrapCol(m_Line, 0, wrapPos);
+  }
+  else
+  {
+    m_Col = m_Lines[m_Line].m_Text.size();
+  }
+}
+
+const ComposeBuffer::Wraps& ComposeBuffer::GetWraps(size_t p_Line)
+{
+  Line& line = m_Lines[p_Line];
+  if (!line.m_Wrapped)
+  {
+    line.m_Wraps.clear();
+    size_t pos = 0;
+    std::pair<size_t, size_t> wrap;
+    while (WrapLayout::WrapSegment(line.m_Text, pos, line.m_Text.size(), m_LineLength, true,
+                                   wrap))
+    {
+      line.m_Wraps.push_back(wrap);
+    }
+
+    line.m_Wraps.push_back(wrap);
+    line.m_Wrapped = true;
+  }
+
+  return line.m_Wraps;
+}
+
+size_t ComposeBuffer::GetWrapIndex(size_t p_Line, size_t p_Col)
+{
+  const Wraps& wraps = GetWraps(p_Line);
+  size_t wrapIndex = 0;
+  while (((wrapIndex + 1) < wraps.size()) && (wraps[wrapIndex + 1].first <= p_Col))
+  {
+    ++wrapIndex;
+  }
+
+  return wrapIndex;
+}
+
+size_t ComposeBuffer::GetWrapCol(size_t p_Line, size_t p_WrapIndex, size_t p_WrapPos)
+{
+  // keep the cursor within the wrapped line, i.e. before a following line without separator
+  const Wraps& wraps = GetWraps(p_Line);
+  size_t maxPos = wraps[p_WrapIndex].second;
+  if (((p_WrapIndex + 1) < wraps.size()) &&
+      (wraps[p_WrapIndex + 1].first == (wraps[p_WrapIndex].first + maxPos)) && (maxPos > 0))
+  {
+    --maxPos;
+  }
+
+  return wraps[p_WrapIndex].first + std::min(p_WrapPos, maxPos);
+}
+
+void ComposeBuffer::EditLine(size_t p_Line)
+{
+  m_Lines[p_Line].m_Wrapped = false;
+}
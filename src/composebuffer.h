@@ -0,0 +1,63 @@
+// composebuffer.h
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// Compose message text, stored as an array of lines with a cursor. Each line keeps its own
+// word wrapped layout, which is only redone when the line is edited, so editing cost depends
+// on the edited line rather than the whole message.
+class ComposeBuffer
+{
+public:
+  ComposeBuffer();
+  virtual ~ComposeBuffer();
+
+  void SetText(const std::wstring& p_Text);
+  std::wstring GetText() const;
+  std::wstring GetWrappedText();
+  bool IsEmpty() const;
+
+  void SetLineLength(unsigned p_LineLength);
+  void GetWrappedLines(size_t p_Offset, size_t p_Count, std::vector<std::wstring>& p_Lines);
+  void GetCursor(int& p_WrapLine, int& p_WrapPos);
+  void SetCursorStart();
+  bool IsCursorStart() const;
+
+  void Insert(wchar_t p_Char);
+  void Backspace();
+  void Delete();
+  void DeleteLine();
+  void MoveLeft();
+  void MoveRight();
+  bool MoveUp();
+  void MoveDown();
+
+private:
+  typedef std::vector<std::pair<size_t, size_t>> Wraps;
+
+  struct Line
+  {
+    std::wstring m_Text;
+    Wraps m_Wraps;
+    bool m_Wrapped = false;
+  };
+
+  const Wraps& GetWraps(size_t p_Line);
+  size_t GetWrapIndex(size_t p_Line, size_t p_Col);
+  size_t GetWrapCol(size_t p_Line, size_t p_WrapIndex, size_t p_WrapPos);
+  void EditLine(size_t p_Line);
+
+private:
+  std::vector<Line> m_Lines;
+  size_t m_Line = 0;
+  size_t m_Col = 0;
+  unsigned m_LineLength = 1;
+};
@@ -0,0 +1,144 @@
+// countingstream.cpp
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "countingstream.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include <libetpan/libetpan.h>
+
+struct CountingStreamData
+{
+  mailstream_low* m_Low = NULL;
+  StreamCounters* m_Counters = NULL;
+};
+
+static mailstream_low* GetDataLow(mailstream_low* p_Stream)
+{
+  return static_cast<CountingStreamData*>(p_Stream->data)->m_Low;
+}
+
+static ssize_t CountingRead(mailstream_low* p_Stream, void* p_Buf, size_t p_Count)
+{
+  CountingStreamData* data = static_cast<CountingStreamData*>(p_Stream->data);
+  ssize_t rv = mailstream_low_read(data->m_Low, p_Buf, p_Count);
+  if (rv > 0)
+  {
+    data->m_Counters->m_Read += rv;
+  }
+
+  return rv;
+}
+
+static ssize_t CountingWrite(mailstream_low* p_Stream, const void* p_Buf, size_t p_Count)
+{
+  CountingStreamData* data = static_cast<CountingStreamData*>(p_Stream->data);
+  ssize_t rv = mailstream_low_write(data->m_Low, p_Buf, p_Count);
+  if (rv > 0)
+  {
+    data->m_Counters->m_Written += rv;
+  }
+
+  return rv;
+}
+
+static int CountingClose(mailstream_low* p_Stream)
+{
+  return mailstream_low_close(GetDataLow(p_Stream));
+}
+
+static int CountingGetFd(mailstream_low* p_Stream)
+{
+  return mailstream_low_get_fd(GetDataLow(p_Stream));
+}
+
+static void CountingFree(mailstream_low* p_Stream)
+{
+  CountingStreamData* data = static_cast<CountingStreamData*>(p_Stream->data);
+  mailstream_low_free(data->m_Low);
+  delete data;
+  p_Stream->data = NULL;
+  free(p_Stream);
+}
+
+static void CountingCancel(mailstream_low* p_Stream)
+{
+  mailstream_low_cancel(GetDataLow(p_Stream));
+}
+
+static struct mailstream_cancel* CountingGetCancel(mailstream_low* p_Stream)
+{
+  return mailstream_low_get_cancel(GetDataLow(p_Stream));
+}
+
+static carray* CountingGetCertificateChain(mailstream_low* p_Stream)
+{
+  return mailstream_low_get_certificate_chain(GetDataLow(p_Stream));
+}
+
+static int CountingSetupIdle(mailstream_low* p_Stream)
+{
+  return mailstream_low_setup_idle(GetDataLow(p_Stream));
+}
+
+static int CountingUnsetupIdle(mailstream_low* p_Stream)
+{
+  return mailstream_low_unsetup_idle(GetDataLow(p_Stream));
+}
+
+static int CountingInterruptIdle(mailstream_low* p_Stream)
+{
+  return mailstream_low_interrupt_idle(GetDataLow(p_Stream));
+}
+
+static mailstream_low_driver GetCountingDriver()
+{
+  // assign by name, as the driver struct has grown between libetpan versions
+  mailstream_low_driver driver;
+  memset(&driver, 0, sizeof(driver));
+  driver.mailstream_read = CountingRead;
+  driver.mailstream_write = CountingWrite;
+  driver.mailstream_close = CountingClose;
+  driver.mailstream_get_fd = CountingGetFd;
+  driver.mailstream_free = CountingFree;
+  driver.mailstream_cancel = CountingCancel;
+  driver.mailstream_get_cancel = CountingGetCancel;
+  driver.mailstream_get_certificate_chain = CountingGetCertificateChain;
+  driver.mailstream_setup_idle = CountingSetupIdle;
+  driver.mailstream_unsetup_idle = CountingUnsetupIdle;
+  driver.mailstream_interrupt_idle = CountingInterruptIdle;
+  return driver;
+}
+
+mailstream_low* CountingStream::Open(mailstream_low* p_Low, StreamCounters* p_Counters)
+{
+  static mailstream_low_driver s_Driver = GetCountingDriver();
+
+  CountingStreamData* data = new CountingStreamData();
+  data->m_Low = p_Low;
+  data->m_Counters = p_Counters;
+
+  mailstream_low* stream = mailstream_low_new(data, &s_Driver);
+  if (stream == NULL)
+  {
+    delete data;
+    return NULL;
+  }
+
+  return stream;
+}
+
+mailstream_low* CountingStream::GetLow(mailstream_low* p_Stream)
+{
+  return GetDataLow(p_Stream);
+}
+
+void CountingStream::SetLow(mailstream_low* p_Stream, mailstream_low* p_Low)
+{
+  static_cast<CountingStreamData*>(p_Stream->data)->m_Low = p_Low;
+}
@@ -0,0 +1,31 @@
+// countingstream.h
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <atomic>
+
+#include <stdint.h>
+
+struct mailstream_low;
+
+struct StreamCounters
+{
+  std::atomic<uint64_t> m_Read{0};
+  std::atomic<uint64_t> m_Written{0};
+};
+
+// Low-level mailstream layer passing all data through to the layer below it, counting bytes
+// read and written. The layer below can be replaced, to insert other layers (e.g. compression)
+// between this one and the socket.
+class CountingStream
+{
+public:
+  static struct mailstream_low* Open(struct mailstream_low* p_Low, StreamCounters* p_Counters);
+  static struct mailstream_low* GetLow(struct mailstream_low* p_Stream);
+  static void SetLow(struct mailstream_low* p_Stream, struct mailstream_low* p_Low);
+};
@@ -17,8 +17,63 @@
 #include <openssl/sha.h>
 #include <openssl/ssl.h>
 
+#include "log.h"
 #include "loghelp.h"
 #include "serialized.h"
+#include "util.h"
+
+// cache record layout: magic, nonce, ciphertext, tag
+static const std::string s_GCMMagic("NMG1");
+static const int s_GCMNonceLen = 12;
+static const int s_GCMTagLen = 16;
+static const int s_KeyLen = 32;
+static const int s_SaltLen = 16;
+static const int s_KDFIterations = 100000;
+
+// cipher contexts are kept per thread and key, so the key schedule is only set up once
+struct CipherContext
+{
+  ~CipherContext()
+  {
+    if (m_Ctx != NULL)
+    {
+      EVP_CIPHER_CTX_free(m_Ctx);
+    }
+  }
+
+  EVP_CIPHER_CTX* m_Ctx = NULL;
+  std::string m_Key;
+};
+
+static EVP_CIPHER_CTX* GetCipherContext(const std::string& p_Key, bool p_Encrypt)
+{
+  static thread_local CipherContext s_Contexts[2];
+  CipherContext& context = s_Contexts[p_Encrypt ? 1 : 0];
+  if (context.m_Ctx == NULL)
+  {
+    context.m_Ctx = EVP_CIPHER_CTX_new();
+    if (context.m_Ctx == NULL) return NULL;
+
+    context.m_Key.clear();
+  }
+
+  if (context.m_Key != p_Key)
+  {
+    const unsigned char* key = (const unsigned char*)p_Key.c_str();
+    const int rv = p_Encrypt
+      ? EVP_EncryptInit_ex(context.m_Ctx, EVP_aes_256_gcm(), NULL, key, NULL)
+      : EVP_DecryptInit_ex(context.m_Ctx, EVP_aes_256_gcm(), NULL, key, NULL);
+    if (rv != 1)
+    {
+      context.m_Key.clear();
+      return NULL;
+    }
+
+    context.m_Key = p_Key;
+  }
+
+  return context.m_Ctx;
+}
 
 void Crypto::Init()
 {
@@ -135,6 +190,106 @@ std::string Crypto::AESDecrypt(const std::string &p_Ciphertext, const std::strin
   return plaintext;
 }
 
+std::string Crypto::GetCacheKey(const std::string& p_Dir, const std::string& p_Pass)
+{
+  // the salt is created once per cache dir, the key is derived once per session
+  const std::string& saltPath = p_Dir + "salt";
+  std::string salt = Util::ReadFile(saltPath);
+  if (salt.size() != s_SaltLen)
+  {
+    unsigned char buf[s_SaltLen] = { 0 };
+    RAND_bytes(buf, sizeof(buf));
+    salt = std::string((char*)buf, sizeof(buf));
+    Util::WriteFile(saltPath, salt);
+  }
+
+  return DeriveKey(p_Pass, salt);
+}
+
+std::string Crypto::DeriveKey(const std::string& p_Pass, const std::string& p_Salt)
+{
+  unsigned char key[s_KeyLen] = { 0 };
+  if (PKCS5_PBKDF2_HMAC(p_Pass.c_str(), p_Pass.size(),
+                        (const unsigned char*)p_Salt.c_str(), p_Salt.size(),
+                        s_KDFIterations, EVP_sha256(), sizeof(key), key) != 1)
+  {
+    LOG_WARNING("key derivation failed");
+    return std::string();
+  }
+
+  return std::string((char*)key, sizeof(key));
+}
+
+bool Crypto::IsAESGCM(const std::string& p_Ciphertext)
+{
+  return (p_Ciphertext.compare(0, s_GCMMagic.size(), s_GCMMagic) == 0);
+}
+
+std::string Crypto::AESGCMEncrypt(const std::string& p_Plaintext, const std::string& p_Key)
+{
+  EVP_CIPHER_CTX* ctx = GetCipherContext(p_Key, true);
+  if (ctx == NULL) return std::string();
+
+  const size_t headerlen = s_GCMMagic.size() + s_GCMNonceLen;
+  std::string ciphertext(headerlen + p_Plaintext.size() + s_GCMTagLen, '\0');
+  unsigned char* buf = (unsigned char*)&ciphertext[0];
+  memcpy(buf, s_GCMMagic.c_str(), s_GCMMagic.size());
+  unsigned char* nonce = buf + s_GCMMagic.size();
+  RAND_bytes(nonce, s_GCMNonceLen);
+
+  int len = 0;
+  int cipherlen = 0;
+  if ((EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce) != 1) ||
+      (EVP_EncryptUpdate(ctx, buf + headerlen, &len,
+                         (const unsigned char*)p_Plaintext.c_str(), p_Plaintext.size()) != 1))
+  {
+    return std::string();
+  }
+
+  cipherlen = len;
+  if ((EVP_EncryptFinal_ex(ctx, buf + headerlen + cipherlen, &len) != 1) ||
+      (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, s_GCMTagLen,
+                           buf + headerlen + cipherlen + len) != 1))
+  {
+    return std::string();
+  }
+
+  return ciphertext;
+}
+
+bool Crypto::AESGCMDecrypt(const std::string& p_Ciphertext, const std::string& p_Key,
+                           std::string& p_Plaintext)
+{
+  p_Plaintext.clear();
+
+  const size_t headerlen = s_GCMMagic.size() + s_GCMNonceLen;
+  if (!IsAESGCM(p_Ciphertext) || (p_Ciphertext.size() < (headerlen + s_GCMTagLen))) return false;
+
+  EVP_CIPHER_CTX* ctx = GetCipherContext(p_Key, false);
+  if (ctx == NULL) return false;
+
+  const unsigned char* buf = (const unsigned char*)p_Ciphertext.c_str();
+  const unsigned char* nonce = buf + s_GCMMagic.size();
+  const size_t cipherlen = p_Ciphertext.size() - headerlen - s_GCMTagLen;
+  unsigned char tag[s_GCMTagLen];
+  memcpy(tag, buf + headerlen + cipherlen, s_GCMTagLen);
+
+  p_Plaintext.resize(cipherlen);
+  unsigned char* plainbuf = (unsigned char*)&p_Plaintext[0];
+  int len = 0;
+  if ((EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce) != 1) ||
+      (EVP_DecryptUpdate(ctx, plainbuf, &len, buf + headerlen, cipherlen) != 1) ||
+      (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, s_GCMTagLen, tag) != 1) ||
+      (EVP_DecryptFinal_ex(ctx, plainbuf + len, &len) != 1))
+  {
+    LOG_WARNING("cache record decryption failed");
+    p_Plaintext.clear();
+    return false;
+  }
+
+  return true;
+}
+
 std::string Crypto::SHA256(const std::string &p_Str)
 {
   unsigned char hash[SHA256_DIGEST_LENGTH];
@@ -18,5 +18,12 @@ public:
   
   static std::string AESEncrypt(const std::string& p_Plaintext, const std::string& p_Pass);
   static std::string AESDecrypt(const std::string& p_Ciphertext, const std::string& p_Pass);
+
+  static std::string GetCacheKey(const std::string& p_Dir, const std::string& p_Pass);
+  static std::string DeriveKey(const std::string& p_Pass, const std::string& p_Salt);
+  static bool IsAESGCM(const std::string& p_Ciphertext);
+  static std::string AESGCMEncrypt(const std::string& p_Plaintext, const std::string& p_Key);
+  static bool AESGCMDecrypt(const std::string& p_Ciphertext, const std::string& p_Key,
+                            std::string& p_Plaintext);
   static std::string SHA256(const std::string& p_Str);
 };
@@ -0,0 +1,374 @@
+// dateuidindex.cpp
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "dateuidindex.h"
+
+DateUidIndex::DateUidIndex()
+{
+  Clear();
+}
+
+DateUidIndex::~DateUidIndex()
+{
+}
+
+bool DateUidIndex::Insert(int64_t p_TimeStamp, uint32_t p_Uid)
+{
+  uint32_t rows = 1;
+  auto it = m_UidTimeStamps.find(p_Uid);
+  if (it != m_UidTimeStamps.end())
+  {
+    if (it->second == p_TimeStamp)
+    {
+      return false;
+    }
+
+    rows = m_Nodes[Find(it->second, p_Uid)].m_Rows;
+    m_Root = Erase(m_Root, it->second, p_Uid);
+    it->second = p_TimeStamp;
+  }
+  else
+  {
+    m_UidTimeStamps.insert(std::pair<uint32_t, int64_t>(p_Uid, p_TimeStamp));
+  }
+
+  InsertNode(p_TimeStamp, p_Uid, rows);
+  return true;
+}
+
+bool DateUidIndex::Remove(uint32_t p_Uid)
+{
+  auto it = m_UidTimeStamps.find(p_Uid);
+  if (it == m_UidTimeStamps.end())
+  {
+    return false;
+  }
+
+  m_Root = Erase(m_Root, it->second, p_Uid);
+  m_UidTimeStamps.erase(it);
+  return true;
+}
+
+void DateUidIndex::Clear()
+{
+  m_Nodes.clear();
+  m_Nodes.push_back(Node{ 0, 0, 0, 0, 0, 0, 0, 0 });
+  m_FreeNodes.clear();
+  m_Root = 0;
+  m_UidTimeStamps.clear();
+}
+
+bool DateUidIndex::Contains(uint32_t p_Uid) const
+{
+  return (m_UidTimeStamps.find(p_Uid) != m_UidTimeStamps.end());
+}
+
+bool DateUidIndex::GetTimeStamp(uint32_t p_Uid, int64_t& p_TimeStamp) const
+{
+  auto it = m_UidTimeStamps.find(p_Uid);
+  if (it == m_UidTimeStamps.end())
+  {
+    return false;
+  }
+
+  p_TimeStamp = it->second;
+  return true;
+}
+
+uint32_t DateUidIndex::GetUid(uint32_t p_Index) const
+{
+  if (p_Index >= Size())
+  {
+    return 0;
+  }
+
+  // list index counts from the newest, i.e. the rightmost node
+  uint32_t rank = Size() - 1 - p_Index;
+  uint32_t node = m_Root;
+  while (node != 0)
+  {
+    const Node& n = m_Nodes[node];
+    const uint32_t leftSize = m_Nodes[n.m_Left].m_Size;
+    if (rank < leftSize)
+    {
+      node = n.m_Left;
+    }
+    else if (rank == leftSize)
+    {
+      return n.m_Uid;
+    }
+    else
+    {
+      rank -= leftSize + 1;
+      node = n.m_Right;
+    }
+  }
+
+  return 0;
+}
+
+bool DateUidIndex::GetIndex(uint32_t p_Uid, uint32_t& p_Index) const
+{
+  int64_t timeStamp = 0;
+  if (!GetTimeStamp(p_Uid, timeStamp))
+  {
+    return false;
+  }
+
+  uint32_t rank = 0;
+  uint32_t node = m_Root;
+  while (node != 0)
+  {
+    const Node& n = m_Nodes[node];
+    if (n.m_Uid == p_Uid)
+    {
+      rank += m_Nodes[n.m_Left].m_Size;
+      p_Index = Size() - 1 - rank;
+      return true;
+    }
+    else if (Less(timeStamp, p_Uid, n))
+    {
+      node = n.m_Left;
+    }
+    else
+    {
+      rank += m_Nodes[n.m_Left].m_Size + 1;
+      node = n.m_Right;
+    }
+  }
+
+  return false;
+}
+
+uint32_t DateUidIndex::Size() const
+{
+  return m_Nodes[m_Root].m_Size;
+}
+
+bool DateUidIndex::Empty() const
+{
+  return (m_Root == 0);
+}
+
+bool DateUidIndex::SetRowCount(uint32_t p_Uid, uint32_t p_RowCount)
+{
+  auto it = m_UidTimeStamps.find(p_Uid);
+  if (it == m_UidTimeStamps.end())
+  {
+    return false;
+  }
+
+  if (m_Nodes[Find(it->second, p_Uid)].m_Rows == p_RowCount)
+  {
+    return false;
+  }
+
+  m_Root = Erase(m_Root, it->second, p_Uid);
+  InsertNode(it->second, p_Uid, p_RowCount);
+  return true;
+}
+
+uint32_t DateUidIndex::GetRowCount() const
+{
+  return m_Nodes[m_Root].m_TotalRows;
+}
+
+uint32_t DateUidIndex::GetUidAtRow(uint32_t p_Row, uint32_t& p_RowOffset) const
+{
+  // rows count from the newest, i.e. the rightmost node
+  uint32_t row = p_Row;
+  uint32_t node = m_Root;
+  while (node != 0)
+  {
+    const Node& n = m_Nodes[node];
+    const uint32_t rightRows = m_Nodes[n.m_Right].m_TotalRows;
+    if (row < rightRows)
+    {
+      node = n.m_Right;
+    }
+    else if (row < (rightRows + n.m_Rows))
+    {
+      p_RowOffset = row - rightRows;
+      return n.m_Uid;
+    }
+    else
+    {
+      row -= rightRows + n.m_Rows;
+      node = n.m_Left;
+    }
+  }
+
+  return 0;
+}
+
+bool DateUidIndex::GetRow(uint32_t p_Uid, uint32_t& p_Row) const
+{
+  int64_t timeStamp = 0;
+  if (!GetTimeStamp(p_Uid, timeStamp))
+  {
+    return false;
+  }
+
+  uint32_t row = 0;
+  uint32_t node = m_Root;
+  while (node != 0)
+  {
+    const Node& n = m_Nodes[node];
+    if (n.m_Uid == p_Uid)
+    {
+      p_Row = row + m_Nodes[n.m_Right].m_TotalRows;
+      return true;
+    }
+    else if (Less(timeStamp, p_Uid, n))
+    {
+      row += m_Nodes[n.m_Right].m_TotalRows + n.m_Rows;
+      node = n.m_Left;
+    }
+    else
+    {
+      node = n.m_Right;
+    }
+  }
+
+  return false;
+}
+
+bool DateUidIndex::Less(int64_t p_TimeStamp, uint32_t p_Uid, const Node& p_Node) const
+{
+  return (p_TimeStamp < p_Node.m_TimeStamp) ||
+    ((p_TimeStamp == p_Node.m_TimeStamp) && (p_Uid < p_Node.m_Uid));
+}
+
+uint32_t DateUidIndex::Find(int64_t p_TimeStamp, uint32_t p_Uid) const
+{
+  uint32_t node = m_Root;
+  while ((node != 0) && (m_Nodes[node].m_Uid != p_Uid))
+  {
+    node = Less(p_TimeStamp, p_Uid, m_Nodes[node]) ? m_Nodes[node].m_Left : m_Nodes[node].m_Right;
+  }
+
+  return node;
+}
+
+void DateUidIndex::InsertNode(int64_t p_TimeStamp, uint32_t p_Uid, uint32_t p_Rows)
+{
+  uint32_t left = 0;
+  uint32_t right = 0;
+  Split(m_Root, p_TimeStamp, p_Uid, left, right);
+  m_Root = Merge(Merge(left, NewNode(p_TimeStamp, p_Uid, p_Rows)), right);
+}
+
+void DateUidIndex::Update(uint32_t p_Node)
+{
+  Node& n = m_Nodes[p_Node];
+  n.m_Size = m_Nodes[n.m_Left].m_Size + m_Nodes[n.m_Right].m_Size + 1;
+  n.m_TotalRows = m_Nodes[n.m_Left].m_TotalRows + m_Nodes[n.m_Right].m_TotalRows + n.m_Rows;
+}
+
+void DateUidIndex::Split(uint32_t p_Node, int64_t p_TimeStamp, uint32_t p_Uid,
+                         uint32_t& p_Left, uint32_t& p_Right)
+{
+  if (p_Node == 0)
+  {
+    p_Left = 0;
+    p_Right = 0;
+    return;
+  }
+
+  if (Less(p_TimeStamp, p_Uid, m_Nodes[p_Node]))
+  {
+    uint32_t left = 0;
+    Split(m_Nodes[p_Node].m_Left, p_TimeStamp, p_Uid, p_Left, left);
+    m_Nodes[p_Node].m_Left = left;
+    p_Right = p_Node;
+  }
+  else
+  {
+    uint32_t right = 0;
+    Split(m_Nodes[p_Node].m_Right, p_TimeStamp, p_Uid, right, p_Right);
+    m_Nodes[p_Node].m_Right = right;
+    p_Left = p_Node;
+  }
+
+  Update(p_Node);
+}
+
+uint32_t DateUidIndex::Merge(uint32_t p_Left, uint32_t p_Right)
+{
+  if ((p_Left == 0) || (p_Right == 0))
+  {
+    return (p_Left != 0) ? p_Left : p_Right;
+  }
+
+  if (m_Nodes[p_Left].m_Priority > m_Nodes[p_Right].m_Priority)
+  {
+    uint32_t right = Merge(m_Nodes[p_Left].m_Right, p_Right);
+    m_Nodes[p_Left].m_Right = right;
+    Update(p_Left);
+    return p_Left;
+  }
+  else
+  {
+    uint32_t left = Merge(p_Left, m_Nodes[p_Right].m_Left);
+    m_Nodes[p_Right].m_Left = left;
+    Update(p_Right);
+    return p_Right;
+  }
+}
+
+uint32_t DateUidIndex::Erase(uint32_t p_Node, int64_t p_TimeStamp, uint32_t p_Uid)
+{
+  if (p_Node == 0)
+  {
+    return 0;
+  }
+
+  if (m_Nodes[p_Node].m_Uid == p_Uid)
+  {
+    uint32_t node = Merge(m_Nodes[p_Node].m_Left, m_Nodes[p_Node].m_Right);
+    m_FreeNodes.push_back(p_Node);
+    return node;
+  }
+
+  if (Less(p_TimeStamp, p_Uid, m_Nodes[p_Node]))
+  {
+    uint32_t left = Erase(m_Nodes[p_Node].m_Left, p_TimeStamp, p_Uid);
+    m_Nodes[p_Node].m_Left = left;
+  }
+  else
+  {
+    uint32_t right = Erase(m_Nodes[p_Node].m_Right, p_TimeStamp, p_Uid);
+    m_Nodes[p_Node].m_Right = right;
+  }
+
+  Update(p_Node);
+  return p_Node;
+}
+
+uint32_t DateUidIndex::NewNode(int64_t p_TimeStamp, uint32_t p_Uid, uint32_t p_Rows)
+{
+  Node node = { p_TimeStamp, p_Uid, NextPriority(), 1, p_Rows, p_Rows, 0, 0 };
+  if (!m_FreeNodes.empty())
+  {
+    uint32_t index = m_FreeNodes.back();
+    m_FreeNodes.pop_back();
+    m_Nodes[index] = node;
+    return index;
+  }
+
+  m_Nodes.push_back(node);
+  return m_Nodes.size() - 1;
+}
+
+uint32_t DateUidIndex::NextPriority()
+{
+  // xorshift32
+  m_Seed ^= m_Seed << 13;
+  m_Seed ^= m_Seed >> 17;
+  m_Seed ^= m_Seed << 5;
+  return m_Seed;
+}
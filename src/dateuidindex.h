@@ -0,0 +1,72 @@
+// dateuidindex.h
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include <stdint.h>
+
+// Message list order index, sorting uids by (timestamp, uid). Kept as a treap with subtree
+// sizes, giving O(log n) insert, remove, and lookup by list index or uid. List index 0 is the
+// newest message. Inserting an existing uid with a new timestamp moves it. Each uid may also
+// occupy a number of rows (default one), with rows looked up the same way as list indexes.
+class DateUidIndex
+{
+public:
+  DateUidIndex();
+  virtual ~DateUidIndex();
+
+  bool Insert(int64_t p_TimeStamp, uint32_t p_Uid);
+  bool Remove(uint32_t p_Uid);
+  void Clear();
+
+  bool Contains(uint32_t p_Uid) const;
+  bool GetTimeStamp(uint32_t p_Uid, int64_t& p_TimeStamp) const;
+  uint32_t GetUid(uint32_t p_Index) const;
+  bool GetIndex(uint32_t p_Uid, uint32_t& p_Index) const;
+  uint32_t Size() const;
+  bool Empty() const;
+
+  bool SetRowCount(uint32_t p_Uid, uint32_t p_RowCount);
+  uint32_t GetRowCount() const;
+  uint32_t GetUidAtRow(uint32_t p_Row, uint32_t& p_RowOffset) const;
+  bool GetRow(uint32_t p_Uid, uint32_t& p_Row) const;
+
+private:
+  struct Node
+  {
+    int64_t m_TimeStamp;
+    uint32_t m_Uid;
+    uint32_t m_Priority;
+    uint32_t m_Size;
+    uint32_t m_Rows;
+    uint32_t m_TotalRows;
+    uint32_t m_Left;
+    uint32_t m_Right;
+  };
+
+  bool Less(int64_t p_TimeStamp, uint32_t p_Uid, const Node& p_Node) const;
+  uint32_t Find(int64_t p_TimeStamp, uint32_t p_Uid) const;
+  void InsertNode(int64_t p_TimeStamp, uint32_t p_Uid, uint32_t p_Rows);
+  void Update(uint32_t p_Node);
+  void Split(uint32_t p_Node, int64_t p_TimeStamp, uint32_t p_Uid, uint32_t& p_Left,
+             uint32_t& p_Right);
+  uint32_t Merge(uint32_t p_Left, uint32_t p_Right);
+  uint32_t Erase(uint32_t p_Node, int64_t p_TimeStamp, uint32_t p_Uid);
+  uint32_t NewNode(int64_t p_TimeStamp, uint32_t p_Uid, uint32_t p_Rows);
+  uint32_t NextPriority();
+
+private:
+  // node 0 is a null sentinel with size 0
+  std::vector<Node> m_Nodes;
+  std::vector<uint32_t> m_FreeNodes;
+  uint32_t m_Root = 0;
+  uint32_t m_Seed = 2463534242;
+  std::map<uint32_t, int64_t> m_UidTimeStamps;
+};
@@ -0,0 +1,356 @@
+// envelopeindex.cpp
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "envelopeindex.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "loghelp.h"
+#include "util.h"
+
+// file layout: header, count * record, string heap
+static const uint32_t s_Magic = 0x3249454e; // "NEI2"
+static const size_t s_HeaderSize = 16;
+static const size_t s_RecordSize = 48;
+static const size_t s_MinSaveCount = 512;
+
+struct EnvelopeRecord
+{
+  uint32_t m_Uid;
+  uint32_t m_Reserved;
+  int64_t m_TimeStamp;
+  uint32_t m_ShortFromOffset;
+  uint32_t m_ShortFromLength;
+  uint32_t m_SubjectOffset;
+  uint32_t m_SubjectLength;
+  uint32_t m_MessageIdOffset;
+  uint32_t m_MessageIdLength;
+  uint32_t m_ReferencesOffset;
+  uint32_t m_ReferencesLength;
+};
+
+static_assert(sizeof(EnvelopeRecord) == s_RecordSize, "unexpected envelope record size");
+
+EnvelopeIndex::EnvelopeIndex()
+{
+}
+
+EnvelopeIndex::~EnvelopeIndex()
+{
+  Unmap();
+}
+
+void EnvelopeIndex::MapFile(const std::string& p_Path)
+{
+  Unmap();
+  m_Buffer.clear();
+  m_Data = NULL;
+  m_Size = 0;
+
+  int fd = open(p_Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return;
+
+  struct stat st;
+  if ((fstat(fd, &st) == 0) && (st.st_size > 0))
+  {
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+    {
+      if (IsValid(static_cast<const char*>(map), st.st_size))
+      {
+        m_Map = map;
+        m_MapSize = st.st_size;
+        m_Data = static_cast<const char*>(map);
+        m_Size = st.st_size;
+      }
+      else
+      {
+        LOG_WARNING("invalid envelope index %s", p_Path.c_str());
+        munmap(map, st.st_size);
+      }
+    }
+  }
+
+  close(fd);
+}
+
+void EnvelopeIndex::SetData(const std::string& p_Data)
+{
+  Unmap();
+  m_Buffer = p_Data;
+  if (IsValid(m_Buffer.c_str(), m_Buffer.size()))
+  {
+    m_Data = m_Buffer.c_str();
+    m_Size = m_Buffer.size();
+  }
+  else
+  {
+    m_Buffer.clear();
+    m_Data = NULL;
+    m_Size = 0;
+  }
+}
+
+std::string EnvelopeIndex::GetData()
+{
+  // merge pending changes with existing records, both already sorted by uid
+  std::string records;
+  std::string heap;
+  uint32_t count = 0;
+
+  auto addRecord = [&](uint32_t p_Uid, const Envelope& p_Envelope)
+  {
+    EnvelopeRecord record;
+    memset(&record, 0, sizeof(record));
+    record.m_Uid = p_Uid;
+    record.m_TimeStamp = p_Envelope.m_TimeStamp;
+    record.m_ShortFromOffset = heap.size();
+    record.m_ShortFromLength = p_Envelope.m_ShortFrom.size();
+    heap += p_Envelope.m_ShortFrom;
+    record.m_SubjectOffset = heap.size();
+    record.m_SubjectLength = p_Envelope.m_Subject.size();
+    heap += p_Envelope.m_Subject;
+    const std::string& references = Util::Join(p_Envelope.m_References, " ");
+    record.m_MessageIdOffset = heap.size();
+    record.m_MessageIdLength = p_Envelope.m_MessageId.size();
+    heap += p_Envelope.m_MessageId;
+    record.m_ReferencesOffset = heap.size();
+    record.m_ReferencesLength = references.size();
+    heap += references;
+    records.append(reinterpret_cast<const char*>(&record), sizeof(record));
+    ++count;
+  };
+
+  const uint32_t oldCount = GetCount();
+  records.reserve((oldCount + m_Added.size()) * s_RecordSize);
+  uint32_t i = 0;
+  auto it = m_Added.begin();
+  while ((i < oldCount) || (it != m_Added.end()))
+  {
+    const bool takeOld = (i < oldCount) &&
+      ((it == m_Added.end()) || (GetRecordUid(i) < it->first));
+    if (takeOld)
+    {
+      const uint32_t uid = GetRecordUid(i);
+      if (m_Removed.find(uid) == m_Removed.end())
+      {
+        Envelope envelope;
+        GetRecordEnvelope(i, envelope);
+        addRecord(uid, envelope);
+      }
+
+      ++i;
+    }
+    else
+    {
+      if ((i < oldCount) && (GetRecordUid(i) == it->first))
+      {
+        ++i;
+      }
+
+      addRecord(it->first, it->second);
+      ++it;
+    }
+  }
+
+  std::string data;
+  data.reserve(s_HeaderSize + records.size() + heap.size());
+  uint32_t header[4] = { s_Magic, count, static_cast<uint32_t>(heap.size()), 0 };
+  data.append(reinterpret_cast<const char*>(header), sizeof(header));
+  data += records;
+  data += heap;
+
+  m_Added.clear();
+  m_Removed.clear();
+  SetData(data);
+
+  return data;
+}
+
+bool EnvelopeIndex::Get(uint32_t p_Uid, Envelope& p_Envelope) const
+{
+  auto it = m_Added.find(p_Uid);
+  if (it != m_Added.end())
+  {
+    p_Envelope = it->second;
+    return true;
+  }
+
+  if (m_Removed.find(p_Uid) != m_Removed.end())
+  {
+    return false;
+  }
+
+  uint32_t index = 0;
+  if (Find(p_Uid, index))
+  {
+    GetRecordEnvelope(index, p_Envelope);
+    return true;
+  }
+
+  return false;
+}
+
+void EnvelopeIndex::Set(uint32_t p_Uid, const Envelope& p_Envelope)
+{
+  m_Added[p_Uid] = p_Envelope;
+  m_Removed.erase(p_Uid);
+}
+
+void EnvelopeIndex::RemoveExcept(const std::set<uint32_t>& p_Uids)
+{
+  for (auto it = m_Added.begin(); it != m_Added.end(); /* increment in loop */)
+  {
+    if (p_Uids.find(it->first) == p_Uids.end())
+    {
+      it = m_Added.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  const uint32_t count = GetCount();
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    const uint32_t uid = GetRecordUid(i);
+    if (p_Uids.find(uid) == p_Uids.end())
+    {
+      m_Removed.insert(uid);
+    }
+  }
+}
+
+void EnvelopeIndex::Remove(uint32_t p_Uid)
+{
+  m_Added.erase(p_Uid);
+  uint32_t index = 0;
+  if (Find(p_Uid, index))
+  {
+    m_Removed.insert(p_Uid);
+  }
+}
+
+bool EnvelopeIndex::NeedsSave() const
+{
+  // amortize rewriting the index by growing the batch with its size
+  const size_t pending = m_Added.size() + m_Removed.size();
+  return (pending >= std::max(s_MinSaveCount, static_cast<size_t>(GetCount() / 8)));
+}
+
+bool EnvelopeIndex::IsDirty() const
+{
+  return !m_Added.empty() || !m_Removed.empty();
+}
+
+void EnvelopeIndex::Unmap()
+{
+  if (m_Map != NULL)
+  {
+    munmap(m_Map, m_MapSize);
+    m_Map = NULL;
+    m_MapSize = 0;
+    m_Data = NULL;
+    m_Size = 0;
+  }
+}
+
+bool EnvelopeIndex::IsValid(const char* p_Data, size_t p_Size) const
+{
+  if (p_Size < s_HeaderSize) return false;
+
+  uint32_t header[4];
+  memcpy(header, p_Data, sizeof(header));
+  return (header[0] == s_Magic) &&
+    ((s_HeaderSize + (static_cast<uint64_t>(header[1]) * s_RecordSize) + header[2]) == p_Size);
+}
+
+uint32_t EnvelopeIndex::GetCount() const
+{
+  if (m_Data == NULL) return 0;
+
+  uint32_t count = 0;
+  memcpy(&count, m_Data + 4, sizeof(count));
+  return count;
+}
+
+const char* EnvelopeIndex::GetRecord(uint32_t p_Index) const
+{
+  return m_Data + s_HeaderSize + (static_cast<size_t>(p_Index) * s_RecordSize);
+}
+
+uint32_t EnvelopeIndex::GetRecordUid(uint32_t p_Index) const
+{
+  uint32_t uid = 0;
+  memcpy(&uid, GetRecord(p_Index), sizeof(uid));
+  return uid;
+}
+
+bool EnvelopeIndex::Find(uint32_t p_Uid, uint32_t& p_Index) const
+{
+  uint32_t lo = 0;
+  uint32_t hi = GetCount();
+  while (lo < hi)
+  {
+    const uint32_t mid = lo + ((hi - lo) / 2);
+    const uint32_t uid = GetRecordUid(mid);
+    if (uid == p_Uid)
+    {
+      p_Index = mid;
+      return true;
+    }
+    else if (uid < p_Uid)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+
+  return false;
+}
+
+void EnvelopeIndex::GetRecordEnvelope(uint32_t p_Index, Envelope& p_Envelope) const
+{
+  EnvelopeRecord record;
+  memcpy(&record, GetRecord(p_Index), sizeof(record));
+
+  const char* heap = m_Data + s_HeaderSize + (static_cast<size_t>(GetCount()) * s_RecordSize);
+  const size_t heapSize = m_Size - (heap - m_Data);
+  p_Envelope.m_TimeStamp = record.m_TimeStamp;
+  if ((static_cast<uint64_t>(record.m_ShortFromOffset) + record.m_ShortFromLength) <= heapSize)
+  {
+    p_Envelope.m_ShortFrom.assign(heap + record.m_ShortFromOffset, record.m_ShortFromLength);
+  }
+
+  if ((static_cast<uint64_t>(record.m_SubjectOffset) + record.m_SubjectLength) <= heapSize)
+  {
+    p_Envelope.m_Subject.assign(heap + record.m_SubjectOffset, record.m_SubjectLength);
+  }
+
+  if ((static_cast<uint64_t>(record.m_MessageIdOffset) + record.m_MessageIdLength) <= heapSize)
+  {
+    p_Envelope.m_MessageId.assign(heap + record.m_MessageIdOffset, record.m_MessageIdLength);
+  }
+
+  if ((static_cast<uint64_t>(record.m_ReferencesOffset) + record.m_ReferencesLength) <= heapSize)
+  {
+    const std::string references(heap + record.m_ReferencesOffset, record.m_ReferencesLength);
+    p_Envelope.m_References = Util::Split(references, ' ');
+  }
+}
@@ -0,0 +1,62 @@
+// envelopeindex.h
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+struct Envelope
+{
+  int64_t m_TimeStamp = 0;
+  std::string m_ShortFrom;
+  std::string m_Subject;
+  std::string m_MessageId;
+  std::vector<std::string> m_References;
+};
+
+// Per-folder index of the header fields needed by the message list and threading. Stored as
+// a table of fixed-width records sorted by uid followed by a string heap, which can be used
+// directly from a memory mapped file, or from a decrypted buffer.
+class EnvelopeIndex
+{
+public:
+  EnvelopeIndex();
+  virtual ~EnvelopeIndex();
+
+  void MapFile(const std::string& p_Path);
+  void SetData(const std::string& p_Data);
+  std::string GetData();
+
+  bool Get(uint32_t p_Uid, Envelope& p_Envelope) const;
+  void Set(uint32_t p_Uid, const Envelope& p_Envelope);
+  void RemoveExcept(const std::set<uint32_t>& p_Uids);
+  void Remove(uint32_t p_Uid);
+  bool NeedsSave() const;
+  bool IsDirty() const;
+
+private:
+  void Unmap();
+  bool IsValid(const char* p_Data, size_t p_Size) const;
+  uint32_t GetCount() const;
+  const char* GetRecord(uint32_t p_Index) const;
+  uint32_t GetRecordUid(uint32_t p_Index) const;
+  bool Find(uint32_t p_Uid, uint32_t& p_Index) const;
+  void GetRecordEnvelope(uint32_t p_Index, Envelope& p_Envelope) const;
+
+private:
+  const char* m_Data = NULL;
+  size_t m_Size = 0;
+  void* m_Map = NULL;
+  size_t m_MapSize = 0;
+  std::string m_Buffer;
+
+  std::map<uint32_t, Envelope> m_Added;
+  std::set<uint32_t> m_Removed;
+};
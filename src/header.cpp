@@ -28,15 +28,42 @@ std::string Header::GetData() const
   return m_Data;
 }
 
+void Header::SetEnvelope(time_t p_TimeStamp, const std::string& p_ShortFrom,
+                         const std::string& p_Subject, const std::string& p_MessageId,
+                         const std::vector<std::string>& p_References)
+{
+  if (p_TimeStamp != 0)
+  {
+    SetTimeStamp(p_TimeStamp);
+  }
+
+  m_ShortFrom = p_ShortFrom;
+  m_Subject = p_Subject;
+  m_MessageId = p_MessageId;
+  m_References = p_References;
+  m_HasEnvelope = true;
+}
+
+bool Header::IsEnvelope() const
+{
+  return m_HasEnvelope && m_Data.empty();
+}
+
+time_t Header::GetTimeStamp()
+{
+  ParseEnvelope();
+  return m_TimeStamp;
+}
+
 std::string Header::GetDateTime()
 {
-  Parse();
+  ParseEnvelope();
   return m_DateTime;
 }
 
 std::string Header::GetDateOrTime(const std::string& p_CurrentDate)
 {
-  Parse();
+  ParseEnvelope();
   return (m_Date == p_CurrentDate) ? m_Time : m_Date;
 }
 
@@ -48,7 +75,7 @@ std::string Header::GetFrom()
 
 std::string Header::GetShortFrom()
 {
-  Parse();
+  ParseEnvelope();
   return m_ShortFrom;
 }
 
@@ -66,7 +93,7 @@ std::string Header::GetCc()
 
 std::string Header::GetSubject()
 {
-  Parse();
+  ParseEnvelope();
   return m_Subject;
 }
 
@@ -78,10 +105,16 @@ std::string Header::GetUniqueId()
 
 std::string Header::GetMessageId()
 {
-  Parse();
+  ParseEnvelope();
   return m_MessageId;
 }
 
+std::vector<std::string> Header::GetReferences()
+{
+  ParseEnvelope();
+  return m_References;
+}
+
 std::set<std::string> Header::GetAddresses()
 {
   Parse();
@@ -99,7 +132,7 @@ std::string Header::GetCurrentDate()
 
 void Header::Parse()
 {
-  if (!m_Parsed)
+  if (!m_Parsed && !m_Data.empty())
   {
     struct mailmime* mime = NULL;
     size_t current_index = 0;
@@ -114,6 +147,7 @@ void Header::Parse()
           if (clist_begin(mime->mm_data.mm_message.mm_fields->fld_list) != NULL)
           {
             struct mailimf_fields* fields = mime->mm_data.mm_message.mm_fields;
+            std::vector<std::string> inReplyTo;
             for (clistiter* it = clist_begin(fields->fld_list); it != NULL; it = clist_next(it))
             {
               std::vector<std::string> addrs;
@@ -123,20 +157,7 @@ void Header::Parse()
                 case MAILIMF_FIELD_ORIG_DATE:
                   {
                     struct mailimf_date_time* dt = field->fld_data.fld_orig_date->dt_date_time;
-                    time_t rawtime = Util::MailtimeToTimet(dt);
-                    struct tm* timeinfo = localtime(&rawtime);
-
-                    char senttimestr[64];
-                    strftime(senttimestr, sizeof(senttimestr), "%H:%M", timeinfo);
-                    std::string senttime(senttimestr);
-
-                    char sentdatestr[64];
-                    strftime(sentdatestr, sizeof(sentdatestr), "%Y-%m-%d", timeinfo);
-                    std::string sentdate(sentdatestr);
-
-                    m_Date = sentdate;
-                    m_DateTime = sentdate + std::string(" ") + senttime;
-                    m_Time = senttime;
+                    SetTimeStamp(Util::MailtimeToTimet(dt));
                   }
                   break;
 
@@ -170,11 +191,26 @@ void Header::Parse()
                   m_MessageId = std::string(field->fld_data.fld_message_id->mid_value);
                   break;
 
+                case MAILIMF_FIELD_IN_REPLY_TO:
+                  inReplyTo = MsgIdListToStrings(field->fld_data.fld_in_reply_to->mid_list);
+                  break;
+
+                case MAILIMF_FIELD_REFERENCES:
+                  m_References = MsgIdListToStrings(field->fld_data.fld_references->mid_list);
+                  break;
+
                 default:
                   break;
               }
             }
 
+            // references ordered oldest first, with the direct parent last
+            if (!inReplyTo.empty() &&
+                (m_References.empty() || (m_References.back() != inReplyTo.back())))
+            {
+              m_References.push_back(inReplyTo.back());
+            }
+
             m_UniqueId = Crypto::SHA256(m_From + m_DateTime + m_MessageId);
           }
         }
@@ -187,6 +223,32 @@ void Header::Parse()
   }
 }
 
+void Header::ParseEnvelope()
+{
+  if (!m_HasEnvelope)
+  {
+    Parse();
+  }
+}
+
+void Header::SetTimeStamp(time_t p_TimeStamp)
+{
+  struct tm* timeinfo = localtime(&p_TimeStamp);
+
+  char senttimestr[64];
+  strftime(senttimestr, sizeof(senttimestr), "%H:%M", timeinfo);
+  std::string senttime(senttimestr);
+
+  char sentdatestr[64];
+  strftime(sentdatestr, sizeof(sentdatestr), "%Y-%m-%d", timeinfo);
+  std::string sentdate(sentdatestr);
+
+  m_TimeStamp = p_TimeStamp;
+  m_Date = sentdate;
+  m_DateTime = sentdate + std::string(" ") + senttime;
+  m_Time = senttime;
+}
+
 std::vector<std::string> Header::MailboxListToStrings(mailimf_mailbox_list *p_MailboxList,
                                                       const bool p_Short)
 {
@@ -272,6 +334,23 @@ std::string Header::GroupToString(mailimf_group *p_Group)
   return str;
 }
 
+std::vector<std::string> Header::MsgIdListToStrings(clist* p_MsgIdList)
+{
+  std::vector<std::string> strs;
+  if (p_MsgIdList == NULL) return strs;
+
+  for (clistiter* it = clist_begin(p_MsgIdList); it != NULL; it = clist_next(it))
+  {
+    const char* msgId = (const char*)clist_content(it);
+    if (msgId != NULL)
+    {
+      strs.push_back(std::string(msgId));
+    }
+  }
+
+  return strs;
+}
+
 std::ostream& operator<<(std::ostream& p_Stream, const Header& p_Header)
 {
   p_Stream << p_Header.GetData();
@@ -11,11 +11,18 @@
 #include <string>
 #include <vector>
 
+#include <time.h>
+
 class Header
 {
 public:
   void SetData(const std::string& p_Data);
   std::string GetData() const;
+  void SetEnvelope(time_t p_TimeStamp, const std::string& p_ShortFrom,
+                   const std::string& p_Subject, const std::string& p_MessageId,
+                   const std::vector<std::string>& p_References);
+  bool IsEnvelope() const;
+  time_t GetTimeStamp();
   std::string GetDateTime();
   std::string GetDateOrTime(const std::string& p_CurrentDate);
   std::string GetFrom();
@@ -25,23 +32,29 @@ public:
   std::string GetSubject();
   std::string GetUniqueId();
   std::string GetMessageId();
+  std::vector<std::string> GetReferences();
   std::set<std::string> GetAddresses();
 
   static std::string GetCurrentDate();
 
 private:
   void Parse();
+  void ParseEnvelope();
+  void SetTimeStamp(time_t p_TimeStamp);
   std::vector<std::string> MailboxListToStrings(struct mailimf_mailbox_list* p_MailboxList,
                                                 const bool p_Short = false);
   std::vector<std::string> AddressListToStrings(struct mailimf_address_list* p_AddrList);
   std::string MailboxToString(struct mailimf_mailbox* p_Mailbox,
                               const bool p_Short = false);
   std::string GroupToString(struct mailimf_group* p_Group);
+  std::vector<std::string> MsgIdListToStrings(struct clist_s* p_MsgIdList);
 
 private:
   std::string m_Data;
 
   bool m_Parsed = false;
+  bool m_HasEnvelope = false;
+  time_t m_TimeStamp = 0;
   std::string m_Date;
   std::string m_DateTime;
   std::string m_Time;
@@ -51,6 +64,7 @@ private:
   std::string m_Cc;
   std::string m_Subject;
   std::string m_MessageId;
+  std::vector<std::string> m_References;
   std::string m_UniqueId;
   std::set<std::string> m_Addresses;
 };
@@ -0,0 +1,810 @@
+// htmlconvert.cpp
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "htmlconvert.h"
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+
+#include "util.h"
+
+static const char* s_Whitespace = " \t\r\n\f\v";
+
+static bool IsVoidTag(const std::string& p_Name)
+{
+  static const std::set<std::string> voidTags =
+  {
+    "area", "base", "br", "col", "embed", "hr", "img", "input", "link", "meta", "param",
+    "source", "track", "wbr",
+  };
+
+  return (voidTags.find(p_Name) != voidTags.end());
+}
+
+static bool IsSkipTag(const std::string& p_Name)
+{
+  static const std::set<std::string> skipTags =
+  {
+    "head", "noscript", "script", "style", "template", "title",
+  };
+
+  return (skipTags.find(p_Name) != skipTags.end());
+}
+
+static bool IsBlockTag(const std::string& p_Name)
+{
+  static const std::set<std::string> blockTags =
+  {
+    "address", "article", "aside", "center", "dd", "div", "dl", "dt", "fieldset", "figcaption",
+    "figure", "footer", "form", "header", "li", "main", "nav", "section", "tr",
+  };
+
+  return (blockTags.find(p_Name) != blockTags.end());
+}
+
+static bool IsParagraphTag(const std::string& p_Name)
+{
+  static const std::set<std::string> paragraphTags =
+  {
+    "h1", "h2", "h3", "h4", "h5", "h6", "p",
+  };
+
+  return (paragraphTags.find(p_Name) != paragraphTags.end());
+}
+
+static bool IsHiddenStyle(const std::string& p_Style)
+{
+  std::string style = Util::ToLower(p_Style);
+  style.erase(std::remove(style.begin(), style.end(), ' '), style.end());
+  return (style.find("display:none") != std::string::npos);
+}
+
+static size_t FindEndTag(const std::string& p_Html, const std::string& p_Name, size_t p_Pos)
+{
+  size_t pos = p_Pos;
+  while ((pos = p_Html.find("</", pos)) != std::string::npos)
+  {
+    bool match = true;
+    for (size_t i = 0; i < p_Name.size(); ++i)
+    {
+      const size_t idx = pos + 2 + i;
+      if ((idx >= p_Html.size()) ||
+          (tolower(static_cast<unsigned char>(p_Html[idx])) != p_Name[i]))
+      {
+        match = false;
+        break;
+      }
+    }
+
+    if (match)
+    {
+      return pos;
+    }
+
+    pos += 2;
+  }
+
+  return std::string::npos;
+}
+
+std::string HtmlConvert::ToText(const std::string& p_Html)
+{
+  HtmlConvert htmlConvert(p_Html);
+  htmlConvert.Convert();
+  return htmlConvert.GetResult();
+}
+
+std::string HtmlConvert::GetCharset(const std::string& p_Html)
+{
+  const std::string& html = Util::ToLower(p_Html.substr(0, 16384));
+  size_t pos = 0;
+  while ((pos = html.find("<meta", pos)) != std::string::npos)
+  {
+    const size_t end = html.find('>', pos);
+    if (end == std::string::npos) break;
+
+    size_t idx = html.find("charset", pos);
+    if (idx < end)
+    {
+      idx += 7;
+      while ((idx < end) && (strchr(" \t\r\n=\"'", html[idx]) != NULL))
+      {
+        ++idx;
+      }
+
+      std::string charset;
+      while ((idx < end) && (isalnum(static_cast<unsigned char>(html[idx])) ||
+                             (strchr("-_.:", html[idx]) != NULL)))
+      {
+        charset += html[idx++];
+      }
+
+      if (!charset.empty())
+      {
+        return charset;
+      }
+    }
+
+    pos = end;
+  }
+
+  return "";
+}
+
+HtmlConvert::HtmlConvert(const std::string& p_Html)
+  : m_Html(p_Html)
+{
+  m_Out.reserve(p_Html.size() / 4);
+}
+
+void HtmlConvert::Convert()
+{
+  const size_t size = m_Html.size();
+  std::string text;
+  size_t pos = 0;
+  while (pos < size)
+  {
+    const size_t next = m_Html.find_first_of("<&", pos);
+    if (next == std::string::npos)
+    {
+      text.append(m_Html, pos, size - pos);
+      break;
+    }
+
+    text.append(m_Html, pos, next - pos);
+    pos = next;
+    if (m_Html[pos] == '&')
+    {
+      text += DecodeEntity(m_Html, pos);
+    }
+    else
+    {
+      AddText(text);
+      text.clear();
+      ParseTag(pos);
+    }
+  }
+
+  AddText(text);
+  EndLink();
+}
+
+void HtmlConvert::ParseTag(size_t& p_Pos)
+{
+  const size_t size = m_Html.size();
+  size_t pos = p_Pos + 1;
+
+  if (m_Html.compare(pos, 3, "!--") == 0)
+  {
+    const size_t end = m_Html.find("-->", pos + 3);
+    p_Pos = (end == std::string::npos) ? size : (end + 3);
+    return;
+  }
+
+  if ((pos < size) && ((m_Html[pos] == '!') || (m_Html[pos] == '?')))
+  {
+    const size_t end = m_Html.find('>', pos);
+    p_Pos = (end == std::string::npos) ? size : (end + 1);
+    return;
+  }
+
+  const bool isEnd = (pos < size) && (m_Html[pos] == '/');
+  if (isEnd)
+  {
+    ++pos;
+  }
+
+  std::string name;
+  while ((pos < size) && isalnum(static_cast<unsigned char>(m_Html[pos])))
+  {
+    name += tolower(static_cast<unsigned char>(m_Html[pos++]));
+  }
+
+  if (name.empty() || !isalpha(static_cast<unsigned char>(name[0])))
+  {
+    // not a tag, keep as text
+    AddText("<");
+    ++p_Pos;
+    return;
+  }
+
+  std::map<std::string, std::string> attrs;
+  while ((pos < size) && (m_Html[pos] != '>'))
+  {
+    if (isspace(static_cast<unsigned char>(m_Html[pos])) || (m_Html[pos] == '/'))
+    {
+      ++pos;
+      continue;
+    }
+
+    const size_t nameStart = pos;
+    while ((pos < size) && !isspace(static_cast<unsigned char>(m_Html[pos])) &&
+           (strchr("=>/", m_Html[pos]) == NULL))
+    {
+      ++pos;
+    }
+
+    const std::string& attrName = Util::ToLower(m_Html.substr(nameStart, pos - nameStart));
+    while ((pos < size) && isspace(static_cast<unsigned char>(m_Html[pos])))
+    {
+      ++pos;
+    }
+
+    size_t valueStart = pos;
+    size_t valueEnd = pos;
+    if ((pos < size) && (m_Html[pos] == '='))
+    {
+      ++pos;
+      while ((pos < size) && isspace(static_cast<unsigned char>(m_Html[pos])))
+      {
+        ++pos;
+      }
+
+      if ((pos < size) && ((m_Html[pos] == '"') || (m_Html[pos] == '\'')))
+      {
+        const char quote = m_Html[pos++];
+        valueStart = pos;
+        valueEnd = m_Html.find(quote, pos);
+        valueEnd = (valueEnd == std::string::npos) ? size : valueEnd;
+        pos = std::min(valueEnd + 1, size);
+      }
+      else
+      {
+        valueStart = pos;
+        while ((pos < size) && !isspace(static_cast<unsigned char>(m_Html[pos])) &&
+               (m_Html[pos] != '>'))
+        {
+          ++pos;
+        }
+
+        valueEnd = pos;
+      }
+    }
+
+    if (((attrName == "href") || (attrName == "alt") || (attrName == "style")) &&
+        (attrs.find(attrName) == attrs.end()))
+    {
+      attrs[attrName] = DecodeEntities(m_Html.substr(valueStart, valueEnd - valueStart));
+    }
+  }
+
+  p_Pos = std::min(pos + 1, size);
+
+  if (isEnd)
+  {
+    EndTag(name);
+  }
+  else if (IsSkipTag(name))
+  {
+    SkipElement(name, p_Pos);
+  }
+  else
+  {
+    StartTag(name, attrs);
+  }
+}
+
+void HtmlConvert::SkipElement(const std::string& p_Name, size_t& p_Pos)
+{
+  const size_t end = FindEndTag(m_Html, p_Name, p_Pos);
+  if (end != std::string::npos)
+  {
+    const size_t close = m_Html.find('>', end);
+    p_Pos = (close == std::string::npos) ? m_Html.size() : (close + 1);
+  }
+  else if (p_Name != "head")
+  {
+    p_Pos = m_Html.size();
+  }
+}
+
+void HtmlConvert::StartTag(const std::string& p_Name,
+                           const std::map<std::string, std::string>& p_Attrs)
+{
+  if (m_HiddenDepth > 0)
+  {
+    if (p_Name == m_HiddenTag)
+    {
+      ++m_HiddenDepth;
+    }
+
+    return;
+  }
+
+  auto styleIt = p_Attrs.find("style");
+  if ((styleIt != p_Attrs.end()) && IsHiddenStyle(styleIt->second))
+  {
+    if (!IsVoidTag(p_Name))
+    {
+      m_HiddenTag = p_Name;
+      m_HiddenDepth = 1;
+    }
+
+    return;
+  }
+
+  if (p_Name == "br")
+  {
+    AddBreak();
+  }
+  else if (IsParagraphTag(p_Name))
+  {
+    AddNewlines(2);
+  }
+  else if ((p_Name == "ul") || (p_Name == "ol"))
+  {
+    AddNewlines(m_Lists.empty() ? 2 : 1);
+    List list;
+    list.m_Ordered = (p_Name == "ol");
+    m_Lists.push_back(list);
+  }
+  else if (p_Name == "li")
+  {
+    AddNewlines(1);
+    if (!m_Lists.empty() && m_Lists.back().m_Ordered)
+    {
+      m_Marker = std::to_string(++m_Lists.back().m_Index) + ". ";
+    }
+    else
+    {
+      m_Marker = "* ";
+    }
+  }
+  else if (p_Name == "blockquote")
+  {
+    AddNewlines(2);
+    ++m_QuoteDepth;
+  }
+  else if (p_Name == "pre")
+  {
+    AddNewlines(2);
+    ++m_PreDepth;
+  }
+  else if (p_Name == "hr")
+  {
+    AddNewlines(1);
+    AddWord(std::string(40, '-'));
+    AddNewlines(1);
+  }
+  else if (p_Name == "table")
+  {
+    AddNewlines(1);
+    m_Cells.push_back(0);
+  }
+  else if ((p_Name == "td") || (p_Name == "th"))
+  {
+    if (!m_Cells.empty() && (m_Cells.back()++ > 0))
+    {
+      m_Spaces = 2;
+    }
+  }
+  else if (p_Name == "a")
+  {
+    auto hrefIt = p_Attrs.find("href");
+    if (hrefIt != p_Attrs.end())
+    {
+      StartLink(hrefIt->second);
+    }
+  }
+  else if (p_Name == "img")
+  {
+    auto altIt = p_Attrs.find("alt");
+    if (altIt != p_Attrs.end())
+    {
+      const std::string& alt = Util::Trim(altIt->second);
+      if (!alt.empty())
+      {
+        AddText("[" + alt + "]");
+      }
+    }
+  }
+  else if (IsBlockTag(p_Name))
+  {
+    AddNewlines(1);
+    if (p_Name == "tr")
+    {
+      if (!m_Cells.empty())
+      {
+        m_Cells.back() = 0;
+      }
+    }
+  }
+}
+
+void HtmlConvert::EndTag(const std::string& p_Name)
+{
+  if (m_HiddenDepth > 0)
+  {
+    if ((p_Name == m_HiddenTag) && (--m_HiddenDepth == 0))
+    {
+      m_HiddenTag.clear();
+    }
+
+    return;
+  }
+
+  if (IsParagraphTag(p_Name))
+  {
+    AddNewlines(2);
+  }
+  else if ((p_Name == "ul") || (p_Name == "ol"))
+  {
+    if (!m_Lists.empty())
+    {
+      m_Lists.pop_back();
+    }
+
+    AddNewlines(m_Lists.empty() ? 2 : 1);
+  }
+  else if (p_Name == "blockquote")
+  {
+    AddNewlines(2);
+    m_QuoteDepth = std::max(0, m_QuoteDepth - 1);
+  }
+  else if (p_Name == "pre")
+  {
+    AddNewlines(2);
+    m_PreDepth = std::max(0, m_PreDepth - 1);
+  }
+  else if (p_Name == "table")
+  {
+    if (!m_Cells.empty())
+    {
+      m_Cells.pop_back();
+    }
+
+    AddNewlines(1);
+  }
+  else if (p_Name == "a")
+  {
+    EndLink();
+  }
+  else if (IsBlockTag(p_Name))
+  {
+    AddNewlines(1);
+  }
+}
+
+void HtmlConvert::StartLink(const std::string& p_Href)
+{
+  EndLink();
+
+  const std::string& href = Util::Trim(p_Href);
+  if (href.empty() || (href[0] == '#') || (Util::ToLower(href).find("javascript:") == 0))
+  {
+    return;
+  }
+
+  m_InLink = true;
+  m_LinkHref = href;
+  m_LinkTextPos = m_Out.size();
+}
+
+void HtmlConvert::EndLink()
+{
+  if (!m_InLink) return;
+
+  m_InLink = false;
+  const std::string& text = Util::Trim(m_Out.substr(m_LinkTextPos));
+  if ((text == m_LinkHref) || (("mailto:" + text) == m_LinkHref))
+  {
+    return;
+  }
+
+  auto it = m_LinkIndexes.find(m_LinkHref);
+  if (it == m_LinkIndexes.end())
+  {
+    m_Links.push_back(m_LinkHref);
+    it = m_LinkIndexes.insert(std::make_pair(m_LinkHref, m_Links.size())).first;
+  }
+
+  m_Spaces = 0;
+  AddWord("[" + std::to_string(it->second) + "]");
+}
+
+void HtmlConvert::AddText(const std::string& p_Text)
+{
+  if ((m_HiddenDepth > 0) || p_Text.empty()) return;
+
+  if (m_PreDepth > 0)
+  {
+    size_t pos = 0;
+    while (pos <= p_Text.size())
+    {
+      size_t end = p_Text.find('\n', pos);
+      end = (end == std::string::npos) ? p_Text.size() : end;
+      std::string line = p_Text.substr(pos, end - pos);
+      line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+      if (!line.empty())
+      {
+        AddWord(line);
+      }
+
+      if (end < p_Text.size())
+      {
+        AddBreak();
+      }
+
+      pos = end + 1;
+    }
+
+    return;
+  }
+
+  size_t pos = 0;
+  while (pos < p_Text.size())
+  {
+    const size_t wordStart = p_Text.find_first_not_of(s_Whitespace, pos);
+    if (wordStart != pos)
+    {
+      AddSpace();
+    }
+
+    if (wordStart == std::string::npos) break;
+
+    size_t wordEnd = p_Text.find_first_of(s_Whitespace, wordStart);
+    wordEnd = (wordEnd == std::string::npos) ? p_Text.size() : wordEnd;
+    AddWord(p_Text.substr(wordStart, wordEnd - wordStart));
+    pos = wordEnd;
+  }
+}
+
+void HtmlConvert::AddWord(const std::string& p_Word)
+{
+  if (m_Newlines > 0)
+  {
+    if (!m_Out.empty())
+    {
+      m_Out.append(m_Newlines, '\n');
+      m_LineStart = true;
+    }
+
+    m_Newlines = 0;
+  }
+
+  if (m_LineStart)
+  {
+    for (int i = 0; i < m_QuoteDepth; ++i)
+    {
+      m_Out += "> ";
+    }
+
+    const int indent = (2 * static_cast<int>(m_Lists.size())) - (m_Marker.empty() ? 0 : 2);
+    m_Out.append(std::max(0, indent), ' ');
+    m_Out += m_Marker;
+    m_Marker.clear();
+    m_LineStart = false;
+  }
+  else if (m_Spaces > 0)
+  {
+    m_Out.append(m_Spaces, ' ');
+  }
+
+  m_Spaces = 0;
+  m_Out += p_Word;
+}
+
+void HtmlConvert::AddSpace()
+{
+  if (!m_LineStart && (m_Newlines == 0))
+  {
+    m_Spaces = std::max(m_Spaces, 1);
+  }
+}
+
+void HtmlConvert::AddNewlines(int p_Count)
+{
+  m_Newlines = std::max(m_Newlines, p_Count);
+  m_Spaces = 0;
+}
+
+void HtmlConvert::AddBreak()
+{
+  ++m_Newlines;
+  m_Spaces = 0;
+}
+
+std::string HtmlConvert::GetResult() const
+{
+  // non-breaking spaces become plain spaces, zero-width characters are dropped
+  std::string out = m_Out;
+  Util::ReplaceString(out, "\xC2\xA0", " ");
+  Util::ReplaceString(out, "\xE2\x80\x8B", "");
+  Util::ReplaceString(out, "\xE2\x80\x8C", "");
+  Util::ReplaceString(out, "\xCD\x8F", "");
+
+  std::string result;
+  result.reserve(out.size() + 64);
+  bool lastEmpty = true;
+  size_t pos = 0;
+  while (pos < out.size())
+  {
+    size_t end = out.find('\n', pos);
+    end = (end == std::string::npos) ? out.size() : end;
+    const size_t last = out.find_last_not_of(" \t", end - 1);
+    const bool empty = (last == std::string::npos) || (last < pos);
+    if (!empty)
+    {
+      result.append(out, pos, last + 1 - pos);
+      result += "\n";
+    }
+    else if (!lastEmpty)
+    {
+      result += "\n";
+    }
+
+    lastEmpty = empty;
+    pos = end + 1;
+  }
+
+  if (!m_Links.empty())
+  {
+    result += lastEmpty ? "Links:\n" : "\nLinks:\n";
+    for (size_t i = 0; i < m_Links.size(); ++i)
+    {
+      result += "[" + std::to_string(i + 1) + "] " + m_Links.at(i) + "\n";
+    }
+  }
+
+  return result;
+}
+
+std::string HtmlConvert::DecodeEntity(const std::string& p_Html, size_t& p_Pos)
+{
+  static const std::map<std::string, uint32_t> entities =
+  {
+    { "amp", '&' }, { "lt", '<' }, { "gt", '>' }, { "quot", '"' }, { "apos", '\'' },
+    { "nbsp", 0xA0 }, { "iexcl", 0xA1 }, { "cent", 0xA2 }, { "pound", 0xA3 },
+    { "curren", 0xA4 }, { "yen", 0xA5 }, { "brvbar", 0xA6 }, { "sect", 0xA7 },
+    { "uml", 0xA8 }, { "copy", 0xA9 }, { "ordf", 0xAA }, { "laquo", 0xAB }, { "not", 0xAC },
+    { "shy", 0xAD }, { "reg", 0xAE }, { "macr", 0xAF }, { "deg", 0xB0 }, { "plusmn", 0xB1 },
+    { "sup2", 0xB2 }, { "sup3", 0xB3 }, { "acute", 0xB4 }, { "micro", 0xB5 },
+    { "para", 0xB6 }, { "middot", 0xB7 }, { "cedil", 0xB8 }, { "sup1", 0xB9 },
+    { "ordm", 0xBA }, { "raquo", 0xBB }, { "frac14", 0xBC }, { "frac12", 0xBD },
+    { "frac34", 0xBE }, { "iquest", 0xBF }, { "Agrave", 0xC0 }, { "Aacute", 0xC1 },
+    { "Acirc", 0xC2 }, { "Atilde", 0xC3 }, { "Auml", 0xC4 }, { "Aring", 0xC5 },
+    { "AElig", 0xC6 }, { "Ccedil", 0xC7 }, { "Egrave", 0xC8 }, { "Eacute", 0xC9 },
+    { "Ecirc", 0xCA }, { "Euml", 0xCB }, { "Igrave", 0xCC }, { "Iacute", 0xCD },
+    { "Icirc", 0xCE }, { "Iuml", 0xCF }, { "ETH", 0xD0 }, { "Ntilde", 0xD1 },
+    { "Ograve", 0xD2 }, { "Oacute", 0xD3 }, { "Ocirc", 0xD4 }, { "Otilde", 0xD5 },
+    { "Ouml", 0xD6 }, { "times", 0xD7 }, { "Oslash", 0xD8 }, { "Ugrave", 0xD9 },
+    { "Uacute", 0xDA }, { "Ucirc", 0xDB }, { "Uuml", 0xDC }, { "Yacute", 0xDD },
+    { "THORN", 0xDE }, { "szlig", 0xDF }, { "agrave", 0xE0 }, { "aacute", 0xE1 },
+    { "acirc", 0xE2 }, { "atilde", 0xE3 }, { "auml", 0xE4 }, { "aring", 0xE5 },
+    { "aelig", 0xE6 }, { "ccedil", 0xE7 }, { "egrave", 0xE8 }, { "eacute", 0xE9 },
+    { "ecirc", 0xEA }, { "euml", 0xEB }, { "igrave", 0xEC }, { "iacute", 0xED },
+    { "icirc", 0xEE }, { "iuml", 0xEF }, { "eth", 0xF0 }, { "ntilde", 0xF1 },
+    { "ograve", 0xF2 }, { "oacute", 0xF3 }, { "ocirc", 0xF4 }, { "otilde", 0xF5 },
+    { "ouml", 0xF6 }, { "divide", 0xF7 }, { "oslash", 0xF8 }, { "ugrave", 0xF9 },
+    { "uacute", 0xFA }, { "ucirc", 0xFB }, { "uuml", 0xFC }, { "yacute", 0xFD },
+    { "thorn", 0xFE }, { "yuml", 0xFF }, { "OElig", 0x152 }, { "oelig", 0x153 },
+    { "Scaron", 0x160 }, { "scaron", 0x161 }, { "Yuml", 0x178 }, { "fnof", 0x192 },
+    { "circ", 0x2C6 }, { "tilde", 0x2DC }, { "ensp", 0x2002 }, { "emsp", 0x2003 },
+    { "thinsp", 0x2009 }, { "zwnj", 0x200C }, { "zwj", 0x200D }, { "lrm", 0x200E },
+    { "rlm", 0x200F }, { "ndash", 0x2013 }, { "mdash", 0x2014 }, { "lsquo", 0x2018 },
+    { "rsquo", 0x2019 }, { "sbquo", 0x201A }, { "ldquo", 0x201C }, { "rdquo", 0x201D },
+    { "bdquo", 0x201E }, { "dagger", 0x2020 }, { "Dagger", 0x2021 }, { "bull", 0x2022 },
+    { "hellip", 0x2026 }, { "permil", 0x2030 }, { "prime", 0x2032 }, { "lsaquo", 0x2039 },
+    { "rsaquo", 0x203A }, { "euro", 0x20AC }, { "trade", 0x2122 }, { "larr", 0x2190 },
+    { "uarr", 0x2191 }, { "rarr", 0x2192 }, { "darr", 0x2193 }, { "hearts", 0x2665 },
+  };
+
+  const size_t end = p_Html.find_first_of("; \t\r\n<&", p_Pos + 1);
+  if ((end == std::string::npos) || (p_Html[end] != ';') || ((end - p_Pos) > 32))
+  {
+    ++p_Pos;
+    return "&";
+  }
+
+  const std::string& name = p_Html.substr(p_Pos + 1, end - p_Pos - 1);
+  uint32_t code = 0;
+  if ((name.size() > 1) && (name[0] == '#'))
+  {
+    const bool isHex = (name[1] == 'x') || (name[1] == 'X');
+    const std::string& digits = name.substr(isHex ? 2 : 1);
+    char* digitsEnd = NULL;
+    code = static_cast<uint32_t>(strtoul(digits.c_str(), &digitsEnd, isHex ? 16 : 10));
+    if (digits.empty() || (*digitsEnd != '\0'))
+    {
+      ++p_Pos;
+      return "&";
+    }
+
+    // windows-1252 code points commonly used in numeric references
+    static const std::map<uint32_t, uint32_t> cp1252 =
+    {
+      { 0x80, 0x20AC }, { 0x85, 0x2026 }, { 0x91, 0x2018 }, { 0x92, 0x2019 },
+      { 0x93, 0x201C }, { 0x94, 0x201D }, { 0x95, 0x2022 }, { 0x96, 0x2013 },
+      { 0x97, 0x2014 }, { 0x99, 0x2122 },
+    };
+
+    auto it = cp1252.find(code);
+    if (it != cp1252.end())
+    {
+      code = it->second;
+    }
+  }
+  else
+  {
+    auto it = entities.find(name);
+    if (it == entities.end())
+    {
+      ++p_Pos;
+      return "&";
+    }
+
+    code = it->second;
+  }
+
+  p_Pos = end + 1;
+
+  std::string str;
+  if ((code == 0xAD) || (code == 0x34F) || ((code >= 0x200B) && (code <= 0x200F)) ||
+      (code == 0x2060) || (code == 0xFEFF))
+  {
+    // invisible characters, often used as padding in newsletter preheaders
+    return str;
+  }
+
+  AppendUtf8(code, str);
+  return str;
+}
+
+std::string HtmlConvert::DecodeEntities(const std::string& p_Str)
+{
+  if (p_Str.find('&') == std::string::npos) return p_Str;
+
+  std::string str;
+  size_t pos = 0;
+  while (pos < p_Str.size())
+  {
+    const size_t next = p_Str.find('&', pos);
+    if (next == std::string::npos)
+    {
+      str.append(p_Str, pos, p_Str.size() - pos);
+      break;
+    }
+
+    str.append(p_Str, pos, next - pos);
+    pos = next;
+    str += DecodeEntity(p_Str, pos);
+  }
+
+  return str;
+}
+
+void HtmlConvert::AppendUtf8(uint32_t p_Code, std::string& p_Str)
+{
+  if ((p_Code == 0) || (p_Code > 0x10FFFF) || ((p_Code >= 0xD800) && (p_Code <= 0xDFFF)))
+  {
+    p_Code = 0xFFFD;
+  }
+
+  if (p_Code < 0x80)
+  {
+    p_Str += static_cast<char>(p_Code);
+  }
+  else if (p_Code < 0x800)
+  {
+    p_Str += static_cast<char>(0xC0 | (p_Code >> 6));
+    p_Str += static_cast<char>(0x80 | (p_Code & 0x3F));
+  }
+  else if (p_Code < 0x10000)
+  {
+    p_Str += static_cast<char>(0xE0 | (p_Code >> 12));
+    p_Str += static_cast<char>(0x80 | ((p_Code >> 6) & 0x3F));
+    p_Str += static_cast<char>(0x80 | (p_Code & 0x3F));
+  }
+  else
+  {
+    p_Str += static_cast<char>(0xF0 | (p_Code >> 18));
+    p_Str += static_cast<char>(0x80 | ((p_Code >> 12) & 0x3F));
+    p_Str += static_cast<char>(0x80 | ((p_Code >> 6) & 0x3F));
+    p_Str += static_cast<char>(0x80 | (p_Code & 0x3F));
+  }
+}
@@ -0,0 +1,72 @@
+// htmlconvert.h
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Built-in html to text converter. Tokenizes the html in a single pass and formats paragraphs,
+// line breaks, lists, tables, quotes and preformatted text. Links are numbered and listed at
+// the end. Lines are not wrapped, as the message view wraps them to the screen width.
+class HtmlConvert
+{
+public:
+  static std::string ToText(const std::string& p_Html);
+  static std::string GetCharset(const std::string& p_Html);
+
+private:
+  explicit HtmlConvert(const std::string& p_Html);
+
+  void Convert();
+  void ParseTag(size_t& p_Pos);
+  void SkipElement(const std::string& p_Name, size_t& p_Pos);
+  void StartTag(const std::string& p_Name, const std::map<std::string, std::string>& p_Attrs);
+  void EndTag(const std::string& p_Name);
+  void StartLink(const std::string& p_Href);
+  void EndLink();
+  void AddText(const std::string& p_Text);
+  void AddWord(const std::string& p_Word);
+  void AddSpace();
+  void AddNewlines(int p_Count);
+  void AddBreak();
+  std::string GetResult() const;
+
+  static std::string DecodeEntity(const std::string& p_Html, size_t& p_Pos);
+  static std::string DecodeEntities(const std::string& p_Str);
+  static void AppendUtf8(uint32_t p_Code, std::string& p_Str);
+
+private:
+  struct List
+  {
+    bool m_Ordered = false;
+    int m_Index = 0;
+  };
+
+  const std::string& m_Html;
+  std::string m_Out;
+
+  int m_Newlines = 0;
+  int m_Spaces = 0;
+  bool m_LineStart = true;
+  std::string m_Marker;
+
+  std::vector<List> m_Lists;
+  std::vector<int> m_Cells;
+  int m_QuoteDepth = 0;
+  int m_PreDepth = 0;
+
+  std::string m_HiddenTag;
+  int m_HiddenDepth = 0;
+
+  bool m_InLink = false;
+  std::string m_LinkHref;
+  size_t m_LinkTextPos = 0;
+  std::vector<std::string> m_Links;
+  std::map<std::string, size_t> m_LinkIndexes;
+};
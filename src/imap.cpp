@@ -7,439 +7,2266 @@
 
 #include "imap.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
 #include <libetpan/libetpan.h>
 
 #include "crypto.h"
 #include "flag.h"
 #include "log.h"
 #include "loghelp.h"
+#include "partdecoder.h"
 #include "serialized.h"
+#include "uidset.h"
 #include "util.h"
 
-Imap::Imap(const std::string &p_User, const std::string &p_Pass, const std::string &p_Host,
-           const uint16_t p_Port, const bool p_CacheEncrypt)
-  : m_User(p_User)
-  , m_Pass(p_Pass)
-  , m_Host(p_Host)
-  , m_Port(p_Port)
-  , m_CacheEncrypt(p_CacheEncrypt)
-{
-  LOG_DEBUG_FUNC(STR(p_User, "***" /*p_Pass*/, p_Host, p_Port, p_CacheEncrypt));
+// uid sets are split to keep command lines below 8192 octets, as recommended by RFC 7162
+static const size_t MaxUidSetLength = 8000;
 
-  m_Imap = LOG_IF_NULL(mailimap_new(0, NULL));
-  InitCacheDir();
-  InitImapCacheDir();
+// parts larger than this are streamed to file in chunks, instead of being held in memory
+static const uint32_t StreamPartSize = 1024 * 1024;
+static const uint32_t StreamChunkSize = 256 * 1024;
+
+// messages per MULTIAPPEND command, and number of APPEND commands in flight with LITERAL+
+static const size_t AppendMaxCount = 25;
+static const size_t AppendMaxSize = 8 * 1024 * 1024;
+static const size_t AppendPipelineDepth = 8;
+
+// number of STATUS commands in flight when refreshing folder statuses
+static const size_t StatusPipelineDepth = 16;
 
-  if (Log::GetTraceEnabled())
+static bool ParseMsgAttFlags(struct mailimap_msg_att* p_MsgAtt, uint32_t& p_Uid, uint32_t& p_Flag)
+{
+  bool hasFlags = false;
+  p_Uid = 0;
+  p_Flag = 0;
+  for (clistiter* ait = clist_begin(p_MsgAtt->att_list); ait != NULL; ait = clist_next(ait))
   {
-    mailimap_set_logger(m_Imap, Logger, NULL);
+    struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item *)clist_content(ait);
+
+    if (item->att_type == MAILIMAP_MSG_ATT_ITEM_DYNAMIC)
+    {
+      hasFlags = true;
+      if (item->att_data.att_dyn->att_list != NULL)
+      {
+        for (clistiter* dit = clist_begin(item->att_data.att_dyn->att_list); dit != NULL;
+             dit = clist_next(dit))
+        {
+          struct mailimap_flag_fetch* flag_fetch =
+            (struct mailimap_flag_fetch*) clist_content(dit);
+          if (flag_fetch && flag_fetch->fl_flag)
+          {
+            switch (flag_fetch->fl_flag->fl_type)
+            {
+              case MAILIMAP_FLAG_SEEN:
+                p_Flag |= Flag::Seen;
+                break;
+
+              default:
+                break;
+            }
+          }
+        }
+      }
+    }
+    else if (item->att_type == MAILIMAP_MSG_ATT_ITEM_STATIC)
+    {
+      if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_UID)
+      {
+        p_Uid = item->att_data.att_static->att_data.att_uid;
+      }
+    }
   }
+
+  return hasFlags;
 }
 
-Imap::~Imap()
+static void ParseUidFlags(clist* p_FetchResult, std::map<uint32_t, uint32_t>& p_Flags)
 {
-  LOG_DEBUG_FUNC(STR());
-
-  if (m_Imap != NULL)
+  for (clistiter* it = clist_begin(p_FetchResult); it != NULL; it = clist_next(it))
   {
-    mailimap_free(m_Imap);
-    m_Imap = NULL;
+    struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
+
+    uint32_t uid = 0;
+    uint32_t flag = 0;
+    ParseMsgAttFlags(msg_att, uid, flag);
+    if (uid == 0)
+    {
+      LOG_WARNING("skip flag uid = %d", uid);
+      continue;
+    }
+
+    p_Flags[uid] = flag;
   }
 }
 
-bool Imap::Login()
+static struct mailimap_set* NewUidSet(const UidSet& p_UidSet)
 {
-  LOG_DEBUG_FUNC(STR());
-
-  bool connected = false;
-
+  struct mailimap_set* set = mailimap_set_new_empty();
+  for (auto& range : p_UidSet.GetRanges())
   {
-    std::lock_guard<std::mutex> imapLock(m_ImapMutex);
-    m_SelectedFolder.clear();
-    int rv = LOG_IF_IMAP_ERR(mailimap_ssl_connect(m_Imap, m_Host.c_str(), m_Port));
-
-    if (rv == MAILIMAP_NO_ERROR_AUTHENTICATED)
+    if (range.first == range.second)
     {
-      connected = true;
+      mailimap_set_add_single(set, range.first);
     }
-    else if (rv == MAILIMAP_NO_ERROR_NON_AUTHENTICATED)
+    else
     {
-      rv = LOG_IF_IMAP_ERR(mailimap_login(m_Imap, m_User.c_str(), m_Pass.c_str()));
-      connected = (rv == MAILIMAP_NO_ERROR);
+      mailimap_set_add_interval(set, range.first, range.second);
     }
   }
 
-  {
-    std::lock_guard<std::mutex> connectedLock(m_ConnectedMutex);
-    m_Connected = connected;
-  }
+  return set;
+}
 
-  if (connected)
+static struct mailimap_section* NewSection(const std::string& p_Section)
+{
+  clist* sec_id = clist_new();
+  for (auto& id : Util::Split(p_Section, '.'))
   {
-    // @todo: clear all cache if cannot use existing (cater for password change)
+    uint32_t* value = (uint32_t*)malloc(sizeof(uint32_t));
+    *value = static_cast<uint32_t>(strtoul(id.c_str(), NULL, 10));
+    clist_append(sec_id, value);
   }
 
-  return connected;
+  return mailimap_section_new_part(mailimap_section_part_new(sec_id));
 }
 
-bool Imap::Logout()
+static std::string GetSectionId(struct mailimap_section* p_Section)
 {
-  LOG_DEBUG_FUNC(STR());
-
-  std::lock_guard<std::mutex> connectedLock(m_ConnectedMutex);
-
-  int rv = MAILIMAP_NO_ERROR;
-  if (m_Connected)
+  std::string section;
+  if ((p_Section != NULL) && (p_Section->sec_spec != NULL) &&
+      (p_Section->sec_spec->sec_type == MAILIMAP_SECTION_SPEC_SECTION_PART) &&
+      (p_Section->sec_spec->sec_data.sec_part != NULL))
   {
-    std::lock_guard<std::mutex> imapLock(m_ImapMutex);
-    if (m_Imap != NULL)
+    clist* sec_id = p_Section->sec_spec->sec_data.sec_part->sec_id;
+    for (clistiter* it = clist_begin(sec_id); it != NULL; it = clist_next(it))
     {
-      rv = LOG_IF_IMAP_LOGOUT_ERR(mailimap_logout(m_Imap));
+      section += (section.empty() ? "" : ".") + std::to_string(*(uint32_t*)clist_content(it));
     }
-    m_SelectedFolder.clear();
-
-    m_Connected = false;
   }
 
-  return ((rv == MAILIMAP_NO_ERROR) || (rv == MAILIMAP_ERROR_STREAM));
+  return section;
 }
 
-bool Imap::GetFolders(const bool p_Cached, std::set<std::string>& p_Folders)
+// returns the body section datas of a message by section, unsolicited fetch responses for
+// other messages may be included and are skipped
+static void ParseBodySections(clist* p_FetchResult, uint32_t p_Uid,
+                              std::map<std::string, std::string>& p_Datas)
 {
-  LOG_DEBUG_FUNC(STR(p_Cached, p_Folders));
-  
-  if (p_Cached)
+  for (clistiter* it = clist_begin(p_FetchResult); it != NULL; it = clist_next(it))
   {
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-    p_Folders = Deserialize<std::set<std::string>>(ReadCacheFile(GetFoldersCachePath()));
-    return true;
-  }
-
-  clist* list = NULL;
-  std::lock_guard<std::mutex> imapLock(m_ImapMutex);
+    struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
 
-  int rv = LOG_IF_IMAP_ERR(mailimap_list(m_Imap, "", "*", &list));
-  if (rv == MAILIMAP_NO_ERROR)
-  {
-    for (clistiter* it = clist_begin(list); it != NULL; it = it->next)
+    uint32_t uid = 0;
+    std::map<std::string, std::string> datas;
+    for (clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
     {
-      struct mailimap_mailbox_list* mblist = (struct mailimap_mailbox_list*)clist_content(it);
-      if (mblist)
+      struct mailimap_msg_att_item* item =
+        (struct mailimap_msg_att_item *) clist_content(ait);
+
+      if (item->att_type != MAILIMAP_MSG_ATT_ITEM_STATIC) continue;
+
+      struct mailimap_msg_att_static* att_static = item->att_data.att_static;
+      if (att_static->att_type == MAILIMAP_MSG_ATT_UID)
       {
-        mailimap_mbx_list_flags* bflags = mblist->mb_flag;
-        if (bflags)
+        uid = att_static->att_data.att_uid;
+      }
+      else if (att_static->att_type == MAILIMAP_MSG_ATT_BODY_SECTION)
+      {
+        struct mailimap_msg_att_body_section* body_section =
+          att_static->att_data.att_body_section;
+        if (body_section->sec_body_part != NULL)
         {
-          if (!((bflags->mbf_type == MAILIMAP_MBX_LIST_FLAGS_SFLAG) &&
-                (bflags->mbf_sflag == MAILIMAP_MBX_LIST_SFLAG_NOSELECT)))
-          {
-            p_Folders.insert(std::string(mblist->mb_name));
-          }
+          datas[GetSectionId(body_section->sec_section)] =
+            std::string(body_section->sec_body_part, body_section->sec_length);
         }
       }
     }
 
-    mailimap_list_result_free(list);
-
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-    WriteCacheFile(GetFoldersCachePath(), Serialize(p_Folders));
+    if (uid == p_Uid)
+    {
+      p_Datas.insert(datas.begin(), datas.end());
+    }
+  }
+}
 
-    return true;
+static std::string GetBodyFieldParam(struct mailimap_body_fld_param* p_Param,
+                                     const std::string& p_Name)
+{
+  if (p_Param != NULL)
+  {
+    for (clistiter* it = clist_begin(p_Param->pa_list); it != NULL; it = clist_next(it))
+    {
+      struct mailimap_single_body_fld_param* param =
+        (struct mailimap_single_body_fld_param*)clist_content(it);
+      if ((param->pa_name != NULL) && (param->pa_value != NULL) &&
+          (Util::ToLower(std::string(param->pa_name)) == p_Name))
+      {
+        return std::string(param->pa_value);
+      }
+    }
   }
 
-  return false;
+  return std::string();
 }
 
-bool Imap::GetUids(const std::string &p_Folder, const bool p_Cached, std::set<uint32_t>& p_Uids)
+static std::string GetMediaBasicType(struct mailimap_media_basic* p_Media)
 {
-  LOG_DEBUG_FUNC(STR(p_Folder, p_Cached, p_Uids));
+  switch (p_Media->med_type)
+  {
+    case MAILIMAP_MEDIA_BASIC_APPLICATION: return "application";
+    case MAILIMAP_MEDIA_BASIC_AUDIO: return "audio";
+    case MAILIMAP_MEDIA_BASIC_IMAGE: return "image";
+    case MAILIMAP_MEDIA_BASIC_MESSAGE: return "message";
+    case MAILIMAP_MEDIA_BASIC_VIDEO: return "video";
+    case MAILIMAP_MEDIA_BASIC_OTHER:
+      return (p_Media->med_basic_type != NULL) ? std::string(p_Media->med_basic_type) : "";
+    default: return "";
+  }
+}
 
-  if (p_Cached)
+static int GetMimeEncoding(struct mailimap_body_fld_enc* p_Encoding)
+{
+  switch ((p_Encoding != NULL) ? p_Encoding->enc_type : MAILIMAP_BODY_FLD_ENC_OTHER)
   {
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-    p_Uids = Deserialize<std::set<uint32_t>>(ReadCacheFile(GetFolderUidsCachePath(p_Folder)));
-    return true;
+    case MAILIMAP_BODY_FLD_ENC_7BIT: return MAILMIME_MECHANISM_7BIT;
+    case MAILIMAP_BODY_FLD_ENC_8BIT: return MAILMIME_MECHANISM_8BIT;
+    case MAILIMAP_BODY_FLD_ENC_BASE64: return MAILMIME_MECHANISM_BASE64;
+    case MAILIMAP_BODY_FLD_ENC_QUOTED_PRINTABLE: return MAILMIME_MECHANISM_QUOTED_PRINTABLE;
+    default: return MAILMIME_MECHANISM_BINARY;
   }
+}
 
-  std::lock_guard<std::mutex> imapLock(m_ImapMutex);
+// collects the leaf parts of a body structure in message order, attached messages are
+// kept as single parts
+static void ParseBodyStructure(struct mailimap_body* p_Body, const std::string& p_Section,
+                               std::vector<PartSection>& p_Sections)
+{
+  if (p_Body == NULL) return;
 
-  if (!SelectFolder(p_Folder, true))
+  if (p_Body->bd_type == MAILIMAP_BODY_MPART)
   {
-    return false;
+    int index = 1;
+    clist* list = p_Body->bd_data.bd_body_mpart->bd_list;
+    for (clistiter* it = clist_begin(list); it != NULL; it = clist_next(it), ++index)
+    {
+      const std::string& section = (p_Section.empty() ? "" : p_Section + ".") +
+        std::to_string(index);
+      ParseBodyStructure((struct mailimap_body*)clist_content(it), section, p_Sections);
+    }
+
+    return;
   }
 
-  if (SelectedFolderIsEmpty())
+  struct mailimap_body_type_1part* part = p_Body->bd_data.bd_body_1part;
+  struct mailimap_body_fields* fields = NULL;
+  std::string mimeType;
+  switch (part->bd_type)
   {
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-    WriteCacheFile(GetFolderUidsCachePath(p_Folder), Serialize(p_Uids));
-    DeleteCacheExceptUids(p_Folder, p_Uids);
-    return true;
+    case MAILIMAP_BODY_TYPE_1PART_BASIC:
+      fields = part->bd_data.bd_type_basic->bd_fields;
+      mimeType = GetMediaBasicType(part->bd_data.bd_type_basic->bd_media_basic) + "/" +
+        std::string(part->bd_data.bd_type_basic->bd_media_basic->med_subtype);
+      break;
+
+    case MAILIMAP_BODY_TYPE_1PART_MSG:
+      fields = part->bd_data.bd_type_msg->bd_fields;
+      mimeType = "message/rfc822";
+      break;
+
+    case MAILIMAP_BODY_TYPE_1PART_TEXT:
+      fields = part->bd_data.bd_type_text->bd_fields;
+      mimeType = "text/" + std::string(part->bd_data.bd_type_text->bd_media_text);
+      break;
+
+    default:
+      return;
   }
 
-  struct mailimap_set* set = mailimap_set_new_interval(1, 0);
-  struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
-  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
-  clist* fetch_result = NULL;
-  
-  int rv = LOG_IF_IMAP_ERR(mailimap_fetch(m_Imap, set, fetch_type, &fetch_result));
-  if (rv == MAILIMAP_NO_ERROR)
+  PartSection section;
+  section.m_Section = p_Section.empty() ? "1" : p_Section;
+  section.m_MimeType = Util::ToLower(mimeType);
+  if (fields != NULL)
   {
-    for(clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
+    section.m_Filename = GetBodyFieldParam(fields->bd_parameter, "name");
+    section.m_Charset = Util::ToLower(GetBodyFieldParam(fields->bd_parameter, "charset"));
+    section.m_Encoding = GetMimeEncoding(fields->bd_encoding);
+    section.m_Size = fields->bd_size;
+    if (fields->bd_id != NULL)
     {
-      struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
-
-      for(clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
+      section.m_ContentId = std::string(fields->bd_id);
+      if ((section.m_ContentId.size() >= 2) && (section.m_ContentId.front() == '<') &&
+          (section.m_ContentId.back() == '>'))
       {
-        struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item *)clist_content(ait);
-        if (item->att_type != MAILIMAP_MSG_ATT_ITEM_STATIC) continue;
-
-        if (item->att_data.att_static->att_type != MAILIMAP_MSG_ATT_UID) continue;
-
-        p_Uids.insert(item->att_data.att_static->att_data.att_uid);
-        break;
+        section.m_ContentId = section.m_ContentId.substr(1, section.m_ContentId.size() - 2);
       }
     }
+  }
 
-    mailimap_fetch_list_free(fetch_result);
-
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-    WriteCacheFile(GetFolderUidsCachePath(p_Folder), Serialize(p_Uids));
-    DeleteCacheExceptUids(p_Folder, p_Uids);
+  if ((part->bd_ext_1part != NULL) && (part->bd_ext_1part->bd_disposition != NULL))
+  {
+    const std::string& filename =
+      GetBodyFieldParam(part->bd_ext_1part->bd_disposition->dsp_attributes, "filename");
+    if (!filename.empty())
+    {
+      section.m_Filename = filename;
+    }
   }
 
-  mailimap_fetch_type_free(fetch_type);
-  mailimap_set_free(set);
+  p_Sections.push_back(section);
+}
 
-  return (rv == MAILIMAP_NO_ERROR);
+static time_t GetMessageTime(const std::string& p_Msg)
+{
+  const size_t headerEnd = p_Msg.find("\r\n\r\n");
+  Header header;
+  header.SetData((headerEnd != std::string::npos) ? p_Msg.substr(0, headerEnd + 4) : p_Msg);
+  return header.GetTimeStamp();
 }
 
-bool Imap::GetHeaders(const std::string &p_Folder, const std::set<uint32_t> &p_Uids,
-                      const bool p_Cached, const bool p_Prefetch,
-                      std::map<uint32_t, Header>& p_Headers)
+static std::string GetAppendDateTime(time_t p_Time)
 {
-  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Cached, p_Prefetch, p_Headers));
+  if (p_Time == 0) return "";
 
-  bool needFetch = false;
-  struct mailimap_set* set = mailimap_set_new_empty();
-  for (auto& uid : p_Uids)
+  static const char* months[] =
   {
-    bool cacheFound = false;
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-    const std::string& cachePath = GetHeaderCachePath(p_Folder, uid);
-    if (Util::NotEmpty(cachePath))
-    {
-      cacheFound = true;
-      if (!p_Prefetch)
-      {
-        const std::string& cacheData = ReadCacheFile(cachePath);
-        if (!cacheData.empty())
-        {
-          Header header;
-          header.SetData(cacheData);
-          Util::Touch(cachePath);
-          p_Headers[uid] = header;
-        }
-      }
-    }
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+  };
+
+  struct tm gt;
+  gmtime_r(&p_Time, &gt);
+  char datetime[64];
+  snprintf(datetime, sizeof(datetime), " \"%2d-%s-%04d %02d:%02d:%02d +0000\"", gt.tm_mday,
+           months[gt.tm_mon], gt.tm_year + 1900, gt.tm_hour, gt.tm_min, gt.tm_sec);
+  return std::string(datetime);
+}
 
-    if (!cacheFound)
+static std::string GetQuotedString(const std::string& p_Str)
+{
+  std::string quoted = "\"";
+  for (auto& ch : p_Str)
+  {
+    if ((ch == '"') || (ch == '\\'))
     {
-      if (!p_Cached)
-      {
-        mailimap_set_add_single(set, uid);
-        needFetch = true;
-      }
+      quoted += '\\';
     }
-  }
 
-  if (p_Cached)
-  {
-    mailimap_set_free(set);
-    return true;
+    quoted += ch;
   }
 
-  int rv = MAILIMAP_NO_ERROR;
+  return quoted + "\"";
+}
+
+static bool WriteStream(mailstream* p_Stream, const std::string& p_Str)
+{
+  return (mailstream_write(p_Stream, p_Str.c_str(), p_Str.size()) ==
+          static_cast<ssize_t>(p_Str.size()));
+}
 
-  if (needFetch)
+static bool ReadResponseLine(mailstream* p_Stream, MMAPString* p_Buffer, std::string& p_Line)
+{
+  p_Line.clear();
+  while (true)
   {
-    clist* fetch_result = NULL;
-    std::lock_guard<std::mutex> imapLock(m_ImapMutex);
+    const char* line = mailstream_read_line_remove_eol(p_Stream, p_Buffer);
+    if (line == NULL) return false;
 
-    if (!SelectFolder(p_Folder))
+    p_Line += line;
+
+    // literals are kept in the line following their size, e.g. a mailbox name in STATUS
+    const size_t literalStart = p_Line.rfind('{');
+    if (p_Line.empty() || (p_Line.back() != '}') || (literalStart == std::string::npos))
     {
-      mailimap_set_free(set);
-      return false;
+      LOG_TRACE("response %s", p_Line.c_str());
+      return true;
     }
 
-    struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
-    mailimap_fetch_type_new_fetch_att_list_add(fetch_type,
-                                               mailimap_fetch_att_new_rfc822_header());
-    mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
-    
-    rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(m_Imap, set, fetch_type, &fetch_result));
-    if (rv == MAILIMAP_NO_ERROR)
+    const size_t size = strtoul(p_Line.c_str() + literalStart + 1, NULL, 10);
+    std::vector<char> literal(std::max(size, (size_t)1));
+    size_t offset = 0;
+    while (offset < size)
     {
-      for(clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
-      {
-        struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
+      const ssize_t count = mailstream_read(p_Stream, &literal[offset], size - offset);
+      if (count <= 0) return false;
 
-        uint32_t uid = 0;
-        Header header;
-        for(clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
-        {
-          struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item *)clist_content(ait);
+      offset += count;
+    }
 
-          if (item->att_type == MAILIMAP_MSG_ATT_ITEM_DYNAMIC) continue;
+    p_Line.append(&literal[0], size);
+  }
+}
 
-          if (item->att_type == MAILIMAP_MSG_ATT_ITEM_STATIC)
-          {
-            if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_RFC822_HEADER)
-            {
-              std::string data(item->att_data.att_static->att_data.att_rfc822_header.att_content,
-                               item->att_data.att_static->att_data.att_rfc822_header.att_length);
-              header.SetData(data);
-            }
+static bool GetTaggedResponse(const std::string& p_Line, std::string& p_Tag,
+                              std::string& p_Status)
+{
+  if (p_Line.empty() || (p_Line.at(0) == '*') || (p_Line.at(0) == '+')) return false;
 
-            if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_UID)
-            {
-              uid = item->att_data.att_static->att_data.att_uid;
-            }
-          }
-        }
+  const size_t tagEnd = p_Line.find(' ');
+  if (tagEnd == std::string::npos) return false;
 
-        if (uid == 0)
-        {
-          LOG_WARNING("skip header uid = %d", uid);
-          continue;
-        }
+  p_Tag = p_Line.substr(0, tagEnd);
+  const std::string& status = p_Line.substr(tagEnd + 1);
+  p_Status = status.substr(0, status.find(' '));
+  return true;
+}
 
-        if (header.GetData().empty())
-        {
-          LOG_WARNING("skip header = \"\"");
-          continue;
-        }
+static bool SendAppendCommand(mailstream* p_Stream, MMAPString* p_Buffer, const std::string& p_Tag,
+                              const std::string& p_Folder, const std::vector<std::string>& p_Msgs,
+                              const std::vector<size_t>& p_Indexes, bool p_LiteralPlus,
+                              std::string& p_Response)
+{
+  std::string command = p_Tag + " APPEND " + GetQuotedString(p_Folder);
+  for (auto& index : p_Indexes)
+  {
+    const std::string& msg = p_Msgs.at(index);
+    command += " (\\Seen)" + GetAppendDateTime(GetMessageTime(msg)) + " {" +
+      std::to_string(msg.size()) + (p_LiteralPlus ? "+" : "") + "}\r\n";
+    if (!WriteStream(p_Stream, command)) return false;
 
-        if (!p_Prefetch)
+    command.clear();
+
+    if (!p_LiteralPlus)
+    {
+      if (mailstream_flush(p_Stream) == -1) return false;
+
+      // wait for continuation, or a tagged response if the server rejects the literal
+      std::string line;
+      std::string tag;
+      std::string status;
+      while (true)
+      {
+        if (!ReadResponseLine(p_Stream, p_Buffer, line)) return false;
+
+        if (!line.empty() && (line.at(0) == '+')) break;
+
+        if (GetTaggedResponse(line, tag, status) && (tag == p_Tag))
         {
-          p_Headers[uid] = header;
+          p_Response = line;
+          return true;
         }
-
-        std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-        WriteCacheFile(GetHeaderCachePath(p_Folder, uid), header.GetData());
       }
-    
-      mailimap_fetch_list_free(fetch_result);
     }
 
-    mailimap_fetch_type_free(fetch_type);
+    if (!WriteStream(p_Stream, msg)) return false;
   }
 
-  mailimap_set_free(set);
-
-  return (rv == MAILIMAP_NO_ERROR);
+  return WriteStream(p_Stream, "\r\n");
 }
 
-bool Imap::GetFlags(const std::string &p_Folder, const std::set<uint32_t> &p_Uids,
-                    const bool p_Cached, std::map<uint32_t, uint32_t>& p_Flags)
+static bool SendAppendCommands(mailstream* p_Stream, MMAPString* p_Buffer,
+                               const std::string& p_Folder, const std::vector<std::string>& p_Msgs,
+                               const std::vector<std::vector<size_t>>& p_Commands,
+                               bool p_LiteralPlus, std::vector<bool>& p_Results)
 {
-  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Cached, p_Flags));
-
-  if (p_Cached)
+  // with literal+ the commands are pipelined, otherwise each literal awaits continuation
+  const size_t depth = p_LiteralPlus ? AppendPipelineDepth : 1;
+  std::map<std::string, size_t> pendingCommands;
+  size_t nextCommand = 0;
+  bool rv = true;
+  while (rv && ((nextCommand < p_Commands.size()) || !pendingCommands.empty()))
+  {
+    while (rv && (nextCommand < p_Commands.size()) && (pendingCommands.size() < depth))
+    {
+      const std::string tag = "A" + std::to_string(nextCommand);
+      pendingCommands[tag] = nextCommand;
+      std::string response;
+      rv = SendAppendCommand(p_Stream, p_Buffer, tag, p_Folder, p_Msgs,
+                             p_Commands.at(nextCommand++), p_LiteralPlus, response);
+      if (!response.empty())
+      {
+        LOG_WARNING("append rejected: %s", response.c_str());
+        pendingCommands.erase(tag);
+      }
+    }
+
+    rv = rv && (mailstream_flush(p_Stream) != -1);
+
+    std::string line;
+    std::string tag;
+    std::string status;
+    while (rv && !pendingCommands.empty() && (rv = ReadResponseLine(p_Stream, p_Buffer, line)))
+    {
+      if (!GetTaggedResponse(line, tag, status) || (pendingCommands.count(tag) == 0)) continue;
+
+      const bool ok = (status == "OK");
+      for (auto& index : p_Commands.at(pendingCommands.at(tag)))
+      {
+        p_Results[index] = ok;
+      }
+
+      if (!ok)
+      {
+        LOG_WARNING("append failed: %s", line.c_str());
+      }
+
+      pendingCommands.erase(tag);
+      break;
+    }
+  }
+
+  return rv;
+}
+
+static bool SendPipelinedCommands(mailstream* p_Stream, MMAPString* p_Buffer,
+                                  const std::vector<std::string>& p_Commands, size_t p_Depth,
+                                  std::vector<std::string>& p_Untagged,
+                                  std::vector<bool>& p_Results)
+{
+  p_Results.assign(p_Commands.size(), false);
+  std::map<std::string, size_t> pendingCommands;
+  size_t nextCommand = 0;
+  bool rv = true;
+  while (rv && ((nextCommand < p_Commands.size()) || !pendingCommands.empty()))
+  {
+    while (rv && (nextCommand < p_Commands.size()) && (pendingCommands.size() < p_Depth))
+    {
+      const std::string tag = "S" + std::to_string(nextCommand);
+      pendingCommands[tag] = nextCommand;
+      rv = WriteStream(p_Stream, tag + " " + p_Commands.at(nextCommand++) + "\r\n");
+    }
+
+    rv = rv && (mailstream_flush(p_Stream) != -1);
+
+    // read until a command completes, so the next one can be sent
+    std::string line;
+    std::string tag;
+    std::string status;
+    while (rv && !pendingCommands.empty() && (rv = ReadResponseLine(p_Stream, p_Buffer, line)))
+    {
+      if (!GetTaggedResponse(line, tag, status))
+      {
+        if (!line.empty() && (line.at(0) == '*'))
+        {
+          p_Untagged.push_back(line);
+        }
+
+        continue;
+      }
+
+      auto pendingIt = pendingCommands.find(tag);
+      if (pendingIt == pendingCommands.end()) continue;
+
+      p_Results[pendingIt->second] = (status == "OK");
+      if (status != "OK")
+      {
+        LOG_WARNING("command failed: %s", line.c_str());
+      }
+
+      pendingCommands.erase(pendingIt);
+      break;
+    }
+  }
+
+  return rv;
+}
+
+static bool ParseAString(const std::string& p_Str, size_t& p_Pos, std::string& p_Value)
+{
+  p_Value.clear();
+  if (p_Pos >= p_Str.size()) return false;
+
+  if (p_Str.at(p_Pos) == '"')
+  {
+    for (++p_Pos; p_Pos < p_Str.size(); ++p_Pos)
+    {
+      char ch = p_Str.at(p_Pos);
+      if (ch == '"')
+      {
+        ++p_Pos;
+        return true;
+      }
+
+      if ((ch == '\\') && ((p_Pos + 1) < p_Str.size()))
+      {
+        ch = p_Str.at(++p_Pos);
+      }
+
+      p_Value += ch;
+    }
+
+    return false;
+  }
+  else if (p_Str.at(p_Pos) == '{')
+  {
+    // literal data follows the size directly, as read by ReadResponseLine()
+    const size_t sizeEnd = p_Str.find('}', p_Pos);
+    if (sizeEnd == std::string::npos) return false;
+
+    const size_t size = strtoul(p_Str.c_str() + p_Pos + 1, NULL, 10);
+    if ((sizeEnd + 1 + size) > p_Str.size()) return false;
+
+    p_Value = p_Str.substr(sizeEnd + 1, size);
+    p_Pos = sizeEnd + 1 + size;
+    return true;
+  }
+  else
+  {
+    const size_t end = std::min(p_Str.find(' ', p_Pos), p_Str.size());
+    p_Value = p_Str.substr(p_Pos, end - p_Pos);
+    p_Pos = end;
+    return !p_Value.empty();
+  }
+}
+
+static bool ParseStatusResponse(const std::string& p_Line, std::string& p_Folder,
+                                FolderStatus& p_Status)
+{
+  static const std::string prefix = "* STATUS ";
+  if (strncasecmp(p_Line.c_str(), prefix.c_str(), prefix.size()) != 0) return false;
+
+  size_t pos = prefix.size();
+  if (!ParseAString(p_Line, pos, p_Folder)) return false;
+
+  const size_t attsStart = p_Line.find('(', pos);
+  if (attsStart == std::string::npos) return false;
+
+  const char* atts = p_Line.c_str() + attsStart + 1;
+  char name[32] = { 0 };
+  unsigned long value = 0;
+  int count = 0;
+  while (sscanf(atts, " %31[A-Za-z] %lu%n", name, &value, &count) == 2)
+  {
+    if (strcasecmp(name, "MESSAGES") == 0)
+    {
+      p_Status.m_Messages = value;
+    }
+    else if (strcasecmp(name, "UNSEEN") == 0)
+    {
+      p_Status.m_Unseen = value;
+    }
+    else if (strcasecmp(name, "UIDNEXT") == 0)
+    {
+      p_Status.m_UidNext = value;
+    }
+
+    atts += count;
+  }
+
+  return true;
+}
+
+static bool ParseSearchCount(const std::string& p_Line, uint32_t& p_Count)
+{
+  static const std::string prefix = "* SEARCH";
+  if (strncasecmp(p_Line.c_str(), prefix.c_str(), prefix.size()) != 0) return false;
+
+  const char* numbers = p_Line.c_str() + prefix.size();
+  unsigned long number = 0;
+  int count = 0;
+  p_Count = 0;
+  while (sscanf(numbers, " %lu%n", &number, &count) == 1)
+  {
+    ++p_Count;
+    numbers += count;
+  }
+
+  return true;
+}
+
+static void ApplyMailboxSizeResponse(const std::string& p_Line,
+                                     struct mailimap_selection_info* p_SelectionInfo)
+{
+  // untagged size updates of the selected folder are normally tracked by libetpan
+  unsigned long number = 0;
+  char name[16] = { 0 };
+  if (p_SelectionInfo == NULL) return;
+
+  if (sscanf(p_Line.c_str(), "* %lu %15s", &number, name) != 2) return;
+
+  if (strcasecmp(name, "EXISTS") == 0)
+  {
+    p_SelectionInfo->sel_exists = number;
+    p_SelectionInfo->sel_has_exists = 1;
+  }
+  else if ((strcasecmp(name, "EXPUNGE") == 0) && (p_SelectionInfo->sel_exists > 0))
+  {
+    --p_SelectionInfo->sel_exists;
+  }
+}
+
+static std::string GetHeaderSearchText(Header& p_Header)
+{
+  return p_Header.GetSubject() + "\n" + p_Header.GetFrom() + "\n" + p_Header.GetTo() + "\n" +
+    p_Header.GetCc();
+}
+
+static std::string GetBodySearchText(Body& p_Body)
+{
+  // html-only messages are indexed by their converted text
+  const std::string& textPlain = p_Body.GetTextPlain();
+  return !textPlain.empty() ? textPlain : p_Body.GetTextFromHtml();
+}
+
+Imap::Imap(const std::string &p_User, const std::string &p_Pass, const std::string &p_Host,
+           const uint16_t p_Port, const bool p_CacheEncrypt,
+           const uint32_t p_PartialFetchSize, const bool p_Compress, const int p_Sessions)
+  : m_User(p_User)
+  , m_Pass(p_Pass)
+  , m_Host(p_Host)
+  , m_Port(p_Port)
+  , m_CacheEncrypt(p_CacheEncrypt)
+  , m_PartialFetchSize(p_PartialFetchSize)
+  , m_Compress(p_Compress)
+{
+  LOG_DEBUG_FUNC(STR(p_User, "***" /*p_Pass*/, p_Host, p_Port, p_CacheEncrypt,
+                     p_PartialFetchSize, p_Compress, p_Sessions));
+
+  for (int i = 0; i < std::max(p_Sessions, 1); ++i)
+  {
+    std::unique_ptr<Session> session(new Session());
+    session->m_Imap = LOG_IF_NULL(mailimap_new(0, NULL));
+    if (Log::GetTraceEnabled())
+    {
+      mailimap_set_logger(session->m_Imap, Logger, NULL);
+    }
+
+    m_Sessions.push_back(std::move(session));
+  }
+
+  InitCacheDir();
+  InitImapCacheDir();
+
+  if (m_CacheEncrypt)
+  {
+    m_CacheKey = Crypto::GetCacheKey(GetImapCacheDir(), m_Pass);
+  }
+}
+
+Imap::~Imap()
+{
+  LOG_DEBUG_FUNC(STR());
+
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    for (auto& envelopeIndex : m_EnvelopeIndexes)
+    {
+      SaveEnvelopeIndex(envelopeIndex.first, true);
+    }
+
+    for (auto& searchIndex : m_SearchIndexes)
+    {
+      SaveSearchIndex(searchIndex.first, true);
+    }
+  }
+
+  LOG_DEBUG("traffic %s", GetTrafficStats().c_str());
+
+  for (auto& session : m_Sessions)
+  {
+    if (session->m_Imap != NULL)
+    {
+      mailimap_free(session->m_Imap);
+      session->m_Imap = NULL;
+    }
+  }
+}
+
+bool Imap::Login(const int p_Session)
+{
+  LOG_DEBUG_FUNC(STR(p_Session));
+
+  Session& session = *m_Sessions.at(p_Session);
+
+  bool connected = false;
+
+  {
+    std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+    session.m_SelectedFolder.clear();
+    session.m_Compress = false;
+    int rv = LOG_IF_IMAP_ERR(mailimap_ssl_connect(session.m_Imap, m_Host.c_str(), m_Port));
+    if ((rv == MAILIMAP_NO_ERROR_AUTHENTICATED) || (rv == MAILIMAP_NO_ERROR_NON_AUTHENTICATED))
+    {
+      InitStreamCounters(session);
+    }
+
+    if (rv == MAILIMAP_NO_ERROR_AUTHENTICATED)
+    {
+      connected = true;
+    }
+    else if (rv == MAILIMAP_NO_ERROR_NON_AUTHENTICATED)
+    {
+      rv = LOG_IF_IMAP_ERR(mailimap_login(session.m_Imap, m_User.c_str(), m_Pass.c_str()));
+      connected = (rv == MAILIMAP_NO_ERROR);
+    }
+
+    if (connected)
+    {
+      EnableExtensions(session);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> connectedLock(m_ConnectedMutex);
+    session.m_Connected = connected;
+  }
+
+  if (connected)
+  {
+    // @todo: clear all cache if cannot use existing (cater for password change)
+  }
+
+  return connected;
+}
+
+bool Imap::Logout(const int p_Session)
+{
+  LOG_DEBUG_FUNC(STR(p_Session));
+
+  Session& session = *m_Sessions.at(p_Session);
+
+  std::lock_guard<std::mutex> connectedLock(m_ConnectedMutex);
+
+  int rv = MAILIMAP_NO_ERROR;
+  if (session.m_Connected)
+  {
+    std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+    if (session.m_Imap != NULL)
+    {
+      rv = LOG_IF_IMAP_LOGOUT_ERR(mailimap_logout(session.m_Imap));
+    }
+    session.m_SelectedFolder.clear();
+
+    session.m_Connected = false;
+  }
+
+  return ((rv == MAILIMAP_NO_ERROR) || (rv == MAILIMAP_ERROR_STREAM));
+}
+
+bool Imap::GetFolders(const bool p_Cached, std::set<std::string>& p_Folders,
+                      const int p_Session)
+{
+  LOG_DEBUG_FUNC(STR(p_Cached, p_Folders));
+  
+  Session& session = *m_Sessions.at(p_Session);
+
+  if (p_Cached)
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    p_Folders = Deserialize<std::set<std::string>>(ReadCacheFile(GetFoldersCachePath()));
+    return true;
+  }
+
+  clist* list = NULL;
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+  int rv = LOG_IF_IMAP_ERR(mailimap_list(session.m_Imap, "", "*", &list));
+  if (rv == MAILIMAP_NO_ERROR)
+  {
+    for (clistiter* it = clist_begin(list); it != NULL; it = it->next)
+    {
+      struct mailimap_mailbox_list* mblist = (struct mailimap_mailbox_list*)clist_content(it);
+      if (mblist)
+      {
+        mailimap_mbx_list_flags* bflags = mblist->mb_flag;
+        if (bflags)
+        {
+          if (!((bflags->mbf_type == MAILIMAP_MBX_LIST_FLAGS_SFLAG) &&
+                (bflags->mbf_sflag == MAILIMAP_MBX_LIST_SFLAG_NOSELECT)))
+          {
+            p_Folders.insert(std::string(mblist->mb_name));
+          }
+        }
+      }
+    }
+
+    mailimap_list_result_free(list);
+
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    WriteCacheFile(GetFoldersCachePath(), Serialize(p_Folders));
+
+    return true;
+  }
+
+  return false;
+}
+
+bool Imap::GetFolderStatuses(const bool p_Cached, const std::set<std::string>& p_Folders,
+                             std::map<std::string, FolderStatus>& p_Statuses,
+                             const int p_Session)
+{
+  LOG_DEBUG_FUNC(STR(p_Cached, p_Folders));
+
+  Session& session = *m_Sessions.at(p_Session);
+
+  if (p_Cached)
+  {
+    std::map<std::string, uint32_t> messages;
+    std::map<std::string, uint32_t> unseen;
+    std::map<std::string, uint32_t> uidNext;
+    {
+      std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+      Serialized serialized;
+      serialized.FromString(ReadCacheFile(GetFolderStatusesCachePath()));
+      serialized >> messages >> unseen >> uidNext;
+    }
+
+    for (auto& message : messages)
+    {
+      FolderStatus& status = p_Statuses[message.first];
+      status.m_Messages = message.second;
+      status.m_Unseen = unseen[message.first];
+      status.m_UidNext = uidNext[message.first];
+    }
+
+    return true;
+  }
+
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+  // STATUS should not be used for the selected folder (RFC 3501), so its message count is
+  // taken from the selection and its unseen count from a search
+  struct mailimap_selection_info* selectionInfo = session.m_Imap->imap_selection_info;
+  const bool hasSelected = (selectionInfo != NULL) && !session.m_SelectedFolder.empty() &&
+    (p_Folders.count(session.m_SelectedFolder) > 0);
+
+  std::vector<std::string> commands;
+  for (const auto& folder : p_Folders)
+  {
+    if (hasSelected && (folder == session.m_SelectedFolder)) continue;
+
+    commands.push_back("STATUS " + GetQuotedString(folder) + " (MESSAGES UNSEEN UIDNEXT)");
+  }
+
+  if (hasSelected)
+  {
+    commands.push_back("SEARCH UNSEEN");
+  }
+
+  std::vector<std::string> untagged;
+  std::vector<bool> results;
+  MMAPString* buffer = mmap_string_new("");
+  bool rv = SendPipelinedCommands(session.m_Imap->imap_stream, buffer, commands,
+                                  StatusPipelineDepth, untagged, results);
+  mmap_string_free(buffer);
+
+  if (!rv)
+  {
+    LOG_WARNING("status stream error");
+    return false;
+  }
+
+  uint32_t selectedUnseen = 0;
+  for (auto& line : untagged)
+  {
+    std::string folder;
+    FolderStatus status;
+    if (ParseStatusResponse(line, folder, status))
+    {
+      if (p_Folders.count(folder) > 0)
+      {
+        p_Statuses[folder] = status;
+      }
+      else
+      {
+        LOG_WARNING("unexpected status for %s", folder.c_str());
+      }
+    }
+    else if (!ParseSearchCount(line, selectedUnseen))
+    {
+      ApplyMailboxSizeResponse(line, selectionInfo);
+    }
+  }
+
+  if (hasSelected && results.back())
+  {
+    FolderStatus& status = p_Statuses[session.m_SelectedFolder];
+    status.m_Messages = selectionInfo->sel_exists;
+    status.m_Unseen = selectedUnseen;
+    status.m_UidNext = selectionInfo->sel_uidnext;
+  }
+
+  std::map<std::string, uint32_t> messages;
+  std::map<std::string, uint32_t> unseen;
+  std::map<std::string, uint32_t> uidNext;
+  for (auto& status : p_Statuses)
+  {
+    messages[status.first] = status.second.m_Messages;
+    unseen[status.first] = status.second.m_Unseen;
+    uidNext[status.first] = status.second.m_UidNext;
+  }
+
+  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+  Serialized serialized;
+  serialized << messages << unseen << uidNext;
+  WriteCacheFile(GetFolderStatusesCachePath(), serialized.ToString());
+
+  return true;
+}
+
+bool Imap::GetUids(const std::string &p_Folder, const bool p_Cached, std::set<uint32_t>& p_Uids,
+                   const int p_Session)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Cached, p_Uids));
+
+  Session& session = *m_Sessions.at(p_Session);
+
+  if (p_Cached)
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    p_Uids = Deserialize<std::set<uint32_t>>(ReadCacheFile(GetFolderUidsCachePath(p_Folder)));
+    return true;
+  }
+
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+  if (!SelectFolder(session, p_Folder, true))
+  {
+    return false;
+  }
+
+  if (SelectedFolderIsEmpty(session))
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    WriteCacheFile(GetFolderUidsCachePath(p_Folder), Serialize(p_Uids));
+    DeleteCacheExceptUids(p_Folder, p_Uids);
+    if (session.m_HighestModSeq != 0)
+    {
+      WriteCacheFile(GetFolderModSeqCachePath(p_Folder), Serialize(session.m_HighestModSeq));
+      m_SyncedFolders.insert(p_Folder);
+    }
+
+    return true;
+  }
+
+  if (session.m_HighestModSeq != 0)
+  {
+    return SyncUids(session, p_Folder, p_Uids);
+  }
+
+  struct mailimap_set* set = mailimap_set_new_interval(1, 0);
+  struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
+  clist* fetch_result = NULL;
+  
+  int rv = LOG_IF_IMAP_ERR(mailimap_fetch(session.m_Imap, set, fetch_type, &fetch_result));
+  if (rv == MAILIMAP_NO_ERROR)
+  {
+    for(clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
+    {
+      struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
+
+      for(clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
+      {
+        struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item *)clist_content(ait);
+        if (item->att_type != MAILIMAP_MSG_ATT_ITEM_STATIC) continue;
+
+        if (item->att_data.att_static->att_type != MAILIMAP_MSG_ATT_UID) continue;
+
+        p_Uids.insert(item->att_data.att_static->att_data.att_uid);
+        break;
+      }
+    }
+
+    mailimap_fetch_list_free(fetch_result);
+
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    WriteCacheFile(GetFolderUidsCachePath(p_Folder), Serialize(p_Uids));
+    DeleteCacheExceptUids(p_Folder, p_Uids);
+  }
+
+  mailimap_fetch_type_free(fetch_type);
+  mailimap_set_free(set);
+
+  return (rv == MAILIMAP_NO_ERROR);
+}
+
+bool Imap::GetHeaders(const std::string &p_Folder, const std::set<uint32_t> &p_Uids,
+                      const bool p_Cached, const bool p_Prefetch,
+                      std::map<uint32_t, Header>& p_Headers, const int p_Session)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Cached, p_Prefetch, p_Headers));
+
+  Session& session = *m_Sessions.at(p_Session);
+
+  std::set<uint32_t> fetchUids;
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    MessageStore& store = GetMessageStore(p_Folder);
+    std::set<uint32_t> cachedUids;
+    for (auto& uid : p_Uids)
+    {
+      if (store.Exists(uid, MessageStore::KindHeader))
+      {
+        cachedUids.insert(uid);
+      }
+      else if (!p_Cached)
+      {
+        fetchUids.insert(uid);
+      }
+    }
+
+    if (!p_Prefetch)
+    {
+      const std::map<uint32_t, std::string>& cacheDatas =
+        ReadCacheMessages(p_Folder, cachedUids, MessageStore::KindHeader);
+      for (auto& cacheData : cacheDatas)
+      {
+        if (!cacheData.second.empty())
+        {
+          Header header;
+          header.SetData(cacheData.second);
+          SetEnvelope(p_Folder, cacheData.first, header);
+          p_Headers[cacheData.first] = header;
+        }
+      }
+
+      SaveEnvelopeIndex(p_Folder, false);
+    }
+  }
+
+  if (p_Cached)
+  {
+    return true;
+  }
+
+  int rv = MAILIMAP_NO_ERROR;
+
+  if (!fetchUids.empty())
+  {
+    std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+    if (!SelectFolder(session, p_Folder))
+    {
+      return false;
+    }
+
+    struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+    mailimap_fetch_type_new_fetch_att_list_add(fetch_type,
+                                               mailimap_fetch_att_new_rfc822_header());
+    mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
+    
+    const std::vector<UidSet>& uidSets = UidSet(fetchUids).Split(MaxUidSetLength);
+    for (auto& uidSet : uidSets)
+    {
+      struct mailimap_set* set = NewUidSet(uidSet);
+      clist* fetch_result = NULL;
+      rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(session.m_Imap, set, fetch_type, &fetch_result));
+      mailimap_set_free(set);
+      if (rv != MAILIMAP_NO_ERROR) break;
+
+      for(clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
+      {
+        struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
+
+        uint32_t uid = 0;
+        Header header;
+        for(clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
+        {
+          struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item *)clist_content(ait);
+
+          if (item->att_type == MAILIMAP_MSG_ATT_ITEM_DYNAMIC) continue;
+
+          if (item->att_type == MAILIMAP_MSG_ATT_ITEM_STATIC)
+          {
+            if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_RFC822_HEADER)
+            {
+              std::string data(item->att_data.att_static->att_data.att_rfc822_header.att_content,
+                               item->att_data.att_static->att_data.att_rfc822_header.att_length);
+              header.SetData(data);
+            }
+
+            if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_UID)
+            {
+              uid = item->att_data.att_static->att_data.att_uid;
+            }
+          }
+        }
+
+        if (uid == 0)
+        {
+          LOG_WARNING("skip header uid = %d", uid);
+          continue;
+        }
+
+        if (header.GetData().empty())
+        {
+          LOG_WARNING("skip header = \"\"");
+          continue;
+        }
+
+        if (!p_Prefetch)
+        {
+          p_Headers[uid] = header;
+        }
+
+        std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+        WriteCacheMessage(p_Folder, uid, MessageStore::KindHeader, header.GetData());
+        SetEnvelope(p_Folder, uid, header);
+        GetSearchIndex(p_Folder).Add(uid, GetHeaderSearchText(header), false);
+      }
+    
+      mailimap_fetch_list_free(fetch_result);
+
+      std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+      SaveEnvelopeIndex(p_Folder, false);
+      SaveSearchIndex(p_Folder, false);
+    }
+
+    mailimap_fetch_type_free(fetch_type);
+  }
+
+  return (rv == MAILIMAP_NO_ERROR);
+}
+
+bool Imap::GetEnvelopes(const std::string &p_Folder, const std::set<uint32_t> &p_Uids,
+                        const bool p_Cached, std::map<uint32_t, Header>& p_Headers,
+                        const int p_Session)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Cached));
+
+  std::set<uint32_t> headerUids;
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    EnvelopeIndex& envelopeIndex = GetEnvelopeIndex(p_Folder);
+    for (auto& uid : p_Uids)
+    {
+      Envelope envelope;
+      if (envelopeIndex.Get(uid, envelope))
+      {
+        Header header;
+        header.SetEnvelope(envelope.m_TimeStamp, envelope.m_ShortFrom, envelope.m_Subject,
+                           envelope.m_MessageId, envelope.m_References);
+        p_Headers[uid] = header;
+      }
+      else
+      {
+        headerUids.insert(uid);
+      }
+    }
+  }
+
+  if (headerUids.empty())
+  {
+    return true;
+  }
+
+  return GetHeaders(p_Folder, headerUids, p_Cached, false /* p_Prefetch */, p_Headers, p_Session);
+}
+
+bool Imap::GetFlags(const std::string &p_Folder, const std::set<uint32_t> &p_Uids,
+                    const bool p_Cached, std::map<uint32_t, uint32_t>& p_Flags,
+                    const int p_Session)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Cached, p_Flags));
+
+  Session& session = *m_Sessions.at(p_Session);
+
+  if (p_Cached)
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    p_Flags = Deserialize<std::map<uint32_t, uint32_t>>(ReadCacheFile(GetFolderFlagsCachePath(p_Folder)));
+    return true;
+  }
+
+  // flags of folders synced by modseq are up-to-date in cache, only fetch missing ones
+  std::set<uint32_t> fetchUids;
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    if (m_SyncedFolders.find(p_Folder) != m_SyncedFolders.end())
+    {
+      const std::map<uint32_t, uint32_t>& cachedFlags =
+        Deserialize<std::map<uint32_t, uint32_t>>(ReadCacheFile(GetFolderFlagsCachePath(p_Folder)));
+      for (auto& uid : p_Uids)
+      {
+        auto it = cachedFlags.find(uid);
+        if (it != cachedFlags.end())
+        {
+          p_Flags[uid] = it->second;
+        }
+        else
+        {
+          fetchUids.insert(uid);
+        }
+      }
+    }
+    else
+    {
+      fetchUids = p_Uids;
+    }
+  }
+
+  if (fetchUids.empty())
+  {
+    return true;
+  }
+
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+  if (!SelectFolder(session, p_Folder))
+  {
+    return false;
+  }
+
+  struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_flags());
+
+  int rv = MAILIMAP_NO_ERROR;
+  const std::vector<UidSet>& uidSets = UidSet(fetchUids).Split(MaxUidSetLength);
+  for (auto& uidSet : uidSets)
+  {
+    struct mailimap_set* set = NewUidSet(uidSet);
+    clist* fetch_result = NULL;
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(session.m_Imap, set, fetch_type, &fetch_result));
+    mailimap_set_free(set);
+    if (rv != MAILIMAP_NO_ERROR) break;
+
+    ParseUidFlags(fetch_result, p_Flags);
+    mailimap_fetch_list_free(fetch_result);
+  }
+
+  if (rv == MAILIMAP_NO_ERROR)
+  {
+    std::map<uint32_t, uint32_t> newFlags = p_Flags;
+    std::map<uint32_t, uint32_t> oldFlags;
+
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    oldFlags = Deserialize<std::map<uint32_t, uint32_t>>(ReadCacheFile(GetFolderFlagsCachePath(p_Folder)));
+    newFlags.insert(oldFlags.begin(), oldFlags.end());
+    // cache combined flags of previously cached and newly fetched, in case requesting flags for not all messages
+    WriteCacheFile(GetFolderFlagsCachePath(p_Folder), Serialize(newFlags));
+  }
+
+  mailimap_fetch_type_free(fetch_type);
+
+  return (rv == MAILIMAP_NO_ERROR);
+}
+
+bool Imap::GetBodys(const std::string &p_Folder, const std::set<uint32_t> &p_Uids,
+                    const bool p_Cached, const bool p_Prefetch, const bool p_Full,
+                    std::map<uint32_t, Body>& p_Bodys, const int p_Session)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Cached, p_Prefetch, p_Full, p_Bodys));
+
+  Session& session = *m_Sessions.at(p_Session);
+
+  std::set<uint32_t> fetchUids;
+  std::map<uint32_t, std::string> cacheDatas;
+  std::map<uint32_t, std::string> parsedDatas;
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    MessageStore& store = GetMessageStore(p_Folder);
+    std::set<uint32_t> cachedUids;
+    std::set<uint32_t> partialUids;
+    for (auto& uid : p_Uids)
+    {
+      if (store.Exists(uid, MessageStore::KindBody))
+      {
+        cachedUids.insert(uid);
+      }
+      else if (store.Exists(uid, MessageStore::KindStructure) && (!p_Full || p_Cached))
+      {
+        partialUids.insert(uid);
+      }
+      else if (!p_Cached)
+      {
+        fetchUids.insert(uid);
+      }
+    }
+
+    if (!p_Prefetch)
+    {
+      cacheDatas = ReadCacheMessages(p_Folder, cachedUids, MessageStore::KindBody);
+      parsedDatas = ReadCacheMessages(p_Folder, cachedUids, MessageStore::KindParsed);
+
+      for (auto& uid : partialUids)
+      {
+        Body body;
+        if (ReadCachePartialBody(p_Folder, uid, body))
+        {
+          p_Bodys[uid] = body;
+        }
+      }
+    }
+  }
+
+  // messages parsed before are restored from their parsed data, others are parsed here,
+  // outside the cache lock, and their parsed data stored
+  std::map<uint32_t, std::string> newParsedDatas;
+  for (auto& cacheData : cacheDatas)
+  {
+    if (!cacheData.second.empty())
+    {
+      Body body;
+      body.SetData(cacheData.second);
+      auto parsedIt = parsedDatas.find(cacheData.first);
+      if ((parsedIt == parsedDatas.end()) || !body.SetParsedData(parsedIt->second))
+      {
+        newParsedDatas[cacheData.first] = body.GetParsedData();
+      }
+
+      p_Bodys[cacheData.first] = body;
+    }
+  }
+
+  if (!newParsedDatas.empty())
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    for (auto& newParsedData : newParsedDatas)
+    {
+      WriteCacheMessage(p_Folder, newParsedData.first, MessageStore::KindParsed,
+                        newParsedData.second);
+    }
+  }
+
+  if (p_Cached)
+  {
+    return true;
+  }
+
+  // large messages only get their text parts fetched here, unless the raw message is requested,
+  // remaining uids are fetched fully
+  if (!fetchUids.empty() && (m_PartialFetchSize > 0) && !p_Full)
+  {
+    if (!GetPartialBodys(session, p_Folder, fetchUids, p_Prefetch, p_Bodys))
+    {
+      return false;
+    }
+  }
+
+  int rv = MAILIMAP_NO_ERROR;
+  
+  if (!fetchUids.empty())
+  {
+    std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+    if (!SelectFolder(session, p_Folder))
+    {
+      return false;
+    }
+
+    struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+    struct mailimap_fetch_att* body_att =
+        mailimap_fetch_att_new_body_peek_section(mailimap_section_new(NULL));
+    mailimap_fetch_type_new_fetch_att_list_add(fetch_type, body_att);
+    mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
+
+    const std::vector<UidSet>& uidSets = UidSet(fetchUids).Split(MaxUidSetLength);
+    for (auto& uidSet : uidSets)
+    {
+      struct mailimap_set* set = NewUidSet(uidSet);
+      clist* fetch_result = NULL;
+      rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(session.m_Imap, set, fetch_type, &fetch_result));
+      mailimap_set_free(set);
+      if (rv != MAILIMAP_NO_ERROR) break;
+
+      for(clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
+      {
+        struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
+
+        uint32_t uid = 0;
+        Body body;
+        for(clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
+        {
+          struct mailimap_msg_att_item* item =
+            (struct mailimap_msg_att_item *) clist_content(ait);
+
+          if (item->att_type == MAILIMAP_MSG_ATT_ITEM_DYNAMIC) continue;
+
+          if (item->att_type == MAILIMAP_MSG_ATT_ITEM_STATIC)
+          {
+            if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_BODY_SECTION)
+            {
+              std::string data(item->att_data.att_static->att_data.att_body_section->sec_body_part,
+                               item->att_data.att_static->att_data.att_body_section->sec_length);
+              body.SetData(data);
+            }
+
+            if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_UID)
+            {
+              uid = item->att_data.att_static->att_data.att_uid;
+            }
+          }
+        }
+
+        if (uid == 0)
+        {
+          LOG_WARNING("skip body uid = %d", uid);
+          continue;
+        }
+
+        if (body.GetData().empty())
+        {
+          LOG_WARNING("skip body = \"\"");
+          continue;
+        }
+
+        // prefetched messages are parsed fully when first read from cache
+        const std::string& bodyText = GetBodySearchText(body);
+        const std::string& parsedData = p_Prefetch ? std::string() : body.GetParsedData();
+        if (!p_Prefetch)
+        {
+          p_Bodys[uid] = body;
+        }
+
+        std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+        WriteCacheMessage(p_Folder, uid, MessageStore::KindBody, body.GetData());
+        if (!parsedData.empty())
+        {
+          WriteCacheMessage(p_Folder, uid, MessageStore::KindParsed, parsedData);
+        }
+        GetSearchIndex(p_Folder).Add(uid, bodyText, true);
+      }
+
+      mailimap_fetch_list_free(fetch_result);
+
+      std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+      SaveSearchIndex(p_Folder, false);
+    }
+    mailimap_fetch_type_free(fetch_type);
+  }
+
+  return (rv == MAILIMAP_NO_ERROR);
+}
+
+bool Imap::GetBodyParts(const std::string& p_Folder,
+                        const std::map<uint32_t, std::set<ssize_t>>& p_Parts, const bool p_Cached,
+                        std::map<uint32_t, Body>& p_Bodys,
+                        const std::function<void(uint32_t)>& p_ProgressHandler,
+                        const int p_Session)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Parts, p_Cached));
+
+  Session& session = *m_Sessions.at(p_Session);
+
+  bool rv = true;
+  for (auto& uidParts : p_Parts)
+  {
+    const uint32_t uid = uidParts.first;
+    Body body;
+    {
+      // fully fetched messages have all their parts already
+      std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+      if (!ReadCachePartialBody(p_Folder, uid, body)) continue;
+    }
+
+    const std::set<ssize_t>& unfetchedParts = body.GetUnfetchedParts();
+    std::set<ssize_t> fetchParts;
+    std::set<ssize_t> streamParts;
+    for (auto& part : uidParts.second)
+    {
+      if (unfetchedParts.find(part) != unfetchedParts.end())
+      {
+        if (body.GetSections().at(part).m_Size > StreamPartSize)
+        {
+          streamParts.insert(part);
+        }
+        else
+        {
+          fetchParts.insert(part);
+        }
+      }
+    }
+
+    if (!p_Cached && (!fetchParts.empty() || !streamParts.empty()))
+    {
+      std::map<ssize_t, std::string> datas;
+      {
+        std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+        if (!SelectFolder(session, p_Folder))
+        {
+          return false;
+        }
+
+        rv = FetchBodyParts(session, uid, body.GetSections(), fetchParts, datas);
+
+        for (auto& part : streamParts)
+        {
+          if (!rv) break;
+
+          const std::string& path = GetPartCachePath(p_Folder, uid, part);
+          rv = StreamBodyPart(session, uid, body.GetSections().at(part), path,
+                              p_ProgressHandler);
+          if (rv)
+          {
+            body.SetSectionPath(part, path);
+          }
+        }
+      }
+
+      for (auto& data : datas)
+      {
+        body.SetSectionData(data.first, data.second);
+      }
+
+      std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+      WriteCacheBodyParts(p_Folder, uid, datas);
+    }
+
+    p_Bodys[uid] = body;
+
+    if (!rv) break;
+  }
+
+  return rv;
+}
+
+bool Imap::Search(const std::string &p_Folder, const std::string &p_Query, const bool p_Cached,
+                  std::set<uint32_t>& p_Uids, const int p_Session)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Query, p_Cached));
+
+  Session& session = *m_Sessions.at(p_Session);
+
+  IndexCachedMessages(p_Folder);
+
+  std::set<uint32_t> searchUids;
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    SearchIndex& searchIndex = GetSearchIndex(p_Folder);
+    p_Uids = searchIndex.Search(p_Query);
+    if (!p_Cached)
+    {
+      const std::set<uint32_t>& uids =
+        Deserialize<std::set<uint32_t>>(ReadCacheFile(GetFolderUidsCachePath(p_Folder)));
+      const std::set<uint32_t>& indexedUids = searchIndex.GetIndexed(true /* p_IsBody */);
+      std::set_difference(uids.begin(), uids.end(), indexedUids.begin(), indexedUids.end(),
+                          std::inserter(searchUids, searchUids.begin()));
+    }
+  }
+
+  if (p_Cached || searchUids.empty())
   {
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-    p_Flags = Deserialize<std::map<uint32_t, uint32_t>>(ReadCacheFile(GetFolderFlagsCachePath(p_Folder)));
     return true;
   }
 
-  if (p_Uids.empty())
+  // messages without locally indexed body are searched on server
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+  if (!SelectFolder(session, p_Folder))
+  {
+    return false;
+  }
+
+  int rv = MAILIMAP_NO_ERROR;
+  const std::vector<std::string>& words = Util::Split(p_Query, ' ');
+  const std::vector<UidSet>& uidSets = UidSet(searchUids).Split(MaxUidSetLength);
+  for (auto& uidSet : uidSets)
+  {
+    struct mailimap_search_key* key = mailimap_search_key_new_multiple_empty();
+    mailimap_search_key_multiple_add(key, mailimap_search_key_new_uid(NewUidSet(uidSet)));
+    for (auto& word : words)
+    {
+      if (word.empty()) continue;
+
+      mailimap_search_key_multiple_add(key, mailimap_search_key_new_text(strdup(word.c_str())));
+    }
+
+    clist* search_result = NULL;
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_search(session.m_Imap, "UTF-8", key, &search_result));
+    if (rv == MAILIMAP_NO_ERROR)
+    {
+      for (clistiter* it = clist_begin(search_result); it != NULL; it = clist_next(it))
+      {
+        uint32_t* uid = (uint32_t*)clist_content(it);
+        p_Uids.insert(*uid);
+      }
+
+      mailimap_search_result_free(search_result);
+    }
+
+    mailimap_search_key_free(key);
+    if (rv != MAILIMAP_NO_ERROR) break;
+  }
+
+  return (rv == MAILIMAP_NO_ERROR);
+}
+
+bool Imap::SetFlagSeen(const std::string &p_Folder, const std::set<uint32_t> &p_Uids,
+                       bool p_Value)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Value));
+
+  Session& session = *m_Sessions.at(0);
+
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+  if (!SelectFolder(session, p_Folder))
+  {
+    return false;
+  }
+
+  struct mailimap_flag_list* flaglist = mailimap_flag_list_new_empty();
+  mailimap_flag_list_add(flaglist, mailimap_flag_new_seen());
+
+  struct mailimap_store_att_flags* storeflags = p_Value
+    ? mailimap_store_att_flags_new_add_flags(flaglist)
+    : mailimap_store_att_flags_new_remove_flags(flaglist);
+
+  int rv = MAILIMAP_NO_ERROR;
+  const std::vector<UidSet>& uidSets = UidSet(p_Uids).Split(MaxUidSetLength);
+  for (auto& uidSet : uidSets)
+  {
+    struct mailimap_set* set = NewUidSet(uidSet);
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_store(session.m_Imap, set, storeflags));
+    mailimap_set_free(set);
+    if (rv != MAILIMAP_NO_ERROR) break;
+  }
+
+  if (storeflags != NULL)
+  {
+    mailimap_store_att_flags_free(storeflags);
+  }
+
+  if (rv == MAILIMAP_NO_ERROR)
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    std::map<uint32_t, uint32_t> flags =
+      Deserialize<std::map<uint32_t, uint32_t>>(ReadCacheFile(GetFolderFlagsCachePath(p_Folder)));
+    for (auto& uid : p_Uids)
+    {
+      if (p_Value)
+      {
+        flags[uid] |= Flag::Seen;
+      }
+      else
+      {
+        flags[uid] &= ~Flag::Seen;
+      }
+    }
+
+    WriteCacheFile(GetFolderFlagsCachePath(p_Folder), Serialize(flags));
+  }
+  
+  return (rv == MAILIMAP_NO_ERROR);
+}
+
+bool Imap::SetFlagDeleted(const std::string &p_Folder, const std::set<uint32_t> &p_Uids,
+                          bool p_Value)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Value));
+  
+  Session& session = *m_Sessions.at(0);
+
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+  if (!SelectFolder(session, p_Folder))
+  {
+    return false;
+  }
+
+  struct mailimap_flag_list* flaglist = mailimap_flag_list_new_empty();
+  mailimap_flag_list_add(flaglist, mailimap_flag_new_deleted());
+
+  struct mailimap_store_att_flags* storeflags = p_Value
+    ? mailimap_store_att_flags_new_add_flags(flaglist)
+    : mailimap_store_att_flags_new_remove_flags(flaglist);
+
+  int rv = MAILIMAP_NO_ERROR;
+  const std::vector<UidSet>& uidSets = UidSet(p_Uids).Split(MaxUidSetLength);
+  for (auto& uidSet : uidSets)
   {
-    return true;
+    struct mailimap_set* set = NewUidSet(uidSet);
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_store(session.m_Imap, set, storeflags));
+    mailimap_set_free(set);
+    if (rv != MAILIMAP_NO_ERROR) break;
   }
 
-  struct mailimap_set* set = mailimap_set_new_empty();
-  for (auto& uid : p_Uids)
+  if (storeflags != NULL)
   {
-    mailimap_set_add_single(set, uid);
+    mailimap_store_att_flags_free(storeflags);
   }
 
-  std::lock_guard<std::mutex> imapLock(m_ImapMutex);
+  return (rv == MAILIMAP_NO_ERROR);
+}
+
+bool Imap::MoveMessages(const std::string &p_Folder, const std::set<uint32_t> &p_Uids,
+                        const std::string &p_DestFolder)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_DestFolder));
+
+  Session& session = *m_Sessions.at(0);
 
-  if (!SelectFolder(p_Folder))
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+  if (!SelectFolder(session, p_Folder))
+  {
+    return false;
+  }
+
+  int rv = MAILIMAP_NO_ERROR;
+  const std::vector<UidSet>& uidSets = UidSet(p_Uids).Split(MaxUidSetLength);
+  for (auto& uidSet : uidSets)
   {
+    struct mailimap_set* set = NewUidSet(uidSet);
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_move(session.m_Imap, set, p_DestFolder.c_str()));
     mailimap_set_free(set);
+    if (rv != MAILIMAP_NO_ERROR) break;
+  }
+
+  if (rv == MAILIMAP_NO_ERROR)
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    std::set<uint32_t> uids =
+      Deserialize<std::set<uint32_t>>(ReadCacheFile(GetFolderUidsCachePath(p_Folder)));
+    MessageStore& store = GetMessageStore(p_Folder);
+    EnvelopeIndex& envelopeIndex = GetEnvelopeIndex(p_Folder);
+    SearchIndex& searchIndex = GetSearchIndex(p_Folder);
+    for (auto& uid : p_Uids)
+    {
+      uids.erase(uid);
+      store.Remove(uid);
+      envelopeIndex.Remove(uid);
+      searchIndex.Remove(uid);
+    }
+
+    SaveEnvelopeIndex(p_Folder, false);
+    SaveSearchIndex(p_Folder, false);
+    
+    WriteCacheFile(GetFolderUidsCachePath(p_Folder), Serialize(uids));
+  }
+
+  return (rv == MAILIMAP_NO_ERROR);
+}
+
+bool Imap::DeleteMessages(const std::string &p_Folder, const std::set<uint32_t> &p_Uids)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids));
+
+  Session& session = *m_Sessions.at(0);
+
+  bool rv = true;
+  rv &= SetFlagDeleted(p_Folder, p_Uids, true);
+
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+  rv &= (LOG_IF_IMAP_ERR(mailimap_expunge(session.m_Imap)) == MAILIMAP_NO_ERROR);
+  return rv;
+}
+
+bool Imap::CheckConnection(const int p_Session)
+{
+  LOG_DEBUG_FUNC(STR(p_Session));
+
+  Session& session = *m_Sessions.at(p_Session);
+
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+  bool rv = true;
+  rv &= (LOG_IF_IMAP_ERR(mailimap_noop(session.m_Imap)) == MAILIMAP_NO_ERROR);
+  return rv;
+}
+
+int Imap::GetSessionCount() const
+{
+  return m_Sessions.size();
+}
+
+bool Imap::GetConnected()
+{
+  std::lock_guard<std::mutex> connectedLock(m_ConnectedMutex);
+  return m_Sessions.at(0)->m_Connected;
+}
+
+int Imap::IdleStart(const std::string& p_Folder)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder));
+
+  Session& session = *m_Sessions.at(0);
+
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+  if (!SelectFolder(session, p_Folder))
+  {
+    return -1;
+  }
+
+  int rv = LOG_IF_IMAP_ERR(mailimap_idle(session.m_Imap));
+  if (rv == MAILIMAP_NO_ERROR)
+  {
+    int fd = mailimap_idle_get_fd(session.m_Imap);
+    return fd;
+  }
+
+  return -1;
+}
+
+bool Imap::IdleDone(std::set<uint32_t>& p_Uids, std::map<uint32_t, uint32_t>& p_Flags)
+{
+  LOG_DEBUG_FUNC(STR());
+
+  Session& session = *m_Sessions.at(0);
+
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+  int rv = LOG_IF_IMAP_ERR(mailimap_idle_done(session.m_Imap));
+  if (rv != MAILIMAP_NO_ERROR)
+  {
     return false;
   }
 
+  return ApplyIdleResponses(session, p_Uids, p_Flags);
+}
+
+std::string Imap::GetTrafficStats()
+{
+  const uint64_t wireRead = m_WireCounters.m_Read;
+  const uint64_t wireWritten = m_WireCounters.m_Written;
+  const uint64_t logicalRead = m_LogicalCounters.m_Read;
+  const uint64_t logicalWritten = m_LogicalCounters.m_Written;
+  const uint64_t wireTotal = wireRead + wireWritten;
+  const uint64_t logicalTotal = logicalRead + logicalWritten;
+  const uint64_t ratio = (logicalTotal > 0) ? ((wireTotal * 100) / logicalTotal) : 100;
+
+  return "wire rx " + std::to_string(wireRead) + " tx " + std::to_string(wireWritten) +
+    " logical rx " + std::to_string(logicalRead) + " tx " + std::to_string(logicalWritten) +
+    " ratio " + std::to_string(ratio) + "%";
+}
+
+bool Imap::UploadMessage(const std::string& p_Folder, const std::string& p_Msg, bool p_IsDraft)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, "***", p_IsDraft));
+  LOG_TRACE_FUNC(STR(p_Folder, p_Msg, p_IsDraft));
+
+  Session& session = *m_Sessions.at(0);
+
+  struct mailimap_flag_list* flaglist = mailimap_flag_list_new_empty();
+  mailimap_flag_list_add(flaglist, mailimap_flag_new_seen());
+
+  if (p_IsDraft)
+  {
+    mailimap_flag_list_add(flaglist, mailimap_flag_new_draft());
+  }
+
+  time_t nowtime = time(NULL);
+  struct tm* lt = localtime(&nowtime);
+  
+  struct mailimap_date_time* datetime =
+    mailimap_date_time_new(lt->tm_mday, (lt->tm_mon + 1), (lt->tm_year + 1900),
+                           lt->tm_hour, lt->tm_min, lt->tm_sec, 0 /* dt_zone */);
+
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+  bool rv = (LOG_IF_IMAP_ERR(mailimap_append(session.m_Imap, p_Folder.c_str(), flaglist, datetime,
+                                             p_Msg.c_str(), p_Msg.size())) == MAILIMAP_NO_ERROR);
+
+  mailimap_date_time_free(datetime);
+
+  return rv;
+}
+
+bool Imap::UploadMessages(const std::string& p_Folder, const std::vector<std::string>& p_Msgs,
+                          std::vector<bool>& p_Results)
+{
+  LOG_DEBUG_FUNC(STR(p_Folder, p_Msgs.size()));
+
+  Session& session = *m_Sessions.at(0);
+
+  std::lock_guard<std::mutex> imapLock(session.m_Mutex);
+
+  p_Results.assign(p_Msgs.size(), false);
+  char multiAppendName[] = "MULTIAPPEND";
+  char literalPlusName[] = "LITERAL+";
+  const bool multiAppend = mailimap_has_extension(session.m_Imap, multiAppendName);
+  const bool literalPlus = mailimap_has_extension(session.m_Imap, literalPlusName);
+  LOG_DEBUG("multiappend = %d literalplus = %d", multiAppend, literalPlus);
+
+  if (!multiAppend && !literalPlus)
+  {
+    return AppendMessages(session, p_Folder, p_Msgs, p_Results);
+  }
+
+  // group messages into commands, one per message unless multiappend is supported
+  std::vector<std::vector<size_t>> commands;
+  size_t commandSize = 0;
+  for (size_t i = 0; i < p_Msgs.size(); ++i)
+  {
+    if (commands.empty() || !multiAppend || (commands.back().size() >= AppendMaxCount) ||
+        ((commandSize + p_Msgs.at(i).size()) > AppendMaxSize))
+    {
+      commands.push_back(std::vector<size_t>());
+      commandSize = 0;
+    }
+
+    commands.back().push_back(i);
+    commandSize += p_Msgs.at(i).size();
+  }
+
+  mailstream* stream = session.m_Imap->imap_stream;
+  MMAPString* buffer = mmap_string_new("");
+  bool rv = SendAppendCommands(stream, buffer, p_Folder, p_Msgs, commands, literalPlus, p_Results);
+  if (rv && multiAppend)
+  {
+    // a rejected multiappend fails all its messages, so retry them one by one
+    std::vector<std::vector<size_t>> retryCommands;
+    for (auto& command : commands)
+    {
+      for (auto& index : command)
+      {
+        if ((command.size() > 1) && !p_Results.at(index))
+        {
+          retryCommands.push_back(std::vector<size_t>(1, index));
+        }
+      }
+    }
+
+    if (!retryCommands.empty())
+    {
+      rv = SendAppendCommands(stream, buffer, p_Folder, p_Msgs, retryCommands, literalPlus,
+                              p_Results);
+    }
+  }
+
+  mmap_string_free(buffer);
+
+  if (!rv)
+  {
+    LOG_WARNING("append stream error");
+  }
+
+  return rv;
+}
+
+bool Imap::AppendMessages(Session& p_Session, const std::string& p_Folder,
+                          const std::vector<std::string>& p_Msgs, std::vector<bool>& p_Results)
+{
+  bool rv = true;
+  for (size_t i = 0; rv && (i < p_Msgs.size()); ++i)
+  {
+    const std::string& msg = p_Msgs.at(i);
+    struct mailimap_flag_list* flaglist = mailimap_flag_list_new_empty();
+    mailimap_flag_list_add(flaglist, mailimap_flag_new_seen());
+
+    struct mailimap_date_time* datetime = NULL;
+    const time_t msgTime = GetMessageTime(msg);
+    if (msgTime != 0)
+    {
+      struct tm gt;
+      gmtime_r(&msgTime, &gt);
+      datetime = mailimap_date_time_new(gt.tm_mday, (gt.tm_mon + 1), (gt.tm_year + 1900),
+                                        gt.tm_hour, gt.tm_min, gt.tm_sec, 0 /* dt_zone */);
+    }
+
+    const int appendRv = LOG_IF_IMAP_ERR(mailimap_append(p_Session.m_Imap, p_Folder.c_str(),
+                                                         flaglist, datetime, msg.c_str(),
+                                                         msg.size()));
+    p_Results[i] = (appendRv == MAILIMAP_NO_ERROR);
+    rv = (appendRv != MAILIMAP_ERROR_STREAM);
+
+    mailimap_flag_list_free(flaglist);
+    if (datetime != NULL)
+    {
+      mailimap_date_time_free(datetime);
+    }
+  }
+
+  return rv;
+}
+
+void Imap::InitStreamCounters(Session& p_Session)
+{
+  mailstream* stream = p_Session.m_Imap->imap_stream;
+  mailstream_low* wireLow = CountingStream::Open(mailstream_get_low(stream), &m_WireCounters);
+  if (wireLow == NULL)
+  {
+    LOG_WARNING("failed to add wire counter");
+    return;
+  }
+
+  mailstream_low* logicalLow = CountingStream::Open(wireLow, &m_LogicalCounters);
+  if (logicalLow == NULL)
+  {
+    LOG_WARNING("failed to add logical counter");
+    mailstream_set_low(stream, wireLow);
+    return;
+  }
+
+  mailstream_set_low(stream, logicalLow);
+}
+
+void Imap::EnableCompress(Session& p_Session)
+{
+  if (!m_Compress || !mailimap_has_compress_deflate(p_Session.m_Imap)) return;
+
+  // insert the compression layer between the logical and wire counters
+  mailstream* stream = p_Session.m_Imap->imap_stream;
+  mailstream_low* logicalLow = mailstream_get_low(stream);
+  mailstream_set_low(stream, CountingStream::GetLow(logicalLow));
+  int rv = LOG_IF_IMAP_ERR(mailimap_compress(p_Session.m_Imap));
+  CountingStream::SetLow(logicalLow, mailstream_get_low(stream));
+  mailstream_set_low(stream, logicalLow);
+
+  p_Session.m_Compress = (rv == MAILIMAP_NO_ERROR);
+  LOG_DEBUG("compress = %d", p_Session.m_Compress);
+}
+
+void Imap::EnableExtensions(Session& p_Session)
+{
+  p_Session.m_Condstore = false;
+  p_Session.m_Qresync = false;
+  p_Session.m_HighestModSeq = 0;
+
+  // refresh capabilities, as servers may advertise more after login
+  struct mailimap_capability_data* cap_data = NULL;
+  if (LOG_IF_IMAP_ERR(mailimap_capability(p_Session.m_Imap, &cap_data)) == MAILIMAP_NO_ERROR)
+  {
+    mailimap_capability_data_free(cap_data);
+  }
+
+  // compress first, so remaining commands benefit from it
+  EnableCompress(p_Session);
+
+  if (mailimap_has_qresync(p_Session.m_Imap))
+  {
+    clist* cap_list = clist_new();
+    clist_append(cap_list, mailimap_capability_new(MAILIMAP_CAPABILITY_NAME, NULL, strdup("QRESYNC")));
+    struct mailimap_capability_data* caps = mailimap_capability_data_new(cap_list);
+    struct mailimap_capability_data* result = NULL;
+    int rv = LOG_IF_IMAP_ERR(mailimap_enable(p_Session.m_Imap, caps, &result));
+    p_Session.m_Qresync = (rv == MAILIMAP_NO_ERROR);
+    mailimap_capability_data_free(caps);
+    if (result != NULL)
+    {
+      mailimap_capability_data_free(result);
+    }
+  }
+
+  p_Session.m_Condstore = p_Session.m_Qresync || mailimap_has_condstore(p_Session.m_Imap);
+  LOG_DEBUG("condstore = %d qresync = %d", p_Session.m_Condstore, p_Session.m_Qresync);
+}
+
+bool Imap::SyncUids(Session& p_Session, const std::string& p_Folder, std::set<uint32_t>& p_Uids)
+{
+  uint64_t modSeq = 0;
+  std::set<uint32_t> uids;
+  std::map<uint32_t, uint32_t> flags;
+
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    modSeq = Deserialize<uint64_t>(ReadCacheFile(GetFolderModSeqCachePath(p_Folder)));
+    if (modSeq != 0)
+    {
+      uids = Deserialize<std::set<uint32_t>>(ReadCacheFile(GetFolderUidsCachePath(p_Folder)));
+      flags = Deserialize<std::map<uint32_t, uint32_t>>(ReadCacheFile(GetFolderFlagsCachePath(p_Folder)));
+    }
+  }
+
+  bool synced = false;
+  if ((modSeq != 0) && !uids.empty())
+  {
+    if ((modSeq == p_Session.m_HighestModSeq) &&
+        (uids.size() == p_Session.m_Imap->imap_selection_info->sel_exists))
+    {
+      std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+      m_SyncedFolders.insert(p_Folder);
+      p_Uids = uids;
+      return true;
+    }
+
+    std::map<uint32_t, uint32_t> changedFlags;
+    std::set<uint32_t> vanishedUids;
+    if (FetchUidFlags(p_Session, modSeq, changedFlags, vanishedUids, uids))
+    {
+      for (auto& uid : vanishedUids)
+      {
+        uids.erase(uid);
+        flags.erase(uid);
+      }
+
+      for (auto& flag : changedFlags)
+      {
+        uids.insert(flag.first);
+        flags[flag.first] = flag.second;
+      }
+
+      // expunges are only reported with qresync, otherwise detected by message count
+      synced = (uids.size() == p_Session.m_Imap->imap_selection_info->sel_exists);
+    }
+
+    LOG_DEBUG("folder %s delta sync %s", p_Folder.c_str(), synced ? "ok" : "failed");
+  }
+
+  if (!synced)
+  {
+    uids.clear();
+    flags.clear();
+    std::set<uint32_t> vanishedUids;
+    if (!FetchUidFlags(p_Session, 0, flags, vanishedUids, uids))
+    {
+      return false;
+    }
+
+    for (auto& flag : flags)
+    {
+      uids.insert(flag.first);
+    }
+  }
+
+  p_Uids = uids;
+
+  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+  WriteCacheFile(GetFolderUidsCachePath(p_Folder), Serialize(uids));
+  WriteCacheFile(GetFolderFlagsCachePath(p_Folder), Serialize(flags));
+  WriteCacheFile(GetFolderModSeqCachePath(p_Folder), Serialize(p_Session.m_HighestModSeq));
+  DeleteCacheExceptUids(p_Folder, uids);
+  m_SyncedFolders.insert(p_Folder);
+
+  return true;
+}
+
+bool Imap::FetchUidFlags(Session& p_Session, uint64_t p_ChangedSince,
+                         std::map<uint32_t, uint32_t>& p_Flags, std::set<uint32_t>& p_Vanished,
+                         const std::set<uint32_t>& p_KnownUids)
+{
+  struct mailimap_set* set = mailimap_set_new_interval(1, 0);
   struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
   mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
   mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_flags());
 
   clist* fetch_result = NULL;
+  struct mailimap_qresync_vanished* vanished = NULL;
+
+  int rv = MAILIMAP_NO_ERROR;
+  if (p_ChangedSince == 0)
+  {
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(p_Session.m_Imap, set, fetch_type, &fetch_result));
+  }
+  else if (p_Session.m_Qresync)
+  {
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch_qresync(p_Session.m_Imap, set, fetch_type,
+                                                    p_ChangedSince, &fetch_result, &vanished));
+  }
+  else
+  {
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch_changedsince(p_Session.m_Imap, set, fetch_type,
+                                                         p_ChangedSince, &fetch_result));
+  }
 
-  int rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(m_Imap, set, fetch_type, &fetch_result));
   if (rv == MAILIMAP_NO_ERROR)
   {
-    for (clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
-    {
-      struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
+    ParseUidFlags(fetch_result, p_Flags);
+    mailimap_fetch_list_free(fetch_result);
 
-      uint32_t uid = 0;
-      uint32_t flag = 0;
-      for (clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
+    if ((vanished != NULL) && (vanished->qr_known_uids != NULL))
+    {
+      // vanished ranges may span uids never seen by us, only match against known
+      for (clistiter* it = clist_begin(vanished->qr_known_uids->set_list); it != NULL;
+           it = clist_next(it))
       {
-        struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item *)clist_content(ait);
-
-        if (item->att_type == MAILIMAP_MSG_ATT_ITEM_DYNAMIC)
+        struct mailimap_set_item* item = (struct mailimap_set_item*)clist_content(it);
+        uint32_t first = std::min(item->set_first, item->set_last);
+        uint32_t last = std::max(item->set_first, item->set_last);
+        if ((item->set_first == 0) || (item->set_last == 0))
         {
-          if (item->att_data.att_dyn->att_list != NULL)
-          {
-            for (clistiter* dit = clist_begin(item->att_data.att_dyn->att_list); dit != NULL;
-                 dit = clist_next(dit))
-            {
-              struct mailimap_flag_fetch* flag_fetch =
-                (struct mailimap_flag_fetch*) clist_content(dit);
-              if (flag_fetch && flag_fetch->fl_flag)
-              {
-                switch (flag_fetch->fl_flag->fl_type)
-                {
-                  case MAILIMAP_FLAG_SEEN:
-                    flag |= Flag::Seen;
-                    break;
-
-                  default:
-                    break;
-                }
-              }
-            }
-          }
+          first = std::max(item->set_first, item->set_last);
+          last = UINT32_MAX;
         }
-        else if (item->att_type == MAILIMAP_MSG_ATT_ITEM_STATIC)
+
+        for (auto uid = p_KnownUids.lower_bound(first);
+             (uid != p_KnownUids.end()) && (*uid <= last); ++uid)
         {
-          if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_UID)
-          {
-            uid = item->att_data.att_static->att_data.att_uid;
-          }
+          p_Vanished.insert(*uid);
         }
       }
-
-      if (uid == 0)
-      {
-        LOG_WARNING("skip flag uid = %d", uid);
-        continue;
-      }
-
-      p_Flags[uid] = flag;
     }
+  }
 
-    mailimap_fetch_list_free(fetch_result);
-
-    std::map<uint32_t, uint32_t> newFlags = p_Flags;
-    std::map<uint32_t, uint32_t> oldFlags;
-
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-    oldFlags = Deserialize<std::map<uint32_t, uint32_t>>(ReadCacheFile(GetFolderFlagsCachePath(p_Folder)));
-    newFlags.insert(oldFlags.begin(), oldFlags.end());
-    // cache combined flags of previously cached and newly fetched, in case requesting flags for not all messages
-    WriteCacheFile(GetFolderFlagsCachePath(p_Folder), Serialize(newFlags));
+  if (vanished != NULL)
+  {
+    mailimap_qresync_vanished_free(vanished);
   }
 
   mailimap_fetch_type_free(fetch_type);
@@ -448,374 +2275,447 @@ bool Imap::GetFlags(const std::string &p_Folder, const std::set<uint32_t> &p_Uid
   return (rv == MAILIMAP_NO_ERROR);
 }
 
-bool Imap::GetBodys(const std::string &p_Folder, const std::set<uint32_t> &p_Uids,
-                    const bool p_Cached, const bool p_Prefetch,
-                    std::map<uint32_t, Body>& p_Bodys)
+bool Imap::ApplyIdleResponses(Session& p_Session, std::set<uint32_t>& p_Uids,
+                              std::map<uint32_t, uint32_t>& p_Flags)
 {
-  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Cached, p_Prefetch, p_Bodys));
+  const std::string folder = p_Session.m_SelectedFolder;
+  struct mailimap_response_info* info = p_Session.m_Imap->imap_response_info;
+  if (folder.empty() || (info == NULL))
+  {
+    return false;
+  }
 
-  bool needFetch = false;
-  struct mailimap_set* set = mailimap_set_new_empty();
-  for (auto& uid : p_Uids)
+  // cached uids in ascending order, i.e. indexed by message sequence number - 1
+  std::vector<uint32_t> uids;
   {
-    bool cacheFound = false;
     std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-    const std::string& cachePath = GetBodyCachePath(p_Folder, uid);
-    if (Util::NotEmpty(cachePath))
+    const std::set<uint32_t>& cachedUids =
+      Deserialize<std::set<uint32_t>>(ReadCacheFile(GetFolderUidsCachePath(folder)));
+    uids.assign(cachedUids.begin(), cachedUids.end());
+  }
+
+  // each expunge renumbers the messages after it, so apply them in order
+  bool hasExpunged = false;
+  for (clistiter* it = clist_begin(info->rsp_expunged); it != NULL; it = clist_next(it))
+  {
+    const uint32_t seq = *((uint32_t*)clist_content(it));
+    if ((seq == 0) || (seq > uids.size()))
     {
-      cacheFound = true;
-      if (!p_Prefetch)
-      {
-        const std::string& cacheData = ReadCacheFile(cachePath);
-        if (!cacheData.empty())
-        {
-          Body body;
-          body.SetData(cacheData);
-          Util::Touch(cachePath);
-          p_Bodys[uid] = body;
-        }
-      }
+      LOG_DEBUG("idle expunge %d out of range", seq);
+      return false;
     }
 
-    if (!cacheFound)
+    uids.erase(uids.begin() + (seq - 1));
+    hasExpunged = true;
+  }
+
+  // with qresync enabled expunged messages are reported as vanished uids
+  for (clistiter* it = clist_begin(info->rsp_extension_list); it != NULL; it = clist_next(it))
+  {
+    struct mailimap_extension_data* ext_data = (struct mailimap_extension_data*)clist_content(it);
+    if ((ext_data->ext_extension->ext_id != MAILIMAP_EXTENSION_QRESYNC) ||
+        (ext_data->ext_type != MAILIMAP_QRESYNC_TYPE_VANISHED)) continue;
+
+    struct mailimap_qresync_vanished* vanished = (struct mailimap_qresync_vanished*)ext_data->ext_data;
+    if ((vanished == NULL) || (vanished->qr_known_uids == NULL)) continue;
+
+    for (clistiter* sit = clist_begin(vanished->qr_known_uids->set_list); sit != NULL;
+         sit = clist_next(sit))
     {
-      if (!p_Cached)
+      struct mailimap_set_item* item = (struct mailimap_set_item*)clist_content(sit);
+      uint32_t first = std::min(item->set_first, item->set_last);
+      uint32_t last = std::max(item->set_first, item->set_last);
+      if ((item->set_first == 0) || (item->set_last == 0))
       {
-        mailimap_set_add_single(set, uid);
-        needFetch = true;
+        first = std::max(item->set_first, item->set_last);
+        last = UINT32_MAX;
       }
+
+      auto begin = std::lower_bound(uids.begin(), uids.end(), first);
+      auto end = std::upper_bound(begin, uids.end(), last);
+      uids.erase(begin, end);
     }
   }
 
-  if (p_Cached)
+  for (clistiter* it = clist_begin(info->rsp_fetch_list); it != NULL; it = clist_next(it))
   {
-    mailimap_set_free(set);
-    return true;
-  }
+    struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
 
-  int rv = MAILIMAP_NO_ERROR;
-  
-  if (needFetch)
-  {
-    std::lock_guard<std::mutex> imapLock(m_ImapMutex);
+    uint32_t uid = 0;
+    uint32_t flag = 0;
+    if (!ParseMsgAttFlags(msg_att, uid, flag)) continue;
 
-    if (!SelectFolder(p_Folder))
+    if (uid == 0)
     {
-      mailimap_set_free(set);
-      return false;
+      // sequence numbers are ambiguous when interleaved with expunges
+      if (hasExpunged)
+      {
+        LOG_DEBUG("idle fetch without uid after expunge");
+        return false;
+      }
+
+      // messages beyond the cached ones are fetched below
+      if ((msg_att->att_number == 0) || (msg_att->att_number > uids.size())) continue;
+
+      uid = uids.at(msg_att->att_number - 1);
     }
 
+    p_Flags[uid] = flag;
+  }
+
+  const uint32_t exists = p_Session.m_Imap->imap_selection_info->sel_exists;
+  if (exists > uids.size())
+  {
+    struct mailimap_set* set = mailimap_set_new_interval(uids.size() + 1, 0);
     struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
-    struct mailimap_fetch_att* body_att =
-        mailimap_fetch_att_new_body_peek_section(mailimap_section_new(NULL));
-    mailimap_fetch_type_new_fetch_att_list_add(fetch_type, body_att);
     mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
-
+    mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_flags());
     clist* fetch_result = NULL;
-    
-    rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(m_Imap, set, fetch_type, &fetch_result));
+
+    std::map<uint32_t, uint32_t> newFlags;
+    int rv = LOG_IF_IMAP_ERR(mailimap_fetch(p_Session.m_Imap, set, fetch_type, &fetch_result));
     if (rv == MAILIMAP_NO_ERROR)
     {
-      for(clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
-      {
-        struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
-
-        uint32_t uid = 0;
-        Body body;
-        for(clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
-        {
-          struct mailimap_msg_att_item* item =
-            (struct mailimap_msg_att_item *) clist_content(ait);
-
-          if (item->att_type == MAILIMAP_MSG_ATT_ITEM_DYNAMIC) continue;
-
-          if (item->att_type == MAILIMAP_MSG_ATT_ITEM_STATIC)
-          {
-            if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_BODY_SECTION)
-            {
-              std::string data(item->att_data.att_static->att_data.att_body_section->sec_body_part,
-                               item->att_data.att_static->att_data.att_body_section->sec_length);
-              body.SetData(data);
-            }
-
-            if (item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_UID)
-            {
-              uid = item->att_data.att_static->att_data.att_uid;
-            }
-          }
-        }
-
-        if (uid == 0)
-        {
-          LOG_WARNING("skip body uid = %d", uid);
-          continue;
-        }
+      ParseUidFlags(fetch_result, newFlags);
+      mailimap_fetch_list_free(fetch_result);
+    }
 
-        if (body.GetData().empty())
-        {
-          LOG_WARNING("skip body = \"\"");
-          continue;
-        }
+    mailimap_fetch_type_free(fetch_type);
+    mailimap_set_free(set);
 
-        if (!p_Prefetch)
-        {
-          p_Bodys[uid] = body;
-        }
+    if (rv != MAILIMAP_NO_ERROR)
+    {
+      return false;
+    }
 
-        std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-        const std::string& cachePath = GetBodyCachePath(p_Folder, uid);
-        WriteCacheFile(cachePath, body.GetData());
+    for (auto& flag : newFlags)
+    {
+      if (!uids.empty() && (flag.first <= uids.back()))
+      {
+        LOG_DEBUG("idle new uid %d not ascending", flag.first);
+        return false;
       }
 
-      mailimap_fetch_list_free(fetch_result);
+      uids.push_back(flag.first);
+      p_Flags[flag.first] = flag.second;
     }
-    mailimap_fetch_type_free(fetch_type);
   }
 
-  mailimap_set_free(set);
-  
-  return (rv == MAILIMAP_NO_ERROR);
-}
-
-bool Imap::SetFlagSeen(const std::string &p_Folder, const std::set<uint32_t> &p_Uids,
-                       bool p_Value)
-{
-  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Value));
-
-  std::lock_guard<std::mutex> imapLock(m_ImapMutex);
-
-  if (!SelectFolder(p_Folder))
+  if (uids.size() != p_Session.m_Imap->imap_selection_info->sel_exists)
   {
+    LOG_DEBUG("idle uid count %d != exists %d", static_cast<int>(uids.size()),
+              p_Session.m_Imap->imap_selection_info->sel_exists);
     return false;
   }
 
-  struct mailimap_flag_list* flaglist = mailimap_flag_list_new_empty();
-  mailimap_flag_list_add(flaglist, mailimap_flag_new_seen());
-
-  struct mailimap_set* set = mailimap_set_new_empty();
-  for (auto& uid : p_Uids)
-  {
-    mailimap_set_add_single(set, uid);
-  }
-
-  struct mailimap_store_att_flags* storeflags = p_Value
-    ? mailimap_store_att_flags_new_add_flags(flaglist)
-    : mailimap_store_att_flags_new_remove_flags(flaglist);
-  
-  int rv = LOG_IF_IMAP_ERR(mailimap_uid_store(m_Imap, set, storeflags));
+  p_Uids = std::set<uint32_t>(uids.begin(), uids.end());
 
-  if (storeflags != NULL)
+  std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+  std::map<uint32_t, uint32_t> flags =
+    Deserialize<std::map<uint32_t, uint32_t>>(ReadCacheFile(GetFolderFlagsCachePath(folder)));
+  for (auto& flag : p_Flags)
   {
-    mailimap_store_att_flags_free(storeflags);
+    flags[flag.first] = flag.second;
   }
 
-  mailimap_set_free(set);
-
-  if (rv == MAILIMAP_NO_ERROR)
-  {
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-    std::map<uint32_t, uint32_t> flags =
-      Deserialize<std::map<uint32_t, uint32_t>>(ReadCacheFile(GetFolderFlagsCachePath(p_Folder)));
-    for (auto& uid : p_Uids)
-    {
-      if (p_Value)
-      {
-        flags[uid] |= Flag::Seen;
-      }
-      else
-      {
-        flags[uid] &= !Flag::Seen;
-      }
-    }
+  WriteCacheFile(GetFolderUidsCachePath(folder), Serialize(p_Uids));
+  WriteCacheFile(GetFolderFlagsCachePath(folder), Serialize(flags));
+  DeleteCacheExceptUids(folder, p_Uids);
 
-    WriteCacheFile(GetFolderFlagsCachePath(p_Folder), Serialize(flags));
-  }
-  
-  return (rv == MAILIMAP_NO_ERROR);
+  return true;
 }
 
-bool Imap::SetFlagDeleted(const std::string &p_Folder, const std::set<uint32_t> &p_Uids,
-                          bool p_Value)
+bool Imap::GetPartialBodys(Session& p_Session, const std::string& p_Folder,
+                           std::set<uint32_t>& p_Uids, const bool p_Prefetch,
+                           std::map<uint32_t, Body>& p_Bodys)
 {
-  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_Value));
-  
-  std::lock_guard<std::mutex> imapLock(m_ImapMutex);
+  std::lock_guard<std::mutex> imapLock(p_Session.m_Mutex);
 
-  if (!SelectFolder(p_Folder))
+  if (!SelectFolder(p_Session, p_Folder))
   {
     return false;
   }
 
-  struct mailimap_flag_list* flaglist = mailimap_flag_list_new_empty();
-  mailimap_flag_list_add(flaglist, mailimap_flag_new_deleted());
+  struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_rfc822_size());
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_bodystructure());
 
-  struct mailimap_set* set = mailimap_set_new_empty();
-  for (auto& uid : p_Uids)
+  int rv = MAILIMAP_NO_ERROR;
+  std::map<uint32_t, std::vector<PartSection>> structures;
+  const std::vector<UidSet>& uidSets = UidSet(p_Uids).Split(MaxUidSetLength);
+  for (auto& uidSet : uidSets)
   {
-    mailimap_set_add_single(set, uid);
-  }
+    struct mailimap_set* set = NewUidSet(uidSet);
+    clist* fetch_result = NULL;
+    rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(p_Session.m_Imap, set, fetch_type, &fetch_result));
+    mailimap_set_free(set);
+    if (rv != MAILIMAP_NO_ERROR) break;
 
-  struct mailimap_store_att_flags* storeflags = p_Value
-    ? mailimap_store_att_flags_new_add_flags(flaglist)
-    : mailimap_store_att_flags_new_remove_flags(flaglist);
-  
-  int rv = LOG_IF_IMAP_ERR(mailimap_uid_store(m_Imap, set, storeflags));
+    for (clistiter* it = clist_begin(fetch_result); it != NULL; it = clist_next(it))
+    {
+      struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(it);
 
-  mailimap_set_free(set);
-  
-  if (storeflags != NULL)
-  {
-    mailimap_store_att_flags_free(storeflags);
-  }
+      uint32_t uid = 0;
+      uint32_t size = 0;
+      std::vector<PartSection> sections;
+      for (clistiter* ait = clist_begin(msg_att->att_list); ait != NULL; ait = clist_next(ait))
+      {
+        struct mailimap_msg_att_item* item =
+          (struct mailimap_msg_att_item *) clist_content(ait);
 
-  return (rv == MAILIMAP_NO_ERROR);
-}
+        if (item->att_type != MAILIMAP_MSG_ATT_ITEM_STATIC) continue;
 
-bool Imap::MoveMessages(const std::string &p_Folder, const std::set<uint32_t> &p_Uids,
-                        const std::string &p_DestFolder)
-{
-  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids, p_DestFolder));
+        struct mailimap_msg_att_static* att_static = item->att_data.att_static;
+        if (att_static->att_type == MAILIMAP_MSG_ATT_UID)
+        {
+          uid = att_static->att_data.att_uid;
+        }
+        else if (att_static->att_type == MAILIMAP_MSG_ATT_RFC822_SIZE)
+        {
+          size = att_static->att_data.att_rfc822_size;
+        }
+        else if (att_static->att_type == MAILIMAP_MSG_ATT_BODYSTRUCTURE)
+        {
+          ParseBodyStructure(att_static->att_data.att_bodystructure, "", sections);
+        }
+      }
 
-  std::lock_guard<std::mutex> imapLock(m_ImapMutex);
+      // small messages, and messages with more parts than can be stored, are fetched fully
+      if ((uid != 0) && (size > m_PartialFetchSize) && !sections.empty() &&
+          (sections.size() <= MessageStore::MaxParts))
+      {
+        structures[uid] = sections;
+      }
+    }
 
-  if (!SelectFolder(p_Folder))
-  {
-    return false;
+    mailimap_fetch_list_free(fetch_result);
   }
 
-  struct mailimap_set* set = mailimap_set_new_empty();
-  for (auto& uid : p_Uids)
+  mailimap_fetch_type_free(fetch_type);
+
+  if (rv != MAILIMAP_NO_ERROR)
   {
-    mailimap_set_add_single(set, uid);
+    return false;
   }
-  
-  int rv = LOG_IF_IMAP_ERR(mailimap_uid_move(m_Imap, set, p_DestFolder.c_str()));
-
-  mailimap_set_free(set);
 
-  if (rv == MAILIMAP_NO_ERROR)
+  for (auto& structure : structures)
   {
-    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-    std::set<uint32_t> uids =
-      Deserialize<std::set<uint32_t>>(ReadCacheFile(GetFolderUidsCachePath(p_Folder)));
-    for (auto& uid : p_Uids)
-    {
-      uids.erase(uid);
+    const uint32_t uid = structure.first;
+    Body body;
+    body.SetStructure(structure.second);
 
-      Util::DeleteFile(GetBodyCachePath(p_Folder, uid));
-      Util::DeleteFile(GetHeaderCachePath(p_Folder, uid));
+    std::map<ssize_t, std::string> datas;
+    if (!FetchBodyParts(p_Session, uid, structure.second, body.GetTextParts(), datas))
+    {
+      return false;
     }
-    
-    WriteCacheFile(GetFolderUidsCachePath(p_Folder), Serialize(uids));
-  }
 
-  return (rv == MAILIMAP_NO_ERROR);
-}
-
-bool Imap::DeleteMessages(const std::string &p_Folder, const std::set<uint32_t> &p_Uids)
-{
-  LOG_DEBUG_FUNC(STR(p_Folder, p_Uids));
+    for (auto& data : datas)
+    {
+      body.SetSectionData(data.first, data.second);
+    }
 
-  bool rv = true;
-  rv &= SetFlagDeleted(p_Folder, p_Uids, true);
+    const std::string& bodyText = GetBodySearchText(body);
+    if (!p_Prefetch)
+    {
+      p_Bodys[uid] = body;
+    }
 
-  std::lock_guard<std::mutex> imapLock(m_ImapMutex);
-  rv &= (LOG_IF_IMAP_ERR(mailimap_expunge(m_Imap)) == MAILIMAP_NO_ERROR);
-  return rv;
-}
+    p_Uids.erase(uid);
 
-bool Imap::CheckConnection()
-{
-  LOG_DEBUG_FUNC(STR());
+    // the structure is written last, as its presence marks the text parts as cached
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    WriteCacheBodyParts(p_Folder, uid, datas);
+    WriteCacheMessage(p_Folder, uid, MessageStore::KindStructure, body.GetStructureData());
+    GetSearchIndex(p_Folder).Add(uid, bodyText, true);
+  }
 
-  std::lock_guard<std::mutex> imapLock(m_ImapMutex);
+  if (!structures.empty())
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    SaveSearchIndex(p_Folder, false);
+  }
 
-  bool rv = true;
-  rv &= (LOG_IF_IMAP_ERR(mailimap_noop(m_Imap)) == MAILIMAP_NO_ERROR);
-  return rv;
+  return true;
 }
 
-bool Imap::GetConnected()
+bool Imap::FetchBodyParts(Session& p_Session, uint32_t p_Uid,
+                          const std::vector<PartSection>& p_Sections,
+                          const std::set<ssize_t>& p_Parts, std::map<ssize_t, std::string>& p_Datas)
 {
-  std::lock_guard<std::mutex> connectedLock(m_ConnectedMutex);
-  return m_Connected;
-}
+  std::map<std::string, ssize_t> sectionParts;
+  for (auto& part : p_Parts)
+  {
+    if ((part >= 0) && (part < (ssize_t)p_Sections.size()))
+    {
+      sectionParts[p_Sections.at(part).m_Section] = part;
+    }
+  }
 
-int Imap::IdleStart(const std::string& p_Folder)
-{
-  LOG_DEBUG_FUNC(STR(p_Folder));
+  if (sectionParts.empty())
+  {
+    return true;
+  }
 
-  std::lock_guard<std::mutex> imapLock(m_ImapMutex);
+  struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+  for (auto& sectionPart : sectionParts)
+  {
+    mailimap_fetch_type_new_fetch_att_list_add(fetch_type,
+      mailimap_fetch_att_new_body_peek_section(NewSection(sectionPart.first)));
+  }
+  mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
 
-  if (!SelectFolder(p_Folder))
+  struct mailimap_set* set = mailimap_set_new_single(p_Uid);
+  clist* fetch_result = NULL;
+  int rv = LOG_IF_IMAP_ERR(mailimap_uid_fetch(p_Session.m_Imap, set, fetch_type, &fetch_result));
+  mailimap_set_free(set);
+  mailimap_fetch_type_free(fetch_type);
+  if (rv != MAILIMAP_NO_ERROR)
   {
-    return -1;
+    return false;
   }
 
-  int rv = LOG_IF_IMAP_ERR(mailimap_idle(m_Imap));
-  if (rv == MAILIMAP_NO_ERROR)
+  std::map<std::string, std::string> sectionDatas;
+  ParseBodySections(fetch_result, p_Uid, sectionDatas);
+  for (auto& sectionData : sectionDatas)
   {
-    int fd = mailimap_idle_get_fd(m_Imap);
-    return fd;
+    auto sectionIt = sectionParts.find(sectionData.first);
+    if (sectionIt != sectionParts.end())
+    {
+      p_Datas[sectionIt->second] = sectionData.second;
+    }
   }
 
-  return -1;
+  mailimap_fetch_list_free(fetch_result);
+
+  return true;
 }
 
-void Imap::IdleDone()
+bool Imap::StreamBodyPart(Session& p_Session, uint32_t p_Uid, const PartSection& p_Section,
+                          const std::string& p_Path,
+                          const std::function<void(uint32_t)>& p_ProgressHandler)
 {
-  LOG_DEBUG_FUNC(STR());
+  // the part is fetched in chunks and decoded to a temporary file, which is renamed once
+  // complete, so only complete parts are found in cache
+  const std::string& tempPath = p_Path + ".tmp";
+  Util::MkDir(Util::DirName(p_Path));
+  std::ofstream file(tempPath, std::ios::binary);
+  if (!file.is_open())
+  {
+    LOG_WARNING("failed to open %s", tempPath.c_str());
+    return false;
+  }
 
-  std::lock_guard<std::mutex> imapLock(m_ImapMutex);
+  PartDecoder decoder(p_Section.m_Encoding);
+  uint32_t offset = 0;
+  bool done = false;
+  bool rv = true;
+  while (rv && !done)
+  {
+    struct mailimap_fetch_type* fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+    mailimap_fetch_type_new_fetch_att_list_add(fetch_type,
+      mailimap_fetch_att_new_body_peek_section_partial(NewSection(p_Section.m_Section), offset,
+                                                       StreamChunkSize));
+    mailimap_fetch_type_new_fetch_att_list_add(fetch_type, mailimap_fetch_att_new_uid());
 
-  mailimap_idle_done(m_Imap);
-}
+    struct mailimap_set* set = mailimap_set_new_single(p_Uid);
+    clist* fetch_result = NULL;
+    rv = (LOG_IF_IMAP_ERR(mailimap_uid_fetch(p_Session.m_Imap, set, fetch_type,
+                                             &fetch_result)) == MAILIMAP_NO_ERROR);
+    mailimap_set_free(set);
+    mailimap_fetch_type_free(fetch_type);
+    if (!rv) break;
 
-bool Imap::UploadMessage(const std::string& p_Folder, const std::string& p_Msg, bool p_IsDraft)
-{
-  LOG_DEBUG_FUNC(STR(p_Folder, "***", p_IsDraft));
-  LOG_TRACE_FUNC(STR(p_Folder, p_Msg, p_IsDraft));
+    std::map<std::string, std::string> sectionDatas;
+    ParseBodySections(fetch_result, p_Uid, sectionDatas);
+    mailimap_fetch_list_free(fetch_result);
 
-  struct mailimap_flag_list* flaglist = mailimap_flag_list_new_empty();
-  mailimap_flag_list_add(flaglist, mailimap_flag_new_seen());
+    // a section missing from the response, e.g. if expunged, must not end the part early
+    auto sectionIt = sectionDatas.find(p_Section.m_Section);
+    if ((sectionIt == sectionDatas.end()) ||
+        (sectionIt->second.empty() && (offset < p_Section.m_Size)))
+    {
+      LOG_WARNING("part %s of uid %u missing at offset %u", p_Section.m_Section.c_str(),
+                  p_Uid, offset);
+      rv = false;
+      break;
+    }
 
-  if (p_IsDraft)
-  {
-    mailimap_flag_list_add(flaglist, mailimap_flag_new_draft());
+    const std::string& chunk = sectionIt->second;
+    file << decoder.Decode(chunk);
+    offset += chunk.size();
+    done = (chunk.size() < StreamChunkSize);
+    rv = file.good();
+
+    if (p_ProgressHandler && (p_Section.m_Size > 0))
+    {
+      p_ProgressHandler(std::min<uint32_t>(100, (uint64_t)offset * 100 / p_Section.m_Size));
+    }
   }
 
-  time_t nowtime = time(NULL);
-  struct tm* lt = localtime(&nowtime);
-  
-  struct mailimap_date_time* datetime =
-    mailimap_date_time_new(lt->tm_mday, (lt->tm_mon + 1), (lt->tm_year + 1900),
-                           lt->tm_hour, lt->tm_min, lt->tm_sec, 0 /* dt_zone */);
+  if (rv && (offset < p_Section.m_Size))
+  {
+    LOG_WARNING("part %s of uid %u truncated at %u of %u", p_Section.m_Section.c_str(),
+                p_Uid, offset, p_Section.m_Size);
+    rv = false;
+  }
 
-  std::lock_guard<std::mutex> imapLock(m_ImapMutex);
+  if (rv)
+  {
+    file << decoder.Finish();
+    file.close();
+    rv = file.good();
+  }
+  else
+  {
+    file.close();
+  }
 
-  bool rv = (LOG_IF_IMAP_ERR(mailimap_append(m_Imap, p_Folder.c_str(), flaglist, datetime,
-                                             p_Msg.c_str(), p_Msg.size())) == MAILIMAP_NO_ERROR);
+  if (!rv)
+  {
+    LOG_WARNING("failed to fetch part to %s", tempPath.c_str());
+    Util::DeleteFile(tempPath);
+    return false;
+  }
 
-  mailimap_date_time_free(datetime);
+  if (rename(tempPath.c_str(), p_Path.c_str()) != 0)
+  {
+    LOG_WARNING("failed to rename %s", tempPath.c_str());
+    Util::DeleteFile(tempPath);
+    return false;
+  }
 
-  return rv;
+  return true;
 }
 
-bool Imap::SelectFolder(const std::string &p_Folder, bool p_Force)
+bool Imap::SelectFolder(Session& p_Session, const std::string &p_Folder, bool p_Force)
 {
   LOG_DEBUG_FUNC(STR(p_Folder, p_Force));
 
-  if (p_Force || (p_Folder != m_SelectedFolder))
+  if (p_Force || (p_Folder != p_Session.m_SelectedFolder))
   {
-    int rv = LOG_IF_IMAP_ERR(mailimap_select(m_Imap, p_Folder.c_str()));
+    int rv = MAILIMAP_NO_ERROR;
+    uint64_t highestModSeq = 0;
+    if (p_Session.m_Condstore)
+    {
+      rv = LOG_IF_IMAP_ERR(mailimap_select_condstore(p_Session.m_Imap, p_Folder.c_str(),
+                                                     &highestModSeq));
+    }
+    else
+    {
+      rv = LOG_IF_IMAP_ERR(mailimap_select(p_Session.m_Imap, p_Folder.c_str()));
+    }
+
     if (rv == MAILIMAP_NO_ERROR)
     {
       std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
-      m_SelectedFolder = p_Folder;
-      m_SelectedFolderIsEmpty = (m_Imap->imap_selection_info->sel_has_exists == 1) && (m_Imap->imap_selection_info->sel_exists == 0);
-      InitFolderCacheDir(p_Folder);
+      p_Session.m_HighestModSeq = highestModSeq;
+      p_Session.m_SelectedFolder = p_Folder;
+      p_Session.m_SelectedFolderIsEmpty = (p_Session.m_Imap->imap_selection_info->sel_has_exists == 1) && (p_Session.m_Imap->imap_selection_info->sel_exists == 0);
+      InitFolderCacheDir(p_Folder, GetUidValidity(p_Session));
       LOG_DEBUG("folder %s = %d", p_Folder.c_str(),
-                (m_Imap->imap_selection_info->sel_has_exists == 1) ? m_Imap->imap_selection_info->sel_exists : -1);
+                (p_Session.m_Imap->imap_selection_info->sel_has_exists == 1) ? p_Session.m_Imap->imap_selection_info->sel_exists : -1);
     }
 
     return (rv == MAILIMAP_NO_ERROR);
@@ -826,14 +2726,14 @@ bool Imap::SelectFolder(const std::string &p_Folder, bool p_Force)
   }
 }
 
-bool Imap::SelectedFolderIsEmpty()
+bool Imap::SelectedFolderIsEmpty(Session& p_Session)
 {
-  return m_SelectedFolderIsEmpty;
+  return p_Session.m_SelectedFolderIsEmpty;
 }
 
-uint32_t Imap::GetUidValidity()
+uint32_t Imap::GetUidValidity(Session& p_Session)
 {
-  return m_Imap->imap_selection_info->sel_uidvalidity;
+  return p_Session.m_Imap->imap_selection_info->sel_uidvalidity;
 }
 
 std::string Imap::GetCacheDir()
@@ -855,7 +2755,7 @@ std::string Imap::GetImapCacheDir()
 
 void Imap::InitImapCacheDir()
 {
-  static const int version = 1;
+  static const int version = 2;
   const std::string imapCacheDir = GetImapCacheDir();
   CommonInitCacheDir(imapCacheDir, version);
 }
@@ -883,37 +2783,224 @@ std::string Imap::GetFolderFlagsCachePath(const std::string &p_Folder)
   return GetFolderCacheDir(p_Folder) + std::string("flags");
 }
 
+std::string Imap::GetFolderPartsCacheDir(const std::string &p_Folder)
+{
+  // streamed parts are stored decoded, so are only kept for the session if cache is encrypted
+  if (m_CacheEncrypt)
+  {
+    return Util::GetTempDir() + std::string("parts/") + Crypto::SHA256(p_Folder) +
+      std::string("/");
+  }
+  else
+  {
+    return GetFolderCacheDir(p_Folder) + std::string("parts/");
+  }
+}
+
+std::string Imap::GetPartCachePath(const std::string &p_Folder, uint32_t p_Uid, ssize_t p_Part)
+{
+  return GetFolderPartsCacheDir(p_Folder) + std::to_string(p_Uid) + std::string(".") +
+    std::to_string(p_Part);
+}
+
+std::string Imap::GetFolderModSeqCachePath(const std::string &p_Folder)
+{
+  return GetFolderCacheDir(p_Folder) + std::string("modseq");
+}
+
 std::string Imap::GetFoldersCachePath()
 {
   return GetImapCacheDir() + std::string("folders");
 }
 
-std::string Imap::GetMessageCachePath(const std::string &p_Folder, uint32_t p_Uid,
-                                      const std::string &p_Suffix)
+std::string Imap::GetFolderStatusesCachePath()
+{
+  return GetImapCacheDir() + std::string("folderstatuses");
+}
+
+MessageStore& Imap::GetMessageStore(const std::string& p_Folder)
+{
+  std::shared_ptr<MessageStore>& store = m_MessageStores[p_Folder];
+  if (!store)
+  {
+    store = std::make_shared<MessageStore>(GetFolderCacheDir(p_Folder));
+  }
+
+  return *store;
+}
+
+std::string Imap::GetFolderEnvelopesCachePath(const std::string &p_Folder)
+{
+  return GetFolderCacheDir(p_Folder) + std::string("envelopes");
+}
+
+EnvelopeIndex& Imap::GetEnvelopeIndex(const std::string& p_Folder)
+{
+  std::shared_ptr<EnvelopeIndex>& envelopeIndex = m_EnvelopeIndexes[p_Folder];
+  if (!envelopeIndex)
+  {
+    envelopeIndex = std::make_shared<EnvelopeIndex>();
+    if (m_CacheEncrypt)
+    {
+      envelopeIndex->SetData(ReadCacheFile(GetFolderEnvelopesCachePath(p_Folder)));
+    }
+    else
+    {
+      envelopeIndex->MapFile(GetFolderEnvelopesCachePath(p_Folder));
+    }
+  }
+
+  return *envelopeIndex;
+}
+
+void Imap::SetEnvelope(const std::string& p_Folder, uint32_t p_Uid, Header& p_Header)
+{
+  Envelope envelope;
+  EnvelopeIndex& envelopeIndex = GetEnvelopeIndex(p_Folder);
+  if (!envelopeIndex.Get(p_Uid, envelope))
+  {
+    envelope.m_TimeStamp = p_Header.GetTimeStamp();
+    envelope.m_ShortFrom = p_Header.GetShortFrom();
+    envelope.m_Subject = p_Header.GetSubject();
+    envelope.m_MessageId = p_Header.GetMessageId();
+    envelope.m_References = p_Header.GetReferences();
+    envelopeIndex.Set(p_Uid, envelope);
+  }
+}
+
+void Imap::SaveEnvelopeIndex(const std::string& p_Folder, bool p_Force)
+{
+  EnvelopeIndex& envelopeIndex = GetEnvelopeIndex(p_Folder);
+  if (envelopeIndex.NeedsSave() || (p_Force && envelopeIndex.IsDirty()))
+  {
+    WriteCacheFile(GetFolderEnvelopesCachePath(p_Folder), envelopeIndex.GetData());
+  }
+}
+
+std::string Imap::GetFolderSearchCachePath(const std::string &p_Folder)
+{
+  return GetFolderCacheDir(p_Folder) + std::string("search");
+}
+
+SearchIndex& Imap::GetSearchIndex(const std::string& p_Folder)
 {
-  const std::string& path = GetFolderCacheDir(p_Folder) + std::string("/") +
-    std::to_string(p_Uid) + p_Suffix;
-  return path;
+  std::shared_ptr<SearchIndex>& searchIndex = m_SearchIndexes[p_Folder];
+  if (!searchIndex)
+  {
+    searchIndex = std::make_shared<SearchIndex>();
+    if (m_CacheEncrypt)
+    {
+      searchIndex->SetData(ReadCacheFile(GetFolderSearchCachePath(p_Folder)));
+    }
+    else
+    {
+      searchIndex->MapFile(GetFolderSearchCachePath(p_Folder));
+    }
+  }
+
+  return *searchIndex;
 }
 
-std::string Imap::GetHeaderCachePath(const std::string &p_Folder, uint32_t p_Uid)
+void Imap::SaveSearchIndex(const std::string& p_Folder, bool p_Force)
 {
-  return GetMessageCachePath(p_Folder, p_Uid, ".hdr");
+  SearchIndex& searchIndex = GetSearchIndex(p_Folder);
+  if (searchIndex.NeedsSave() || (p_Force && searchIndex.IsDirty()))
+  {
+    WriteCacheFile(GetFolderSearchCachePath(p_Folder), searchIndex.GetData());
+  }
 }
 
-std::string Imap::GetBodyCachePath(const std::string &p_Folder, uint32_t p_Uid)
+void Imap::IndexCachedMessages(const std::string& p_Folder)
 {
-  return GetMessageCachePath(p_Folder, p_Uid, ".eml");
+  // index messages cached before search indexing, in batches to not hold the cache lock
+  std::set<uint32_t> headerUids;
+  std::set<uint32_t> bodyUids;
+  {
+    std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+    const std::set<uint32_t>& uids =
+      Deserialize<std::set<uint32_t>>(ReadCacheFile(GetFolderUidsCachePath(p_Folder)));
+    SearchIndex& searchIndex = GetSearchIndex(p_Folder);
+    const std::set<uint32_t>& indexedHeaderUids = searchIndex.GetIndexed(false /* p_IsBody */);
+    const std::set<uint32_t>& indexedBodyUids = searchIndex.GetIndexed(true /* p_IsBody */);
+    MessageStore& store = GetMessageStore(p_Folder);
+    for (auto& uid : uids)
+    {
+      if ((indexedHeaderUids.find(uid) == indexedHeaderUids.end()) &&
+          store.Exists(uid, MessageStore::KindHeader))
+      {
+        headerUids.insert(uid);
+      }
+
+      if ((indexedBodyUids.find(uid) == indexedBodyUids.end()) &&
+          store.Exists(uid, MessageStore::KindBody))
+      {
+        bodyUids.insert(uid);
+      }
+    }
+  }
+
+  static const size_t batchSize = 256;
+  for (int i = 0; i < 2; ++i)
+  {
+    const bool isBody = (i == 1);
+    const std::set<uint32_t>& uids = isBody ? bodyUids : headerUids;
+    for (auto it = uids.begin(); it != uids.end(); /* increment in loop */)
+    {
+      std::set<uint32_t> batchUids;
+      while ((it != uids.end()) && (batchUids.size() < batchSize))
+      {
+        batchUids.insert(*it++);
+      }
+
+      std::map<uint32_t, std::string> datas;
+      {
+        std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+        datas = ReadCacheMessages(p_Folder, batchUids,
+                                  isBody ? MessageStore::KindBody : MessageStore::KindHeader);
+      }
+
+      std::map<uint32_t, std::string> texts;
+      for (auto& data : datas)
+      {
+        if (isBody)
+        {
+          Body body;
+          body.SetData(data.second);
+          texts[data.first] = GetBodySearchText(body);
+        }
+        else
+        {
+          Header header;
+          header.SetData(data.second);
+          texts[data.first] = GetHeaderSearchText(header);
+        }
+      }
+
+      std::lock_guard<std::mutex> cacheLock(m_CacheMutex);
+      SearchIndex& searchIndex = GetSearchIndex(p_Folder);
+      for (auto& text : texts)
+      {
+        searchIndex.Add(text.first, text.second, isBody);
+      }
+
+      SaveSearchIndex(p_Folder, false);
+    }
+  }
 }
 
-void Imap::InitFolderCacheDir(const std::string &p_Folder)
+void Imap::InitFolderCacheDir(const std::string &p_Folder, uint32_t p_UidValidity)
 {
-  static const int validity = GetUidValidity();
   const std::string folderCacheDir = GetFolderCacheDir(p_Folder);
-  CommonInitCacheDir(folderCacheDir, validity);
+  if (CommonInitCacheDir(folderCacheDir, p_UidValidity))
+  {
+    m_MessageStores.erase(p_Folder);
+    m_EnvelopeIndexes.erase(p_Folder);
+    m_SearchIndexes.erase(p_Folder);
+    m_SyncedFolders.erase(p_Folder);
+  }
 }
 
-void Imap::CommonInitCacheDir(const std::string &p_Dir, int p_Version)
+bool Imap::CommonInitCacheDir(const std::string &p_Dir, int p_Version)
 {
   const std::string& dirVersionPath = p_Dir + "version";
   if (Util::Exists(p_Dir))
@@ -925,20 +3012,31 @@ void Imap::CommonInitCacheDir(const std::string &p_Dir, int p_Version)
       Util::RmDir(p_Dir);
       Util::MkDir(p_Dir);
       SerializeToFile(dirVersionPath, p_Version);
+      return true;
     }
   }
   else
   {
     Util::MkDir(p_Dir);
     SerializeToFile(dirVersionPath, p_Version);
+    return true;
   }
+
+  return false;
 }
 
 std::string Imap::ReadCacheFile(const std::string &p_Path)
 {
   if (m_CacheEncrypt)
   {
-    return Crypto::AESDecrypt(Util::ReadFile(p_Path), m_Pass);
+    bool isLegacy = false;
+    const std::string& str = DecryptCacheData(Util::ReadFile(p_Path), isLegacy);
+    if (isLegacy)
+    {
+      WriteCacheFile(p_Path, str);
+    }
+
+    return str;
   }
   else
   {
@@ -950,7 +3048,7 @@ void Imap::WriteCacheFile(const std::string &p_Path, const std::string &p_Str)
 {
   if (m_CacheEncrypt)
   {
-    Util::WriteFile(p_Path, Crypto::AESEncrypt(p_Str, m_Pass));
+    Util::WriteFile(p_Path, Crypto::AESGCMEncrypt(p_Str, m_CacheKey));
   }
   else
   {
@@ -958,23 +3056,124 @@ void Imap::WriteCacheFile(const std::string &p_Path, const std::string &p_Str)
   }
 }
 
-void Imap::DeleteCacheExceptUids(const std::string &p_Folder, const std::set<uint32_t>& p_Uids)
+std::map<uint32_t, std::string> Imap::ReadCacheMessages(const std::string &p_Folder,
+                                                        const std::set<uint32_t> &p_Uids,
+                                                        MessageStore::Kind p_Kind)
 {
-  const std::vector<std::string>& cacheFiles = Util::ListDir(GetFolderCacheDir(p_Folder));
-  for (auto& cacheFile : cacheFiles)
+  std::map<uint32_t, std::string> datas = GetMessageStore(p_Folder).Read(p_Uids, p_Kind);
+  if (m_CacheEncrypt)
   {
-    const std::string& fileName = Util::RemoveFileExt(Util::BaseName(cacheFile));
-    if (Util::IsInteger(fileName))
+    for (auto& data : datas)
     {
-      uint32_t uid = Util::ToInteger(fileName);
-      if (p_Uids.find(uid) == p_Uids.end())
+      bool isLegacy = false;
+      data.second = DecryptCacheData(data.second, isLegacy);
+      if (isLegacy)
       {
-        const std::string& filePath = GetFolderCacheDir(p_Folder) + cacheFile;
-        Util::DeleteFile(filePath);
+        WriteCacheMessage(p_Folder, data.first, p_Kind, data.second);
       }
     }
   }
 
+  return datas;
+}
+
+void Imap::WriteCacheMessage(const std::string &p_Folder, uint32_t p_Uid,
+                             MessageStore::Kind p_Kind, const std::string &p_Str)
+{
+  if (m_CacheEncrypt)
+  {
+    GetMessageStore(p_Folder).Write(p_Uid, p_Kind, Crypto::AESGCMEncrypt(p_Str, m_CacheKey));
+  }
+  else
+  {
+    GetMessageStore(p_Folder).Write(p_Uid, p_Kind, p_Str);
+  }
+}
+
+bool Imap::ReadCachePartialBody(const std::string& p_Folder, uint32_t p_Uid, Body& p_Body)
+{
+  const std::set<uint32_t> uids = { p_Uid };
+  const std::map<uint32_t, std::string>& structureDatas =
+    ReadCacheMessages(p_Folder, uids, MessageStore::KindStructure);
+  auto structureIt = structureDatas.find(p_Uid);
+  if ((structureIt == structureDatas.end()) || !p_Body.SetStructureData(structureIt->second))
+  {
+    return false;
+  }
+
+  MessageStore::Kind kind;
+  for (size_t i = 0; (i < p_Body.GetSections().size()) && MessageStore::GetPartKind(i, kind);
+       ++i)
+  {
+    const std::map<uint32_t, std::string>& datas = ReadCacheMessages(p_Folder, uids, kind);
+    auto dataIt = datas.find(p_Uid);
+    if (dataIt != datas.end())
+    {
+      p_Body.SetSectionData(i, dataIt->second);
+    }
+    else if (Util::Exists(GetPartCachePath(p_Folder, p_Uid, i)))
+    {
+      p_Body.SetSectionPath(i, GetPartCachePath(p_Folder, p_Uid, i));
+    }
+  }
+
+  return true;
+}
+
+void Imap::WriteCacheBodyParts(const std::string& p_Folder, uint32_t p_Uid,
+                               const std::map<ssize_t, std::string>& p_Datas)
+{
+  MessageStore::Kind kind;
+  for (auto& data : p_Datas)
+  {
+    if ((data.first >= 0) && MessageStore::GetPartKind(data.first, kind))
+    {
+      WriteCacheMessage(p_Folder, p_Uid, kind, data.second);
+    }
+  }
+}
+
+std::string Imap::DecryptCacheData(const std::string &p_Data, bool &p_IsLegacy)
+{
+  std::string str;
+  p_IsLegacy = false;
+  if (p_Data.empty())
+  {
+    return str;
+  }
+
+  if (Crypto::IsAESGCM(p_Data))
+  {
+    Crypto::AESGCMDecrypt(p_Data, m_CacheKey, str);
+  }
+  else
+  {
+    // data encrypted by earlier versions is re-encrypted by the caller
+    str = Crypto::AESDecrypt(p_Data, m_Pass);
+    p_IsLegacy = !str.empty();
+  }
+
+  return str;
+}
+
+void Imap::DeleteCacheExceptUids(const std::string &p_Folder, const std::set<uint32_t>& p_Uids)
+{
+  GetMessageStore(p_Folder).RemoveExcept(p_Uids);
+  GetEnvelopeIndex(p_Folder).RemoveExcept(p_Uids);
+  SaveEnvelopeIndex(p_Folder, false);
+  GetSearchIndex(p_Folder).RemoveExcept(p_Uids);
+  SaveSearchIndex(p_Folder, false);
+
+  const std::string& partsDir = GetFolderPartsCacheDir(p_Folder);
+  for (auto& partFile : Util::ListDir(partsDir))
+  {
+    const uint32_t uid = static_cast<uint32_t>(strtoul(partFile.c_str(), NULL, 10));
+    if (p_Uids.find(uid) == p_Uids.end())
+    {
+      Util::DeleteFile(partsDir + partFile);
+    }
+  }
+
   std::map<uint32_t, uint32_t> flags = Deserialize<std::map<uint32_t, uint32_t>>(ReadCacheFile(GetFolderFlagsCachePath(p_Folder)));
   for (auto flag = flags.begin(); flag != flags.end(); /* increment in loop */)
   {
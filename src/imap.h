@@ -7,33 +7,65 @@
 
 #pragma once
 
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "body.h"
+#include "countingstream.h"
+#include "envelopeindex.h"
 #include "header.h"
+#include "messagestore.h"
+#include "searchindex.h"
+
+struct FolderStatus
+{
+  uint32_t m_Messages = 0;
+  uint32_t m_Unseen = 0;
+  uint32_t m_UidNext = 0;
+};
 
 class Imap
 {
 public:
   Imap(const std::string& p_User, const std::string& p_Pass, const std::string& p_Host,
-       const uint16_t p_Port, const bool p_CacheEncrypt);
+       const uint16_t p_Port, const bool p_CacheEncrypt, const uint32_t p_PartialFetchSize,
+       const bool p_Compress, const int p_Sessions = 1);
   virtual ~Imap();
   
-  bool Login();
-  bool Logout();
-
-  bool GetFolders(const bool p_Cached, std::set<std::string>& p_Folders);
-  bool GetUids(const std::string& p_Folder, const bool p_Cached, std::set<uint32_t>& p_Uids);
+  bool Login(const int p_Session = 0);
+  bool Logout(const int p_Session = 0);
+
+  bool GetFolders(const bool p_Cached, std::set<std::string>& p_Folders,
+                  const int p_Session = 0);
+  bool GetFolderStatuses(const bool p_Cached, const std::set<std::string>& p_Folders,
+                         std::map<std::string, FolderStatus>& p_Statuses,
+                         const int p_Session = 0);
+  bool GetUids(const std::string& p_Folder, const bool p_Cached, std::set<uint32_t>& p_Uids,
+               const int p_Session = 0);
   bool GetHeaders(const std::string& p_Folder, const std::set<uint32_t>& p_Uids,
                   const bool p_Cached, const bool p_Prefetch,
-                  std::map<uint32_t, Header>& p_Headers);
+                  std::map<uint32_t, Header>& p_Headers, const int p_Session = 0);
+  bool GetEnvelopes(const std::string& p_Folder, const std::set<uint32_t>& p_Uids,
+                    const bool p_Cached, std::map<uint32_t, Header>& p_Headers,
+                    const int p_Session = 0);
   bool GetFlags(const std::string& p_Folder, const std::set<uint32_t>& p_Uids,
-                const bool p_Cached, std::map<uint32_t, uint32_t>& p_Flags);
+                const bool p_Cached, std::map<uint32_t, uint32_t>& p_Flags,
+                const int p_Session = 0);
   bool GetBodys(const std::string& p_Folder, const std::set<uint32_t>& p_Uids,
-                const bool p_Cached, const bool p_Prefetch, std::map<uint32_t, Body>& p_Bodys);
+                const bool p_Cached, const bool p_Prefetch, const bool p_Full,
+                std::map<uint32_t, Body>& p_Bodys, const int p_Session = 0);
+  bool GetBodyParts(const std::string& p_Folder,
+                    const std::map<uint32_t, std::set<ssize_t>>& p_Parts, const bool p_Cached,
+                    std::map<uint32_t, Body>& p_Bodys,
+                    const std::function<void(uint32_t)>& p_ProgressHandler,
+                    const int p_Session = 0);
+  bool Search(const std::string& p_Folder, const std::string& p_Query, const bool p_Cached,
+              std::set<uint32_t>& p_Uids, const int p_Session = 0);
 
   bool SetFlagSeen(const std::string& p_Folder, const std::set<uint32_t>& p_Uids, bool p_Value);
   bool SetFlagDeleted(const std::string& p_Folder, const std::set<uint32_t>& p_Uids,
@@ -41,17 +73,59 @@ public:
   bool MoveMessages(const std::string& p_Folder, const std::set<uint32_t>& p_Uids,
                     const std::string& p_DestFolder);
   bool DeleteMessages(const std::string& p_Folder, const std::set<uint32_t>& p_Uids);
-  bool CheckConnection();
+  bool CheckConnection(const int p_Session = 0);
 
+  int GetSessionCount() const;
   bool GetConnected();
   int IdleStart(const std::string& p_Folder);
-  void IdleDone();
+  bool IdleDone(std::set<uint32_t>& p_Uids, std::map<uint32_t, uint32_t>& p_Flags);
   bool UploadMessage(const std::string& p_Folder, const std::string& p_Msg, bool p_IsDraft);
+  // returns false on connection errors, messages rejected by server are indicated in results
+  bool UploadMessages(const std::string& p_Folder, const std::vector<std::string>& p_Msgs,
+                      std::vector<bool>& p_Results);
+  std::string GetTrafficStats();
 
 private:
-  bool SelectFolder(const std::string& p_Folder, bool p_Force = false);
-  bool SelectedFolderIsEmpty();
-  uint32_t GetUidValidity();
+  // session 0 is used for interactive requests, actions and idle
+  struct Session
+  {
+    std::mutex m_Mutex;
+    struct mailimap* m_Imap = NULL;
+    std::string m_SelectedFolder;
+    bool m_SelectedFolderIsEmpty = true;
+    bool m_Connected = false;
+    bool m_Condstore = false;
+    bool m_Qresync = false;
+    bool m_Compress = false;
+    uint64_t m_HighestModSeq = 0;
+  };
+
+  void InitStreamCounters(Session& p_Session);
+  void EnableCompress(Session& p_Session);
+  void EnableExtensions(Session& p_Session);
+  bool SyncUids(Session& p_Session, const std::string& p_Folder, std::set<uint32_t>& p_Uids);
+  bool FetchUidFlags(Session& p_Session, uint64_t p_ChangedSince,
+                     std::map<uint32_t, uint32_t>& p_Flags, std::set<uint32_t>& p_Vanished,
+                     const std::set<uint32_t>& p_KnownUids);
+  bool ApplyIdleResponses(Session& p_Session, std::set<uint32_t>& p_Uids,
+                          std::map<uint32_t, uint32_t>& p_Flags);
+
+  bool GetPartialBodys(Session& p_Session, const std::string& p_Folder,
+                       std::set<uint32_t>& p_Uids, const bool p_Prefetch,
+                       std::map<uint32_t, Body>& p_Bodys);
+  bool FetchBodyParts(Session& p_Session, uint32_t p_Uid,
+                      const std::vector<PartSection>& p_Sections, const std::set<ssize_t>& p_Parts,
+                      std::map<ssize_t, std::string>& p_Datas);
+  bool StreamBodyPart(Session& p_Session, uint32_t p_Uid, const PartSection& p_Section,
+                      const std::string& p_Path,
+                      const std::function<void(uint32_t)>& p_ProgressHandler);
+
+  bool AppendMessages(Session& p_Session, const std::string& p_Folder,
+                      const std::vector<std::string>& p_Msgs, std::vector<bool>& p_Results);
+
+  bool SelectFolder(Session& p_Session, const std::string& p_Folder, bool p_Force = false);
+  bool SelectedFolderIsEmpty(Session& p_Session);
+  uint32_t GetUidValidity(Session& p_Session);
   std::string GetCacheDir();
   void InitCacheDir();
   std::string GetImapCacheDir();
@@ -59,17 +133,35 @@ private:
   std::string GetFolderCacheDir(const std::string& p_Folder);
   std::string GetFolderUidsCachePath(const std::string& p_Folder);
   std::string GetFolderFlagsCachePath(const std::string& p_Folder);
+  std::string GetFolderPartsCacheDir(const std::string& p_Folder);
+  std::string GetPartCachePath(const std::string& p_Folder, uint32_t p_Uid, ssize_t p_Part);
+  std::string GetFolderModSeqCachePath(const std::string& p_Folder);
   std::string GetFoldersCachePath();
-  std::string GetMessageCachePath(const std::string& p_Folder, uint32_t p_Uid,
-                                  const std::string& p_Suffix);
-  std::string GetHeaderCachePath(const std::string& p_Folder, uint32_t p_Uid);
-  std::string GetBodyCachePath(const std::string& p_Folder, uint32_t p_Uid);
-
-  void InitFolderCacheDir(const std::string& p_Folder);
-  void CommonInitCacheDir(const std::string& p_Dir, int p_Version);
+  std::string GetFolderStatusesCachePath();
+  MessageStore& GetMessageStore(const std::string& p_Folder);
+  std::string GetFolderEnvelopesCachePath(const std::string& p_Folder);
+  EnvelopeIndex& GetEnvelopeIndex(const std::string& p_Folder);
+  void SetEnvelope(const std::string& p_Folder, uint32_t p_Uid, Header& p_Header);
+  void SaveEnvelopeIndex(const std::string& p_Folder, bool p_Force);
+  std::string GetFolderSearchCachePath(const std::string& p_Folder);
+  SearchIndex& GetSearchIndex(const std::string& p_Folder);
+  void SaveSearchIndex(const std::string& p_Folder, bool p_Force);
+  void IndexCachedMessages(const std::string& p_Folder);
+
+  void InitFolderCacheDir(const std::string& p_Folder, uint32_t p_UidValidity);
+  bool CommonInitCacheDir(const std::string& p_Dir, int p_Version);
 
   std::string ReadCacheFile(const std::string& p_Path);
   void WriteCacheFile(const std::string& p_Path, const std::string& p_Str);
+  std::map<uint32_t, std::string> ReadCacheMessages(const std::string& p_Folder,
+                                                    const std::set<uint32_t>& p_Uids,
+                                                    MessageStore::Kind p_Kind);
+  void WriteCacheMessage(const std::string& p_Folder, uint32_t p_Uid, MessageStore::Kind p_Kind,
+                         const std::string& p_Str);
+  bool ReadCachePartialBody(const std::string& p_Folder, uint32_t p_Uid, Body& p_Body);
+  void WriteCacheBodyParts(const std::string& p_Folder, uint32_t p_Uid,
+                           const std::map<ssize_t, std::string>& p_Datas);
+  std::string DecryptCacheData(const std::string& p_Data, bool& p_IsLegacy);
 
   void DeleteCacheExceptUids(const std::string &p_Folder, const std::set<uint32_t>& p_Uids);
 
@@ -81,15 +173,21 @@ private:
   std::string m_Host;
   uint16_t m_Port = 0;
   bool m_CacheEncrypt = false;
+  uint32_t m_PartialFetchSize = 0;
+  bool m_Compress = false;
+  std::string m_CacheKey;
 
-  std::mutex m_ImapMutex;
-  struct mailimap* m_Imap = NULL;
+  // wire counts bytes below compression (above tls), logical the uncompressed protocol data
+  StreamCounters m_WireCounters;
+  StreamCounters m_LogicalCounters;
 
-  std::mutex m_CacheMutex;
+  std::vector<std::unique_ptr<Session>> m_Sessions;
 
-  std::string m_SelectedFolder;
-  bool m_SelectedFolderIsEmpty = true;
+  std::mutex m_CacheMutex;
+  std::map<std::string, std::shared_ptr<MessageStore>> m_MessageStores;
+  std::map<std::string, std::shared_ptr<EnvelopeIndex>> m_EnvelopeIndexes;
+  std::map<std::string, std::shared_ptr<SearchIndex>> m_SearchIndexes;
+  std::set<std::string> m_SyncedFolders;
 
   std::mutex m_ConnectedMutex;
-  bool m_Connected = false;
 };
@@ -7,18 +7,86 @@
 
 #include "imapmanager.h"
 
+#include <algorithm>
 #include <vector>
 
+#include "crypto.h"
+#include "importsource.h"
 #include "loghelp.h"
+#include "maphelp.h"
+#include "serialized.h"
+#include "sethelp.h"
 #include "util.h"
 
+// messages read from the import source and appended per batch
+static const size_t ImportBatchCount = 200;
+static const size_t ImportBatchSize = 32 * 1024 * 1024;
+
+// pending requests are merged up to a limited number of uids, to not delay their responses
+static const size_t MaxMergeUids = 100;
+static const size_t MaxMergeBodys = 10;
+
+static size_t GetUnionSize(const std::set<uint32_t>& p_Lhs, const std::set<uint32_t>& p_Rhs)
+{
+  size_t size = p_Lhs.size();
+  for (auto& uid : p_Rhs)
+  {
+    if (p_Lhs.find(uid) == p_Lhs.end())
+    {
+      ++size;
+    }
+  }
+
+  return size;
+}
+
+static bool CanMergeRequests(const ImapManager::Request& p_Pending,
+                             const ImapManager::Request& p_Request)
+{
+  // only requests for the same folder and the same kinds of data are merged, part requests
+  // are few and kept separate
+  if (!p_Pending.m_GetBodyParts.empty() || !p_Request.m_GetBodyParts.empty() ||
+      (p_Pending.m_PrefetchLevel != p_Request.m_PrefetchLevel) ||
+      (p_Pending.m_Priority != p_Request.m_Priority) ||
+      (p_Pending.m_FullBodys != p_Request.m_FullBodys) ||
+      (p_Pending.m_Folder != p_Request.m_Folder) ||
+      (p_Pending.m_GetFolders != p_Request.m_GetFolders) ||
+      (p_Pending.m_GetFolderStatuses != p_Request.m_GetFolderStatuses) ||
+      (p_Pending.m_GetUids != p_Request.m_GetUids) ||
+      (p_Pending.m_SearchQuery != p_Request.m_SearchQuery) ||
+      (p_Pending.m_GetEnvelopes.empty() != p_Request.m_GetEnvelopes.empty()) ||
+      (p_Pending.m_GetHeaders.empty() != p_Request.m_GetHeaders.empty()) ||
+      (p_Pending.m_GetFlags.empty() != p_Request.m_GetFlags.empty()) ||
+      (p_Pending.m_GetBodys.empty() != p_Request.m_GetBodys.empty()))
+  {
+    return false;
+  }
+
+  const size_t maxUids = p_Request.m_GetBodys.empty() ? MaxMergeUids : MaxMergeBodys;
+  return (GetUnionSize(p_Pending.m_GetEnvelopes, p_Request.m_GetEnvelopes) <= maxUids) &&
+    (GetUnionSize(p_Pending.m_GetHeaders, p_Request.m_GetHeaders) <= maxUids) &&
+    (GetUnionSize(p_Pending.m_GetFlags, p_Request.m_GetFlags) <= maxUids) &&
+    (GetUnionSize(p_Pending.m_GetBodys, p_Request.m_GetBodys) <= maxUids);
+}
+
+static bool IsEmptyRequest(const ImapManager::Request& p_Request)
+{
+  return !p_Request.m_GetFolders && !p_Request.m_GetFolderStatuses && !p_Request.m_GetUids &&
+    p_Request.m_GetEnvelopes.empty() && p_Request.m_GetHeaders.empty() &&
+    p_Request.m_GetFlags.empty() && p_Request.m_GetBodys.empty() &&
+    p_Request.m_GetBodyParts.empty() && p_Request.m_SearchQuery.empty();
+}
+
 ImapManager::ImapManager(const std::string& p_User, const std::string& p_Pass,
                          const std::string& p_Host, const uint16_t p_Port,
-                         const bool p_Connect, const bool p_CacheEncrypt,
+                         const int p_Connections, const bool p_Connect,
+                         const bool p_CacheEncrypt, const uint32_t p_PartialFetchSize,
+                         const bool p_Compress,
                          const std::function<void(const ImapManager::Request&,const ImapManager::Response&)>& p_ResponseHandler,
                          const std::function<void(const ImapManager::Action&,const ImapManager::Result&)>& p_ResultHandler,
                          const std::function<void(const StatusUpdate&)>& p_StatusHandler)
-  : m_Imap(p_User, p_Pass, p_Host, p_Port, p_CacheEncrypt)
+  : m_Imap(p_User, p_Pass, p_Host, p_Port, p_CacheEncrypt, p_PartialFetchSize, p_Compress,
+           p_Connections)
   , m_Connect(p_Connect)
   , m_ResponseHandler(p_ResponseHandler)
   , m_ResultHandler(p_ResultHandler)
@@ -26,6 +94,9 @@ ImapManager::ImapManager(const std::string& p_User, const std::string& p_Pass,
   , m_Connecting(false)
   , m_Running(false)
   , m_CacheRunning(false)
+  , m_RequestsQueued(0)
+  , m_RequestsMerged(0)
+  , m_RequestsDropped(0)
 {
   pipe(m_Pipe);
   pipe(m_CachePipe);
@@ -34,6 +105,11 @@ ImapManager::ImapManager(const std::string& p_User, const std::string& p_Pass,
   m_Running = true;
   m_CacheRunning = true;
   LOG_DEBUG("start threads");
+  for (int session = 1; session < m_Imap.GetSessionCount(); ++session)
+  {
+    m_PrefetchThreads.push_back(std::thread(&ImapManager::PrefetchProcess, this, session));
+  }
+
   m_Thread = std::thread(&ImapManager::Process, this);
   m_CacheThread = std::thread(&ImapManager::CacheProcess, this);
 }
@@ -49,6 +125,7 @@ ImapManager::~ImapManager()
       m_Requests.clear();
       m_PrefetchRequests.clear();
       m_Actions.clear();
+      m_ImportJobs.clear();
       m_QueueMutex.unlock();
       LOG_DEBUG("queues cleared");
     }
@@ -71,6 +148,18 @@ ImapManager::~ImapManager()
     }
   }
 
+  {
+    std::lock_guard<std::mutex> lock(m_QueueMutex);
+    m_PrefetchCond.notify_all();
+  }
+
+  for (auto& thread : m_PrefetchThreads)
+  {
+    thread.join();
+  }
+
+  LOG_DEBUG("prefetch threads joined");
+
   {
     std::unique_lock<std::mutex> lock(m_ExitedCacheCondMutex);
 
@@ -105,7 +194,7 @@ void ImapManager::AsyncRequest(const ImapManager::Request &p_Request)
   if (m_Imap.GetConnected() || m_Connecting)
   {
     std::lock_guard<std::mutex> lock(m_QueueMutex);
-    m_Requests.push_front(p_Request);
+    EnqueueRequest(m_Requests, p_Request);
     write(m_Pipe[1], "1", 1);
     m_RequestsTotal = m_Requests.size();
     m_RequestsDone = 0;
@@ -117,8 +206,9 @@ void ImapManager::PrefetchRequest(const ImapManager::Request &p_Request)
   if (m_Imap.GetConnected() || m_Connecting)
   {
     std::lock_guard<std::mutex> lock(m_QueueMutex);
-    m_PrefetchRequests[p_Request.m_PrefetchLevel].push_front(p_Request);
+    EnqueueRequest(m_PrefetchRequests[p_Request.m_PrefetchLevel], p_Request);
     write(m_Pipe[1], "1", 1);
+    m_PrefetchCond.notify_one();
     m_PrefetchRequestsTotal = 0;
     for (auto it = m_PrefetchRequests.begin(); it != m_PrefetchRequests.end(); ++it)
     {
@@ -194,27 +284,48 @@ bool ImapManager::ProcessIdle()
     struct timeval idletv = {(29 * 60), 0};
     selrv = select(maxfd + 1, &fds, NULL, NULL, &idletv);
 
-    m_Imap.IdleDone();
+    std::set<uint32_t> uids;
+    std::map<uint32_t, uint32_t> flags;
+    const bool applied = m_Imap.IdleDone(uids, flags);
     ClearStatus(Status::FlagIdle);
     
     if ((selrv != 0) && FD_ISSET(idlefd, &fds))
     {
       LOG_DEBUG("idle notification");
 
-      int len = 0;
-      ioctl(idlefd, FIONREAD, &len);
-      if (len > 0)
+      if (applied)
       {
-        std::vector<char> buf(len);
-        read(idlefd, &buf[0], len);
+        // untagged responses received during idle already describe the changes
+        ImapManager::Request request;
+        request.m_Folder = currentFolder;
+        request.m_GetUids = true;
+        for (auto& flag : flags)
+        {
+          request.m_GetFlags.insert(flag.first);
+        }
+
+        ImapManager::Response response;
+        response.m_Folder = currentFolder;
+        response.m_Uids = uids;
+        response.m_Flags = flags;
+        m_ResponseHandler(request, response);
+
+        if (!FD_ISSET(m_Pipe[0], &fds))
+        {
+          selrv = 0;
+          continue;
+        }
+      }
+      else
+      {
+        ImapManager::Request request;
+        m_Mutex.lock();
+        request.m_Folder = m_CurrentFolder;
+        m_Mutex.unlock();
+        request.m_GetUids = true;
+        AsyncRequest(request);
       }
 
-      ImapManager::Request request;
-      m_Mutex.lock();
-      request.m_Folder = m_CurrentFolder;
-      m_Mutex.unlock();
-      request.m_GetUids = true;
-      AsyncRequest(request);
       break;
     }
     else
@@ -281,8 +392,11 @@ void ImapManager::Process()
 
       m_QueueMutex.lock();
 
+      // prefetch requests are handled by the prefetch threads, when there are any
+      const bool prefetch = m_PrefetchThreads.empty();
       while (m_Running &&
-             (!m_Requests.empty() || !m_PrefetchRequests.empty() || !m_Actions.empty()))
+             (!m_Requests.empty() || (prefetch && !m_PrefetchRequests.empty()) ||
+              !m_Actions.empty() || !m_ImportJobs.empty()))
       {
         while (!m_Actions.empty() && m_Running)
         {
@@ -319,7 +433,7 @@ void ImapManager::Process()
         ClearStatus(Status::FlagFetching);        
         m_QueueMutex.lock();
 
-        if (!m_PrefetchRequests.empty() && m_Running)
+        if (prefetch && !m_PrefetchRequests.empty() && m_Running)
         {
           const Request request = m_PrefetchRequests.begin()->second.front();
           m_PrefetchRequests.begin()->second.pop_front();
@@ -345,6 +459,23 @@ void ImapManager::Process()
         m_QueueMutex.unlock();
         ClearStatus(Status::FlagPrefetching);
         m_QueueMutex.lock();
+
+        if (!m_ImportJobs.empty() && m_Running)
+        {
+          ImportJob importJob = m_ImportJobs.front();
+          m_ImportJobs.pop_front();
+
+          m_QueueMutex.unlock();
+
+          const bool done = PerformImport(importJob);
+
+          m_QueueMutex.lock();
+
+          if (!done)
+          {
+            m_ImportJobs.push_back(importJob);
+          }
+        }
       }
 
       m_RequestsTotal = 0;
@@ -352,6 +483,10 @@ void ImapManager::Process()
       m_PrefetchRequestsTotal = 0;
       m_PrefetchRequestsDone = 0;
 
+      LOG_DEBUG("requests queued %u merged %u dropped %u", (uint32_t)m_RequestsQueued,
+                (uint32_t)m_RequestsMerged, (uint32_t)m_RequestsDropped);
+      LOG_DEBUG("traffic %s", m_Imap.GetTrafficStats().c_str());
+
       m_QueueMutex.unlock();
     }
 
@@ -456,8 +591,208 @@ void ImapManager::CacheProcess()
   m_ExitedCacheCond.notify_one();
 }
 
+void ImapManager::PrefetchProcess(const int p_Session)
+{
+  THREAD_REGISTER();
+
+  std::string folder;
+  bool connected = false;
+
+  LOG_DEBUG("entering prefetch loop %d", p_Session);
+  while (m_Running)
+  {
+    if (m_Connect && !connected)
+    {
+      connected = m_Imap.Login(p_Session);
+      if (!connected)
+      {
+        std::unique_lock<std::mutex> lock(m_QueueMutex);
+        if (m_Running)
+        {
+          m_PrefetchCond.wait_for(lock, std::chrono::seconds(15));
+        }
+
+        continue;
+      }
+    }
+
+    Request request;
+    uint32_t progress = 0;
+    {
+      std::unique_lock<std::mutex> lock(m_QueueMutex);
+      while (m_Running && m_PrefetchRequests.empty())
+      {
+        m_PrefetchCond.wait(lock);
+      }
+
+      if (!m_Running) break;
+
+      TakePrefetchRequest(folder, request);
+
+      const int progressReportMinTasks = 2;
+      progress = (m_PrefetchRequestsTotal >= progressReportMinTasks) ?
+        ((m_PrefetchRequestsDone * 100) / m_PrefetchRequestsTotal) : 0;
+    }
+
+    SetStatus(Status::FlagPrefetching, progress);
+
+    bool rv = PerformRequest(request, false /* p_Cached */, true /* p_Prefetch */, p_Session);
+    folder = request.m_Folder;
+
+    if (!rv && !m_Imap.CheckConnection(p_Session))
+    {
+      LOG_WARNING("prefetch connection %d lost", p_Session);
+      m_Imap.Logout(p_Session);
+      connected = false;
+    }
+    else
+    {
+      rv = true;
+    }
+
+    bool done = false;
+    {
+      std::lock_guard<std::mutex> lock(m_QueueMutex);
+      if (rv)
+      {
+        ++m_PrefetchRequestsDone;
+      }
+      else
+      {
+        // retry the request once reconnected, or by another session
+        m_PrefetchRequests[request.m_PrefetchLevel].push_front(request);
+        m_PrefetchCond.notify_one();
+      }
+
+      if (m_PrefetchRequests.empty())
+      {
+        m_PrefetchRequestsTotal = 0;
+        m_PrefetchRequestsDone = 0;
+        done = true;
+      }
+    }
+
+    if (done)
+    {
+      ClearStatus(Status::FlagPrefetching);
+    }
+  }
+
+  LOG_DEBUG("exiting prefetch loop %d", p_Session);
+
+  if (connected)
+  {
+    m_Imap.Logout(p_Session);
+  }
+}
+
+bool ImapManager::TakePrefetchRequest(const std::string& p_Folder, Request& p_Request)
+{
+  if (m_PrefetchRequests.empty()) return false;
+
+  // take the highest priority request, preferring the folder already selected by the session
+  std::deque<Request>& requests = m_PrefetchRequests.begin()->second;
+  auto it = requests.begin();
+  for (auto folderIt = requests.begin(); folderIt != requests.end(); ++folderIt)
+  {
+    if (folderIt->m_Folder == p_Folder)
+    {
+      it = folderIt;
+      break;
+    }
+  }
+
+  p_Request = *it;
+  requests.erase(it);
+  if (requests.empty())
+  {
+    m_PrefetchRequests.erase(m_PrefetchRequests.begin());
+  }
+
+  return true;
+}
+
+void ImapManager::EnqueueRequest(std::deque<Request>& p_Requests, const Request& p_Request)
+{
+  // requests are served by priority then age, with new requests merged into a pending one of
+  // the same priority if possible
+  ++m_RequestsQueued;
+  for (auto& request : p_Requests)
+  {
+    if (!CanMergeRequests(request, p_Request)) continue;
+
+    const size_t orgCount = request.m_GetEnvelopes.size() + request.m_GetHeaders.size() +
+      request.m_GetFlags.size() + request.m_GetBodys.size();
+    request.m_GetEnvelopes = request.m_GetEnvelopes + p_Request.m_GetEnvelopes;
+    request.m_GetHeaders = request.m_GetHeaders + p_Request.m_GetHeaders;
+    request.m_GetFlags = request.m_GetFlags + p_Request.m_GetFlags;
+    request.m_GetBodys = request.m_GetBodys + p_Request.m_GetBodys;
+    const size_t newCount = request.m_GetEnvelopes.size() + request.m_GetHeaders.size() +
+      request.m_GetFlags.size() + request.m_GetBodys.size();
+    if (newCount > orgCount)
+    {
+      ++m_RequestsMerged;
+    }
+    else
+    {
+      ++m_RequestsDropped;
+    }
+
+    return;
+  }
+
+  auto it = p_Requests.begin();
+  while ((it != p_Requests.end()) && (it->m_Priority >= p_Request.m_Priority))
+  {
+    ++it;
+  }
+
+  p_Requests.insert(it, p_Request);
+}
+
+void ImapManager::RemoveCachedRequests(const Response& p_Response)
+{
+  // pending server requests for messages just read from cache are no longer needed
+  std::set<uint32_t> envelopeUids;
+  std::set<uint32_t> headerUids;
+  for (auto& header : p_Response.m_Headers)
+  {
+    envelopeUids.insert(header.first);
+    if (!header.second.IsEnvelope())
+    {
+      headerUids.insert(header.first);
+    }
+  }
+
+  const std::set<uint32_t>& bodyUids = MapKey(p_Response.m_Bodys);
+  if (envelopeUids.empty() && bodyUids.empty()) return;
+
+  std::lock_guard<std::mutex> lock(m_QueueMutex);
+  for (auto it = m_Requests.begin(); it != m_Requests.end(); /* increment in loop */)
+  {
+    if (it->m_Folder == p_Response.m_Folder)
+    {
+      it->m_GetEnvelopes = it->m_GetEnvelopes - envelopeUids;
+      it->m_GetHeaders = it->m_GetHeaders - headerUids;
+      if (!it->m_FullBodys)
+      {
+        it->m_GetBodys = it->m_GetBodys - bodyUids;
+      }
+
+      if (IsEmptyRequest(*it))
+      {
+        it = m_Requests.erase(it);
+        ++m_RequestsDropped;
+        continue;
+      }
+    }
+
+    ++it;
+  }
+}
+
 bool ImapManager::PerformRequest(const ImapManager::Request& p_Request, bool p_Cached,
-                                 bool p_Prefetch)
+                                 bool p_Prefetch, const int p_Session)
 {
   Response response;
 
@@ -466,42 +801,85 @@ bool ImapManager::PerformRequest(const ImapManager::Request& p_Request, bool p_C
   response.m_Cached = p_Cached;
   if (p_Request.m_GetFolders)
   {
-    const bool rv = m_Imap.GetFolders(p_Cached, response.m_Folders);
+    const bool rv = m_Imap.GetFolders(p_Cached, response.m_Folders, p_Session);
     response.m_ResponseStatus |= rv ? ResponseStatusOk : ResponseStatusGetFoldersFailed;
   }
 
+  // cached folder statuses are cheap to read, so they accompany the cached folder list
+  if (p_Request.m_GetFolderStatuses || (p_Request.m_GetFolders && p_Cached))
+  {
+    std::set<std::string> folders = response.m_Folders;
+    if (!p_Request.m_GetFolders)
+    {
+      m_Imap.GetFolders(true /* p_Cached */, folders, p_Session);
+    }
+
+    const bool rv = m_Imap.GetFolderStatuses(p_Cached, folders, response.m_FolderStatuses,
+                                             p_Session);
+    response.m_ResponseStatus |= rv ? ResponseStatusOk : ResponseStatusGetFolderStatusesFailed;
+  }
+
   if (p_Request.m_GetUids)
   {
-    const bool rv = m_Imap.GetUids(p_Request.m_Folder, p_Cached, response.m_Uids);
+    const bool rv = m_Imap.GetUids(p_Request.m_Folder, p_Cached, response.m_Uids, p_Session);
     response.m_ResponseStatus |= rv ? ResponseStatusOk : ResponseStatusGetUidsFailed;
   }
 
+  if (!p_Request.m_GetEnvelopes.empty())
+  {
+    const bool rv = m_Imap.GetEnvelopes(p_Request.m_Folder, p_Request.m_GetEnvelopes, p_Cached,
+                                        response.m_Headers, p_Session);
+    response.m_ResponseStatus |= rv ? ResponseStatusOk : ResponseStatusGetHeadersFailed;
+  }
+
   if (!p_Request.m_GetHeaders.empty())
   {
     const bool rv = m_Imap.GetHeaders(p_Request.m_Folder, p_Request.m_GetHeaders, p_Cached,
-                                      p_Prefetch, response.m_Headers);
+                                      p_Prefetch, response.m_Headers, p_Session);
     response.m_ResponseStatus |= rv ? ResponseStatusOk : ResponseStatusGetHeadersFailed;
   }
 
   if (!p_Request.m_GetFlags.empty())
   {
     const bool rv = m_Imap.GetFlags(p_Request.m_Folder, p_Request.m_GetFlags, p_Cached,
-                                    response.m_Flags);
+                                    response.m_Flags, p_Session);
     response.m_ResponseStatus |= rv ? ResponseStatusOk : ResponseStatusGetFlagsFailed;
   }
 
   if (!p_Request.m_GetBodys.empty())
   {
     const bool rv = m_Imap.GetBodys(p_Request.m_Folder, p_Request.m_GetBodys, p_Cached,
-                                    p_Prefetch, response.m_Bodys);
+                                    p_Prefetch, p_Request.m_FullBodys, response.m_Bodys,
+                                    p_Session);
     response.m_ResponseStatus |= rv ? ResponseStatusOk : ResponseStatusGetBodysFailed;
   }
 
+  if (!p_Request.m_GetBodyParts.empty())
+  {
+    const std::function<void(uint32_t)> progressHandler =
+      std::bind(&ImapManager::SetStatus, this, Status::FlagFetching, std::placeholders::_1);
+    const bool rv = m_Imap.GetBodyParts(p_Request.m_Folder, p_Request.m_GetBodyParts, p_Cached,
+                                        response.m_Bodys, progressHandler, p_Session);
+    response.m_ResponseStatus |= rv ? ResponseStatusOk : ResponseStatusGetBodyPartsFailed;
+  }
+
+  if (!p_Request.m_SearchQuery.empty())
+  {
+    const bool rv = m_Imap.Search(p_Request.m_Folder, p_Request.m_SearchQuery, p_Cached,
+                                  response.m_SearchUids, p_Session);
+    response.m_ResponseStatus |= rv ? ResponseStatusOk : ResponseStatusSearchFailed;
+  }
+
   if (m_ResponseHandler)
   {
     m_ResponseHandler(p_Request, response);
   }
 
+  if (p_Cached)
+  {
+    RemoveCachedRequests(response);
+  }
+
   return (response.m_ResponseStatus == ResponseStatusOk);
 }
 
@@ -539,6 +917,29 @@ bool ImapManager::PerformAction(const ImapManager::Action& p_Action)
     ClearStatus(Status::FlagSaving);
   }
 
+  if (!p_Action.m_ImportPath.empty())
+  {
+    // result is reported when the import job is done
+    ImportJob importJob;
+    importJob.m_Action = p_Action;
+    importJob.m_StartTime = time(NULL);
+    std::vector<uint64_t> state;
+    DeserializeFromFile(GetImportStatePath(p_Action), state);
+    if (state.size() == 3)
+    {
+      importJob.m_Position = state.at(0);
+      importJob.m_Imported = static_cast<uint32_t>(state.at(1));
+      importJob.m_Failed = static_cast<uint32_t>(state.at(2));
+      LOG_INFO("resuming import of %s at %llu", p_Action.m_ImportPath.c_str(),
+               (unsigned long long)importJob.m_Position);
+    }
+
+    SetStatus(Status::FlagImporting);
+    std::lock_guard<std::mutex> lock(m_QueueMutex);
+    m_ImportJobs.push_back(importJob);
+    return true;
+  }
+
   if (p_Action.m_DeleteMessages)
   {
     SetStatus(Status::FlagDeleting);
@@ -554,6 +955,89 @@ bool ImapManager::PerformAction(const ImapManager::Action& p_Action)
   return (result.m_Result);
 }
 
+bool ImapManager::PerformImport(ImportJob& p_Job)
+{
+  const Action& action = p_Job.m_Action;
+  Result result;
+  result.m_Result = false;
+
+  ImportSource importSource;
+  if (importSource.Open(action.m_ImportPath, p_Job.m_Position))
+  {
+    std::vector<std::string> msgs;
+    size_t batchSize = 0;
+    std::string msg;
+    while ((msgs.size() < ImportBatchCount) && (batchSize < ImportBatchSize) &&
+           importSource.Next(msg))
+    {
+      batchSize += msg.size();
+      msgs.push_back(msg);
+    }
+
+    if (msgs.empty())
+    {
+      // done, rejected messages are reported but not retried on a later import
+      const time_t elapsed = std::max(time(NULL) - p_Job.m_StartTime, (time_t)1);
+      LOG_INFO("import of %s done, %u imported %u failed, %u msg/s %llu KB/s",
+               action.m_ImportPath.c_str(), p_Job.m_Imported, p_Job.m_Failed,
+               (uint32_t)(p_Job.m_RunImported / elapsed),
+               (unsigned long long)(p_Job.m_RunBytes / elapsed / 1024));
+      Util::DeleteFile(GetImportStatePath(action));
+      result.m_Result = (p_Job.m_Failed == 0);
+      if (!result.m_Result)
+      {
+        result.m_Message = "Imported " + std::to_string(p_Job.m_Imported) + " messages, " +
+          std::to_string(p_Job.m_Failed) + " rejected by server";
+      }
+    }
+    else
+    {
+      std::vector<bool> results;
+      if (m_Imap.UploadMessages(action.m_Folder, msgs, results))
+      {
+        // rejected messages are skipped, only connection errors stop the import
+        const uint32_t imported =
+          static_cast<uint32_t>(std::count(results.begin(), results.end(), true));
+        p_Job.m_Imported += imported;
+        p_Job.m_Failed += static_cast<uint32_t>(msgs.size()) - imported;
+        p_Job.m_RunImported += imported;
+        p_Job.m_RunBytes += batchSize;
+        p_Job.m_Position = importSource.GetPosition();
+
+        const std::vector<uint64_t> state =
+          { p_Job.m_Position, p_Job.m_Imported, p_Job.m_Failed };
+        Util::MkDir(Util::DirName(GetImportStatePath(action)));
+        SerializeToFile(GetImportStatePath(action), state);
+
+        const time_t elapsed = std::max(time(NULL) - p_Job.m_StartTime, (time_t)1);
+        LOG_DEBUG("import %u imported %u failed, %u msg/s %llu KB/s", p_Job.m_Imported,
+                  p_Job.m_Failed, (uint32_t)(p_Job.m_RunImported / elapsed),
+                  (unsigned long long)(p_Job.m_RunBytes / elapsed / 1024));
+        SetStatus(Status::FlagImporting, std::max(importSource.GetProgress(), (uint32_t)1));
+        return false;
+      }
+
+      LOG_WARNING("import of %s interrupted at %llu", action.m_ImportPath.c_str(),
+                  (unsigned long long)p_Job.m_Position);
+    }
+  }
+
+  ClearStatus(Status::FlagImporting);
+
+  if (m_ResultHandler)
+  {
+    m_ResultHandler(action, result);
+  }
+
+  return true;
+}
+
+std::string ImapManager::GetImportStatePath(const Action& p_Action)
+{
+  const std::string& key = p_Action.m_Folder + "\n" + Util::AbsolutePath(p_Action.m_ImportPath);
+  return Util::GetApplicationDir() + "imports/" + Crypto::SHA256(key);
+}
+
 void ImapManager::SetStatus(uint32_t p_Flags, uint32_t p_Progress /* = 0 */)
 {
   StatusUpdate statusUpdate;
@@ -14,6 +14,7 @@
 #include <set>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <unistd.h>
 #include <sys/ioctl.h>
@@ -36,17 +37,32 @@ public:
     ResponseStatusGetFlagsFailed = (1 << 3),
     ResponseStatusGetBodysFailed = (1 << 4),
     ResponseStatusLoginFailed = (1 << 5),
+    ResponseStatusSearchFailed = (1 << 6),
+    ResponseStatusGetFolderStatusesFailed = (1 << 7),
+    ResponseStatusGetBodyPartsFailed = (1 << 8),
+  };
+
+  enum RequestPriority
+  {
+    RequestPriorityNormal = 0,
+    RequestPriorityCurrentMessage,
   };
   
   struct Request
   {
     uint32_t m_PrefetchLevel = 0;
+    uint32_t m_Priority = RequestPriorityNormal;
     std::string m_Folder;
     bool m_GetFolders = false;
+    bool m_GetFolderStatuses = false;
     bool m_GetUids = false;
+    std::set<uint32_t> m_GetEnvelopes;
     std::set<uint32_t> m_GetHeaders;
     std::set<uint32_t> m_GetFlags;
     std::set<uint32_t> m_GetBodys;
+    bool m_FullBodys = false;
+    std::map<uint32_t, std::set<ssize_t>> m_GetBodyParts;
+    std::string m_SearchQuery;
   };
 
   struct Response
@@ -55,10 +71,12 @@ public:
     std::string m_Folder;
     bool m_Cached = false;
     std::set<std::string> m_Folders;
+    std::map<std::string, FolderStatus> m_FolderStatuses;
     std::set<uint32_t> m_Uids;
     std::map<uint32_t, Header> m_Headers;
     std::map<uint32_t, uint32_t> m_Flags;
     std::map<uint32_t, Body> m_Bodys;
+    std::set<uint32_t> m_SearchUids;
   };
 
   struct Action
@@ -72,16 +90,32 @@ public:
     bool m_DeleteMessages = false;
     std::string m_MoveDestination;
     std::string m_Msg;
+    std::string m_ImportPath;
   };
 
   struct Result
   {
     bool m_Result;
+    std::string m_Message;
+  };
+
+private:
+  // bulk import, performed in batches interleaved with other requests and actions
+  struct ImportJob
+  {
+    Action m_Action;
+    uint64_t m_Position = 0;
+    uint32_t m_Imported = 0;
+    uint32_t m_Failed = 0;
+    uint32_t m_RunImported = 0;
+    uint64_t m_RunBytes = 0;
+    time_t m_StartTime = 0;
   };
 
 public:
   ImapManager(const std::string& p_User, const std::string& p_Pass, const std::string& p_Host,
-              const uint16_t p_Port, const bool p_Connect, const bool p_CacheEncrypt,
+              const uint16_t p_Port, const int p_Connections, const bool p_Connect,
+              const bool p_CacheEncrypt, const uint32_t p_PartialFetchSize, const bool p_Compress,
               const std::function<void(const ImapManager::Request&,const ImapManager::Response&)>& p_ResponseHandler,
               const std::function<void(const ImapManager::Action&,const ImapManager::Result&)>& p_ResultHandler,
               const std::function<void(const StatusUpdate&)>& p_StatusHandler);
@@ -96,8 +130,15 @@ private:
   bool ProcessIdle();
   void Process();
   void CacheProcess();
-  bool PerformRequest(const Request& p_Request, bool p_Cached, bool p_Prefetch);
+  void PrefetchProcess(const int p_Session);
+  bool TakePrefetchRequest(const std::string& p_Folder, Request& p_Request);
+  void EnqueueRequest(std::deque<Request>& p_Requests, const Request& p_Request);
+  void RemoveCachedRequests(const Response& p_Response);
+  bool PerformRequest(const Request& p_Request, bool p_Cached, bool p_Prefetch,
+                      const int p_Session = 0);
   bool PerformAction(const Action& p_Action);
+  bool PerformImport(ImportJob& p_Job);
+  static std::string GetImportStatePath(const Action& p_Action);
   void SetStatus(uint32_t p_Flags, uint32_t p_Progress = 0);
   void ClearStatus(uint32_t p_Flags);
 
@@ -112,17 +153,23 @@ private:
   std::atomic<bool> m_CacheRunning;
   std::thread m_Thread;
   std::thread m_CacheThread;
+  std::vector<std::thread> m_PrefetchThreads;
 
   std::deque<Request> m_Requests;
   std::deque<Request> m_CacheRequests;
   std::map<uint32_t, std::deque<Request>> m_PrefetchRequests;
   std::deque<Action> m_Actions;
+  std::deque<ImportJob> m_ImportJobs;
   uint32_t m_RequestsTotal = 0;
   uint32_t m_RequestsDone = 0;
   uint32_t m_PrefetchRequestsTotal = 0;
   uint32_t m_PrefetchRequestsDone = 0;
+  std::atomic<uint32_t> m_RequestsQueued;
+  std::atomic<uint32_t> m_RequestsMerged;
+  std::atomic<uint32_t> m_RequestsDropped;
   std::mutex m_QueueMutex;
   std::mutex m_CacheQueueMutex;
+  std::condition_variable m_PrefetchCond;
 
   std::condition_variable m_ExitedCond;
   std::mutex m_ExitedCondMutex;
@@ -0,0 +1,208 @@
+// importsource.cpp
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "importsource.h"
+
+#include <algorithm>
+
+#include "apathy/path.hpp"
+
+#include "log.h"
+#include "loghelp.h"
+#include "util.h"
+
+ImportSource::ImportSource()
+{
+}
+
+ImportSource::~ImportSource()
+{
+}
+
+bool ImportSource::Open(const std::string& p_Path, uint64_t p_Position)
+{
+  m_IsMbox = false;
+  m_FromLineRead = false;
+  m_Paths.clear();
+  m_Position = p_Position;
+  m_StreamPos = p_Position;
+
+  const apathy::Path path(p_Path);
+  if (path.is_directory())
+  {
+    // maildir messages are in cur and new, other directories hold one message per file
+    std::vector<apathy::Path> dirs;
+    if (apathy::Path(p_Path + "/cur").is_directory())
+    {
+      dirs.push_back(apathy::Path(p_Path + "/cur"));
+      dirs.push_back(apathy::Path(p_Path + "/new"));
+    }
+    else
+    {
+      dirs.push_back(path);
+    }
+
+    for (auto& dir : dirs)
+    {
+      const std::vector<apathy::Path>& files = apathy::Path::listdir(dir);
+      for (auto& file : files)
+      {
+        const std::string& name = file.filename();
+        if (file.is_file() && !name.empty() && (name.at(0) != '.'))
+        {
+          m_Paths.push_back(file.string());
+        }
+      }
+    }
+
+    // maildir file names start with the delivery time, giving chronological order
+    std::sort(m_Paths.begin(), m_Paths.end());
+    return true;
+  }
+
+  if (!path.is_file())
+  {
+    LOG_WARNING("import source %s not found", p_Path.c_str());
+    return false;
+  }
+
+  m_Stream.open(p_Path, std::ios::binary);
+  std::string line;
+  if (m_Stream.good() && std::getline(m_Stream, line) && IsMboxFromLine(line))
+  {
+    m_IsMbox = true;
+    m_Size = Util::GetFileSize(p_Path);
+    m_Stream.clear();
+    m_Stream.seekg(m_Position);
+    return m_Stream.good();
+  }
+
+  m_Stream.close();
+  m_Paths.push_back(p_Path);
+  return true;
+}
+
+bool ImportSource::Next(std::string& p_Msg)
+{
+  return m_IsMbox ? NextMbox(p_Msg) : NextFile(p_Msg);
+}
+
+uint64_t ImportSource::GetPosition() const
+{
+  return m_Position;
+}
+
+uint32_t ImportSource::GetProgress() const
+{
+  const uint64_t total = m_IsMbox ? m_Size : m_Paths.size();
+  return (total > 0) ? static_cast<uint32_t>((std::min(m_Position, total) * 100) / total) : 100;
+}
+
+bool ImportSource::NextMbox(std::string& p_Msg)
+{
+  std::string msg;
+  bool hasMsg = false;
+  while (msg.empty() && (m_FromLineRead || !m_Stream.eof()))
+  {
+    hasMsg = m_FromLineRead;
+    m_FromLineRead = false;
+
+    std::string line;
+    uint64_t lineStart = m_StreamPos;
+    while (std::getline(m_Stream, line))
+    {
+      lineStart = m_StreamPos;
+      m_StreamPos += line.size() + (m_Stream.eof() ? 0 : 1);
+      if (IsMboxFromLine(line))
+      {
+        if (hasMsg)
+        {
+          // separator of the next message is consumed, resume from its start
+          m_FromLineRead = true;
+          break;
+        }
+
+        hasMsg = true;
+        continue;
+      }
+
+      if (!line.empty() && (line.back() == '\r'))
+      {
+        line.pop_back();
+      }
+
+      // mboxrd escaping, one '>' is removed from lines matching ^>+From
+      const size_t quotes = line.find_first_not_of('>');
+      if ((quotes != std::string::npos) && (quotes > 0) &&
+          (line.compare(quotes, 5, "From ") == 0))
+      {
+        line.erase(0, 1);
+      }
+
+      msg += line + "\r\n";
+    }
+
+    m_Position = m_FromLineRead ? lineStart : m_StreamPos;
+
+    // blank line separating messages is not part of the message
+    if ((msg.size() >= 4) && (msg.compare(msg.size() - 4, 4, "\r\n\r\n") == 0))
+    {
+      msg.resize(msg.size() - 2);
+    }
+
+    if (!hasMsg || (msg == "\r\n"))
+    {
+      msg.clear();
+    }
+  }
+
+  if (msg.empty())
+  {
+    return false;
+  }
+
+  p_Msg = msg;
+  return true;
+}
+
+bool ImportSource::NextFile(std::string& p_Msg)
+{
+  while (m_Position < m_Paths.size())
+  {
+    const std::string& msg = Util::ReadFile(m_Paths.at(m_Position++));
+    if (!msg.empty())
+    {
+      p_Msg = ToCrlf(msg);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool ImportSource::IsMboxFromLine(const std::string& p_Line)
+{
+  return (p_Line.compare(0, 5, "From ") == 0);
+}
+
+std::string ImportSource::ToCrlf(const std::string& p_Str)
+{
+  std::string str;
+  str.reserve(p_Str.size() + (p_Str.size() / 32));
+  for (size_t i = 0; i < p_Str.size(); ++i)
+  {
+    const char c = p_Str.at(i);
+    if ((c == '\n') && ((i == 0) || (p_Str.at(i - 1) != '\r')))
+    {
+      str += '\r';
+    }
+
+    str += c;
+  }
+
+  return str;
+}
@@ -0,0 +1,44 @@
+// importsource.h
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+// Sequential reader of messages to import from an mbox file, a Maildir, a directory of
+// message files or a single message file. Messages are read one at a time with CRLF line
+// endings, and reading can be resumed from the position after any returned message.
+class ImportSource
+{
+public:
+  ImportSource();
+  virtual ~ImportSource();
+
+  bool Open(const std::string& p_Path, uint64_t p_Position = 0);
+  bool Next(std::string& p_Msg);
+  uint64_t GetPosition() const;
+  uint32_t GetProgress() const;
+
+private:
+  bool NextMbox(std::string& p_Msg);
+  bool NextFile(std::string& p_Msg);
+  static bool IsMboxFromLine(const std::string& p_Line);
+  static std::string ToCrlf(const std::string& p_Str);
+
+private:
+  bool m_IsMbox = false;
+  std::ifstream m_Stream;
+  uint64_t m_Size = 0;
+  uint64_t m_StreamPos = 0;
+  bool m_FromLineRead = false;
+  std::vector<std::string> m_Paths;
+  uint64_t m_Position = 0;
+};
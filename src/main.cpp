@@ -5,6 +5,7 @@
 //
 // nmail is distributed under the MIT license, see LICENSE for details.
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 
@@ -117,9 +118,11 @@ int main(int argc, char* argv[])
     {"user", ""},
     {"imap_host", ""},
     {"imap_port", "993"},
+    {"imap_connections", "2"},
     {"smtp_host", ""},
     {"smtp_port", "587"},
     {"smtp_user", ""},
+    {"smtp_idle_timeout", "60"},
     {"save_pass", "0"},
     {"inbox", "INBOX"},
     {"trash", ""},
@@ -130,6 +133,8 @@ int main(int argc, char* argv[])
     {"html_convert_cmd", ""},
     {"ext_viewer_cmd", ""},
     {"prefetch_level", "2"},
+    {"partial_fetch_size", "0"},
+    {"imap_compress", "1"},
     {"verbose_logging", "0"},
     {"pager_cmd", ""},
     {"editor_cmd", ""},
@@ -182,6 +187,7 @@ int main(int argc, char* argv[])
   std::string sent = mainConfig->Get("sent");
   const bool clientStoreSent = (mainConfig->Get("client_store_sent") == "1");
   const bool cacheEncrypt = (mainConfig->Get("cache_encrypt") == "1");
+  const bool imapCompress = (mainConfig->Get("imap_compress") == "1");
   Util::SetHtmlConvertCmd(mainConfig->Get("html_convert_cmd"));
   Util::SetExtViewerCmd(mainConfig->Get("ext_viewer_cmd"));
   Util::SetPagerCmd(mainConfig->Get("pager_cmd"));
@@ -238,11 +244,17 @@ int main(int argc, char* argv[])
   uint16_t imapPort = 0;
   uint16_t smtpPort = 0;
   uint32_t prefetchLevel = 0;
+  uint32_t partialFetchSize = 0;
+  int imapConnections = 1;
+  int smtpIdleTimeout = 0;
   try
   {
     imapPort = std::stoi(mainConfig->Get("imap_port"));
+    imapConnections = std::max(std::stoi(mainConfig->Get("imap_connections")), 1);
     smtpPort = std::stoi(mainConfig->Get("smtp_port"));
     prefetchLevel = std::stoi(mainConfig->Get("prefetch_level"));
+    partialFetchSize = std::stoi(mainConfig->Get("partial_fetch_size")) * 1024;
+    smtpIdleTimeout = std::stoi(mainConfig->Get("smtp_idle_timeout"));
   }
   catch (...)
   {
@@ -309,13 +321,15 @@ int main(int argc, char* argv[])
   Ui ui(inbox, address, prefetchLevel);
 
   std::shared_ptr<ImapManager> imapManager =
-    std::make_shared<ImapManager>(user, pass, imapHost, imapPort, online, cacheEncrypt,
+    std::make_shared<ImapManager>(user, pass, imapHost, imapPort, imapConnections, online,
+                                  cacheEncrypt, partialFetchSize, imapCompress,
                                   std::bind(&Ui::ResponseHandler, std::ref(ui), std::placeholders::_1, std::placeholders::_2),
                                   std::bind(&Ui::ResultHandler, std::ref(ui), std::placeholders::_1, std::placeholders::_2),
                                   std::bind(&Ui::StatusHandler, std::ref(ui), std::placeholders::_1));
 
   std::shared_ptr<SmtpManager> smtpManager =
     std::make_shared<SmtpManager>(smtpUser, smtpPass, smtpHost, smtpPort, name, address, online,
+                                  smtpIdleTimeout,
                                   std::bind(&Ui::SmtpResultHandler, std::ref(ui), std::placeholders::_1),
                                   std::bind(&Ui::StatusHandler, std::ref(ui), std::placeholders::_1));
 
@@ -0,0 +1,606 @@
+// messagestore.cpp
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "messagestore.h"
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "loghelp.h"
+#include "util.h"
+
+static const uint32_t s_RecordMagic = 0x31534d4e; // "NMS1"
+static const uint32_t s_IndexMagic = 0x3149534e; // "NSI1"
+static const size_t s_RecordHeaderSize = 17;
+static const uint64_t s_MaxSegmentSize = 64 * 1024 * 1024;
+static const uint64_t s_MinCompactDeadBytes = 4 * 1024 * 1024;
+static const size_t s_MaxReadSpan = 1024 * 1024;
+static const uint32_t s_MaxUnindexedRecords = 4096;
+
+static void PutU32(std::string& p_Str, uint32_t p_Val)
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    p_Str += static_cast<char>((p_Val >> (8 * i)) & 0xff);
+  }
+}
+
+static void PutU64(std::string& p_Str, uint64_t p_Val)
+{
+  for (int i = 0; i < 8; ++i)
+  {
+    p_Str += static_cast<char>((p_Val >> (8 * i)) & 0xff);
+  }
+}
+
+static uint32_t GetU32(const char* p_Buf)
+{
+  uint32_t val = 0;
+  for (int i = 3; i >= 0; --i)
+  {
+    val = (val << 8) | static_cast<unsigned char>(p_Buf[i]);
+  }
+  return val;
+}
+
+static uint64_t GetU64(const char* p_Buf)
+{
+  uint64_t val = 0;
+  for (int i = 7; i >= 0; --i)
+  {
+    val = (val << 8) | static_cast<unsigned char>(p_Buf[i]);
+  }
+  return val;
+}
+
+static bool PReadAll(int p_Fd, char* p_Buf, size_t p_Len, uint64_t p_Offset)
+{
+  while (p_Len > 0)
+  {
+    ssize_t rv = pread(p_Fd, p_Buf, p_Len, p_Offset);
+    if (rv <= 0) return false;
+
+    p_Buf += rv;
+    p_Len -= rv;
+    p_Offset += rv;
+  }
+
+  return true;
+}
+
+static bool PWriteAll(int p_Fd, const char* p_Buf, size_t p_Len, uint64_t p_Offset)
+{
+  while (p_Len > 0)
+  {
+    ssize_t rv = pwrite(p_Fd, p_Buf, p_Len, p_Offset);
+    if (rv <= 0) return false;
+
+    p_Buf += rv;
+    p_Len -= rv;
+    p_Offset += rv;
+  }
+
+  return true;
+}
+
+MessageStore::MessageStore(const std::string& p_Dir)
+  : m_Dir(p_Dir)
+{
+  Load();
+}
+
+MessageStore::~MessageStore()
+{
+  Flush();
+  CloseSegments();
+}
+
+bool MessageStore::Exists(uint32_t p_Uid, Kind p_Kind) const
+{
+  return (m_Index.find(Key(p_Uid, p_Kind)) != m_Index.end());
+}
+
+std::string MessageStore::Read(uint32_t p_Uid, Kind p_Kind)
+{
+  std::string data;
+  auto it = m_Index.find(Key(p_Uid, p_Kind));
+  if (it != m_Index.end())
+  {
+    ReadRecord(it->second, data);
+  }
+
+  return data;
+}
+
+std::map<uint32_t, std::string> MessageStore::Read(const std::set<uint32_t>& p_Uids, Kind p_Kind)
+{
+  // order lookups by disk position, and read adjacent records with a single pread
+  std::vector<std::pair<uint32_t, Location>> locations;
+  for (auto& uid : p_Uids)
+  {
+    auto it = m_Index.find(Key(uid, p_Kind));
+    if (it != m_Index.end())
+    {
+      locations.push_back(std::make_pair(uid, it->second));
+    }
+  }
+
+  std::sort(locations.begin(), locations.end(),
+            [](const std::pair<uint32_t, Location>& p_Lhs, const std::pair<uint32_t, Location>& p_Rhs)
+  {
+    return (p_Lhs.second.m_Segment != p_Rhs.second.m_Segment)
+      ? (p_Lhs.second.m_Segment < p_Rhs.second.m_Segment)
+      : (p_Lhs.second.m_Offset < p_Rhs.second.m_Offset);
+  });
+
+  std::map<uint32_t, std::string> datas;
+  std::string span;
+  for (size_t i = 0; i < locations.size(); /* increment in loop */)
+  {
+    const Location& first = locations.at(i).second;
+    uint64_t spanEnd = first.m_Offset + first.m_Length;
+    size_t j = i + 1;
+    while ((j < locations.size()) &&
+           (locations.at(j).second.m_Segment == first.m_Segment) &&
+           (locations.at(j).second.m_Offset - spanEnd <= s_RecordHeaderSize) &&
+           (locations.at(j).second.m_Offset + locations.at(j).second.m_Length - first.m_Offset <= s_MaxReadSpan))
+    {
+      spanEnd = locations.at(j).second.m_Offset + locations.at(j).second.m_Length;
+      ++j;
+    }
+
+    Segment* segment = OpenSegment(first.m_Segment, false);
+    span.resize(spanEnd - first.m_Offset);
+    if ((segment != NULL) && PReadAll(segment->m_Fd, &span[0], span.size(), first.m_Offset))
+    {
+      for (size_t k = i; k < j; ++k)
+      {
+        const Location& location = locations.at(k).second;
+        datas[locations.at(k).first] = span.substr(location.m_Offset - first.m_Offset, location.m_Length);
+      }
+    }
+    else
+    {
+      LOG_WARNING("failed to read segment %d offset %llu", first.m_Segment,
+                  (unsigned long long)first.m_Offset);
+    }
+
+    i = j;
+  }
+
+  return datas;
+}
+
+void MessageStore::Write(uint32_t p_Uid, Kind p_Kind, const std::string& p_Data)
+{
+  const uint64_t key = Key(p_Uid, p_Kind);
+  Location location;
+  if (Append(key, false, p_Data, location))
+  {
+    auto it = m_Index.find(key);
+    if (it != m_Index.end())
+    {
+      m_LiveBytes -= (s_RecordHeaderSize + it->second.m_Length);
+      m_DeadBytes += (s_RecordHeaderSize + it->second.m_Length);
+    }
+
+    m_Index[key] = location;
+    m_LiveBytes += (s_RecordHeaderSize + location.m_Length);
+    FlushIfNeeded();
+  }
+}
+
+void MessageStore::Remove(uint32_t p_Uid)
+{
+  // all kinds of a uid are adjacent in the index
+  auto it = m_Index.lower_bound(Key(p_Uid, KindHeader));
+  while ((it != m_Index.end()) && (static_cast<uint32_t>(it->first >> 8) == p_Uid))
+  {
+    auto next = std::next(it);
+    Erase(it);
+    it = next;
+  }
+
+  CompactIfNeeded();
+  FlushIfNeeded();
+}
+
+void MessageStore::RemoveExcept(const std::set<uint32_t>& p_Uids)
+{
+  for (auto it = m_Index.begin(); it != m_Index.end(); /* increment in loop */)
+  {
+    const uint32_t uid = static_cast<uint32_t>(it->first >> 8);
+    if (p_Uids.find(uid) == p_Uids.end())
+    {
+      auto next = std::next(it);
+      Erase(it);
+      it = next;
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  CompactIfNeeded();
+  FlushIfNeeded();
+}
+
+void MessageStore::Flush()
+{
+  if (!m_Dirty) return;
+
+  for (auto& segment : m_Segments)
+  {
+    if (segment.second.m_Fd != -1)
+    {
+      fdatasync(segment.second.m_Fd);
+    }
+  }
+
+  std::string str;
+  PutU32(str, s_IndexMagic);
+  PutU32(str, static_cast<uint32_t>(m_Segments.size()));
+  for (auto& segment : m_Segments)
+  {
+    PutU32(str, segment.first);
+    PutU64(str, segment.second.m_Size);
+  }
+
+  PutU32(str, static_cast<uint32_t>(m_Index.size()));
+  for (auto& entry : m_Index)
+  {
+    PutU64(str, entry.first);
+    PutU32(str, entry.second.m_Segment);
+    PutU64(str, entry.second.m_Offset);
+    PutU32(str, entry.second.m_Length);
+  }
+
+  const std::string& indexPath = GetIndexPath();
+  const std::string& tmpPath = indexPath + ".tmp";
+  Util::WriteFile(tmpPath, str);
+  rename(tmpPath.c_str(), indexPath.c_str());
+
+  m_IndexedSizes.clear();
+  for (auto& segment : m_Segments)
+  {
+    m_IndexedSizes[segment.first] = segment.second.m_Size;
+  }
+
+  m_UnindexedRecords = 0;
+  m_Dirty = false;
+}
+
+void MessageStore::Compact()
+{
+  LOG_DEBUG("compact %s live %llu dead %llu", m_Dir.c_str(), (unsigned long long)m_LiveBytes,
+            (unsigned long long)m_DeadBytes);
+
+  const std::map<uint32_t, Segment> oldSegments = m_Segments;
+  std::vector<std::pair<uint64_t, Location>> entries(m_Index.begin(), m_Index.end());
+  std::sort(entries.begin(), entries.end(),
+            [](const std::pair<uint64_t, Location>& p_Lhs, const std::pair<uint64_t, Location>& p_Rhs)
+  {
+    return (p_Lhs.second.m_Segment != p_Rhs.second.m_Segment)
+      ? (p_Lhs.second.m_Segment < p_Rhs.second.m_Segment)
+      : (p_Lhs.second.m_Offset < p_Rhs.second.m_Offset);
+  });
+
+  // live records are copied to fresh segments, so a crash before the index is flushed
+  // leaves the old segments intact and the copies are picked up by the tail scan.
+  m_CurrentSegment = oldSegments.empty() ? 0 : (oldSegments.rbegin()->first + 1);
+  std::map<uint64_t, Location> newIndex;
+  m_LiveBytes = 0;
+  for (auto& entry : entries)
+  {
+    std::string data;
+    Location location;
+    if (ReadRecord(entry.second, data) && Append(entry.first, false, data, location))
+    {
+      newIndex[entry.first] = location;
+      m_LiveBytes += (s_RecordHeaderSize + location.m_Length);
+    }
+  }
+
+  m_Index.swap(newIndex);
+  m_DeadBytes = 0;
+
+  for (auto& segment : oldSegments)
+  {
+    if (segment.second.m_Fd != -1)
+    {
+      close(segment.second.m_Fd);
+    }
+
+    m_Segments.erase(segment.first);
+  }
+
+  m_Dirty = true;
+  Flush();
+
+  for (auto& segment : oldSegments)
+  {
+    Util::DeleteFile(GetSegmentPath(segment.first));
+  }
+}
+
+std::string MessageStore::GetSegmentPath(uint32_t p_Segment) const
+{
+  return m_Dir + std::string("messages.") + std::to_string(p_Segment);
+}
+
+std::string MessageStore::GetIndexPath() const
+{
+  return m_Dir + std::string("messages.idx");
+}
+
+MessageStore::Segment* MessageStore::OpenSegment(uint32_t p_Segment, bool p_Create)
+{
+  auto it = m_Segments.find(p_Segment);
+  if ((it != m_Segments.end()) && (it->second.m_Fd != -1))
+  {
+    return &it->second;
+  }
+
+  const std::string& path = GetSegmentPath(p_Segment);
+  int fd = open(path.c_str(), O_RDWR | O_CLOEXEC | (p_Create ? O_CREAT : 0), 0600);
+  if (fd == -1)
+  {
+    if (p_Create)
+    {
+      LOG_WARNING("failed to open %s", path.c_str());
+    }
+
+    return NULL;
+  }
+
+  Segment& segment = m_Segments[p_Segment];
+  segment.m_Fd = fd;
+  segment.m_Size = static_cast<uint64_t>(lseek(fd, 0, SEEK_END));
+  return &segment;
+}
+
+void MessageStore::CloseSegments()
+{
+  for (auto& segment : m_Segments)
+  {
+    if (segment.second.m_Fd != -1)
+    {
+      close(segment.second.m_Fd);
+      segment.second.m_Fd = -1;
+    }
+  }
+}
+
+void MessageStore::Load()
+{
+  const std::string& str = Util::ReadFile(GetIndexPath());
+  const char* buf = str.c_str();
+  const char* end = buf + str.size();
+
+  if ((str.size() >= 8) && (GetU32(buf) == s_IndexMagic))
+  {
+    buf += 4;
+    uint32_t segmentCount = GetU32(buf);
+    buf += 4;
+    for (uint32_t i = 0; (i < segmentCount) && ((end - buf) >= 12); ++i)
+    {
+      m_IndexedSizes[GetU32(buf)] = GetU64(buf + 4);
+      buf += 12;
+    }
+
+    uint32_t entryCount = ((end - buf) >= 4) ? GetU32(buf) : 0;
+    buf += 4;
+    for (uint32_t i = 0; (i < entryCount) && ((end - buf) >= 24); ++i)
+    {
+      Location location;
+      const uint64_t key = GetU64(buf);
+      location.m_Segment = GetU32(buf + 8);
+      location.m_Offset = GetU64(buf + 12);
+      location.m_Length = GetU32(buf + 20);
+      m_Index[key] = location;
+      buf += 24;
+    }
+  }
+
+  // pick up segments present on disk, including ones written after the last index snapshot
+  const std::string prefix = "messages.";
+  const std::vector<std::string>& files = Util::ListDir(m_Dir);
+  std::set<uint32_t> segmentIds;
+  for (auto& file : files)
+  {
+    if (file.compare(0, prefix.size(), prefix) != 0) continue;
+
+    const std::string& suffix = file.substr(prefix.size());
+    if (Util::IsInteger(suffix))
+    {
+      segmentIds.insert(static_cast<uint32_t>(Util::ToInteger(suffix)));
+    }
+  }
+
+  for (auto& segmentId : segmentIds)
+  {
+    OpenSegment(segmentId, false);
+  }
+
+  // drop index entries pointing past the end of (or into missing) segments
+  for (auto it = m_Index.begin(); it != m_Index.end(); /* increment in loop */)
+  {
+    auto sit = m_Segments.find(it->second.m_Segment);
+    if ((sit == m_Segments.end()) ||
+        ((it->second.m_Offset + it->second.m_Length) > sit->second.m_Size))
+    {
+      it = m_Index.erase(it);
+      m_Dirty = true;
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  for (auto& segmentId : segmentIds)
+  {
+    auto sit = m_IndexedSizes.find(segmentId);
+    const uint64_t indexedSize = (sit != m_IndexedSizes.end()) ? sit->second : 0;
+    if (m_Segments[segmentId].m_Size > indexedSize)
+    {
+      Scan(segmentId, indexedSize);
+    }
+  }
+
+  uint64_t totalBytes = 0;
+  for (auto& segment : m_Segments)
+  {
+    totalBytes += segment.second.m_Size;
+  }
+
+  m_LiveBytes = 0;
+  for (auto& entry : m_Index)
+  {
+    m_LiveBytes += (s_RecordHeaderSize + entry.second.m_Length);
+  }
+
+  m_DeadBytes = (totalBytes > m_LiveBytes) ? (totalBytes - m_LiveBytes) : 0;
+  m_CurrentSegment = segmentIds.empty() ? 0 : *segmentIds.rbegin();
+}
+
+void MessageStore::Scan(uint32_t p_Segment, uint64_t p_Offset)
+{
+  Segment* segment = OpenSegment(p_Segment, false);
+  if (segment == NULL) return;
+
+  LOG_DEBUG("scan %s from %llu", GetSegmentPath(p_Segment).c_str(), (unsigned long long)p_Offset);
+
+  uint64_t offset = p_Offset;
+  char hdr[s_RecordHeaderSize];
+  while ((offset + s_RecordHeaderSize) <= segment->m_Size)
+  {
+    if (!PReadAll(segment->m_Fd, hdr, sizeof(hdr), offset) || (GetU32(hdr) != s_RecordMagic)) break;
+
+    const uint64_t key = GetU64(hdr + 4);
+    const bool removed = (hdr[12] != 0);
+    const uint32_t length = GetU32(hdr + 13);
+    if ((offset + s_RecordHeaderSize + length) > segment->m_Size) break;
+
+    if (removed)
+    {
+      m_Index.erase(key);
+    }
+    else
+    {
+      Location location;
+      location.m_Segment = p_Segment;
+      location.m_Offset = offset + s_RecordHeaderSize;
+      location.m_Length = length;
+      m_Index[key] = location;
+    }
+
+    offset += s_RecordHeaderSize + length;
+  }
+
+  if (offset < segment->m_Size)
+  {
+    LOG_WARNING("truncating %s at %llu", GetSegmentPath(p_Segment).c_str(),
+                (unsigned long long)offset);
+    if (ftruncate(segment->m_Fd, static_cast<off_t>(offset)) == 0)
+    {
+      segment->m_Size = offset;
+    }
+  }
+
+  m_Dirty = true;
+}
+
+bool MessageStore::Append(uint64_t p_Key, bool p_Removed, const std::string& p_Data,
+                          Location& p_Location)
+{
+  Segment* segment = OpenSegment(m_CurrentSegment, true);
+  if ((segment != NULL) && (segment->m_Size >= s_MaxSegmentSize))
+  {
+    segment = OpenSegment(++m_CurrentSegment, true);
+  }
+
+  if (segment == NULL) return false;
+
+  std::string record;
+  record.reserve(s_RecordHeaderSize + p_Data.size());
+  PutU32(record, s_RecordMagic);
+  PutU64(record, p_Key);
+  record += static_cast<char>(p_Removed ? 1 : 0);
+  PutU32(record, static_cast<uint32_t>(p_Data.size()));
+  record += p_Data;
+
+  if (!PWriteAll(segment->m_Fd, record.c_str(), record.size(), segment->m_Size))
+  {
+    LOG_WARNING("failed to write %s", GetSegmentPath(m_CurrentSegment).c_str());
+    if (ftruncate(segment->m_Fd, static_cast<off_t>(segment->m_Size)) != 0)
+    {
+      LOG_WARNING("failed to truncate %s", GetSegmentPath(m_CurrentSegment).c_str());
+    }
+
+    return false;
+  }
+
+  p_Location.m_Segment = m_CurrentSegment;
+  p_Location.m_Offset = segment->m_Size + s_RecordHeaderSize;
+  p_Location.m_Length = static_cast<uint32_t>(p_Data.size());
+  segment->m_Size += record.size();
+  ++m_UnindexedRecords;
+  m_Dirty = true;
+
+  return true;
+}
+
+bool MessageStore::ReadRecord(const Location& p_Location, std::string& p_Data)
+{
+  Segment* segment = OpenSegment(p_Location.m_Segment, false);
+  if (segment == NULL) return false;
+
+  p_Data.resize(p_Location.m_Length);
+  if ((p_Location.m_Length > 0) &&
+      !PReadAll(segment->m_Fd, &p_Data[0], p_Location.m_Length, p_Location.m_Offset))
+  {
+    LOG_WARNING("failed to read segment %d offset %llu", p_Location.m_Segment,
+                (unsigned long long)p_Location.m_Offset);
+    p_Data.clear();
+    return false;
+  }
+
+  return true;
+}
+
+void MessageStore::Erase(std::map<uint64_t, Location>::iterator p_It)
+{
+  // tombstone keeps removals durable for records appended after the last index snapshot
+  Location location;
+  Append(p_It->first, true, std::string(), location);
+  m_LiveBytes -= (s_RecordHeaderSize + p_It->second.m_Length);
+  m_DeadBytes += (s_RecordHeaderSize + p_It->second.m_Length) + s_RecordHeaderSize;
+  m_Index.erase(p_It);
+}
+
+void MessageStore::FlushIfNeeded()
+{
+  // bound the tail which has to be scanned on next open
+  if (m_UnindexedRecords >= s_MaxUnindexedRecords)
+  {
+    Flush();
+  }
+}
+
+void MessageStore::CompactIfNeeded()
+{
+  if ((m_DeadBytes >= s_MinCompactDeadBytes) && (m_DeadBytes > m_LiveBytes))
+  {
+    Compact();
+  }
+}
@@ -0,0 +1,93 @@
+// messagestore.h
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+
+// Packed per-folder message cache. Records are appended to segment files and located
+// through an in-memory uid index, which is snapshotted to disk on Flush(). Records written
+// after the last snapshot are recovered by scanning the segment tails on open.
+class MessageStore
+{
+public:
+  enum Kind : uint8_t
+  {
+    KindHeader = 0,
+    KindBody = 1,
+    KindParsed = 2,
+    KindStructure = 3,
+    KindPart = 16,
+  };
+
+  // separately fetched parts are stored as kinds following KindPart, one per part index
+  static const size_t MaxParts = 240;
+  static inline bool GetPartKind(size_t p_Index, Kind& p_Kind)
+  {
+    if (p_Index >= MaxParts) return false;
+
+    p_Kind = static_cast<Kind>(KindPart + p_Index);
+    return true;
+  }
+
+  explicit MessageStore(const std::string& p_Dir);
+  virtual ~MessageStore();
+
+  bool Exists(uint32_t p_Uid, Kind p_Kind) const;
+  std::string Read(uint32_t p_Uid, Kind p_Kind);
+  std::map<uint32_t, std::string> Read(const std::set<uint32_t>& p_Uids, Kind p_Kind);
+  void Write(uint32_t p_Uid, Kind p_Kind, const std::string& p_Data);
+  void Remove(uint32_t p_Uid);
+  void RemoveExcept(const std::set<uint32_t>& p_Uids);
+  void Flush();
+  void Compact();
+
+private:
+  struct Location
+  {
+    uint32_t m_Segment = 0;
+    uint64_t m_Offset = 0;
+    uint32_t m_Length = 0;
+  };
+
+  struct Segment
+  {
+    int m_Fd = -1;
+    uint64_t m_Size = 0;
+  };
+
+  static inline uint64_t Key(uint32_t p_Uid, Kind p_Kind)
+  {
+    return (static_cast<uint64_t>(p_Uid) << 8) | static_cast<uint64_t>(p_Kind);
+  }
+
+  std::string GetSegmentPath(uint32_t p_Segment) const;
+  std::string GetIndexPath() const;
+  Segment* OpenSegment(uint32_t p_Segment, bool p_Create);
+  void CloseSegments();
+  void Load();
+  void Scan(uint32_t p_Segment, uint64_t p_Offset);
+  bool Append(uint64_t p_Key, bool p_Removed, const std::string& p_Data, Location& p_Location);
+  bool ReadRecord(const Location& p_Location, std::string& p_Data);
+  void Erase(std::map<uint64_t, Location>::iterator p_It);
+  void FlushIfNeeded();
+  void CompactIfNeeded();
+
+private:
+  std::string m_Dir;
+  std::map<uint64_t, Location> m_Index;
+  std::map<uint32_t, Segment> m_Segments;
+  std::map<uint32_t, uint64_t> m_IndexedSizes;
+  uint32_t m_CurrentSegment = 0;
+  uint64_t m_LiveBytes = 0;
+  uint64_t m_DeadBytes = 0;
+  uint32_t m_UnindexedRecords = 0;
+  bool m_Dirty = false;
+};
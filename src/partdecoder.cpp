@@ -0,0 +1,167 @@
+// partdecoder.cpp
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "partdecoder.h"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+
+#include <libetpan/libetpan.h>
+
+static int GetBase64Value(char p_Char)
+{
+  if ((p_Char >= 'A') && (p_Char <= 'Z')) return p_Char - 'A';
+  if ((p_Char >= 'a') && (p_Char <= 'z')) return p_Char - 'a' + 26;
+  if ((p_Char >= '0') && (p_Char <= '9')) return p_Char - '0' + 52;
+  if (p_Char == '+') return 62;
+  if (p_Char == '/') return 63;
+
+  return -1;
+}
+
+PartDecoder::PartDecoder(int p_Encoding)
+  : m_Encoding(p_Encoding)
+{
+}
+
+PartDecoder::~PartDecoder()
+{
+}
+
+std::string PartDecoder::Decode(const std::string& p_Data)
+{
+  switch (m_Encoding)
+  {
+    case MAILMIME_MECHANISM_BASE64:
+      m_Pending += p_Data;
+      return DecodeBase64(false);
+
+    case MAILMIME_MECHANISM_QUOTED_PRINTABLE:
+      m_Pending += p_Data;
+      return DecodeQuotedPrintable(false);
+
+    default:
+      return p_Data;
+  }
+}
+
+std::string PartDecoder::Finish()
+{
+  switch (m_Encoding)
+  {
+    case MAILMIME_MECHANISM_BASE64:
+      return DecodeBase64(true);
+
+    case MAILMIME_MECHANISM_QUOTED_PRINTABLE:
+      return DecodeQuotedPrintable(true);
+
+    default:
+      return std::string();
+  }
+}
+
+std::string PartDecoder::DecodeBase64(bool p_Finish)
+{
+  // line breaks, padding and other characters outside the alphabet are skipped
+  std::string decoded;
+  uint32_t quantum = 0;
+  int count = 0;
+  size_t consumed = 0;
+  for (size_t i = 0; i < m_Pending.size(); ++i)
+  {
+    const int value = GetBase64Value(m_Pending.at(i));
+    if (value < 0) continue;
+
+    quantum = (quantum << 6) | static_cast<uint32_t>(value);
+    if (++count == 4)
+    {
+      decoded += static_cast<char>((quantum >> 16) & 0xff);
+      decoded += static_cast<char>((quantum >> 8) & 0xff);
+      decoded += static_cast<char>(quantum & 0xff);
+      quantum = 0;
+      count = 0;
+      consumed = i + 1;
+    }
+  }
+
+  if (!p_Finish)
+  {
+    m_Pending.erase(0, consumed);
+    return decoded;
+  }
+
+  // final quantum shortened by padding
+  if (count == 2)
+  {
+    decoded += static_cast<char>((quantum >> 4) & 0xff);
+  }
+  else if (count == 3)
+  {
+    decoded += static_cast<char>((quantum >> 10) & 0xff);
+    decoded += static_cast<char>((quantum >> 2) & 0xff);
+  }
+
+  m_Pending.clear();
+  return decoded;
+}
+
+std::string PartDecoder::DecodeQuotedPrintable(bool p_Finish)
+{
+  std::string decoded;
+  size_t i = 0;
+  while (i < m_Pending.size())
+  {
+    const char c = m_Pending.at(i);
+    if (c != '=')
+    {
+      decoded += c;
+      ++i;
+      continue;
+    }
+
+    // an escape sequence may continue in the next chunk
+    if ((m_Pending.size() - i) < 3)
+    {
+      if (!p_Finish) break;
+
+      const std::string& rest = m_Pending.substr(i + 1);
+      if (!rest.empty() && (rest != "\n") && (rest != "\r"))
+      {
+        decoded += m_Pending.substr(i);
+      }
+
+      i = m_Pending.size();
+      break;
+    }
+
+    const char c1 = m_Pending.at(i + 1);
+    const char c2 = m_Pending.at(i + 2);
+    if ((c1 == '\r') && (c2 == '\n'))
+    {
+      i += 3;
+    }
+    else if (c1 == '\n')
+    {
+      i += 2;
+    }
+    else if (isxdigit(static_cast<unsigned char>(c1)) && isxdigit(static_cast<unsigned char>(c2)))
+    {
+      const char hex[3] = { c1, c2, 0 };
+      decoded += static_cast<char>(strtol(hex, NULL, 16));
+      i += 3;
+    }
+    else
+    {
+      decoded += c;
+      ++i;
+    }
+  }
+
+  m_Pending.erase(0, i);
+  return decoded;
+}
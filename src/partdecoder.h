@@ -0,0 +1,30 @@
+// partdecoder.h
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <string>
+
+// Incremental decoder of transfer encoded message part data. Data may be passed in chunks
+// split at any position, incomplete encoded sequences are held until the next chunk.
+class PartDecoder
+{
+public:
+  explicit PartDecoder(int p_Encoding);
+  virtual ~PartDecoder();
+
+  std::string Decode(const std::string& p_Data);
+  std::string Finish();
+
+private:
+  std::string DecodeBase64(bool p_Finish);
+  std::string DecodeQuotedPrintable(bool p_Finish);
+
+private:
+  int m_Encoding = 0;
+  std::string m_Pending;
+};
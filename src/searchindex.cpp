@@ -0,0 +1,539 @@
+// searchindex.cpp
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "searchindex.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "loghelp.h"
+
+// file layout: header, count * record, term heap, uid heap
+static const uint32_t s_Magic = 0x3158534e; // "NSX1"
+static const size_t s_HeaderSize = 16;
+static const size_t s_RecordSize = 24;
+static const size_t s_MinSaveCount = 512;
+static const size_t s_MinTermLength = 2;
+static const size_t s_MaxTermLength = 48;
+
+// reserved terms listing uids indexed so far, cannot collide with tokenized terms
+static const std::string s_HeaderTerm("\x01h");
+static const std::string s_BodyTerm("\x01" "b");
+
+struct TermRecord
+{
+  uint32_t m_TermOffset;
+  uint32_t m_TermLength;
+  uint32_t m_UidsOffset;
+  uint32_t m_UidsLength;
+  uint32_t m_UidsCount;
+  uint32_t m_LastUid;
+};
+
+static_assert(sizeof(TermRecord) == s_RecordSize, "unexpected term record size");
+
+static void SortUnique(std::vector<uint32_t>& p_Uids)
+{
+  std::sort(p_Uids.begin(), p_Uids.end());
+  p_Uids.erase(std::unique(p_Uids.begin(), p_Uids.end()), p_Uids.end());
+}
+
+static void RemoveUids(std::vector<uint32_t>& p_Uids, const std::set<uint32_t>& p_Removed)
+{
+  if (p_Removed.empty()) return;
+
+  std::vector<uint32_t> uids;
+  uids.reserve(p_Uids.size());
+  std::set_difference(p_Uids.begin(), p_Uids.end(), p_Removed.begin(), p_Removed.end(),
+                      std::back_inserter(uids));
+  p_Uids.swap(uids);
+}
+
+static bool IsShorter(const std::vector<uint32_t>& p_Lhs, const std::vector<uint32_t>& p_Rhs)
+{
+  return p_Lhs.size() < p_Rhs.size();
+}
+
+static bool IsAppendable(const char* p_Record, const std::vector<uint32_t>& p_Uids)
+{
+  TermRecord record;
+  memcpy(&record, p_Record, sizeof(record));
+  return !p_Uids.empty() && (*std::min_element(p_Uids.begin(), p_Uids.end()) > record.m_LastUid);
+}
+
+static void EncodeUids(const std::vector<uint32_t>& p_Uids, uint32_t p_Prev, std::string& p_Heap)
+{
+  uint32_t prev = p_Prev;
+  for (auto& uid : p_Uids)
+  {
+    uint32_t delta = uid - prev;
+    prev = uid;
+    while (delta >= 0x80)
+    {
+      p_Heap.push_back(static_cast<char>((delta & 0x7f) | 0x80));
+      delta >>= 7;
+    }
+
+    p_Heap.push_back(static_cast<char>(delta));
+  }
+}
+
+SearchIndex::SearchIndex()
+{
+}
+
+SearchIndex::~SearchIndex()
+{
+  Unmap();
+}
+
+void SearchIndex::MapFile(const std::string& p_Path)
+{
+  Unmap();
+  m_Buffer.clear();
+  m_Data = NULL;
+  m_Size = 0;
+
+  int fd = open(p_Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return;
+
+  struct stat st;
+  if ((fstat(fd, &st) == 0) && (st.st_size > 0))
+  {
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+    {
+      if (IsValid(static_cast<const char*>(map), st.st_size))
+      {
+        m_Map = map;
+        m_MapSize = st.st_size;
+        m_Data = static_cast<const char*>(map);
+        m_Size = st.st_size;
+      }
+      else
+      {
+        LOG_WARNING("invalid search index %s", p_Path.c_str());
+        munmap(map, st.st_size);
+      }
+    }
+  }
+
+  close(fd);
+}
+
+void SearchIndex::SetData(const std::string& p_Data)
+{
+  Unmap();
+  m_Buffer = p_Data;
+  if (IsValid(m_Buffer.c_str(), m_Buffer.size()))
+  {
+    m_Data = m_Buffer.c_str();
+    m_Size = m_Buffer.size();
+  }
+  else
+  {
+    m_Buffer.clear();
+    m_Data = NULL;
+    m_Size = 0;
+  }
+}
+
+std::string SearchIndex::GetData()
+{
+  // merge pending terms with existing records, both already sorted by term
+  std::string records;
+  std::string termHeap;
+  std::string uidHeap;
+  uint32_t count = 0;
+
+  const uint32_t oldCount = GetCount();
+  uint32_t i = 0;
+  auto it = m_Added.begin();
+  std::string oldTerm = (i < oldCount) ? GetRecordTerm(i) : std::string();
+  while ((i < oldCount) || (it != m_Added.end()))
+  {
+    const int cmp = (i >= oldCount) ? 1 : (it == m_Added.end()) ? -1 : oldTerm.compare(it->first);
+    TermRecord record;
+    record.m_TermOffset = termHeap.size();
+    record.m_UidsOffset = uidHeap.size();
+    if ((cmp <= 0) && m_Removed.empty() &&
+        ((cmp < 0) || IsAppendable(GetRecord(i), it->second)))
+    {
+      // unchanged uid list is copied as is, and new uids appended if all are greater
+      TermRecord oldRecord;
+      memcpy(&oldRecord, GetRecord(i), sizeof(oldRecord));
+      termHeap += oldTerm;
+      uidHeap.append(GetUidHeap() + oldRecord.m_UidsOffset, oldRecord.m_UidsLength);
+      record.m_UidsCount = oldRecord.m_UidsCount;
+      record.m_LastUid = oldRecord.m_LastUid;
+      if (cmp == 0)
+      {
+        std::vector<uint32_t> uids = it->second;
+        SortUnique(uids);
+        EncodeUids(uids, oldRecord.m_LastUid, uidHeap);
+        record.m_UidsCount += uids.size();
+        record.m_LastUid = uids.back();
+      }
+    }
+    else
+    {
+      std::vector<uint32_t> uids;
+      if (cmp <= 0)
+      {
+        GetRecordUids(i, uids);
+      }
+
+      if (cmp >= 0)
+      {
+        uids.insert(uids.end(), it->second.begin(), it->second.end());
+        SortUnique(uids);
+      }
+
+      RemoveUids(uids, m_Removed);
+      if (!uids.empty())
+      {
+        termHeap += (cmp <= 0) ? oldTerm : it->first;
+        EncodeUids(uids, 0, uidHeap);
+        record.m_LastUid = uids.back();
+      }
+
+      record.m_UidsCount = uids.size();
+    }
+
+    if (cmp <= 0)
+    {
+      ++i;
+      oldTerm = (i < oldCount) ? GetRecordTerm(i) : std::string();
+    }
+
+    if (cmp >= 0)
+    {
+      ++it;
+    }
+
+    if (record.m_UidsCount == 0) continue;
+
+    record.m_TermLength = termHeap.size() - record.m_TermOffset;
+    record.m_UidsLength = uidHeap.size() - record.m_UidsOffset;
+    records.append(reinterpret_cast<const char*>(&record), sizeof(record));
+    ++count;
+  }
+
+  std::string data;
+  data.reserve(s_HeaderSize + records.size() + termHeap.size() + uidHeap.size());
+  uint32_t header[4] = { s_Magic, count, static_cast<uint32_t>(termHeap.size()),
+                         static_cast<uint32_t>(uidHeap.size()) };
+  data.append(reinterpret_cast<const char*>(header), sizeof(header));
+  data += records;
+  data += termHeap;
+  data += uidHeap;
+
+  m_Added.clear();
+  m_Removed.clear();
+  m_AddedCount = 0;
+  SetData(data);
+
+  return data;
+}
+
+void SearchIndex::Add(uint32_t p_Uid, const std::string& p_Text, bool p_IsBody)
+{
+  std::set<std::string> terms;
+  Tokenize(p_Text, terms);
+  terms.insert(p_IsBody ? s_BodyTerm : s_HeaderTerm);
+  for (auto& term : terms)
+  {
+    m_Added[term].push_back(p_Uid);
+  }
+
+  m_Removed.erase(p_Uid);
+  ++m_AddedCount;
+}
+
+std::set<uint32_t> SearchIndex::GetIndexed(bool p_IsBody) const
+{
+  std::vector<uint32_t> uids;
+  GetUids(p_IsBody ? s_BodyTerm : s_HeaderTerm, uids);
+  return std::set<uint32_t>(uids.begin(), uids.end());
+}
+
+std::set<uint32_t> SearchIndex::Search(const std::string& p_Query) const
+{
+  std::set<std::string> terms;
+  Tokenize(p_Query, terms);
+  if (terms.empty()) return std::set<uint32_t>();
+
+  std::vector<std::vector<uint32_t>> termUids(terms.size());
+  size_t i = 0;
+  for (auto& term : terms)
+  {
+    GetUids(term, termUids[i]);
+    if (termUids[i].empty()) return std::set<uint32_t>();
+
+    ++i;
+  }
+
+  // intersect starting with the most selective term
+  std::sort(termUids.begin(), termUids.end(), IsShorter);
+
+  std::vector<uint32_t> uids = termUids[0];
+  for (i = 1; (i < termUids.size()) && !uids.empty(); ++i)
+  {
+    std::vector<uint32_t> intersection;
+    std::set_intersection(uids.begin(), uids.end(), termUids[i].begin(), termUids[i].end(),
+                          std::back_inserter(intersection));
+    uids.swap(intersection);
+  }
+
+  return std::set<uint32_t>(uids.begin(), uids.end());
+}
+
+void SearchIndex::RemoveExcept(const std::set<uint32_t>& p_Uids)
+{
+  std::vector<uint32_t> uids;
+  GetUids(s_HeaderTerm, uids);
+  std::vector<uint32_t> bodyUids;
+  GetUids(s_BodyTerm, bodyUids);
+  uids.insert(uids.end(), bodyUids.begin(), bodyUids.end());
+
+  for (auto& uid : uids)
+  {
+    if (p_Uids.find(uid) == p_Uids.end())
+    {
+      m_Removed.insert(uid);
+    }
+  }
+}
+
+void SearchIndex::Remove(uint32_t p_Uid)
+{
+  m_Removed.insert(p_Uid);
+}
+
+bool SearchIndex::NeedsSave() const
+{
+  // amortize rewriting the index by growing the batch with its size
+  uint32_t indexedCount = 0;
+  uint32_t index = 0;
+  if (Find(s_HeaderTerm, index))
+  {
+    TermRecord record;
+    memcpy(&record, GetRecord(index), sizeof(record));
+    indexedCount = record.m_UidsCount;
+  }
+
+  const size_t pending = m_AddedCount + m_Removed.size();
+  return (pending >= std::max(s_MinSaveCount, static_cast<size_t>(indexedCount / 8)));
+}
+
+bool SearchIndex::IsDirty() const
+{
+  return !m_Added.empty() || !m_Removed.empty();
+}
+
+void SearchIndex::Tokenize(const std::string& p_Text, std::set<std::string>& p_Terms)
+{
+  // ascii letters and digits are case folded, non-ascii utf-8 bytes kept as is
+  std::string word;
+  for (size_t i = 0; i <= p_Text.size(); ++i)
+  {
+    const unsigned char ch = (i < p_Text.size()) ? p_Text.at(i) : ' ';
+    if (isalnum(ch) || (ch >= 0x80))
+    {
+      word.push_back(tolower(ch));
+    }
+    else if (!word.empty())
+    {
+      if ((word.size() >= s_MinTermLength) && (word.size() <= s_MaxTermLength))
+      {
+        p_Terms.insert(Stem(word));
+      }
+
+      word.clear();
+    }
+  }
+}
+
+std::string SearchIndex::Stem(const std::string& p_Word)
+{
+  // light suffix stripping for english plurals and verb forms
+  static const std::vector<std::pair<std::string, std::string>> suffixes =
+  {
+    { "sses", "ss" },
+    { "ies", "y" },
+    { "ing", "" },
+    { "ed", "" },
+    { "ly", "" },
+    { "ss", "ss" },
+    { "s", "" },
+  };
+
+  for (auto& ch : p_Word)
+  {
+    if (static_cast<unsigned char>(ch) >= 0x80) return p_Word;
+  }
+
+  for (auto& suffix : suffixes)
+  {
+    const std::string& from = suffix.first;
+    if ((p_Word.size() >= (from.size() + 3)) &&
+        (p_Word.compare(p_Word.size() - from.size(), from.size(), from) == 0))
+    {
+      return p_Word.substr(0, p_Word.size() - from.size()) + suffix.second;
+    }
+  }
+
+  return p_Word;
+}
+
+void SearchIndex::Unmap()
+{
+  if (m_Map != NULL)
+  {
+    munmap(m_Map, m_MapSize);
+    m_Map = NULL;
+    m_MapSize = 0;
+    m_Data = NULL;
+    m_Size = 0;
+  }
+}
+
+bool SearchIndex::IsValid(const char* p_Data, size_t p_Size) const
+{
+  if (p_Size < s_HeaderSize) return false;
+
+  uint32_t header[4];
+  memcpy(header, p_Data, sizeof(header));
+  if ((header[0] != s_Magic) ||
+      ((s_HeaderSize + (static_cast<uint64_t>(header[1]) * s_RecordSize) +
+        header[2] + header[3]) != p_Size)) return false;
+
+  // check all records once, so lookups need no bounds checks
+  const char* records = p_Data + s_HeaderSize;
+  for (uint32_t i = 0; i < header[1]; ++i)
+  {
+    TermRecord record;
+    memcpy(&record, records + (static_cast<size_t>(i) * s_RecordSize), sizeof(record));
+    if (((static_cast<uint64_t>(record.m_TermOffset) + record.m_TermLength) > header[2]) ||
+        ((static_cast<uint64_t>(record.m_UidsOffset) + record.m_UidsLength) > header[3]))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+uint32_t SearchIndex::GetCount() const
+{
+  if (m_Data == NULL) return 0;
+
+  uint32_t count = 0;
+  memcpy(&count, m_Data + 4, sizeof(count));
+  return count;
+}
+
+const char* SearchIndex::GetRecord(uint32_t p_Index) const
+{
+  return m_Data + s_HeaderSize + (static_cast<size_t>(p_Index) * s_RecordSize);
+}
+
+std::string SearchIndex::GetRecordTerm(uint32_t p_Index) const
+{
+  TermRecord record;
+  memcpy(&record, GetRecord(p_Index), sizeof(record));
+
+  const char* termHeap = m_Data + s_HeaderSize + (static_cast<size_t>(GetCount()) * s_RecordSize);
+  return std::string(termHeap + record.m_TermOffset, record.m_TermLength);
+}
+
+bool SearchIndex::Find(const std::string& p_Term, uint32_t& p_Index) const
+{
+  uint32_t lo = 0;
+  uint32_t hi = GetCount();
+  while (lo < hi)
+  {
+    const uint32_t mid = lo + ((hi - lo) / 2);
+    const int cmp = GetRecordTerm(mid).compare(p_Term);
+    if (cmp == 0)
+    {
+      p_Index = mid;
+      return true;
+    }
+    else if (cmp < 0)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+
+  return false;
+}
+
+const char* SearchIndex::GetUidHeap() const
+{
+  uint32_t header[4];
+  memcpy(header, m_Data, sizeof(header));
+  return m_Data + s_HeaderSize + (static_cast<size_t>(header[1]) * s_RecordSize) + header[2];
+}
+
+void SearchIndex::GetRecordUids(uint32_t p_Index, std::vector<uint32_t>& p_Uids) const
+{
+  TermRecord record;
+  memcpy(&record, GetRecord(p_Index), sizeof(record));
+
+  const unsigned char* pos =
+    reinterpret_cast<const unsigned char*>(GetUidHeap() + record.m_UidsOffset);
+  const unsigned char* end = pos + record.m_UidsLength;
+  p_Uids.reserve(p_Uids.size() + record.m_UidsCount);
+  uint32_t uid = 0;
+  while (pos < end)
+  {
+    uint32_t delta = 0;
+    int shift = 0;
+    while ((pos < end) && (*pos & 0x80) && (shift < 28))
+    {
+      delta |= static_cast<uint32_t>(*pos++ & 0x7f) << shift;
+      shift += 7;
+    }
+
+    if (pos == end) break;
+
+    delta |= static_cast<uint32_t>(*pos++) << shift;
+    uid += delta;
+    p_Uids.push_back(uid);
+  }
+}
+
+void SearchIndex::GetUids(const std::string& p_Term, std::vector<uint32_t>& p_Uids) const
+{
+  uint32_t index = 0;
+  if (Find(p_Term, index))
+  {
+    GetRecordUids(index, p_Uids);
+  }
+
+  auto it = m_Added.find(p_Term);
+  if (it != m_Added.end())
+  {
+    p_Uids.insert(p_Uids.end(), it->second.begin(), it->second.end());
+    SortUnique(p_Uids);
+  }
+
+  RemoveUids(p_Uids, m_Removed);
+}
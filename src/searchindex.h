@@ -0,0 +1,60 @@
+// searchindex.h
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Per-folder inverted index of stemmed terms from message headers and text bodies. Stored as
+// a table of fixed-width term records sorted by term, followed by a term heap and delta coded
+// uid lists, which can be used directly from a memory mapped file, or from a decrypted buffer.
+class SearchIndex
+{
+public:
+  SearchIndex();
+  virtual ~SearchIndex();
+
+  void MapFile(const std::string& p_Path);
+  void SetData(const std::string& p_Data);
+  std::string GetData();
+
+  void Add(uint32_t p_Uid, const std::string& p_Text, bool p_IsBody);
+  std::set<uint32_t> GetIndexed(bool p_IsBody) const;
+  std::set<uint32_t> Search(const std::string& p_Query) const;
+  void RemoveExcept(const std::set<uint32_t>& p_Uids);
+  void Remove(uint32_t p_Uid);
+  bool NeedsSave() const;
+  bool IsDirty() const;
+
+  static void Tokenize(const std::string& p_Text, std::set<std::string>& p_Terms);
+  static std::string Stem(const std::string& p_Word);
+
+private:
+  void Unmap();
+  bool IsValid(const char* p_Data, size_t p_Size) const;
+  uint32_t GetCount() const;
+  const char* GetRecord(uint32_t p_Index) const;
+  std::string GetRecordTerm(uint32_t p_Index) const;
+  bool Find(const std::string& p_Term, uint32_t& p_Index) const;
+  const char* GetUidHeap() const;
+  void GetRecordUids(uint32_t p_Index, std::vector<uint32_t>& p_Uids) const;
+  void GetUids(const std::string& p_Term, std::vector<uint32_t>& p_Uids) const;
+
+private:
+  const char* m_Data = NULL;
+  size_t m_Size = 0;
+  void* m_Map = NULL;
+  size_t m_MapSize = 0;
+  std::string m_Buffer;
+
+  std::map<std::string, std::vector<uint32_t>> m_Added;
+  std::set<uint32_t> m_Removed;
+  uint32_t m_AddedCount = 0;
+};
@@ -7,6 +7,9 @@
 
 #include "serialized.h"
 
+// binary format header, a nul byte never occurs in the legacy hex text format
+static const std::string s_BinaryHeader("\0NS\1", 4);
+
 Serialized::Serialized()
 {
 }
@@ -19,17 +22,22 @@ Serialized::Serialized(const std::string &p_Path)
 
 Serialized::Serialized(const Serialized &p_Serialized)
   : m_String(p_Serialized.m_String)
+  , m_Pos(p_Serialized.m_Pos)
+  , m_Binary(p_Serialized.m_Binary)
 {
 }
 
 void Serialized::Clear()
 {
   m_String.clear();
+  m_Pos = 0;
+  m_Binary = false;
 }
 
 void Serialized::FromString(const std::string &p_String)
 {
   m_String = p_String;
+  DetectFormat();
 }
 
 std::string Serialized::ToString()
@@ -39,41 +47,124 @@ std::string Serialized::ToString()
 
 void Serialized::Load(const std::string &p_Path)
 {
-  std::ifstream file(p_Path);
+  std::ifstream file(p_Path, std::ios::binary);
   std::stringstream ss;
   ss << file.rdbuf();
   m_String = ss.str();
+  DetectFormat();
 }
 
 void Serialized::Save(const std::string &p_Path)
 {
   const std::string& path = !p_Path.empty() ? p_Path : m_Path;
-  std::ofstream file(path);
+  std::ofstream file(path, std::ios::binary);
   file << m_String;
 }
 
 std::string Serialized::ToHex(const std::string &p_String)
 {
-  std::ostringstream oss;
-  for(const char& ch : p_String)
+  static const char* digits = "0123456789ABCDEF";
+  std::string result;
+  result.reserve(p_String.size() * 2);
+  for (const char& ch : p_String)
   {
-    char buf[3] = { 0 };
-    snprintf(buf, sizeof(buf), "%02X", (unsigned char)ch);
-    oss << buf;
+    result += digits[((unsigned char)ch) >> 4];
+    result += digits[((unsigned char)ch) & 0xf];
   }
 
-  return oss.str();
+  return result;
 }
 
 std::string Serialized::FromHex(const std::string &p_String)
 {
   std::string result;
-  std::istringstream iss(p_String);
+  result.reserve(p_String.size() / 2);
   char buf[3] = { 0 };
-  while (iss.read(buf, 2))
+  for (size_t i = 0; (i + 1) < p_String.size(); i += 2)
   {
+    buf[0] = p_String[i];
+    buf[1] = p_String[i + 1];
     result += static_cast<char>(strtol(buf, NULL, 16) & 0xff);
   }
 
   return result;
 }
+
+void Serialized::BeginWrite()
+{
+  if (m_String.empty())
+  {
+    m_String = s_BinaryHeader;
+    m_Pos = s_BinaryHeader.size();
+    m_Binary = true;
+  }
+}
+
+void Serialized::DetectFormat()
+{
+  // data written before the binary format is still read, and converted on next save
+  m_Binary = (m_String.compare(0, s_BinaryHeader.size(), s_BinaryHeader) == 0);
+  m_Pos = m_Binary ? s_BinaryHeader.size() : 0;
+}
+
+bool Serialized::ReadLine(std::string& p_Line)
+{
+  if (m_Pos >= m_String.size()) return false;
+
+  size_t end = m_String.find('\n', m_Pos);
+  if (end == std::string::npos)
+  {
+    end = m_String.size();
+  }
+
+  p_Line = m_String.substr(m_Pos, end - m_Pos);
+  m_Pos = end + 1;
+  return true;
+}
+
+void Serialized::WriteVarint(std::string& p_String, uint64_t p_Value)
+{
+  while (p_Value >= 0x80)
+  {
+    p_String += static_cast<char>((p_Value & 0x7f) | 0x80);
+    p_Value >>= 7;
+  }
+
+  p_String += static_cast<char>(p_Value);
+}
+
+bool Serialized::ReadVarint(const std::string& p_String, size_t& p_Pos, uint64_t& p_Value)
+{
+  p_Value = 0;
+  for (int shift = 0; (shift < 64) && (p_Pos < p_String.size()); shift += 7)
+  {
+    const uint8_t byte = static_cast<uint8_t>(p_String[p_Pos++]);
+    p_Value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+
+  p_Pos = p_String.size();
+  return false;
+}
+
+void Serialized::WriteBytes(std::string& p_String, const std::string& p_Value)
+{
+  WriteVarint(p_String, p_Value.size());
+  p_String += p_Value;
+}
+
+bool Serialized::ReadBytes(const std::string& p_String, size_t& p_Pos, std::string& p_Value)
+{
+  uint64_t size = 0;
+  if (!ReadVarint(p_String, p_Pos, size)) return false;
+
+  if (size > (p_String.size() - p_Pos))
+  {
+    p_Pos = p_String.size();
+    return false;
+  }
+
+  p_Value.assign(p_String, p_Pos, size);
+  p_Pos += size;
+  return true;
+}
@@ -12,6 +12,7 @@
 #include <map>
 #include <set>
 #include <sstream>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -31,9 +32,8 @@ public:
   template <typename T>
   friend Serialized& operator<<(Serialized& p_Serialized, const T& p_Value)
   {
-    std::string string;
-    FromVal(p_Value, string);
-    p_Serialized.m_String += ToHex(string) + "\n";
+    p_Serialized.BeginWrite();
+    WriteVal(p_Serialized.m_String, p_Value);
 
     return p_Serialized;
   }
@@ -41,13 +41,12 @@ public:
   template <typename T>
   friend Serialized& operator<<(Serialized& p_Serialized, const std::vector<T>& p_Vector)
   {
+    p_Serialized.BeginWrite();
+    WriteVarint(p_Serialized.m_String, p_Vector.size());
     for (auto& value : p_Vector)
     {
-      std::string string;
-      FromVal(value, string);
-      p_Serialized.m_String += ToHex(string) + " ";
+      WriteVal(p_Serialized.m_String, value);
     }
-    p_Serialized.m_String += "\n";
     
     return p_Serialized;
   }
@@ -55,13 +54,13 @@ public:
   template <typename T>
   friend Serialized& operator<<(Serialized& p_Serialized, const std::set<T>& p_Set)
   {
+    p_Serialized.BeginWrite();
+    WriteVarint(p_Serialized.m_String, p_Set.size());
+    T prev = T();
     for (auto& value : p_Set)
     {
-      std::string string;
-      FromVal(value, string);
-      p_Serialized.m_String += ToHex(string) + " ";
+      WriteKey(p_Serialized.m_String, value, prev, IsDeltaCoded<T>());
     }
-    p_Serialized.m_String += "\n";
     
     return p_Serialized;
   }
@@ -69,15 +68,14 @@ public:
   template <typename T, typename U>
   friend Serialized& operator<<(Serialized& p_Serialized, const std::map<T, U>& p_Map)
   {
+    p_Serialized.BeginWrite();
+    WriteVarint(p_Serialized.m_String, p_Map.size());
+    T prev = T();
     for (auto& value : p_Map)
     {
-      std::string string;
-      FromVal(value.first, string);
-      p_Serialized.m_String += ToHex(string) + " ";
-      FromVal(value.second, string);
-      p_Serialized.m_String += ToHex(string) + " ";
+      WriteKey(p_Serialized.m_String, value.first, prev, IsDeltaCoded<T>());
+      WriteVal(p_Serialized.m_String, value.second);
     }
-    p_Serialized.m_String += "\n";
     
     return p_Serialized;
   }
@@ -85,12 +83,17 @@ public:
   template <typename T>
   friend Serialized& operator>>(Serialized& p_Serialized, T& p_Value)
   {
-    std::istringstream iss(p_Serialized.m_String);
-    std::string line;
-    if (std::getline(iss, line))
+    if (p_Serialized.m_Binary)
     {
-      ToVal(FromHex(line), p_Value);
-      p_Serialized.m_String = p_Serialized.m_String.substr(line.size() + 1);
+      ReadVal(p_Serialized.m_String, p_Serialized.m_Pos, p_Value);
+    }
+    else
+    {
+      std::string line;
+      if (p_Serialized.ReadLine(line))
+      {
+        ToVal(FromHex(line), p_Value);
+      }
     }
         
     return p_Serialized;
@@ -99,20 +102,34 @@ public:
   template <typename T>
   friend Serialized& operator>>(Serialized& p_Serialized, std::vector<T>& p_Vector)
   {
-    std::istringstream iss(p_Serialized.m_String);
-    std::string line;
-    if (std::getline(iss, line))
+    if (p_Serialized.m_Binary)
     {
-      std::istringstream issl(line);
-      std::string word;
-      while (issl >> word)
+      uint64_t count = 0;
+      if (ReadVarint(p_Serialized.m_String, p_Serialized.m_Pos, count))
       {
-        T value;
-        ToVal(FromHex(word), value);
-        p_Vector.push_back(value);
+        for (uint64_t i = 0; i < count; ++i)
+        {
+          T value = T();
+          if (!ReadVal(p_Serialized.m_String, p_Serialized.m_Pos, value)) break;
+
+          p_Vector.push_back(value);
+        }
+      }
+    }
+    else
+    {
+      std::string line;
+      if (p_Serialized.ReadLine(line))
+      {
+        std::istringstream issl(line);
+        std::string word;
+        while (issl >> word)
+        {
+          T value;
+          ToVal(FromHex(word), value);
+          p_Vector.push_back(value);
+        }
       }
-      
-      p_Serialized.m_String = p_Serialized.m_String.substr(line.size() + 1);
     }
     
     return p_Serialized;
@@ -121,20 +138,36 @@ public:
   template <typename T>
   friend Serialized& operator>>(Serialized& p_Serialized, std::set<T>& p_Set)
   {
-    std::istringstream iss(p_Serialized.m_String);
-    std::string line;
-    if (std::getline(iss, line))
+    if (p_Serialized.m_Binary)
     {
-      std::istringstream issl(line);
-      std::string word;
-      while (issl >> word)
+      uint64_t count = 0;
+      if (ReadVarint(p_Serialized.m_String, p_Serialized.m_Pos, count))
       {
-        T value;
-        ToVal(FromHex(word), value);
-        p_Set.insert(value);
+        T prev = T();
+        for (uint64_t i = 0; i < count; ++i)
+        {
+          T value = T();
+          if (!ReadKey(p_Serialized.m_String, p_Serialized.m_Pos, value, prev,
+                       IsDeltaCoded<T>())) break;
+
+          p_Set.insert(p_Set.end(), value);
+        }
+      }
+    }
+    else
+    {
+      std::string line;
+      if (p_Serialized.ReadLine(line))
+      {
+        std::istringstream issl(line);
+        std::string word;
+        while (issl >> word)
+        {
+          T value;
+          ToVal(FromHex(word), value);
+          p_Set.insert(value);
+        }
       }
-      
-      p_Serialized.m_String = p_Serialized.m_String.substr(line.size() + 1);
     }
     
     return p_Serialized;
@@ -143,22 +176,40 @@ public:
   template <typename T, typename U>
   friend Serialized& operator>>(Serialized& p_Serialized, std::map<T, U>& p_Map)
   {
-    std::istringstream iss(p_Serialized.m_String);
-    std::string line;
-    if (std::getline(iss, line))
+    if (p_Serialized.m_Binary)
     {
-      std::istringstream issl(line);
-      std::string firstWord, secondWord;
-      while ((issl >> firstWord) && (issl >> secondWord))
+      uint64_t count = 0;
+      if (ReadVarint(p_Serialized.m_String, p_Serialized.m_Pos, count))
       {
-        T firstValue;
-        U secondValue;
-        ToVal(FromHex(firstWord), firstValue);
-        ToVal(FromHex(secondWord), secondValue);
-        p_Map.insert(std::pair<T, U>(firstValue, secondValue));
+        T prev = T();
+        for (uint64_t i = 0; i < count; ++i)
+        {
+          T firstValue = T();
+          U secondValue = U();
+          if (!ReadKey(p_Serialized.m_String, p_Serialized.m_Pos, firstValue, prev,
+                       IsDeltaCoded<T>()) ||
+              !ReadVal(p_Serialized.m_String, p_Serialized.m_Pos, secondValue)) break;
+
+          p_Map.insert(p_Map.end(), std::pair<T, U>(firstValue, secondValue));
+        }
+      }
+    }
+    else
+    {
+      std::string line;
+      if (p_Serialized.ReadLine(line))
+      {
+        std::istringstream issl(line);
+        std::string firstWord, secondWord;
+        while ((issl >> firstWord) && (issl >> secondWord))
+        {
+          T firstValue;
+          U secondValue;
+          ToVal(FromHex(firstWord), firstValue);
+          ToVal(FromHex(secondWord), secondValue);
+          p_Map.insert(std::pair<T, U>(firstValue, secondValue));
+        }
       }
-      
-      p_Serialized.m_String = p_Serialized.m_String.substr(line.size() + 1);
     }
     
     return p_Serialized;
@@ -169,6 +220,111 @@ public:
   static std::string FromHex(const std::string& p_String);
 
 private:
+  // sorted unsigned integer keys (uids) are stored as deltas from the previous key
+  template <typename T>
+  struct IsDeltaCoded
+    : std::integral_constant<bool, std::is_integral<T>::value && std::is_unsigned<T>::value>
+  {
+  };
+
+  void BeginWrite();
+  void DetectFormat();
+  bool ReadLine(std::string& p_Line);
+
+  static void WriteVarint(std::string& p_String, uint64_t p_Value);
+  static bool ReadVarint(const std::string& p_String, size_t& p_Pos, uint64_t& p_Value);
+  static void WriteBytes(std::string& p_String, const std::string& p_Value);
+  static bool ReadBytes(const std::string& p_String, size_t& p_Pos, std::string& p_Value);
+
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type
+  WriteVal(std::string& p_String, const T& p_Value)
+  {
+    WriteVarint(p_String, static_cast<uint64_t>(p_Value));
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+  WriteVal(std::string& p_String, const T& p_Value)
+  {
+    const int64_t value = static_cast<int64_t>(p_Value);
+    WriteVarint(p_String, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+  }
+
+  template <typename T>
+  static typename std::enable_if<!std::is_integral<T>::value>::type
+  WriteVal(std::string& p_String, const T& p_Value)
+  {
+    std::string string;
+    FromVal(p_Value, string);
+    WriteBytes(p_String, string);
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, bool>::type
+  ReadVal(const std::string& p_String, size_t& p_Pos, T& p_Value)
+  {
+    uint64_t value = 0;
+    if (!ReadVarint(p_String, p_Pos, value)) return false;
+
+    p_Value = static_cast<T>(value);
+    return true;
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, bool>::type
+  ReadVal(const std::string& p_String, size_t& p_Pos, T& p_Value)
+  {
+    uint64_t value = 0;
+    if (!ReadVarint(p_String, p_Pos, value)) return false;
+
+    p_Value = static_cast<T>(static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1));
+    return true;
+  }
+
+  template <typename T>
+  static typename std::enable_if<!std::is_integral<T>::value, bool>::type
+  ReadVal(const std::string& p_String, size_t& p_Pos, T& p_Value)
+  {
+    std::string string;
+    if (!ReadBytes(p_String, p_Pos, string)) return false;
+
+    ToVal(string, p_Value);
+    return true;
+  }
+
+  template <typename T>
+  static void WriteKey(std::string& p_String, const T& p_Value, T& p_Prev, std::true_type)
+  {
+    WriteVarint(p_String, static_cast<uint64_t>(p_Value - p_Prev));
+    p_Prev = p_Value;
+  }
+
+  template <typename T>
+  static void WriteKey(std::string& p_String, const T& p_Value, T& /*p_Prev*/, std::false_type)
+  {
+    WriteVal(p_String, p_Value);
+  }
+
+  template <typename T>
+  static bool ReadKey(const std::string& p_String, size_t& p_Pos, T& p_Value, T& p_Prev,
+                      std::true_type)
+  {
+    uint64_t delta = 0;
+    if (!ReadVarint(p_String, p_Pos, delta)) return false;
+
+    p_Value = static_cast<T>(p_Prev + delta);
+    p_Prev = p_Value;
+    return true;
+  }
+
+  template <typename T>
+  static bool ReadKey(const std::string& p_String, size_t& p_Pos, T& p_Value, T& /*p_Prev*/,
+                      std::false_type)
+  {
+    return ReadVal(p_String, p_Pos, p_Value);
+  }
+
   template <typename T>
   static void ToVal(const std::string& p_String, T& p_Value)
   {
@@ -187,6 +343,8 @@ private:
 private:
   std::string m_Path;
   std::string m_String;
+  size_t m_Pos = 0;
+  bool m_Binary = false;
 };
 
 
@@ -14,21 +14,28 @@
 #include "log.h"
 #include "loghelp.h"
 
+static const bool s_EnableEsmtp = true;
+static const bool s_EnableLmtp = !s_EnableEsmtp;
+
 Smtp::Smtp(const std::string &p_User, const std::string &p_Pass, const std::string &p_Host,
-           const uint16_t p_Port, const std::string &p_Name, const std::string &p_Address)
+           const uint16_t p_Port, const std::string &p_Name, const std::string &p_Address,
+           const int p_IdleTimeout)
   : m_User(p_User)
   , m_Pass(p_Pass)
   , m_Host(p_Host)
   , m_Port(p_Port)
   , m_Name(p_Name)
   , m_Address(p_Address)
+  , m_IdleTimeout(p_IdleTimeout)
 {
-  LOG_DEBUG_FUNC(STR(p_User, "***" /*p_Pass*/, p_Host, p_Port, p_Name, p_Address));
+  LOG_DEBUG_FUNC(STR(p_User, "***" /*p_Pass*/, p_Host, p_Port, p_Name, p_Address,
+                     p_IdleTimeout));
 }
 
 Smtp::~Smtp()
 {
   LOG_DEBUG_FUNC(STR());
+  Disconnect(false);
 }
 
 bool Smtp::Send(const std::string& p_Subject, const std::string& p_Message,
@@ -53,155 +60,333 @@ bool Smtp::Send(const std::string& p_Subject, const std::string& p_Message,
   return SendMessage(data, recipients);
 }
 
-bool Smtp::SendMessage(const std::string &p_Data, const std::vector<Contact> &p_Recipients)
+void Smtp::CheckIdle()
 {
-  LOG_DEBUG_FUNC(STR());
-  LOG_TRACE_FUNC(STR(p_Data, p_Recipients));
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if ((m_Smtp != NULL) && ((time(NULL) - m_LastUse) >= m_IdleTimeout))
+  {
+    LOG_DEBUG("close idle session");
+    Disconnect(true);
+  }
+}
+
+void Smtp::Logout()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  Disconnect(true);
+}
+
+bool Smtp::Connect()
+{
+  if (m_Smtp != NULL)
+  {
+    if ((time(NULL) - m_LastUse) >= m_IdleTimeout)
+    {
+      Disconnect(true);
+    }
+    else if (mailsmtp_reset(m_Smtp) == MAILSMTP_NO_ERROR)
+    {
+      // reset both verifies the connection and clears any unfinished transaction
+      LOG_DEBUG("reuse session");
+      return true;
+    }
+    else
+    {
+      LOG_DEBUG("session stale, reconnecting");
+      Disconnect(false);
+    }
+  }
 
   const bool enableSsl = (m_Port == 465);
   const bool enableTls = !enableSsl;
-  const bool enableEsmtp = true;
-  const bool enableLmtp = !enableEsmtp;
 
-  mailsmtp *smtp = LOG_IF_NULL(mailsmtp_new(0, NULL));
-  if (smtp == NULL) return false;
+  m_Smtp = LOG_IF_NULL(mailsmtp_new(0, NULL));
+  if (m_Smtp == NULL) return false;
 
   if (Log::GetTraceEnabled())
   {
-    mailsmtp_set_logger(smtp, Logger, NULL);
+    mailsmtp_set_logger(m_Smtp, Logger, NULL);
   }
   
   int rv = MAILSMTP_NO_ERROR;
   if (enableSsl)
   {
-    rv = LOG_IF_SMTP_ERR(mailsmtp_ssl_connect(smtp, m_Host.c_str(), m_Port));
+    rv = LOG_IF_SMTP_ERR(mailsmtp_ssl_connect(m_Smtp, m_Host.c_str(), m_Port));
   }
   else
   {
-    rv = LOG_IF_SMTP_ERR(mailsmtp_socket_connect(smtp, m_Host.c_str(), m_Port));
+    rv = LOG_IF_SMTP_ERR(mailsmtp_socket_connect(m_Smtp, m_Host.c_str(), m_Port));
   }
 
-  if (rv != MAILSMTP_NO_ERROR) return false;
+  if (rv != MAILSMTP_NO_ERROR)
+  {
+    Disconnect(false);
+    return false;
+  }
 
-  bool esmtpMode = false;
+  m_EsmtpMode = false;
   const std::string& hostname = Util::GetHostname();
-  if (enableLmtp)
+  if (s_EnableLmtp)
   {
-    rv = LOG_IF_SMTP_ERR(mailesmtp_lhlo(smtp, hostname.c_str()));
+    rv = LOG_IF_SMTP_ERR(mailesmtp_lhlo(m_Smtp, hostname.c_str()));
   }
-  else if (enableEsmtp && (rv = LOG_IF_SMTP_ERR(mailesmtp_ehlo(smtp))) == MAILSMTP_NO_ERROR)
+  else if (s_EnableEsmtp && (rv = LOG_IF_SMTP_ERR(mailesmtp_ehlo(m_Smtp))) == MAILSMTP_NO_ERROR)
   {
-    esmtpMode = true;
+    m_EsmtpMode = true;
   }
-  else if (!enableEsmtp || (rv == MAILSMTP_ERROR_NOT_IMPLEMENTED))
+  else if (!s_EnableEsmtp || (rv == MAILSMTP_ERROR_NOT_IMPLEMENTED))
   {
-    rv = LOG_IF_SMTP_ERR(mailsmtp_helo(smtp));
+    rv = LOG_IF_SMTP_ERR(mailsmtp_helo(m_Smtp));
   }
 
-  if (rv != MAILSMTP_NO_ERROR) return false;
+  if (rv != MAILSMTP_NO_ERROR)
+  {
+    Disconnect(false);
+    return false;
+  }
 
-  if (esmtpMode && enableTls)
+  if (m_EsmtpMode && enableTls)
   {
-    rv = LOG_IF_SMTP_ERR(mailsmtp_socket_starttls(smtp));
+    rv = LOG_IF_SMTP_ERR(mailsmtp_socket_starttls(m_Smtp));
 
-    if (rv != MAILSMTP_NO_ERROR) return false;
+    if (rv != MAILSMTP_NO_ERROR)
+    {
+      Disconnect(false);
+      return false;
+    }
 
-    if (enableLmtp)
+    if (s_EnableLmtp)
     {
-      rv = LOG_IF_SMTP_ERR(mailesmtp_lhlo(smtp, hostname.c_str()));
+      rv = LOG_IF_SMTP_ERR(mailesmtp_lhlo(m_Smtp, hostname.c_str()));
     }
-    else if (enableEsmtp && ((rv = LOG_IF_SMTP_ERR(mailesmtp_ehlo(smtp))) == MAILSMTP_NO_ERROR))
+    else if (s_EnableEsmtp &&
+             ((rv = LOG_IF_SMTP_ERR(mailesmtp_ehlo(m_Smtp))) == MAILSMTP_NO_ERROR))
     {
-      esmtpMode = true;
+      m_EsmtpMode = true;
     }
-    else if (!enableEsmtp || rv == MAILSMTP_ERROR_NOT_IMPLEMENTED)
+    else if (!s_EnableEsmtp || rv == MAILSMTP_ERROR_NOT_IMPLEMENTED)
     {
-      rv = LOG_IF_SMTP_ERR(mailsmtp_helo(smtp));
+      rv = LOG_IF_SMTP_ERR(mailsmtp_helo(m_Smtp));
     }
 
-    if (rv != MAILSMTP_NO_ERROR) return false;
+    if (rv != MAILSMTP_NO_ERROR)
+    {
+      Disconnect(false);
+      return false;
+    }
   }
 
-  if (esmtpMode)
+  if (m_EsmtpMode)
   {
-    LOG_DEBUG("smtp->auth = 0x%x", smtp->auth);
+    LOG_DEBUG("smtp->auth = 0x%x", m_Smtp->auth);
 
-    rv = LOG_IF_SMTP_ERR(mailsmtp_auth(smtp, m_User.c_str(), m_Pass.c_str()));
+    rv = LOG_IF_SMTP_ERR(mailsmtp_auth(m_Smtp, m_User.c_str(), m_Pass.c_str()));
 
-    if (rv != MAILSMTP_NO_ERROR) return false;
+    if (rv != MAILSMTP_NO_ERROR)
+    {
+      Disconnect(false);
+      return false;
+    }
   }
 
+  LOG_DEBUG("smtp->esmtp = 0x%x", m_Smtp->esmtp);
+
+  return true;
+}
+
+void Smtp::Disconnect(bool p_Quit)
+{
+  if (m_Smtp == NULL) return;
+
+  if (p_Quit)
+  {
+    mailsmtp_quit(m_Smtp);
+  }
+
+  mailsmtp_free(m_Smtp);
+  m_Smtp = NULL;
+}
+
+bool Smtp::SendMessage(const std::string &p_Data, const std::vector<Contact> &p_Recipients)
+{
+  LOG_DEBUG_FUNC(STR());
+  LOG_TRACE_FUNC(STR(p_Data, p_Recipients));
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+
+  if (!Connect()) return false;
+
   static int msgid = 0;
-  std::string envid = std::to_string(++msgid) + std::string("@") + hostname;
+  std::string envid = std::to_string(++msgid) + std::string("@") + Util::GetHostname();
+
+  bool rv = false;
+  if (m_EsmtpMode && (m_Smtp->esmtp & MAILSMTP_ESMTP_PIPELINING))
+  {
+    rv = SendEnvelopePipelined(envid, p_Recipients) && SendData(p_Data, p_Recipients);
+  }
+  else
+  {
+    rv = SendEnvelope(envid, p_Recipients) && SendData(p_Data, p_Recipients);
+  }
+
+  m_LastUse = time(NULL);
+
+  if (!rv)
+  {
+    // dropping the connection aborts a partially accepted transaction
+    Disconnect(false);
+    return false;
+  }
 
-  if (esmtpMode)
+  if (m_IdleTimeout <= 0)
   {
-    rv = LOG_IF_SMTP_ERR(mailesmtp_mail(smtp, m_Address.c_str(), 1, envid.c_str()));
+    Disconnect(true);
+  }
+
+  LOG_DEBUG("send success");
+
+  return true;
+}
+
+bool Smtp::SendEnvelope(const std::string& p_EnvId, const std::vector<Contact>& p_Recipients)
+{
+  int rv = MAILSMTP_NO_ERROR;
+  if (m_EsmtpMode)
+  {
+    rv = LOG_IF_SMTP_ERR(mailesmtp_mail(m_Smtp, m_Address.c_str(), 1, p_EnvId.c_str()));
   }
   else
   {
-    rv = LOG_IF_SMTP_ERR(mailsmtp_mail(smtp, m_Address.c_str()));
+    rv = LOG_IF_SMTP_ERR(mailsmtp_mail(m_Smtp, m_Address.c_str()));
   }
 
   if (rv != MAILSMTP_NO_ERROR) return false;
 
-  clist *recipients = clist_new();
   for (auto& recipient : p_Recipients)
   {
-    char* r = strdup(recipient.GetAddress().c_str());
-    if (esmtpMode)
+    if (m_EsmtpMode)
     {
-      rv = LOG_IF_SMTP_ERR(mailesmtp_rcpt(smtp, r,
+      rv = LOG_IF_SMTP_ERR(mailesmtp_rcpt(m_Smtp, recipient.GetAddress().c_str(),
                                           MAILSMTP_DSN_NOTIFY_FAILURE|MAILSMTP_DSN_NOTIFY_DELAY,
                                           NULL));
     }
     else
     {
-      rv = LOG_IF_SMTP_ERR(mailsmtp_rcpt(smtp, r));
+      rv = LOG_IF_SMTP_ERR(mailsmtp_rcpt(m_Smtp, recipient.GetAddress().c_str()));
     }
 
     if (rv != MAILSMTP_NO_ERROR) return false;
+  }
+
+  rv = LOG_IF_SMTP_ERR(mailsmtp_data(m_Smtp));
+
+  return (rv == MAILSMTP_NO_ERROR);
+}
+
+bool Smtp::SendEnvelopePipelined(const std::string& p_EnvId,
+                                 const std::vector<Contact>& p_Recipients)
+{
+  // same parameters as mailesmtp_mail() and mailesmtp_rcpt(), sent as one batch (RFC 2920)
+  const bool dsn = (m_Smtp->esmtp & MAILSMTP_ESMTP_DSN);
+  std::string commands = "MAIL FROM:<" + m_Address + ">" +
+    (dsn ? (" RET=FULL ENVID=" + p_EnvId) : "") + "\r\n";
+  for (auto& recipient : p_Recipients)
+  {
+    commands += "RCPT TO:<" + recipient.GetAddress() + ">" +
+      (dsn ? " NOTIFY=FAILURE,DELAY" : "") + "\r\n";
+  }
 
-    clist_append(recipients, (void*)r);
+  commands += "DATA\r\n";
 
-    free(r);
+  if ((mailstream_write(m_Smtp->stream, commands.c_str(), commands.size()) == -1) ||
+      (mailstream_flush(m_Smtp->stream) == -1))
+  {
+    LOG_WARNING("pipelined write failed");
+    return false;
   }
 
-  rv = LOG_IF_SMTP_ERR(mailsmtp_data(smtp));
+  // read all responses, as a rejected command does not stop the server processing the rest
+  bool rv = true;
+  int code = ReadResponse();
+  if (code != 250)
+  {
+    LOG_WARNING("mail from failed (%d)", code);
+    if (code == -1) return false;
 
-  if (rv != MAILSMTP_NO_ERROR) return false;
+    rv = false;
+  }
 
+  for (auto& recipient : p_Recipients)
+  {
+    code = ReadResponse();
+    if ((code != 250) && (code != 251))
+    {
+      LOG_WARNING("rcpt to %s failed (%d)", recipient.GetAddress().c_str(), code);
+      if (code == -1) return false;
+
+      rv = false;
+    }
+  }
 
-  if (enableLmtp)
+  code = ReadResponse();
+  if (code != 354)
   {
+    LOG_WARNING("data failed (%d)", code);
+    return false;
+  }
+
+  return rv;
+}
+
+bool Smtp::SendData(const std::string& p_Data, const std::vector<Contact>& p_Recipients)
+{
+  int rv = MAILSMTP_NO_ERROR;
+  if (s_EnableLmtp)
+  {
+    std::vector<std::string> addresses;
+    for (auto& recipient : p_Recipients)
+    {
+      addresses.push_back(recipient.GetAddress());
+    }
+
+    clist *recipients = clist_new();
+    for (auto& address : addresses)
+    {
+      clist_append(recipients, const_cast<char*>(address.c_str()));
+    }
+
     int *retcodes = (int *)malloc((clist_count(recipients) * sizeof(int)));
 
-    rv = LOG_IF_SMTP_ERR(maillmtp_data_message(smtp, p_Data.c_str(), p_Data.size(),
+    rv = LOG_IF_SMTP_ERR(maillmtp_data_message(m_Smtp, p_Data.c_str(), p_Data.size(),
                                                recipients, retcodes));
 
-    if (rv != MAILSMTP_NO_ERROR) return false;
-
-    for (int i = 0; i < clist_count(recipients); i++)
+    for (int i = 0; (rv == MAILSMTP_NO_ERROR) && (i < clist_count(recipients)); i++)
     {
       LOG_WARNING("recipient \"%s\" returned %d", (char *)clist_nth_data(recipients, i),
                   retcodes[i]);
     }
 
     free(retcodes);
+    clist_free(recipients);
   }
   else
   {
-    rv = LOG_IF_SMTP_ERR(mailsmtp_data_message(smtp, p_Data.c_str(), p_Data.size()));
-
-    if (rv != MAILSMTP_NO_ERROR) return false;
+    rv = LOG_IF_SMTP_ERR(mailsmtp_data_message(m_Smtp, p_Data.c_str(), p_Data.size()));
   }
 
-  clist_free(recipients);
-  mailsmtp_free(smtp);
+  return (rv == MAILSMTP_NO_ERROR);
+}
 
-  LOG_DEBUG("send success");
+int Smtp::ReadResponse()
+{
+  while (true)
+  {
+    char* line = mailstream_read_line_remove_eol(m_Smtp->stream, m_Smtp->line_buffer);
+    if ((line == NULL) || (strlen(line) < 3)) return -1;
 
-  return true;
+    // multi-line replies have a dash after the code on all but the last line
+    if (line[3] != '-') return atoi(line);
+  }
 }
 
 std::string Smtp::GetHeader(const std::string& p_Subject, const std::vector<Contact>& p_To,
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <ctime>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -19,7 +20,8 @@ class Smtp
 {
 public:
   Smtp(const std::string& p_User, const std::string& p_Pass, const std::string& p_Host,
-       const uint16_t p_Port, const std::string& p_Name, const std::string& p_Address);
+       const uint16_t p_Port, const std::string& p_Name, const std::string& p_Address,
+       const int p_IdleTimeout = 0);
   virtual ~Smtp();
 
   bool Send(const std::string& p_Subject, const std::string& p_Message,
@@ -34,9 +36,18 @@ public:
                         const std::string& p_RefMsgId);
   std::string GetBody(const std::string& p_Message,
                       const std::vector<std::string>& p_AttachmentPaths);
+  void CheckIdle();
+  void Logout();
 
 private:
+  bool Connect();
+  void Disconnect(bool p_Quit);
   bool SendMessage(const std::string& p_Data, const std::vector<Contact>& p_Recipients);
+  bool SendEnvelope(const std::string& p_EnvId, const std::vector<Contact>& p_Recipients);
+  bool SendEnvelopePipelined(const std::string& p_EnvId,
+                             const std::vector<Contact>& p_Recipients);
+  bool SendData(const std::string& p_Data, const std::vector<Contact>& p_Recipients);
+  int ReadResponse();
   struct mailmime* GetMimeTextPart(const char * p_MimeType, int p_EncodingType,
                                    const std::string& p_Message);
   struct mailmime* GetMimeFilePart(const std::string& p_Path,
@@ -57,4 +68,9 @@ private:
   uint16_t m_Port = 0;  
   std::string m_Name;
   std::string m_Address;
+  int m_IdleTimeout = 0;
+
+  mailsmtp* m_Smtp = NULL;
+  bool m_EsmtpMode = false;
+  time_t m_LastUse = 0;
 };
@@ -10,12 +10,11 @@
 #include <sys/ioctl.h>
 
 #include "loghelp.h"
-#include "smtp.h"
 
 SmtpManager::SmtpManager(const std::string &p_User, const std::string &p_Pass,
                          const std::string &p_Host, const uint16_t p_Port,
                          const std::string &p_Name, const std::string &p_Address,
-                         const bool p_Connect,
+                         const bool p_Connect, const int p_IdleTimeout,
                          const std::function<void (const SmtpManager::Result &)> &p_ResultHandler,
                          const std::function<void (const StatusUpdate &)> &p_StatusHandler)
   : m_User(p_User)
@@ -25,6 +24,8 @@ SmtpManager::SmtpManager(const std::string &p_User, const std::string &p_Pass,
   , m_Name(p_Name)
   , m_Address(p_Address)
   , m_Connect(p_Connect)
+  , m_IdleTimeout(p_IdleTimeout)
+  , m_Smtp(p_User, p_Pass, p_Host, p_Port, p_Name, p_Address, p_IdleTimeout)
   , m_ResultHandler(p_ResultHandler)
   , m_StatusHandler(p_StatusHandler)
   , m_Running(false)
@@ -102,10 +103,14 @@ void SmtpManager::Process()
     FD_ZERO(&fds);
     FD_SET(m_Pipe[0], &fds);
     int maxfd = m_Pipe[0];
-    struct timeval tv = {60, 0};
+    struct timeval tv = {(m_IdleTimeout > 0) ? std::min(m_IdleTimeout, 60) : 60, 0};
     int rv = select(maxfd + 1, &fds, NULL, NULL, &tv);
 
-    if (rv == 0) continue;
+    if (rv == 0)
+    {
+      m_Smtp.CheckIdle();
+      continue;
+    }
 
     if (FD_ISSET(m_Pipe[0], &fds))
     {
@@ -143,6 +148,8 @@ void SmtpManager::Process()
     }
   }
 
+  m_Smtp.Logout();
+
   LOG_DEBUG("exiting loop");
 
   std::unique_lock<std::mutex> lock(m_ExitedCondMutex);
@@ -160,19 +167,17 @@ SmtpManager::Result SmtpManager::PerformAction(const SmtpManager::Action &p_Acti
   const std::string& ref = p_Action.m_RefMsgId;
   const std::vector<std::string> att = Util::Trim(Util::Split(p_Action.m_Att));
 
-  Smtp smtp(m_User, m_Pass, m_Host, m_Port, m_Name, m_Address);
-
   if (p_Action.m_IsSendMessage)
   {
     SetStatus(Status::FlagSending);
-    result.m_Result = smtp.Send(p_Action.m_Subject, p_Action.m_Body, to, cc, bcc, ref, att,
-                                result.m_Message);
+    result.m_Result = m_Smtp.Send(p_Action.m_Subject, p_Action.m_Body, to, cc, bcc, ref, att,
+                                  result.m_Message);
     ClearStatus(Status::FlagSending);
   }
   else if (p_Action.m_IsCreateMessage)
   {
-    const std::string& header = smtp.GetHeader(p_Action.m_Subject, to, cc, bcc, ref);
-    const std::string& body = smtp.GetBody(p_Action.m_Body, att);
+    const std::string& header = m_Smtp.GetHeader(p_Action.m_Subject, to, cc, bcc, ref);
+    const std::string& body = m_Smtp.GetBody(p_Action.m_Body, att);
     result.m_Message = header + body;
     result.m_Result = !result.m_Message.empty();
   }
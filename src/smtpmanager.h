@@ -20,6 +20,7 @@
 
 #include "contact.h"
 #include "log.h"
+#include "smtp.h"
 #include "status.h"
 
 class SmtpManager
@@ -49,7 +50,7 @@ public:
 public:
   SmtpManager(const std::string& p_User, const std::string& p_Pass, const std::string& p_Host,
               const uint16_t p_Port, const std::string& p_Name, const std::string& p_Address,
-              const bool p_Connect,
+              const bool p_Connect, const int p_IdleTimeout,
               const std::function<void(const SmtpManager::Result&)>& p_ResultHandler,
               const std::function<void(const StatusUpdate&)>& p_StatusHandler);
   virtual ~SmtpManager();
@@ -72,6 +73,8 @@ private:
   std::string m_Name;
   std::string m_Address;
   bool m_Connect;
+  int m_IdleTimeout;
+  Smtp m_Smtp;
   std::function<void(const SmtpManager::Result&)> m_ResultHandler;
   std::function<void(const StatusUpdate&)> m_StatusHandler;
   std::atomic<bool> m_Running;
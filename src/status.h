@@ -34,7 +34,8 @@ public:
     FlagConnected = (1 << 8),
     FlagOffline = (1 << 9),
     FlagIdle = (1 << 10),
-    FlagMax = FlagIdle,
+    FlagImporting = (1 << 11),
+    FlagMax = FlagImporting,
   };
 
   Status();
@@ -0,0 +1,466 @@
+// threadindex.cpp
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "threadindex.h"
+
+#include <algorithm>
+
+#include "util.h"
+
+ThreadIndex::ThreadIndex()
+{
+  Clear();
+}
+
+ThreadIndex::~ThreadIndex()
+{
+}
+
+bool ThreadIndex::Add(uint32_t p_Uid, int64_t p_TimeStamp, const std::string& p_MessageId,
+                      const std::vector<std::string>& p_References,
+                      const std::string& p_Subject)
+{
+  if (Contains(p_Uid)) return false;
+
+  // reuse a placeholder created from references of earlier messages, while a duplicate
+  // message id gets a node of its own
+  uint32_t node = 0;
+  auto idIt = p_MessageId.empty() ? m_IdNodes.end() : m_IdNodes.find(p_MessageId);
+  if ((idIt != m_IdNodes.end()) && (m_Nodes[idIt->second].m_Uid == 0))
+  {
+    node = idIt->second;
+  }
+  else
+  {
+    node = NewNode();
+    if (!p_MessageId.empty() && (idIt == m_IdNodes.end()))
+    {
+      m_Nodes[node].m_MessageId = p_MessageId;
+      m_IdNodes[p_MessageId] = node;
+    }
+  }
+
+  const uint32_t oldParent = m_Nodes[node].m_Parent;
+  Unlink(node);
+  m_Nodes[node].m_Uid = p_Uid;
+  m_Nodes[node].m_TimeStamp = p_TimeStamp;
+  m_UidNodes[p_Uid] = node;
+  AddCount(node, 1, p_TimeStamp);
+
+  // link the reference chain, keeping links already made by other messages
+  uint32_t parent = 0;
+  for (auto& reference : p_References)
+  {
+    if (reference.empty() || (reference == p_MessageId)) continue;
+
+    const uint32_t refNode = GetNode(reference);
+    if ((parent != 0) && (m_Nodes[refNode].m_Parent == 0) && !IsAncestor(refNode, parent))
+    {
+      Link(refNode, parent);
+    }
+
+    parent = refNode;
+  }
+
+  if ((parent != 0) && !IsAncestor(node, parent))
+  {
+    Link(node, parent);
+  }
+  else if ((oldParent != 0) && !IsAncestor(node, oldParent))
+  {
+    Link(node, oldParent);
+  }
+  else if (p_References.empty())
+  {
+    bool isReply = false;
+    const std::string& subject = GetThreadSubject(p_Subject, isReply);
+    if (!subject.empty())
+    {
+      auto subjectIt = m_SubjectNodes.find(subject);
+      if (subjectIt == m_SubjectNodes.end())
+      {
+        m_Nodes[node].m_Subject = subject;
+        m_SubjectNodes[subject] = node;
+      }
+      else if (isReply)
+      {
+        const uint32_t root = GetRoot(subjectIt->second);
+        if (!IsAncestor(node, root))
+        {
+          Link(node, root);
+        }
+      }
+    }
+  }
+
+  // drop placeholders which did not end up linking any message
+  if ((oldParent != 0) && (m_Nodes[node].m_Parent != oldParent))
+  {
+    Prune(oldParent);
+  }
+
+  for (auto& reference : p_References)
+  {
+    auto refIt = m_IdNodes.find(reference);
+    if (refIt != m_IdNodes.end())
+    {
+      Prune(refIt->second);
+    }
+  }
+
+  UpdateRoot(GetRoot(node));
+  return true;
+}
+
+bool ThreadIndex::Remove(uint32_t p_Uid)
+{
+  auto uidIt = m_UidNodes.find(p_Uid);
+  if (uidIt == m_UidNodes.end()) return false;
+
+  const uint32_t node = uidIt->second;
+  m_UidNodes.erase(uidIt);
+
+  // keep the node as a placeholder while it links other messages of the thread
+  Node& n = m_Nodes[node];
+  const int64_t timeStamp = n.m_TimeStamp;
+  if (n.m_Parent != 0)
+  {
+    std::set<std::pair<int64_t, uint32_t>>& siblings = m_Nodes[n.m_Parent].m_Children;
+    siblings.erase(std::make_pair(timeStamp, node));
+    siblings.insert(std::make_pair(0, node));
+  }
+
+  if (!n.m_Subject.empty())
+  {
+    m_SubjectNodes.erase(n.m_Subject);
+    n.m_Subject.clear();
+  }
+
+  n.m_Uid = 0;
+  n.m_TimeStamp = 0;
+  RemoveCount(node, 1, timeStamp);
+  UpdateRoot(GetRoot(node));
+  Prune(node);
+  return true;
+}
+
+void ThreadIndex::Clear()
+{
+  m_Nodes.clear();
+  m_Nodes.push_back(Node());
+  m_FreeNodes.clear();
+  m_IdNodes.clear();
+  m_UidNodes.clear();
+  m_SubjectNodes.clear();
+  m_Roots.Clear();
+  m_Expanded.clear();
+}
+
+bool ThreadIndex::Contains(uint32_t p_Uid) const
+{
+  return (m_UidNodes.find(p_Uid) != m_UidNodes.end());
+}
+
+uint32_t ThreadIndex::GetRowCount() const
+{
+  return m_Roots.GetRowCount();
+}
+
+bool ThreadIndex::GetRow(uint32_t p_Row, uint32_t& p_Uid, uint32_t& p_Depth,
+                         uint32_t& p_CollapsedCount) const
+{
+  uint32_t rowOffset = 0;
+  const uint32_t root = m_Roots.GetUidAtRow(p_Row, rowOffset);
+  if (root == 0) return false;
+
+  p_Uid = GetThreadUid(root, rowOffset, p_Depth);
+  p_CollapsedCount = (m_Expanded.find(root) == m_Expanded.end()) ? m_Nodes[root].m_Count : 0;
+  return (p_Uid != 0);
+}
+
+bool ThreadIndex::GetRowIndex(uint32_t p_Uid, uint32_t& p_Row) const
+{
+  auto uidIt = m_UidNodes.find(p_Uid);
+  if (uidIt == m_UidNodes.end()) return false;
+
+  // messages of a collapsed thread are all found at the thread row
+  const uint32_t node = uidIt->second;
+  const uint32_t root = GetRoot(node);
+  uint32_t row = 0;
+  if (!m_Roots.GetRow(root, row)) return false;
+
+  const bool expanded = (m_Expanded.find(root) != m_Expanded.end());
+  p_Row = row + (expanded ? GetThreadIndex(node) : 0);
+  return true;
+}
+
+bool ThreadIndex::SetExpanded(uint32_t p_Uid, bool p_Expanded)
+{
+  auto uidIt = m_UidNodes.find(p_Uid);
+  if (uidIt == m_UidNodes.end()) return false;
+
+  const uint32_t root = GetRoot(uidIt->second);
+  bool changed = false;
+  if (p_Expanded)
+  {
+    changed = (m_Nodes[root].m_Count > 1) && m_Expanded.insert(root).second;
+  }
+  else
+  {
+    changed = (m_Expanded.erase(root) > 0);
+  }
+
+  UpdateRoot(root);
+  return changed;
+}
+
+std::string ThreadIndex::GetThreadSubject(const std::string& p_Subject, bool& p_IsReply)
+{
+  // strip reply and forward prefixes, e.g. "Re: Fwd: Re[2]: subject"
+  static const std::vector<std::string> prefixes = { "re", "fw", "fwd", "aw", "sv" };
+  std::string subject = Util::ToLower(Util::Trim(p_Subject));
+  p_IsReply = false;
+  bool stripped = true;
+  while (stripped)
+  {
+    stripped = false;
+    for (auto& prefix : prefixes)
+    {
+      if (subject.compare(0, prefix.size(), prefix) != 0) continue;
+
+      size_t pos = prefix.size();
+      if ((pos < subject.size()) && (subject[pos] == '['))
+      {
+        pos = subject.find(']', pos);
+        if (pos == std::string::npos) continue;
+
+        ++pos;
+      }
+
+      if ((pos < subject.size()) && (subject[pos] == ':'))
+      {
+        subject = Util::Trim(subject.substr(pos + 1));
+        p_IsReply = true;
+        stripped = true;
+        break;
+      }
+    }
+  }
+
+  return subject;
+}
+
+uint32_t ThreadIndex::GetNode(const std::string& p_MessageId)
+{
+  auto idIt = m_IdNodes.find(p_MessageId);
+  if (idIt != m_IdNodes.end()) return idIt->second;
+
+  const uint32_t node = NewNode();
+  m_Nodes[node].m_MessageId = p_MessageId;
+  m_IdNodes[p_MessageId] = node;
+  return node;
+}
+
+uint32_t ThreadIndex::NewNode()
+{
+  if (!m_FreeNodes.empty())
+  {
+    const uint32_t node = m_FreeNodes.back();
+    m_FreeNodes.pop_back();
+    return node;
+  }
+
+  m_Nodes.push_back(Node());
+  return m_Nodes.size() - 1;
+}
+
+void ThreadIndex::DeleteNode(uint32_t p_Node)
+{
+  Node& n = m_Nodes[p_Node];
+  auto idIt = m_IdNodes.find(n.m_MessageId);
+  if ((idIt != m_IdNodes.end()) && (idIt->second == p_Node))
+  {
+    m_IdNodes.erase(idIt);
+  }
+
+  m_Roots.Remove(p_Node);
+  m_Expanded.erase(p_Node);
+  n = Node();
+  m_FreeNodes.push_back(p_Node);
+}
+
+uint32_t ThreadIndex::GetRoot(uint32_t p_Node) const
+{
+  uint32_t node = p_Node;
+  while (m_Nodes[node].m_Parent != 0)
+  {
+    node = m_Nodes[node].m_Parent;
+  }
+
+  return node;
+}
+
+bool ThreadIndex::IsAncestor(uint32_t p_Ancestor, uint32_t p_Node) const
+{
+  for (uint32_t node = p_Node; node != 0; node = m_Nodes[node].m_Parent)
+  {
+    if (node == p_Ancestor) return true;
+  }
+
+  return false;
+}
+
+void ThreadIndex::Link(uint32_t p_Child, uint32_t p_Parent)
+{
+  Node& child = m_Nodes[p_Child];
+  child.m_Parent = p_Parent;
+  m_Nodes[p_Parent].m_Children.insert(std::make_pair(child.m_TimeStamp, p_Child));
+  m_Roots.Remove(p_Child);
+  m_Expanded.erase(p_Child);
+  AddCount(p_Parent, child.m_Count, child.m_Latest);
+  UpdateRoot(GetRoot(p_Parent));
+}
+
+void ThreadIndex::Unlink(uint32_t p_Child)
+{
+  Node& child = m_Nodes[p_Child];
+  const uint32_t parent = child.m_Parent;
+  if (parent == 0) return;
+
+  m_Nodes[parent].m_Children.erase(std::make_pair(child.m_TimeStamp, p_Child));
+  child.m_Parent = 0;
+  RemoveCount(parent, child.m_Count, child.m_Latest);
+  UpdateRoot(GetRoot(parent));
+  UpdateRoot(p_Child);
+}
+
+void ThreadIndex::AddCount(uint32_t p_Node, uint32_t p_Count, int64_t p_Latest)
+{
+  for (uint32_t node = p_Node; node != 0; node = m_Nodes[node].m_Parent)
+  {
+    Node& n = m_Nodes[node];
+    n.m_Latest = (n.m_Count > 0) ? std::max(n.m_Latest, p_Latest) : p_Latest;
+    n.m_Count += p_Count;
+  }
+}
+
+void ThreadIndex::RemoveCount(uint32_t p_Node, uint32_t p_Count, int64_t p_Latest)
+{
+  for (uint32_t node = p_Node; node != 0; node = m_Nodes[node].m_Parent)
+  {
+    Node& n = m_Nodes[node];
+    n.m_Count -= p_Count;
+    if (p_Latest >= n.m_Latest)
+    {
+      // the newest message left the subtree, rescan its direct children
+      n.m_Latest = n.m_TimeStamp;
+      for (auto& child : n.m_Children)
+      {
+        if (m_Nodes[child.second].m_Count > 0)
+        {
+          n.m_Latest = std::max(n.m_Latest, m_Nodes[child.second].m_Latest);
+        }
+      }
+    }
+  }
+}
+
+void ThreadIndex::UpdateRoot(uint32_t p_Root)
+{
+  const Node& n = m_Nodes[p_Root];
+  if ((n.m_Parent == 0) && (n.m_Count > 0))
+  {
+    // an expanded thread occupies one row per message
+    const bool expanded = (m_Expanded.find(p_Root) != m_Expanded.end());
+    m_Roots.Insert(n.m_Latest, p_Root);
+    m_Roots.SetRowCount(p_Root, expanded ? n.m_Count : 1);
+  }
+  else
+  {
+    m_Roots.Remove(p_Root);
+    m_Expanded.erase(p_Root);
+  }
+}
+
+void ThreadIndex::Prune(uint32_t p_Node)
+{
+  // delete placeholders no longer linking any message
+  uint32_t node = p_Node;
+  while ((node != 0) && (m_Nodes[node].m_Uid == 0) && m_Nodes[node].m_Children.empty())
+  {
+    const uint32_t parent = m_Nodes[node].m_Parent;
+    if (parent != 0)
+    {
+      m_Nodes[parent].m_Children.erase(std::make_pair(m_Nodes[node].m_TimeStamp, node));
+    }
+
+    DeleteNode(node);
+    node = parent;
+  }
+}
+
+uint32_t ThreadIndex::GetThreadUid(uint32_t p_Node, uint32_t p_Index, uint32_t& p_Depth) const
+{
+  // messages of a thread in depth-first order, oldest reply first, placeholders not shown
+  uint32_t node = p_Node;
+  uint32_t index = p_Index;
+  uint32_t depth = 0;
+  while (true)
+  {
+    const Node& n = m_Nodes[node];
+    if (n.m_Uid != 0)
+    {
+      if (index == 0)
+      {
+        p_Depth = depth;
+        return n.m_Uid;
+      }
+
+      --index;
+      ++depth;
+    }
+
+    uint32_t next = 0;
+    for (auto& child : n.m_Children)
+    {
+      const uint32_t count = m_Nodes[child.second].m_Count;
+      if (index < count)
+      {
+        next = child.second;
+        break;
+      }
+
+      index -= count;
+    }
+
+    if (next == 0) return 0;
+
+    node = next;
+  }
+}
+
+uint32_t ThreadIndex::GetThreadIndex(uint32_t p_Node) const
+{
+  uint32_t index = 0;
+  for (uint32_t node = p_Node; m_Nodes[node].m_Parent != 0; node = m_Nodes[node].m_Parent)
+  {
+    const Node& parent = m_Nodes[m_Nodes[node].m_Parent];
+    if (parent.m_Uid != 0)
+    {
+      ++index;
+    }
+
+    for (auto& child : parent.m_Children)
+    {
+      if (child.second == node) break;
+
+      index += m_Nodes[child.second].m_Count;
+    }
+  }
+
+  return index;
+}
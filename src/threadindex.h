@@ -0,0 +1,83 @@
+// threadindex.h
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+#include "dateuidindex.h"
+
+// Conversation threads of a folder, linked by Message-ID / References (with In-Reply-To last),
+// falling back to subject for replies without references. Messages are added one at a time
+// as their headers arrive, each costing O(log n) plus the length of its reference chain and the
+// depth of its thread. Threads are ordered by their newest message, and shown as one row each
+// unless expanded. Finding a thread row takes O(log n) through the thread order index, but
+// finding a message within a thread scans the children along its path, so the cost is linear
+// in the thread size for wide threads, e.g. many subject fallback replies to a single root.
+class ThreadIndex
+{
+public:
+  ThreadIndex();
+  virtual ~ThreadIndex();
+
+  bool Add(uint32_t p_Uid, int64_t p_TimeStamp, const std::string& p_MessageId,
+           const std::vector<std::string>& p_References, const std::string& p_Subject);
+  bool Remove(uint32_t p_Uid);
+  void Clear();
+  bool Contains(uint32_t p_Uid) const;
+
+  uint32_t GetRowCount() const;
+  bool GetRow(uint32_t p_Row, uint32_t& p_Uid, uint32_t& p_Depth,
+              uint32_t& p_CollapsedCount) const;
+  bool GetRowIndex(uint32_t p_Uid, uint32_t& p_Row) const;
+  bool SetExpanded(uint32_t p_Uid, bool p_Expanded);
+
+  static std::string GetThreadSubject(const std::string& p_Subject, bool& p_IsReply);
+
+private:
+  struct Node
+  {
+    std::string m_MessageId;
+    std::string m_Subject;
+    uint32_t m_Uid = 0;
+    int64_t m_TimeStamp = 0;
+    uint32_t m_Parent = 0;
+    std::set<std::pair<int64_t, uint32_t>> m_Children;
+    uint32_t m_Count = 0;
+    int64_t m_Latest = 0;
+  };
+
+  uint32_t GetNode(const std::string& p_MessageId);
+  uint32_t NewNode();
+  void DeleteNode(uint32_t p_Node);
+  uint32_t GetRoot(uint32_t p_Node) const;
+  bool IsAncestor(uint32_t p_Ancestor, uint32_t p_Node) const;
+  void Link(uint32_t p_Child, uint32_t p_Parent);
+  void Unlink(uint32_t p_Child);
+  void AddCount(uint32_t p_Node, uint32_t p_Count, int64_t p_Latest);
+  void RemoveCount(uint32_t p_Node, uint32_t p_Count, int64_t p_Latest);
+  void UpdateRoot(uint32_t p_Root);
+  void Prune(uint32_t p_Node);
+  uint32_t GetThreadUid(uint32_t p_Node, uint32_t p_Index, uint32_t& p_Depth) const;
+  uint32_t GetThreadIndex(uint32_t p_Node) const;
+
+private:
+  // node 0 is unused, marking no parent
+  std::vector<Node> m_Nodes;
+  std::vector<uint32_t> m_FreeNodes;
+  std::map<std::string, uint32_t> m_IdNodes;
+  std::map<uint32_t, uint32_t> m_UidNodes;
+  std::map<std::string, uint32_t> m_SubjectNodes;
+  DateUidIndex m_Roots;
+  std::set<uint32_t> m_Expanded;
+};
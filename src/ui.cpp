@@ -61,6 +61,8 @@ void Ui::Init()
     {"cancel_without_confirm", "0"},
     {"postpone_without_confirm", "0"},
     {"show_embedded_images", "1"},
+    {"thread_view", "0"},
+    {"folder_status_interval", "60"},
     {"key_prev_msg", "p"},
     {"key_next_msg", "n"},
     {"key_reply", "r"},
@@ -86,6 +88,11 @@ void Ui::Init()
     {"key_othercmd_help", "o"},
     {"key_export", "e"},
     {"key_import", "i"},
+    {"key_search", "/"},
+    {"key_toggle_threads", "v"},
+    {"key_tag", ":"},
+    {"key_tag_matching", ";"},
+    {"key_tag_all", "a"},
   };
   const std::string configPath(Util::GetApplicationDir() + std::string("ui.conf"));
   m_Config = Config(configPath, defaultConfig);
@@ -94,6 +101,8 @@ void Ui::Init()
   m_HelpEnabled = m_Config.Get("help_enabled") == "1";
   m_PersistFolderFilter = m_Config.Get("persist_folder_filter") == "1";
   m_Plaintext = m_Config.Get("plain_text") == "1";
+  m_ThreadView = m_Config.Get("thread_view") == "1";
+  m_FolderStatusInterval = Util::ToInteger(m_Config.Get("folder_status_interval"));
   m_KeyPrevMsg = Util::GetKeyCode(m_Config.Get("key_prev_msg"));
   m_KeyNextMsg = Util::GetKeyCode(m_Config.Get("key_next_msg"));
   m_KeyReply = Util::GetKeyCode(m_Config.Get("key_reply"));
@@ -119,6 +128,11 @@ void Ui::Init()
   m_KeyOtherCmdHelp = Util::GetKeyCode(m_Config.Get("key_othercmd_help"));
   m_KeyExport = Util::GetKeyCode(m_Config.Get("key_export"));
   m_KeyImport = Util::GetKeyCode(m_Config.Get("key_import"));
+  m_KeySearch = Util::GetKeyCode(m_Config.Get("key_search"));
+  m_KeyToggleThreads = Util::GetKeyCode(m_Config.Get("key_toggle_threads"));
+  m_KeyTag = Util::GetKeyCode(m_Config.Get("key_tag"));
+  m_KeyTagMatching = Util::GetKeyCode(m_Config.Get("key_tag_matching"));
+  m_KeyTagAll = Util::GetKeyCode(m_Config.Get("key_tag_all"));
   m_ShowProgress = m_Config.Get("show_progress") == "1";
   m_NewMsgBell = m_Config.Get("new_msg_bell") == "1";
   m_QuitWithoutConfirm = m_Config.Get("quit_without_confirm") == "1";
@@ -133,6 +147,7 @@ void Ui::Init()
 void Ui::Cleanup()
 {
   m_Config.Set("plain_text", m_Plaintext ? "1" : "0");
+  m_Config.Set("thread_view", m_ThreadView ? "1" : "0");
   m_Config.Save();
   close(m_Pipe[0]);
   close(m_Pipe[1]);
@@ -194,6 +209,13 @@ void Ui::CleanupWindows()
 
 void Ui::DrawAll()
 {
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_DamagedUids.clear();
+  }
+
+  m_DrawTime = std::chrono::steady_clock::now();
+
   switch (m_State)
   {
     case StateViewMessageList:
@@ -248,6 +270,13 @@ void Ui::DrawAll()
       DrawDialog();
       break;
 
+    case StateViewSearchList:
+      DrawTop();
+      DrawMessageList();
+      DrawHelp();
+      DrawDialog();
+      break;
+
     default:
       werase(m_MainWin);
       mvwprintw(m_MainWin, 0, 0, "Unimplemented state %d", m_State);
@@ -393,9 +422,14 @@ void Ui::DrawHelp()
       GetKeyDisplay(m_KeyToggleUnread), "TgUnread",
       GetKeyDisplay(m_KeyExport), "Export",
       GetKeyDisplay(m_KeyImport), "Import",
+      GetKeyDisplay(m_KeySearch), "Search",
+      GetKeyDisplay(m_KeyToggleThreads), "TgThreads",
       GetKeyDisplay(m_KeyOtherCmdHelp), "OtherCmds",
     },
     {
+      GetKeyDisplay(m_KeyTag), "Tag",
+      GetKeyDisplay(m_KeyTagMatching), "TagMatch",
+      GetKeyDisplay(m_KeyTagAll), "TagAll",
     },
   };
 
@@ -465,6 +499,20 @@ void Ui::DrawHelp()
     },
   };
 
+  static std::vector<std::vector<std::string>> viewSearchListHelp =
+  {
+    {
+      GetKeyDisplay(m_KeyBack), "MsgList",
+      GetKeyDisplay(m_KeyPrevMsg), "PrevMsg",
+      GetKeyDisplay(m_KeySearch), "Search",
+    },
+    {
+      GetKeyDisplay(m_KeyOpen), "ViewMsg",
+      GetKeyDisplay(m_KeyNextMsg), "NextMsg",
+      GetKeyDisplay(m_KeyQuit), "Quit",
+    },
+  };
+
   if (m_HelpEnabled)
   {
     werase(m_HelpWin);
@@ -506,6 +554,10 @@ void Ui::DrawHelp()
         DrawHelpText(viewPartListHelp);
         break;
 
+      case StateViewSearchList:
+        DrawHelpText(viewSearchListHelp);
+        break;
+
       default:
         break;
     }
@@ -555,16 +607,21 @@ void Ui::DrawFolderList()
 
   werase(m_MainWin);
 
+  RequestFolderStatuses();
+
   std::set<std::string> folders;
+  std::map<std::string, FolderStatus> folderStatuses;
 
   if (m_FolderListFilterStr.empty())
   {
     std::lock_guard<std::mutex> lock(m_Mutex);
     folders = m_Folders;
+    folderStatuses = m_FolderStatuses;
   }
   else
   {
     std::lock_guard<std::mutex> lock(m_Mutex);
+    folderStatuses = m_FolderStatuses;
     for (const auto& folder : m_Folders)
     {
       if (Util::ToLower(folder).find(Util::ToLower(Util::ToString(m_FolderListFilterStr)))
@@ -607,8 +664,24 @@ void Ui::DrawFolderList()
         m_FolderListCurrentFolder = folder;
       }
 
+      // unread / total count is right aligned, leaving the folder name the remaining width
+      std::wstring wcount;
+      auto statusIt = folderStatuses.find(folder);
+      if (statusIt != folderStatuses.end())
+      {
+        wcount = Util::ToWString(std::to_string(statusIt->second.m_Unseen) + "/" +
+                                 std::to_string(statusIt->second.m_Messages));
+      }
+
       std::wstring wfolder = Util::ToWString(folder);
-      mvwaddnwstr(m_MainWin, i - idxOffs, 2, wfolder.c_str(), wfolder.size());
+      const int countPos = std::max(2, m_ScreenWidth - 2 - (int)wcount.size());
+      const int folderMax = wcount.empty() ? (m_ScreenWidth - 2) : (countPos - 3);
+      mvwaddnwstr(m_MainWin, i - idxOffs, 2, wfolder.c_str(),
+                  std::min((int)wfolder.size(), std::max(0, folderMax)));
+      if (!wcount.empty())
+      {
+        mvwaddnwstr(m_MainWin, i - idxOffs, countPos, wcount.c_str(), wcount.size());
+      }
 
       if (i == m_FolderListCurrentIndex)
       {
@@ -767,6 +840,7 @@ void Ui::DrawMessageList()
   }
   
   std::set<uint32_t> fetchHeaderUids;  
+  std::set<uint32_t> fetchFullHeaderUids;
   std::set<uint32_t> fetchFlagUids;  
   std::set<uint32_t> fetchBodyUids;
   std::set<uint32_t> prefetchBodyUids;
@@ -776,7 +850,12 @@ void Ui::DrawMessageList()
     std::set<uint32_t>& newUids = m_NewUids[m_CurrentFolder];
     std::map<uint32_t, Header>& headers = m_Headers[m_CurrentFolder];
     std::map<uint32_t, uint32_t>& flags = m_Flags[m_CurrentFolder];
-    auto& msgDateUids = m_MsgDateUids[m_CurrentFolder];
+    const bool isSearch = (m_State == StateViewSearchList);
+    const bool isThreadView = !isSearch && m_ThreadView;
+    auto& msgDateUids = isSearch ? m_SearchDateUids : m_MsgDateUids[m_CurrentFolder];
+    const ThreadIndex& threadIndex = m_ThreadIndexes[m_CurrentFolder];
+    const int32_t currentIndex =
+      isSearch ? m_SearchListCurrentIndex : m_MessageListCurrentIndex[m_CurrentFolder];
 
     std::set<uint32_t>& requestedHeaders = m_RequestedHeaders[m_CurrentFolder];
     std::set<uint32_t>& requestedFlags = m_RequestedFlags[m_CurrentFolder];
@@ -803,22 +882,67 @@ void Ui::DrawMessageList()
       newUids.clear();
     }
 
+    if (isSearch)
+    {
+      for (auto& uid : m_SearchUids)
+      {
+        if ((headers.find(uid) == headers.end()) &&
+            (requestedHeaders.find(uid) == requestedHeaders.end()))
+        {
+          fetchHeaderUids.insert(uid);
+          requestedHeaders.insert(uid);
+        }
+      }
+    }
+
     const std::map<uint32_t, Body>& bodys = m_Bodys[m_CurrentFolder];
     std::set<uint32_t>& prefetchedBodys = m_PrefetchedBodys[m_CurrentFolder];
     std::set<uint32_t>& requestedBodys = m_RequestedBodys[m_CurrentFolder];
+    std::set<uint32_t>& requestedFullHeaders = m_RequestedFullHeaders[m_CurrentFolder];
     
-    int idxOffs = Util::Bound(0, (int)(m_MessageListCurrentIndex[m_CurrentFolder] -
-                                       ((m_MainWinHeight - 1) / 2)),
-                              std::max(0, (int)msgDateUids.size() - (int)m_MainWinHeight));
-    int idxMax = idxOffs + std::min(m_MainWinHeight, (int)msgDateUids.size());
+    int idxOffs = 0;
+    int idxMax = 0;
+    GetMessageListWindow(currentIndex, GetMessageListCount(isSearch), idxOffs, idxMax);
+    m_DrawnUids.clear();
+    m_DrawnCurrentIndex = currentIndex;
 
     const std::string& currentDate = Header::GetCurrentDate();
+    if ((m_MessageListRowsWidth != m_ScreenWidth) || (m_MessageListRowsDate != currentDate))
+    {
+      m_MessageListRows.clear();
+      m_MessageListRowsWidth = m_ScreenWidth;
+      m_MessageListRowsDate = currentDate;
+    }
+
+    std::map<uint32_t, std::wstring>& rows = m_MessageListRows[m_CurrentFolder];
 
     werase(m_MainWin);
 
     for (int i = idxOffs; i < idxMax; ++i)
     {
-      uint32_t uid = std::prev(msgDateUids.end(), i + 1)->second;
+      uint32_t uid = 0;
+      std::string threadPrefix;
+      if (isThreadView)
+      {
+        // collapsed threads show their message count, replies are indented by depth
+        uint32_t depth = 0;
+        uint32_t collapsedCount = 0;
+        threadIndex.GetRow(i, uid, depth, collapsedCount);
+        if (collapsedCount > 1)
+        {
+          threadPrefix = "(" + std::to_string(collapsedCount) + ") ";
+        }
+        else if (depth > 0)
+        {
+          threadPrefix = std::string(2 * (std::min(depth, 8u) - 1), ' ') + "> ";
+        }
+      }
+      else
+      {
+        uid = msgDateUids.GetUid(i);
+      }
+
+      m_DrawnUids.push_back(uid);
 
       if ((flags.find(uid) == flags.end()) &&
           (requestedFlags.find(uid) == requestedFlags.end()))
@@ -827,46 +951,45 @@ void Ui::DrawMessageList()
         requestedFlags.insert(uid);
       }
 
-      std::string seenFlag;
-      if ((flags.find(uid) != flags.end()) && (!Flag::GetSeen(flags.at(uid))))
+      // rows are rendered once and kept until their header, flags, width or date change,
+      // while thread rows depend on the thread and are rendered when drawn
+      std::wstring wheader;
+      if (threadPrefix.empty())
       {
-        seenFlag = std::string("N");
-      }
+        auto rit = rows.find(uid);
+        if (rit == rows.end())
+        {
+          rit = rows.insert(std::make_pair(uid, GetMessageListRow(uid, "", currentDate))).first;
+        }
 
-      std::string shortDate;
-      std::string shortFrom;
-      std::string subject;
-      if (headers.find(uid) != headers.end())
+        wheader = rit->second;
+      }
+      else
       {
-        Header& header = headers.at(uid);
-        shortDate = header.GetDateOrTime(currentDate);
-        shortFrom = header.GetShortFrom();
-        subject = header.GetSubject();
+        wheader = GetMessageListRow(uid, threadPrefix, currentDate);
       }
 
-      seenFlag = Util::TrimPadString(seenFlag, 1);
-      shortDate = Util::TrimPadString(shortDate, 10);
-      shortFrom = Util::ToString(Util::TrimPadWString(Util::ToWString(shortFrom), 20));
-      std::string headerLeft = " " + seenFlag + "  " + shortDate + "  " + shortFrom + "  ";
-      int subjectWidth = m_ScreenWidth - headerLeft.size() - 1;
-      subject = Util::ToString(Util::TrimPadWString(Util::ToWString(subject), subjectWidth));
-      std::string header = headerLeft + subject + " ";
-
-      if (i == m_MessageListCurrentIndex[m_CurrentFolder])
+      if (i == currentIndex)
       {
         wattron(m_MainWin, A_REVERSE);
       }
 
-      std::wstring wheader = Util::ToWString(header);
       mvwaddnwstr(m_MainWin, i - idxOffs, 0, wheader.c_str(), wheader.size());
 
-      if (i == m_MessageListCurrentIndex[m_CurrentFolder])
+      if (i == currentIndex)
       {
         wattroff(m_MainWin, A_REVERSE);
       }
 
-      if (i == m_MessageListCurrentIndex[m_CurrentFolder])
+      if (i == currentIndex)
       {
+        if ((headers.find(uid) != headers.end()) && headers.at(uid).IsEnvelope() &&
+            (requestedFullHeaders.find(uid) == requestedFullHeaders.end()))
+        {
+          requestedFullHeaders.insert(uid);
+          fetchFullHeaderUids.insert(uid);
+        }
+
         if ((bodys.find(uid) == bodys.end()) &&
             (requestedBodys.find(uid) == requestedBodys.end()))
         {
@@ -899,6 +1022,7 @@ void Ui::DrawMessageList()
     {
       ImapManager::Request request;
       request.m_Folder = m_CurrentFolder;
+      request.m_Priority = ImapManager::RequestPriorityCurrentMessage;
 
       std::set<uint32_t> fetchUids;
       fetchUids.insert(uid);
@@ -938,15 +1062,26 @@ void Ui::DrawMessageList()
       {
         ImapManager::Request request;
         request.m_Folder = m_CurrentFolder;
-        request.m_GetHeaders = subsetFetchHeaderUids;
+        request.m_GetEnvelopes = subsetFetchHeaderUids;
 
-        LOG_DEBUG_VAR("async request headers =", subsetFetchHeaderUids);
+        LOG_DEBUG_VAR("async request envelopes =", subsetFetchHeaderUids);
         m_ImapManager->AsyncRequest(request);
         
         subsetFetchHeaderUids.clear(); 
       }
     }
   }
+
+  if (!fetchFullHeaderUids.empty())
+  {
+    ImapManager::Request request;
+    request.m_Folder = m_CurrentFolder;
+    request.m_Priority = ImapManager::RequestPriorityCurrentMessage;
+    request.m_GetHeaders = fetchFullHeaderUids;
+
+    LOG_DEBUG_VAR("async request headers =", fetchFullHeaderUids);
+    m_ImapManager->AsyncRequest(request);
+  }
   
   const int maxFlagsFetchRequest = 1000;
   if (!fetchFlagUids.empty())
@@ -973,10 +1108,48 @@ void Ui::DrawMessageList()
   wrefresh(m_MainWin);
 }
 
+std::wstring Ui::GetMessageListRow(uint32_t p_Uid, const std::string& p_SubjectPrefix,
+                                   const std::string& p_CurrentDate)
+{
+  std::map<uint32_t, Header>& headers = m_Headers[m_CurrentFolder];
+  std::map<uint32_t, uint32_t>& flags = m_Flags[m_CurrentFolder];
+
+  std::string seenFlag;
+  if ((flags.find(p_Uid) != flags.end()) && (!Flag::GetSeen(flags.at(p_Uid))))
+  {
+    seenFlag = std::string("N");
+  }
+
+  const std::set<uint32_t>& taggedUids = m_TaggedUids[m_CurrentFolder];
+  const std::string tagFlag = (taggedUids.find(p_Uid) != taggedUids.end()) ? "*" : " ";
+
+  std::string shortDate;
+  std::string shortFrom;
+  std::string subject;
+  if (headers.find(p_Uid) != headers.end())
+  {
+    Header& header = headers.at(p_Uid);
+    shortDate = header.GetDateOrTime(p_CurrentDate);
+    shortFrom = header.GetShortFrom();
+    subject = header.GetSubject();
+  }
+
+  seenFlag = Util::TrimPadString(seenFlag, 1);
+  shortDate = Util::TrimPadString(shortDate, 10);
+  std::wstring wshortFrom = Util::TrimPadWString(Util::ToWString(shortFrom), 20);
+  std::wstring wheaderLeft =
+    Util::ToWString(" " + seenFlag + tagFlag + " " + shortDate + "  ") + wshortFrom + L"  ";
+  int subjectWidth = m_ScreenWidth - wheaderLeft.size() - 1;
+  std::wstring wsubject =
+    Util::TrimPadWString(Util::ToWString(p_SubjectPrefix + subject), subjectWidth);
+  return wheaderLeft + wsubject + L" ";
+}
+
 void Ui::DrawMessage()
 {
   werase(m_MainWin);
 
+  std::set<uint32_t> fetchHeaderUids;
   std::set<uint32_t> fetchBodyUids;
   bool markSeen = false;
   {
@@ -985,9 +1158,18 @@ void Ui::DrawMessage()
     std::map<uint32_t, Body>& bodys = m_Bodys[m_CurrentFolder];
 
     std::set<uint32_t>& requestedBodys = m_RequestedBodys[m_CurrentFolder];
+    std::set<uint32_t>& requestedFullHeaders = m_RequestedFullHeaders[m_CurrentFolder];
 
     int uid = m_MessageListCurrentUid[m_CurrentFolder];
 
+    if ((uid != -1) &&
+        (headers.find(uid) != headers.end()) && headers.at(uid).IsEnvelope() &&
+        (requestedFullHeaders.find(uid) == requestedFullHeaders.end()))
+    {
+      requestedFullHeaders.insert(uid);
+      fetchHeaderUids.insert(uid);
+    }
+
     if ((uid != -1) &&
         (bodys.find(uid) == bodys.end()) &&
         (requestedBodys.find(uid) == requestedBodys.end()))
@@ -996,65 +1178,70 @@ void Ui::DrawMessage()
       fetchBodyUids.insert(uid);
     }
 
-    std::string headerText;
     std::map<uint32_t, Header>::iterator headerIt = headers.find(uid);
     std::map<uint32_t, Body>::iterator bodyIt = bodys.find(uid);
 
-    std::stringstream ss;
-    if (headerIt != headers.end())
+    if (bodyIt != bodys.end())
     {
-      Header& header = headerIt->second;
-      ss << "Date: " << header.GetDateTime() << "\n";
-      ss << "From: " << header.GetFrom() << "\n";
-      ss << "To: " << header.GetTo() << "\n";
-      if (!header.GetCc().empty())
+      // the wrapped text is kept until message, width, view mode or header detail changes
+      const std::string layoutKey = m_CurrentFolder + "\n" + std::to_string(uid) + "\n" +
+        std::to_string(m_MaxLineLength) + "\n" + std::to_string(m_Plaintext) + "\n" +
+        ((headerIt == headers.end()) ? "-" : (headerIt->second.IsEnvelope() ? "e" : "h"));
+      if (layoutKey != m_MessageViewLayoutKey)
       {
-        ss << "Cc: " << header.GetCc() << "\n";
-      }
-      
-      ss << "Subject: " << header.GetSubject() << "\n";
-
-      if (bodyIt != bodys.end())
-      {
-        Body& body = bodyIt->second;
-        std::map<ssize_t, Part> parts = body.GetParts();
-        std::vector<std::string> attnames;
-        for (auto it = parts.begin(); it != parts.end(); ++it)
+        std::stringstream ss;
+        if (headerIt != headers.end())
         {
-          if (!it->second.m_Filename.empty())
+          Header& header = headerIt->second;
+          ss << "Date: " << header.GetDateTime() << "\n";
+          ss << "From: " << header.GetFrom() << "\n";
+          ss << "To: " << header.GetTo() << "\n";
+          if (!header.GetCc().empty())
           {
-            attnames.push_back(it->second.m_Filename);
+            ss << "Cc: " << header.GetCc() << "\n";
+          }
+
+          ss << "Subject: " << header.GetSubject() << "\n";
+
+          Body& body = bodyIt->second;
+          std::map<ssize_t, Part> parts = body.GetParts();
+          std::vector<std::string> attnames;
+          for (auto it = parts.begin(); it != parts.end(); ++it)
+          {
+            if (!it->second.m_Filename.empty())
+            {
+              attnames.push_back(it->second.m_Filename);
+            }
+          }
+
+          if (!attnames.empty())
+          {
+            ss << "Attachments: ";
+            ss << Util::Join(attnames, ", ");
+            ss << "\n";
           }
-        }
 
-        if (!attnames.empty())
-        {
-          ss << "Attachments: ";
-          ss << Util::Join(attnames, ", ");
           ss << "\n";
         }
-      }
-
-      ss << "\n";
-    }
 
-    headerText = ss.str();
+        Body& body = bodyIt->second;
+        const std::string& bodyText = m_Plaintext ? body.GetTextPlain() : body.GetText();
+        m_CurrentMessageViewText = ss.str() + bodyText;
+        m_MessageViewLayout.SetText(Util::ToWString(m_CurrentMessageViewText), m_MaxLineLength,
+                                    true);
+        m_MessageViewLayoutKey = layoutKey;
+      }
 
-    if (bodyIt != bodys.end())
-    {
-      Body& body = bodyIt->second;
-      const std::string& bodyText = m_Plaintext ? body.GetTextPlain() : body.GetText();
-      const std::string text = headerText + bodyText;
-      m_CurrentMessageViewText = text;
-      const std::wstring wtext = Util::ToWString(text);
-      const std::vector<std::wstring>& wlines = Util::WordWrap(wtext, m_MaxLineLength, true);
-      int countLines = wlines.size();
+      // only lay out lines up to the bottom of the view, or all for bounding at the end
+      m_MessageViewLineOffset = std::max(0, m_MessageViewLineOffset);
+      m_MessageViewLayout.Layout((size_t)m_MessageViewLineOffset + m_MainWinHeight);
+      int countLines = m_MessageViewLayout.GetLineCount();
 
       m_MessageViewLineOffset = Util::Bound(0, m_MessageViewLineOffset,
                                             countLines - m_MainWinHeight);
       for (int i = 0; ((i < m_MainWinHeight) && (i < countLines)); ++i)
       {
-        const std::wstring& wdispStr = wlines.at(i + m_MessageViewLineOffset);
+        const std::wstring& wdispStr = m_MessageViewLayout.GetLine(i + m_MessageViewLineOffset);
         const std::string& dispStr = Util::ToString(wdispStr);
         mvwprintw(m_MainWin, i, 0, "%s", dispStr.c_str());
       }
@@ -1063,10 +1250,21 @@ void Ui::DrawMessage()
     }
   }
 
+  if (!fetchHeaderUids.empty())
+  {
+    ImapManager::Request request;
+    request.m_Folder = m_CurrentFolder;
+    request.m_Priority = ImapManager::RequestPriorityCurrentMessage;
+    request.m_GetHeaders = fetchHeaderUids;
+    LOG_DEBUG_VAR("async request headers =", fetchHeaderUids);
+    m_ImapManager->AsyncRequest(request);
+  }
+
   if (!fetchBodyUids.empty())
   {
     ImapManager::Request request;
     request.m_Folder = m_CurrentFolder;
+    request.m_Priority = ImapManager::RequestPriorityCurrentMessage;
     request.m_GetBodys = fetchBodyUids;
     LOG_DEBUG_VAR("async request bodys =", fetchBodyUids);
     m_ImapManager->AsyncRequest(request);
@@ -1082,9 +1280,7 @@ void Ui::DrawMessage()
 
 void Ui::DrawComposeMessage()
 {
-  m_ComposeMessageLines = Util::WordWrap(m_ComposeMessageStr, m_MaxLineLength, true,
-                                         m_ComposeMessagePos, m_ComposeMessageWrapLine,
-                                         m_ComposeMessageWrapPos);
+  m_ComposeMessageBuffer.SetLineLength(m_MaxLineLength);
 
   int cursY = 0;
   int cursX = 0;
@@ -1098,8 +1294,11 @@ void Ui::DrawComposeMessage()
   }
   else
   {
-    cursY = 5 + m_ComposeMessageWrapLine;
-    cursX = m_ComposeMessageWrapPos;
+    int wrapLine = 0;
+    int wrapPos = 0;
+    m_ComposeMessageBuffer.GetCursor(wrapLine, wrapPos);
+    cursY = 5 + wrapLine;
+    cursX = wrapPos;
   }
 
   werase(m_MainWin);
@@ -1140,11 +1339,6 @@ void Ui::DrawComposeMessage()
 
   composeLines.push_back(L"");
 
-  for (auto line = m_ComposeMessageLines.begin(); line != m_ComposeMessageLines.end(); ++line)
-  {
-    composeLines.push_back(*line);
-  }
-
   if (cursY < m_ComposeMessageOffsetY)
   {
     m_ComposeMessageOffsetY = std::max(m_ComposeMessageOffsetY - (m_MainWinHeight / 2), 0);
@@ -1155,15 +1349,21 @@ void Ui::DrawComposeMessage()
     m_ComposeMessageOffsetY += (m_MainWinHeight / 2);
   }
 
+  // only the visible part of the message is fetched from the compose buffer
+  const int headerCount = composeLines.size();
+  const int messageOffset = std::max(m_ComposeMessageOffsetY - headerCount, 0);
+  std::vector<std::wstring> messageLines;
+  m_ComposeMessageBuffer.GetWrappedLines(messageOffset, m_MainWinHeight + 1, messageLines);
+  const int countLines = headerCount + messageOffset + messageLines.size();
+
   int messageY = 0;
-  int idx = 0;
-  for (auto line = composeLines.begin(); line != composeLines.end(); ++line, ++idx)
+  for (int idx = m_ComposeMessageOffsetY; idx < countLines; ++idx)
   {
-    if (idx < m_ComposeMessageOffsetY) continue;
-
     if (messageY > m_MainWinHeight) break;
 
-    const std::string& dispStr = Util::ToString(*line);
+    const std::wstring& line = (idx < headerCount) ? composeLines.at(idx)
+      : messageLines.at(idx - headerCount - messageOffset);
+    const std::string& dispStr = Util::ToString(line);
     mvwprintw(m_MainWin, messageY, 0, "%s", dispStr.c_str());
     ++messageY;
   }
@@ -1208,10 +1408,14 @@ void Ui::DrawPartList()
         {
           wattron(m_MainWin, A_REVERSE);
           m_PartListCurrentPart = part;
+          m_PartListCurrentPartIndex = it->first;
         }
 
         std::string leftPad = "    ";
-        std::string sizeStr = std::to_string(part.m_Data.size()) + " bytes"; 
+        const uint64_t size =
+          part.m_Path.empty() ? part.m_Data.size() : Util::GetFileSize(part.m_Path);
+        std::string sizeStr = part.m_Fetched ? (std::to_string(size) + " bytes")
+                                             : std::string("not fetched");
         std::string sizeStrPadded = Util::TrimPadString(sizeStr, 18);
         std::string mimeTypePadded = Util::TrimPadString(part.m_MimeType, 30);
         std::string line = leftPad + sizeStrPadded + mimeTypePadded;
@@ -1240,10 +1444,17 @@ void Ui::AsyncUiRequest(char p_UiRequest)
 
 void Ui::PerformUiRequest(char p_UiRequest)
 {
-  if (p_UiRequest & UiRequestDrawAll)
+  if ((p_UiRequest & UiRequestDrawAll) ||
+      ((p_UiRequest & UiRequestDrawDamaged) && IsDamageVisible()))
   {
     DrawAll();
   }
+  else if (p_UiRequest & UiRequestDrawTop)
+  {
+    DrawTop();
+    DrawDialog();
+    m_DrawTime = std::chrono::steady_clock::now();
+  }
 
   if (p_UiRequest & UiRequestDrawError)
   {
@@ -1259,24 +1470,150 @@ void Ui::PerformUiRequest(char p_UiRequest)
   }
 }
 
+bool Ui::IsDamageVisible()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  std::set<uint32_t> damagedUids;
+  damagedUids.swap(m_DamagedUids);
+
+  switch (m_State)
+  {
+    case StateViewMessageList:
+    case StateViewSearchList:
+      {
+        // new uids are only requested when the list is drawn
+        if (!m_NewUids[m_CurrentFolder].empty()) return true;
+
+        const bool isSearch = (m_State == StateViewSearchList);
+        const int32_t currentIndex =
+          isSearch ? m_SearchListCurrentIndex : m_MessageListCurrentIndex[m_CurrentFolder];
+        if (currentIndex != m_DrawnCurrentIndex) return true;
+
+        int idxOffs = 0;
+        int idxMax = 0;
+        GetMessageListWindow(currentIndex, GetMessageListCount(isSearch), idxOffs, idxMax);
+        if ((idxMax - idxOffs) != (int)m_DrawnUids.size()) return true;
+
+        for (int i = idxOffs; i < idxMax; ++i)
+        {
+          uint32_t uid = GetMessageListUid(isSearch, i);
+          if ((uid != m_DrawnUids[i - idxOffs]) || (damagedUids.find(uid) != damagedUids.end()))
+          {
+            return true;
+          }
+        }
+
+        if (!isSearch && m_ThreadView)
+        {
+          // a collapsed thread row changes with any message of the thread
+          const ThreadIndex& threadIndex = m_ThreadIndexes[m_CurrentFolder];
+          for (auto& uid : damagedUids)
+          {
+            uint32_t row = 0;
+            if (!threadIndex.GetRowIndex(uid, row) ||
+                (((int)row >= idxOffs) && ((int)row < idxMax)))
+            {
+              return true;
+            }
+          }
+        }
+
+        return false;
+      }
+
+    case StateViewMessage:
+    case StateViewPartList:
+      return (damagedUids.find(m_MessageListCurrentUid[m_CurrentFolder]) != damagedUids.end());
+
+    default:
+      return false;
+  }
+}
+
+void Ui::GetMessageListWindow(int32_t p_CurrentIndex, int32_t p_Count, int& p_IdxOffs,
+                              int& p_IdxMax)
+{
+  p_IdxOffs = Util::Bound(0, (int)(p_CurrentIndex - ((m_MainWinHeight - 1) / 2)),
+                          std::max(0, (int)p_Count - (int)m_MainWinHeight));
+  p_IdxMax = p_IdxOffs + std::min(m_MainWinHeight, (int)p_Count);
+}
+
+int32_t Ui::GetMessageListCount(bool p_IsSearch)
+{
+  if (p_IsSearch)
+  {
+    return m_SearchDateUids.Size();
+  }
+  else if (m_ThreadView)
+  {
+    return m_ThreadIndexes[m_CurrentFolder].GetRowCount();
+  }
+  else
+  {
+    return m_MsgDateUids[m_CurrentFolder].Size();
+  }
+}
+
+uint32_t Ui::GetMessageListUid(bool p_IsSearch, int32_t p_Index)
+{
+  if (p_IsSearch)
+  {
+    return m_SearchDateUids.GetUid(p_Index);
+  }
+  else if (m_ThreadView)
+  {
+    uint32_t uid = 0;
+    uint32_t depth = 0;
+    uint32_t collapsedCount = 0;
+    m_ThreadIndexes[m_CurrentFolder].GetRow(p_Index, uid, depth, collapsedCount);
+    return uid;
+  }
+  else
+  {
+    return m_MsgDateUids[m_CurrentFolder].GetUid(p_Index);
+  }
+}
+
 void Ui::Run()
 {
   DrawAll();
   int64_t uiIdleTime = 0;
+  char pendingUiRequest = UiRequestNone;
+  const int64_t drawIntervalUs = 50000; // async redraws are limited to 20 per second
   LOG_DEBUG("entering loop");
 
   while (m_Running)
   {
+    struct timeval tv = {1, 0}; // uiIdleTime logic below is dependent on timeout value
+    if (pendingUiRequest != UiRequestNone)
+    {
+      const int64_t elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - m_DrawTime).count();
+      if (elapsedUs >= drawIntervalUs)
+      {
+        PerformUiRequest(pendingUiRequest);
+        pendingUiRequest = UiRequestNone;
+      }
+      else
+      {
+        tv.tv_sec = 0;
+        tv.tv_usec = drawIntervalUs - elapsedUs;
+      }
+    }
+
     fd_set fds;
     FD_ZERO(&fds);
     FD_SET(STDIN_FILENO, &fds);
     FD_SET(m_Pipe[0], &fds);
     int maxfd = std::max(STDIN_FILENO, m_Pipe[0]);
-    struct timeval tv = {1, 0}; // uiIdleTime logic below is dependent on timeout value
     int rv = select(maxfd + 1, &fds, NULL, NULL, &tv);
 
     if (rv == 0)
     {
+      if (pendingUiRequest != UiRequestNone) continue;
+
+      RequestFolderStatuses();
+
       if (++uiIdleTime >= 600) // ui idle refresh every 10 minutes
       {
         PerformUiRequest(UiRequestDrawAll);
@@ -1311,6 +1648,10 @@ void Ui::Run()
           ViewMessageKeyHandler(key);
           break;
 
+        case StateViewSearchList:
+          ViewSearchListKeyHandler(key);
+          break;
+
         case StateGotoFolder:
         case StateMoveToFolder:
           ViewFolderListKeyHandler(key);
@@ -1350,13 +1691,10 @@ void Ui::Run()
         len = std::min(len, 256);
         std::vector<char> buf(len);
         read(m_Pipe[0], &buf[0], len);
-        char uiRequest = UiRequestNone;
         for (int i = 0; i < len; ++i)
         {
-          uiRequest |= buf[i];
+          pendingUiRequest |= buf[i];
         }
-
-        PerformUiRequest(uiRequest);
       }
     }
 
@@ -1410,7 +1748,8 @@ void Ui::ViewFolderListKeyHandler(int p_Key)
     {
       if (m_FolderListCurrentFolder != m_CurrentFolder)
       {
-        MoveMessage(m_MessageListCurrentUid[m_CurrentFolder], m_CurrentFolder, m_FolderListCurrentFolder);
+        MoveMessages(GetActionUids(m_LastState == StateViewMessageList), m_CurrentFolder,
+                     m_FolderListCurrentFolder);
         UpdateUidFromIndex(true /* p_UserTriggered */);
         SetLastStateOrMessageList();
       }
@@ -1719,6 +2058,9 @@ void Ui::ViewMessageListKeyHandler(int p_Key)
   {
     if (IsConnected())
     {
+      // drafts are edited with their attachments, which may not be fetched yet
+      if ((m_CurrentFolder == m_DraftsFolder) && !CurrentMessagePartsAvailable()) return;
+
       SetState(StateComposeMessage);
     }
     else
@@ -1759,7 +2101,10 @@ void Ui::ViewMessageListKeyHandler(int p_Key)
       {
         if (CurrentMessageBodyAvailable())
         {
-          SetState(StateForwardMessage);
+          if (CurrentMessagePartsAvailable())
+          {
+            SetState(StateForwardMessage);
+          }
         }
         else
         {
@@ -1824,6 +2169,43 @@ void Ui::ViewMessageListKeyHandler(int p_Key)
   {
     ImportMessage();
   }
+  else if (p_Key == m_KeySearch)
+  {
+    SearchMessages();
+  }
+  else if (p_Key == m_KeyToggleThreads)
+  {
+    m_ThreadView = !m_ThreadView;
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_MessageListUidSet[m_CurrentFolder] = true;
+    }
+
+    UpdateIndexFromUid();
+  }
+  else if (m_ThreadView && ((p_Key == KEY_RIGHT) || (p_Key == KEY_LEFT)))
+  {
+    SetThreadExpanded(p_Key == KEY_RIGHT);
+  }
+  else if (p_Key == m_KeyTag)
+  {
+    if (m_MessageListCurrentUid[m_CurrentFolder] != -1)
+    {
+      ToggleTag();
+    }
+    else
+    {
+      SetDialogMessage("No message to tag");
+    }
+  }
+  else if (p_Key == m_KeyTagMatching)
+  {
+    TagMatching();
+  }
+  else if (p_Key == m_KeyTagAll)
+  {
+    ToggleTagAll();
+  }
   else
   {
     SetDialogMessage("Invalid input (" + Util::ToHexString(p_Key) +  ")");
@@ -1876,7 +2258,7 @@ void Ui::ViewMessageKeyHandler(int p_Key)
   }
   else if ((p_Key == KEY_BACKSPACE) || (p_Key == KEY_DELETE) || (p_Key == m_KeyBack))
   {
-    SetState(StateViewMessageList);
+    SetState(m_SearchQuery.empty() ? StateViewMessageList : StateViewSearchList);
   }
   else if (p_Key == m_KeyOpen)
   {
@@ -1901,6 +2283,9 @@ void Ui::ViewMessageKeyHandler(int p_Key)
   {
     if (IsConnected())
     {
+      // drafts are edited with their attachments, which may not be fetched yet
+      if ((m_CurrentFolder == m_DraftsFolder) && !CurrentMessagePartsAvailable()) return;
+
       SetState(StateComposeMessage);
     }
     else
@@ -1932,7 +2317,10 @@ void Ui::ViewMessageKeyHandler(int p_Key)
     {
       if (CurrentMessageBodyAvailable())
       {
-        SetState(StateForwardMessage);
+        if (CurrentMessagePartsAvailable())
+        {
+          SetState(StateForwardMessage);
+        }
       }
       else
       {
@@ -2088,7 +2476,7 @@ void Ui::ComposeMessageKeyHandler(int p_Key)
         else
         {
           m_IsComposeHeader = false;
-          m_ComposeMessagePos = 0;
+          m_ComposeMessageBuffer.SetCursorStart();
         }
       }
       else
@@ -2135,30 +2523,31 @@ void Ui::ComposeMessageKeyHandler(int p_Key)
   {
     if (p_Key == KEY_UP)
     {
-      ComposeMessagePrevLine();
+      if (!m_ComposeMessageBuffer.MoveUp())
+      {
+        m_IsComposeHeader = true;
+      }
     }
     else if (p_Key == KEY_DOWN)
     {
-      ComposeMessageNextLine();
+      m_ComposeMessageBuffer.MoveDown();
     }
     else if (p_Key == KEY_PPAGE)
     {
       for (int i = 0; i < (m_MainWinHeight / 2); ++i)
       {
-        ComposeMessagePrevLine();
-        m_ComposeMessageLines = Util::WordWrap(m_ComposeMessageStr, m_MaxLineLength, true,
-                                               m_ComposeMessagePos, m_ComposeMessageWrapLine,
-                                               m_ComposeMessageWrapPos);
+        if (!m_ComposeMessageBuffer.MoveUp())
+        {
+          m_IsComposeHeader = true;
+          break;
+        }
       }
     }
     else if (p_Key == KEY_NPAGE)
     {
       for (int i = 0; i < (m_MainWinHeight / 2); ++i)
       {
-        ComposeMessageNextLine();
-        m_ComposeMessageLines = Util::WordWrap(m_ComposeMessageStr, m_MaxLineLength, true,
-                                               m_ComposeMessagePos, m_ComposeMessageWrapLine,
-                                               m_ComposeMessageWrapPos);
+        m_ComposeMessageBuffer.MoveDown();
       }
     }
     else if (p_Key == KEY_HOME)
@@ -2171,38 +2560,31 @@ void Ui::ComposeMessageKeyHandler(int p_Key)
     }
     else if (p_Key == KEY_LEFT)
     {
-      --m_ComposeMessagePos;
-      if (m_ComposeMessagePos < 0)
+      if (m_ComposeMessageBuffer.IsCursorStart())
       {
         m_IsComposeHeader = true;
         m_ComposeHeaderPos = (int)m_ComposeHeaderStr.at(m_ComposeHeaderLine).size();
       }
-
-      m_ComposeMessagePos = Util::Bound(0, m_ComposeMessagePos,
-                                        (int)m_ComposeMessageStr.size());
+      else
+      {
+        m_ComposeMessageBuffer.MoveLeft();
+      }
     }
     else if (p_Key == KEY_RIGHT)
     {
-      m_ComposeMessagePos = Util::Bound(0, m_ComposeMessagePos + 1,
-                                        (int)m_ComposeMessageStr.size());
+      m_ComposeMessageBuffer.MoveRight();
     }
     else if ((p_Key == KEY_BACKSPACE) || (p_Key == KEY_DELETE))
     {
-      if (m_ComposeMessagePos > 0)
-      {
-        m_ComposeMessageStr.erase(--m_ComposeMessagePos, 1);
-      }
+      m_ComposeMessageBuffer.Backspace();
     }
     else if (p_Key == KEY_DC)
     {
-      if (m_ComposeMessagePos < (int)m_ComposeMessageStr.size())
-      {
-        m_ComposeMessageStr.erase(m_ComposeMessagePos, 1);
-      }
+      m_ComposeMessageBuffer.Delete();
     }
     else if (p_Key == m_KeyDeleteLine)
     {
-      Util::DeleteToMatch(m_ComposeMessageStr, m_ComposeMessagePos, '\n');
+      m_ComposeMessageBuffer.DeleteLine();
     }
     else
     {
@@ -2256,7 +2638,11 @@ void Ui::ComposeMessageKeyHandler(int p_Key)
     }
     else if (p_Key == m_KeyExternalEditor)
     {
-      ExternalEditor(m_ComposeMessageStr, m_ComposeMessagePos);
+      std::wstring composeMessageStr = m_ComposeMessageBuffer.GetText();
+      if (ExternalEditor(composeMessageStr))
+      {
+        m_ComposeMessageBuffer.SetText(composeMessageStr);
+      }
     }
     else if (IsValidTextKey(p_Key))
     {
@@ -2266,7 +2652,7 @@ void Ui::ComposeMessageKeyHandler(int p_Key)
       }
       else
       {
-        m_ComposeMessageStr.insert(m_ComposeMessagePos++, 1, p_Key);
+        m_ComposeMessageBuffer.Insert(p_Key);
       }
     }
     else
@@ -2315,6 +2701,11 @@ void Ui::ViewPartListKeyHandler(int p_Key)
     Util::CleanupAttachmentsTempDir();
     SetState(StateViewMessage);
   }
+  else if (((p_Key == KEY_RETURN) || (p_Key == KEY_ENTER) || (p_Key == m_KeyOpen) ||
+            (p_Key == m_KeySaveFile)) && !m_PartListCurrentPart.m_Fetched)
+  {
+    RequestBodyParts(m_MessageListCurrentUid[m_CurrentFolder], { m_PartListCurrentPartIndex });
+  }
   else if ((p_Key == KEY_RETURN) || (p_Key == KEY_ENTER) || (p_Key == m_KeyOpen))
   {
     std::string ext;
@@ -2355,13 +2746,14 @@ void Ui::ViewPartListKeyHandler(int p_Key)
             {
               const std::string& tempPartFilePath = Util::GetAttachmentsTempDir() + part.second.m_ContentId;
               LOG_DEBUG("writing \"%s\"", tempPartFilePath.c_str());
-              Util::WriteFile(tempPartFilePath, part.second.m_Data);
+              WritePartFile(tempPartFilePath, part.second);
             }
           }
         }
 
         tempFilePath = Util::GetAttachmentsTempDir() + fileName;
-        std::string partData = m_PartListCurrentPart.m_Data;
+        std::string partData = m_PartListCurrentPart.m_Path.empty() ?
+          m_PartListCurrentPart.m_Data : Util::ReadFile(m_PartListCurrentPart.m_Path);
         Util::ReplaceString(partData, "src=cid:", "src=file://" + Util::GetAttachmentsTempDir());
         Util::ReplaceString(partData, "src=\"cid:", "src=\"file://" + Util::GetAttachmentsTempDir());
         LOG_DEBUG("writing \"%s\"", tempFilePath.c_str());
@@ -2371,7 +2763,7 @@ void Ui::ViewPartListKeyHandler(int p_Key)
       {
         tempFilePath = Util::GetAttachmentsTempDir() + fileName;
         LOG_DEBUG("writing \"%s\"", tempFilePath.c_str());
-        Util::WriteFile(tempFilePath, m_PartListCurrentPart.m_Data);
+        WritePartFile(tempFilePath, m_PartListCurrentPart);
       }
 
       LOG_DEBUG("opening \"%s\" in external viewer", tempFilePath.c_str());
@@ -2401,7 +2793,7 @@ void Ui::ViewPartListKeyHandler(int p_Key)
     {
       if (!filename.empty())
       {
-        Util::WriteFile(filename, m_PartListCurrentPart.m_Data);
+        WritePartFile(filename, m_PartListCurrentPart);
         SetDialogMessage("File saved");
       }
       else
@@ -2422,15 +2814,89 @@ void Ui::ViewPartListKeyHandler(int p_Key)
   DrawAll();
 }
 
-void Ui::SetState(Ui::State p_State)
+void Ui::ViewSearchListKeyHandler(int p_Key)
 {
-  if ((p_State == StateAddressList) || (p_State == StateFileList))
+  if (p_Key == m_KeyQuit)
   {
-    // going to address or file list
-    m_LastMessageState = m_State;
-    m_State = p_State;
+    Quit();
   }
-  else if ((m_State != StateAddressList) && (m_State != StateFileList))
+  else if ((p_Key == KEY_UP) || (p_Key == m_KeyPrevMsg))
+  {
+    --m_SearchListCurrentIndex;
+  }
+  else if ((p_Key == KEY_DOWN) || (p_Key == m_KeyNextMsg))
+  {
+    ++m_SearchListCurrentIndex;
+  }
+  else if (p_Key == KEY_PPAGE)
+  {
+    m_SearchListCurrentIndex = m_SearchListCurrentIndex - m_MainWinHeight;
+  }
+  else if ((p_Key == KEY_NPAGE) || (p_Key == KEY_SPACE))
+  {
+    m_SearchListCurrentIndex = m_SearchListCurrentIndex + m_MainWinHeight;
+  }
+  else if (p_Key == KEY_HOME)
+  {
+    m_SearchListCurrentIndex = 0;
+  }
+  else if (p_Key == KEY_END)
+  {
+    m_SearchListCurrentIndex = std::numeric_limits<int>::max();
+  }
+  else if ((p_Key == KEY_RETURN) || (p_Key == KEY_ENTER) || (p_Key == m_KeyOpen))
+  {
+    bool found = false;
+
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      if (m_SearchListCurrentIndex < (int32_t)m_SearchDateUids.Size())
+      {
+        m_MessageListCurrentUid[m_CurrentFolder] =
+          m_SearchDateUids.GetUid(m_SearchListCurrentIndex);
+        m_MessageListUidSet[m_CurrentFolder] = true;
+        found = true;
+      }
+    }
+
+    if (found)
+    {
+      UpdateIndexFromUid();
+      SetState(StateViewMessage);
+    }
+  }
+  else if ((p_Key == KEY_BACKSPACE) || (p_Key == KEY_DELETE) || (p_Key == m_KeyBack) ||
+           (p_Key == m_KeyCancel))
+  {
+    SetState(StateViewMessageList);
+  }
+  else if (p_Key == m_KeySearch)
+  {
+    SearchMessages();
+  }
+  else
+  {
+    SetDialogMessage("Invalid input (" + Util::ToHexString(p_Key) +  ")");
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_SearchListCurrentIndex =
+      Util::Bound(0, m_SearchListCurrentIndex, std::max(0, (int)m_SearchDateUids.Size() - 1));
+  }
+
+  DrawAll();
+}
+
+void Ui::SetState(Ui::State p_State)
+{
+  if ((p_State == StateAddressList) || (p_State == StateFileList))
+  {
+    // going to address or file list
+    m_LastMessageState = m_State;
+    m_State = p_State;
+  }
+  else if ((m_State != StateAddressList) && (m_State != StateFileList))
   {
     // normal state transition
     m_LastState = m_State;
@@ -2469,8 +2935,15 @@ void Ui::SetState(Ui::State p_State)
     {
       std::lock_guard<std::mutex> lock(m_Mutex);
       m_MessageViewToggledSeen = false;
+      m_SearchQuery.clear();
+      m_SearchUids.clear();
+      m_SearchDateUids.Clear();
     }
   }
+  else if (m_State == StateViewSearchList)
+  {
+    curs_set(0);
+  }
   else if (m_State == StateViewMessage)
   {
     curs_set(0);
@@ -2488,8 +2961,7 @@ void Ui::SetState(Ui::State p_State)
     m_ComposeHeaderLine = 0;
     m_ComposeHeaderPos = 0;
     m_ComposeHeaderRef.clear();
-    m_ComposeMessageStr.clear();
-    m_ComposeMessagePos = 0;
+    m_ComposeMessageBuffer.SetText(L"");
     m_IsComposeHeader = true;
     m_ComposeDraftUid = 0;
     m_ComposeMessageOffsetY = 0;
@@ -2511,8 +2983,9 @@ void Ui::SetState(Ui::State p_State)
         Body& body = bit->second;
 
         const std::string& bodyText = m_Plaintext ? body.GetTextPlain() : body.GetText();
-        m_ComposeMessageStr = Util::ToWString(bodyText);
-        Util::StripCR(m_ComposeMessageStr);
+        std::wstring composeMessageStr = Util::ToWString(bodyText);
+        Util::StripCR(composeMessageStr);
+        m_ComposeMessageBuffer.SetText(composeMessageStr);
 
         // @todo: handle quoted commas in address name
         std::vector<std::string> tos = Util::Split(header.GetTo(), ',');
@@ -2532,7 +3005,7 @@ void Ui::SetState(Ui::State p_State)
             Util::MkDir(tmpfiledir);
             std::string tmpfilepath = tmpfiledir + part.second.m_Filename;
 
-            Util::WriteFile(tmpfilepath, part.second.m_Data);
+            WritePartFile(tmpfilepath, part.second);
             if (m_ComposeHeaderStr[2].empty())
             {
               m_ComposeHeaderStr[2] = m_ComposeHeaderStr[2] + Util::ToWString(tmpfilepath);
@@ -2560,8 +3033,7 @@ void Ui::SetState(Ui::State p_State)
     m_ComposeHeaderStr[3] = L"";
     m_ComposeHeaderLine = 3;
     m_ComposeHeaderPos = 0;
-    m_ComposeMessageStr.clear();
-    m_ComposeMessagePos = 0;
+    m_ComposeMessageBuffer.SetText(L"");
     m_ComposeMessageOffsetY = 0;
     m_ComposeTempDirectory.clear();
 
@@ -2582,11 +3054,12 @@ void Ui::SetState(Ui::State p_State)
       std::string indentBodyText =
         Util::AddIndent(Util::ToString(Util::Join(bodyTextLines)), "> ");
       
-      m_ComposeMessageStr = Util::ToWString("\n\nOn " + header.GetDateTime() + " " +
-                                            header.GetFrom() +
-                                            " wrote:\n\n" +
-                                            indentBodyText);
-      Util::StripCR(m_ComposeMessageStr);
+      std::wstring composeMessageStr = Util::ToWString("\n\nOn " + header.GetDateTime() + " " +
+                                                       header.GetFrom() +
+                                                       " wrote:\n\n" +
+                                                       indentBodyText);
+      Util::StripCR(composeMessageStr);
+      m_ComposeMessageBuffer.SetText(composeMessageStr);
 
       // @todo: handle quoted commas in address name
       std::vector<std::string> ccs = Util::Split(header.GetCc(), ',');
@@ -2619,8 +3092,7 @@ void Ui::SetState(Ui::State p_State)
     m_ComposeHeaderStr[3] = L"";
     m_ComposeHeaderLine = 0;
     m_ComposeHeaderPos = 0;
-    m_ComposeMessageStr.clear();
-    m_ComposeMessagePos = 0;
+    m_ComposeMessageBuffer.SetText(L"");
     m_ComposeMessageOffsetY = 0;
     m_ComposeTempDirectory.clear();
 
@@ -2645,7 +3117,7 @@ void Ui::SetState(Ui::State p_State)
           Util::MkDir(tmpfiledir);
           std::string tmpfilepath = tmpfiledir + part.second.m_Filename;
 
-          Util::WriteFile(tmpfilepath, part.second.m_Data);
+          WritePartFile(tmpfilepath, part.second);
           if (m_ComposeHeaderStr[2].empty())
           {
             m_ComposeHeaderStr[2] = m_ComposeHeaderStr[2] + Util::ToWString(tmpfilepath);
@@ -2657,7 +3129,7 @@ void Ui::SetState(Ui::State p_State)
         }
       }
 
-      m_ComposeMessageStr =
+      std::wstring composeMessageStr =
         Util::ToWString("\n\n---------- Forwarded message ---------\n"
                         "From: " + header.GetFrom() + "\n"
                         "Date: " + header.GetDateTime() + "\n"
@@ -2665,13 +3137,14 @@ void Ui::SetState(Ui::State p_State)
                         "To: " + header.GetTo() + "\n");
       if (!header.GetCc().empty())
       {
-        m_ComposeMessageStr +=
+        composeMessageStr +=
           Util::ToWString("Cc: " + header.GetCc());
       }
 
       const std::string& bodyText = m_Plaintext ? body.GetTextPlain() : body.GetText();
-      m_ComposeMessageStr += Util::ToWString("\n" + bodyText + "\n");
-      Util::StripCR(m_ComposeMessageStr);
+      composeMessageStr += Util::ToWString("\n" + bodyText + "\n");
+      Util::StripCR(composeMessageStr);
+      m_ComposeMessageBuffer.SetText(composeMessageStr);
 
       m_ComposeHeaderStr[3] = Util::ToWString(Util::MakeForwardSubject(header.GetSubject()));
 
@@ -2725,6 +3198,27 @@ void Ui::ResponseHandler(const ImapManager::Request& p_Request, const ImapManage
       LOG_DEBUG_VAR("new folders =", p_Response.m_Folders);
     }
 
+    if (!p_Response.m_FolderStatuses.empty())
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      for (auto& folderStatus : p_Response.m_FolderStatuses)
+      {
+        m_FolderStatuses[folderStatus.first] = folderStatus.second;
+      }
+
+      if ((m_State == StateGotoFolder) || (m_State == StateMoveToFolder))
+      {
+        uiRequest |= UiRequestDrawAll;
+      }
+    }
+
+    if (p_Request.m_GetFolderStatuses)
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_HasRequestedFolderStatuses = false;
+      m_FolderStatusesTime = std::chrono::steady_clock::now();
+    }
+
     if (p_Request.m_GetUids && !(p_Response.m_ResponseStatus & ImapManager::ResponseStatusGetUidsFailed))
     {
       std::lock_guard<std::mutex> lock(m_Mutex);
@@ -2764,23 +3258,63 @@ void Ui::ResponseHandler(const ImapManager::Request& p_Request, const ImapManage
       }
       
       m_Uids[p_Response.m_Folder] = p_Response.m_Uids;
-      uiRequest |= UiRequestDrawAll;
+      if (!m_SearchQuery.empty() && (p_Response.m_Folder == m_CurrentFolder))
+      {
+        UpdateSearchDateUids();
+      }
+
+      if (p_Response.m_Folder == m_CurrentFolder)
+      {
+        m_DamagedUids.insert(removedUids.begin(), removedUids.end());
+        uiRequest |= UiRequestDrawDamaged;
+      }
+
       updateIndexFromUid = true;
       LOG_DEBUG_VAR("new uids =", p_Response.m_Uids);
     }
 
-    if (!p_Request.m_GetHeaders.empty() && !(p_Response.m_ResponseStatus & ImapManager::ResponseStatusGetHeadersFailed))
+    if ((!p_Request.m_GetEnvelopes.empty() || !p_Request.m_GetHeaders.empty()) &&
+        !(p_Response.m_ResponseStatus & ImapManager::ResponseStatusGetHeadersFailed))
     {
       std::lock_guard<std::mutex> lock(m_Mutex);
-      m_Headers[p_Response.m_Folder].insert(p_Response.m_Headers.begin(), p_Response.m_Headers.end());
-      uiRequest |= UiRequestDrawAll;
+      std::map<uint32_t, Header>& headers = m_Headers[p_Response.m_Folder];
+      for (auto& header : p_Response.m_Headers)
+      {
+        // full headers replace envelope-only headers, but never the other way around
+        auto it = headers.find(header.first);
+        if (it == headers.end())
+        {
+          headers.insert(header);
+        }
+        else if (it->second.IsEnvelope() && !header.second.IsEnvelope())
+        {
+          it->second = header.second;
+        }
+      }
 
+      InvalidateMessageListRows(p_Response.m_Folder, MapKey(p_Response.m_Headers));
       AddUidDate(p_Response.m_Folder, p_Response.m_Headers);
+      if (!m_SearchQuery.empty() && (p_Response.m_Folder == m_CurrentFolder))
+      {
+        UpdateSearchDateUids();
+      }
 
       for (auto& header : p_Response.m_Headers)
       {
-        AddressBook::Add(m_Headers[p_Response.m_Folder][header.first].GetUniqueId(),
-                         m_Headers[p_Response.m_Folder][header.first].GetAddresses());
+        if (header.second.IsEnvelope()) continue;
+
+        AddressBook::Add(headers[header.first].GetUniqueId(),
+                         headers[header.first].GetAddresses());
+      }
+
+      if (p_Response.m_Folder == m_CurrentFolder)
+      {
+        for (auto& header : p_Response.m_Headers)
+        {
+          m_DamagedUids.insert(header.first);
+        }
+
+        uiRequest |= UiRequestDrawDamaged;
       }
 
       updateIndexFromUid = true;
@@ -2793,17 +3327,74 @@ void Ui::ResponseHandler(const ImapManager::Request& p_Request, const ImapManage
       std::map<uint32_t, uint32_t> newFlags = p_Response.m_Flags;
       newFlags.insert(m_Flags[p_Response.m_Folder].begin(), m_Flags[p_Response.m_Folder].end());
       m_Flags[p_Response.m_Folder] = newFlags;
-      uiRequest |= UiRequestDrawAll;
+      InvalidateMessageListRows(p_Response.m_Folder, MapKey(p_Response.m_Flags));
+      if (p_Response.m_Folder == m_CurrentFolder)
+      {
+        for (auto& flag : p_Response.m_Flags)
+        {
+          m_DamagedUids.insert(flag.first);
+        }
+
+        uiRequest |= UiRequestDrawDamaged;
+      }
+
       LOG_DEBUG_VAR("new flags =", MapKey(p_Response.m_Flags));
     }
 
     if (!p_Request.m_GetBodys.empty() && !(p_Response.m_ResponseStatus & ImapManager::ResponseStatusGetBodysFailed))
     {
       std::lock_guard<std::mutex> lock(m_Mutex);
-      m_Bodys[p_Response.m_Folder].insert(p_Response.m_Bodys.begin(), p_Response.m_Bodys.end());
-      uiRequest |= UiRequestDrawAll;
+      if (p_Request.m_FullBodys)
+      {
+        // raw messages replace the partially fetched bodys held
+        for (auto& body : p_Response.m_Bodys)
+        {
+          m_Bodys[p_Response.m_Folder][body.first] = body.second;
+        }
+      }
+      else
+      {
+        m_Bodys[p_Response.m_Folder].insert(p_Response.m_Bodys.begin(), p_Response.m_Bodys.end());
+      }
+
+      if (p_Response.m_Folder == m_CurrentFolder)
+      {
+        for (auto& body : p_Response.m_Bodys)
+        {
+          m_DamagedUids.insert(body.first);
+        }
+
+        uiRequest |= UiRequestDrawDamaged;
+      }
+
       LOG_DEBUG_VAR("new bodys =", MapKey(p_Response.m_Bodys));
     }
+
+    if (!p_Request.m_GetBodyParts.empty() && !(p_Response.m_ResponseStatus & ImapManager::ResponseStatusGetBodyPartsFailed))
+    {
+      // bodys with newly fetched parts replace the ones held
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      for (auto& body : p_Response.m_Bodys)
+      {
+        m_Bodys[p_Response.m_Folder][body.first] = body.second;
+      }
+
+      uiRequest |= UiRequestDrawAll;
+      LOG_DEBUG_VAR("new body parts =", MapKey(p_Response.m_Bodys));
+    }
+
+    if (!p_Request.m_SearchQuery.empty() && !(p_Response.m_ResponseStatus & ImapManager::ResponseStatusSearchFailed))
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      if ((p_Response.m_Folder == m_CurrentFolder) && (p_Request.m_SearchQuery == m_SearchQuery))
+      {
+        m_SearchUids = p_Response.m_SearchUids;
+        UpdateSearchDateUids();
+        uiRequest |= UiRequestDrawAll;
+      }
+
+      LOG_DEBUG_VAR("new search uids =", p_Response.m_SearchUids);
+    }
   }
   
   if (m_PrefetchLevel == PrefetchLevelFullSync)
@@ -2869,6 +3460,8 @@ void Ui::ResponseHandler(const ImapManager::Request& p_Request, const ImapManage
   
   if (p_Response.m_ResponseStatus != ImapManager::ResponseStatusOk)
   {
+    uiRequest |= UiRequestDrawAll;
+
     if (p_Response.m_ResponseStatus & ImapManager::ResponseStatusGetFoldersFailed)
     {
       SetDialogMessage("Get folders failed", true /* p_Warn */);
@@ -2893,6 +3486,18 @@ void Ui::ResponseHandler(const ImapManager::Request& p_Request, const ImapManage
     {
       SetDialogMessage("Login failed", true /* p_Warn */);
     }
+    else if (p_Response.m_ResponseStatus & ImapManager::ResponseStatusSearchFailed)
+    {
+      SetDialogMessage("Search failed", true /* p_Warn */);
+    }
+    else if (p_Response.m_ResponseStatus & ImapManager::ResponseStatusGetFolderStatusesFailed)
+    {
+      SetDialogMessage("Get folder status failed", true /* p_Warn */);
+    }
+    else if (p_Response.m_ResponseStatus & ImapManager::ResponseStatusGetBodyPartsFailed)
+    {
+      SetDialogMessage("Get message parts failed", true /* p_Warn */);
+    }
   }
 
   if (updateIndexFromUid)
@@ -2900,7 +3505,10 @@ void Ui::ResponseHandler(const ImapManager::Request& p_Request, const ImapManage
     UpdateIndexFromUid();
   }
   
-  AsyncUiRequest(uiRequest);
+  if (uiRequest != UiRequestNone)
+  {
+    AsyncUiRequest(uiRequest);
+  }
 }
 
 void Ui::ResultHandler(const ImapManager::Action& p_Action, const ImapManager::Result& p_Result)
@@ -2923,6 +3531,12 @@ void Ui::ResultHandler(const ImapManager::Action& p_Action, const ImapManager::R
     {
       SetDialogMessage("Importing message failed", true /* p_Warn */);
     }
+    else if (!p_Action.m_ImportPath.empty())
+    {
+      SetDialogMessage(p_Result.m_Message.empty()
+                       ? "Importing messages failed, import again to resume"
+                       : p_Result.m_Message, true /* p_Warn */);
+    }
     else if (p_Action.m_DeleteMessages)
     {
       SetDialogMessage("Permanently delete message failed", true /* p_Warn */);
@@ -2932,6 +3546,18 @@ void Ui::ResultHandler(const ImapManager::Action& p_Action, const ImapManager::R
       SetDialogMessage("Unknown IMAP action error", true /* p_Warn */);
     }
   }
+  else
+  {
+    // actions change folder counts, so refresh them on next idle
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_FolderStatusesStale = true;
+  }
+
+  if (!p_Action.m_ImportPath.empty())
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_HasRequestedUids[p_Action.m_Folder] = false;
+  }
 }
 
 void Ui::SmtpResultHandlerError(const SmtpManager::Result& p_Result)
@@ -3051,8 +3677,17 @@ void Ui::StatusHandler(const StatusUpdate& p_StatusUpdate)
     m_HasPrefetchRequestedFolders = true;
     m_ImapManager->PrefetchRequest(request);
   }
-  
-  AsyncUiRequest(UiRequestDrawAll);
+
+  // only the top bar shows progress, but connection changes may trigger new requests
+  const uint32_t connectionFlags = Status::FlagConnected | Status::FlagOffline;
+  if ((p_StatusUpdate.SetFlags | p_StatusUpdate.ClearFlags) & connectionFlags)
+  {
+    AsyncUiRequest(UiRequestDrawAll);
+  }
+  else
+  {
+    AsyncUiRequest(UiRequestDrawTop);
+  }
 }
 
 void Ui::SetImapManager(std::shared_ptr<ImapManager> p_ImapManager)
@@ -3099,6 +3734,26 @@ void Ui::SetClientStoreSent(bool p_ClientStoreSent)
   m_ClientStoreSent = p_ClientStoreSent;
 }
 
+void Ui::RequestFolderStatuses()
+{
+  if ((m_FolderStatusInterval <= 0) || !IsConnected()) return;
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (m_Folders.empty() || m_HasRequestedFolderStatuses) return;
+
+  const int64_t elapsedSec = std::chrono::duration_cast<std::chrono::seconds>(
+    std::chrono::steady_clock::now() - m_FolderStatusesTime).count();
+  if (!m_FolderStatusesStale && (elapsedSec < m_FolderStatusInterval)) return;
+
+  ImapManager::Request request;
+  request.m_PrefetchLevel = PrefetchLevelCurrentView;
+  request.m_GetFolderStatuses = true;
+  LOG_DEBUG("prefetch request folder statuses");
+  m_HasRequestedFolderStatuses = true;
+  m_FolderStatusesStale = false;
+  m_ImapManager->PrefetchRequest(request);
+}
+
 bool Ui::IsConnected()
 {
   std::lock_guard<std::mutex> lock(m_Mutex);
@@ -3179,6 +3834,7 @@ std::string Ui::GetStateStr()
     case StateAddressList: return "Address Book";
     case StateFileList: return "File Selection";
     case StateViewPartList: return "Message Parts";
+    case StateViewSearchList: return "Search: " + m_SearchQuery;
     default: return "Unknown State";
   }
 }
@@ -3196,8 +3852,9 @@ void Ui::SendComposedMessage()
   action.m_Cc = Util::ToString(m_ComposeHeaderStr.at(1));
   action.m_Att = Util::ToString(m_ComposeHeaderStr.at(2));
   action.m_Subject = Util::ToString(m_ComposeHeaderStr.at(3));
-  action.m_Body = Util::ToString(m_ComposeHardwrap ? Util::Join(m_ComposeMessageLines)
-                                                   : m_ComposeMessageStr);
+  m_ComposeMessageBuffer.SetLineLength(m_MaxLineLength);
+  action.m_Body = Util::ToString(m_ComposeHardwrap ? m_ComposeMessageBuffer.GetWrappedText()
+                                                   : m_ComposeMessageBuffer.GetText());
   action.m_RefMsgId = m_ComposeHeaderRef;
   action.m_ComposeTempDirectory = m_ComposeTempDirectory;
   action.m_ComposeDraftUid = m_ComposeDraftUid;
@@ -3215,8 +3872,10 @@ void Ui::UploadDraftMessage()
     smtpAction.m_Cc = Util::ToString(m_ComposeHeaderStr.at(1));
     smtpAction.m_Att = Util::ToString(m_ComposeHeaderStr.at(2));
     smtpAction.m_Subject = Util::ToString(m_ComposeHeaderStr.at(3));
-    smtpAction.m_Body = Util::ToString(m_ComposeHardwrap ? Util::Join(m_ComposeMessageLines)
-                                                         : m_ComposeMessageStr);
+    m_ComposeMessageBuffer.SetLineLength(m_MaxLineLength);
+    smtpAction.m_Body =
+      Util::ToString(m_ComposeHardwrap ? m_ComposeMessageBuffer.GetWrappedText()
+                                       : m_ComposeMessageBuffer.GetText());
     smtpAction.m_RefMsgId = m_ComposeHeaderRef;
 
     SmtpManager::Result smtpResult = m_SmtpManager->SyncAction(smtpAction);
@@ -3244,9 +3903,10 @@ bool Ui::DeleteMessage()
 {
   if (!m_TrashFolder.empty())
   {
+    const std::set<uint32_t> uids = GetActionUids(m_State == StateViewMessageList);
     if (m_CurrentFolder != m_TrashFolder)
     {
-      MoveMessage(m_MessageListCurrentUid[m_CurrentFolder], m_CurrentFolder, m_TrashFolder);
+      MoveMessages(uids, m_CurrentFolder, m_TrashFolder);
 
       m_MessageViewLineOffset = 0;
       UpdateUidFromIndex(true /* p_UserTriggered */);    
@@ -3254,7 +3914,7 @@ bool Ui::DeleteMessage()
       bool isMsgDateUidsEmpty = false;
       {
         std::lock_guard<std::mutex> lock(m_Mutex);
-        isMsgDateUidsEmpty = m_MsgDateUids[m_CurrentFolder].empty();
+        isMsgDateUidsEmpty = m_MsgDateUids[m_CurrentFolder].Empty();
       }
 
       if (isMsgDateUidsEmpty)
@@ -3264,9 +3924,12 @@ bool Ui::DeleteMessage()
     }
     else
     {
-      if (Ui::PromptYesNo("Permanently delete message (y/n)?"))
+      const std::string prompt = (uids.size() > 1) ?
+        ("Permanently delete " + std::to_string(uids.size()) + " messages (y/n)?") :
+        std::string("Permanently delete message (y/n)?");
+      if (Ui::PromptYesNo(prompt))
       {
-        DeleteMessage(m_MessageListCurrentUid[m_CurrentFolder], m_CurrentFolder);
+        DeleteMessages(uids, m_CurrentFolder);
       }
     }
     
@@ -3281,28 +3944,35 @@ bool Ui::DeleteMessage()
 
 void Ui::MoveMessage(uint32_t p_Uid, const std::string& p_From, const std::string& p_To)
 {
+  MoveMessages(std::set<uint32_t>({ p_Uid }), p_From, p_To);
+}
+
+void Ui::MoveMessages(const std::set<uint32_t>& p_Uids, const std::string& p_From,
+                      const std::string& p_To)
+{
+  // all messages are moved by a single action, i.e. one server command and cache update
   ImapManager::Action action;
   action.m_Folder = p_From;
-  action.m_Uids.insert(p_Uid);
+  action.m_Uids = p_Uids;
   action.m_MoveDestination = p_To;
   m_ImapManager->AsyncAction(action);
 
   {
     std::lock_guard<std::mutex> lock(m_Mutex);
-    RemoveUidDate(m_CurrentFolder, action.m_Uids);
-    m_Uids[m_CurrentFolder] = m_Uids[m_CurrentFolder] - action.m_Uids;
-    m_Headers[m_CurrentFolder] = m_Headers[m_CurrentFolder] - action.m_Uids;
+    RemoveUidDate(p_From, action.m_Uids);
+    m_Uids[p_From] = m_Uids[p_From] - action.m_Uids;
+    m_Headers[p_From] = m_Headers[p_From] - action.m_Uids;
 
     m_HasRequestedUids[p_From] = false;
     m_HasRequestedUids[p_To] = false;
   }
 }
 
-void Ui::DeleteMessage(uint32_t p_Uid, const std::string& p_Folder)
+void Ui::DeleteMessages(const std::set<uint32_t>& p_Uids, const std::string& p_Folder)
 {
   ImapManager::Action action;
   action.m_Folder = p_Folder;
-  action.m_Uids.insert(p_Uid);
+  action.m_Uids = p_Uids;
   action.m_DeleteMessages = true;
   m_ImapManager->AsyncAction(action);
 
@@ -3318,28 +3988,122 @@ void Ui::DeleteMessage(uint32_t p_Uid, const std::string& p_Folder)
 
 void Ui::ToggleSeen()
 {
-  std::map<uint32_t, uint32_t> flags;
+  // multiple messages are all marked read, unless they already are
+  const std::set<uint32_t> uids = GetActionUids(m_State == StateViewMessageList);
+  bool oldSeen = true;
   {
     std::lock_guard<std::mutex> lock(m_Mutex);
-    flags = m_Flags[m_CurrentFolder];
+    const std::map<uint32_t, uint32_t>& flags = m_Flags[m_CurrentFolder];
+    for (auto& uid : uids)
+    {
+      auto it = flags.find(uid);
+      oldSeen &= ((it != flags.end()) && Flag::GetSeen(it->second));
+    }
   }
-  uint32_t uid = m_MessageListCurrentUid[m_CurrentFolder];
-  bool oldSeen = ((flags.find(uid) != flags.end()) && (Flag::GetSeen(flags.at(uid))));
+
   bool newSeen = !oldSeen;
 
   ImapManager::Action action;
   action.m_Folder = m_CurrentFolder;
-  action.m_Uids.insert(m_MessageListCurrentUid[m_CurrentFolder]);
+  action.m_Uids = uids;
   action.m_SetSeen = newSeen;
   action.m_SetUnseen = !newSeen;
   m_ImapManager->AsyncAction(action);
 
   {
     std::lock_guard<std::mutex> lock(m_Mutex);
-    Flag::SetSeen(m_Flags[m_CurrentFolder][uid], newSeen);
+    for (auto& uid : uids)
+    {
+      Flag::SetSeen(m_Flags[m_CurrentFolder][uid], newSeen);
+    }
+
+    InvalidateMessageListRows(m_CurrentFolder, action.m_Uids);
   }
 }
 
+std::set<uint32_t> Ui::GetActionUids(bool p_Tagged)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (p_Tagged)
+  {
+    const std::set<uint32_t>& taggedUids = m_TaggedUids[m_CurrentFolder];
+    if (!taggedUids.empty())
+    {
+      return taggedUids;
+    }
+  }
+
+  return std::set<uint32_t>({ (uint32_t)m_MessageListCurrentUid[m_CurrentFolder] });
+}
+
+void Ui::ToggleTag()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    const uint32_t uid = m_MessageListCurrentUid[m_CurrentFolder];
+    std::set<uint32_t>& taggedUids = m_TaggedUids[m_CurrentFolder];
+    if (!taggedUids.erase(uid))
+    {
+      taggedUids.insert(uid);
+    }
+
+    InvalidateMessageListRows(m_CurrentFolder, std::set<uint32_t>({ uid }));
+  }
+
+  ++m_MessageListCurrentIndex[m_CurrentFolder];
+  UpdateUidFromIndex(true /* p_UserTriggered */);
+}
+
+void Ui::TagMatching()
+{
+  std::string pattern;
+  if (!PromptString("Tag Matching: ", pattern)) return;
+
+  pattern = Util::ToLower(Util::Trim(pattern));
+  if (pattern.empty()) return;
+
+  // match sender name and subject, as available from message envelopes
+  std::set<uint32_t> uids;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    std::set<uint32_t>& taggedUids = m_TaggedUids[m_CurrentFolder];
+    for (auto& uidHeader : m_Headers[m_CurrentFolder])
+    {
+      Header& header = uidHeader.second;
+      if ((Util::ToLower(header.GetShortFrom()).find(pattern) != std::string::npos) ||
+          (Util::ToLower(header.GetSubject()).find(pattern) != std::string::npos))
+      {
+        if (taggedUids.insert(uidHeader.first).second)
+        {
+          uids.insert(uidHeader.first);
+        }
+      }
+    }
+
+    InvalidateMessageListRows(m_CurrentFolder, uids);
+  }
+
+  SetDialogMessage("Tagged " + std::to_string(uids.size()) + " messages");
+}
+
+void Ui::ToggleTagAll()
+{
+  // untag all if all messages are tagged, otherwise tag all
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  const std::set<uint32_t>& uids = m_Uids[m_CurrentFolder];
+  std::set<uint32_t>& taggedUids = m_TaggedUids[m_CurrentFolder];
+  if (!uids.empty() && (taggedUids.size() < uids.size()))
+  {
+    taggedUids = uids;
+  }
+  else
+  {
+    taggedUids.clear();
+  }
+
+  m_MessageListRows.erase(m_CurrentFolder);
+}
+
 void Ui::MarkSeen()
 {
   std::map<uint32_t, uint32_t> flags;
@@ -3364,20 +4128,21 @@ void Ui::MarkSeen()
   {
     std::lock_guard<std::mutex> lock(m_Mutex);
     Flag::SetSeen(m_Flags[m_CurrentFolder][uid], newSeen);
+    InvalidateMessageListRows(m_CurrentFolder, action.m_Uids);
   }
 }
 
 void Ui::UpdateUidFromIndex(bool p_UserTriggered)
 {
   std::lock_guard<std::mutex> lock(m_Mutex);
-  auto& msgDateUids = m_MsgDateUids[m_CurrentFolder];
+  const int32_t count = GetMessageListCount(false /* p_IsSearch */);
 
   m_MessageListCurrentIndex[m_CurrentFolder] =
-    Util::Bound(0, m_MessageListCurrentIndex[m_CurrentFolder], (int)msgDateUids.size() - 1);
-  if (msgDateUids.size() > 0)
+    Util::Bound(0, m_MessageListCurrentIndex[m_CurrentFolder], count - 1);
+  if (count > 0)
   {
     m_MessageListCurrentUid[m_CurrentFolder] =
-      std::prev(msgDateUids.end(), m_MessageListCurrentIndex[m_CurrentFolder] + 1)->second;
+      GetMessageListUid(false /* p_IsSearch */, m_MessageListCurrentIndex[m_CurrentFolder]);
   }
   else
   {
@@ -3405,16 +4170,15 @@ void Ui::UpdateIndexFromUid()
 
     if (m_MessageListUidSet[m_CurrentFolder])
     {
-      auto& msgDateUids = m_MsgDateUids[m_CurrentFolder];
-
-      for (auto it = msgDateUids.rbegin(); it != msgDateUids.rend(); ++it)
+      const uint32_t uid = m_MessageListCurrentUid[m_CurrentFolder];
+      uint32_t index = 0;
+      if (m_ThreadView ? m_ThreadIndexes[m_CurrentFolder].GetRowIndex(uid, index)
+          : m_MsgDateUids[m_CurrentFolder].GetIndex(uid, index))
       {
-        if ((int32_t)it->second == m_MessageListCurrentUid[m_CurrentFolder])
-        {
-          m_MessageListCurrentIndex[m_CurrentFolder] = std::distance(msgDateUids.rbegin(), it);
-          found = true;
-          break;
-        }
+        // a message in a collapsed thread is selected through the thread row
+        m_MessageListCurrentIndex[m_CurrentFolder] = index;
+        m_MessageListCurrentUid[m_CurrentFolder] = GetMessageListUid(false, index);
+        found = true;
       }
     }
   }
@@ -3427,29 +4191,45 @@ void Ui::UpdateIndexFromUid()
   LOG_DEBUG("current uid = %d, idx = %d", m_MessageListCurrentUid[m_CurrentFolder], m_MessageListCurrentIndex[m_CurrentFolder]);
 }
 
+void Ui::SetThreadExpanded(bool p_Expanded)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_ThreadIndexes[m_CurrentFolder].SetExpanded(m_MessageListCurrentUid[m_CurrentFolder],
+                                                 p_Expanded);
+    m_MessageListUidSet[m_CurrentFolder] = true;
+  }
+
+  UpdateIndexFromUid();
+}
+
 void Ui::AddUidDate(const std::string& p_Folder, const std::map<uint32_t, Header>& p_UidHeaders)
 {
   auto& msgDateUids = m_MsgDateUids[p_Folder];
-  auto& msgUidDates = m_MsgUidDates[p_Folder];
+  ThreadIndex& threadIndex = m_ThreadIndexes[p_Folder];
+  std::map<uint32_t, Header>& headers = m_Headers[p_Folder];
 
   for (auto it = p_UidHeaders.begin(); it != p_UidHeaders.end(); ++it)
   {
     const uint32_t uid = it->first;
-    const std::string& date = m_Headers[p_Folder][uid].GetDateTime();
-    std::string dateUid = date + std::to_string(uid);
+    auto hit = headers.find(uid);
+    const int64_t timeStamp = (hit != headers.end()) ? hit->second.GetTimeStamp() : 0;
 
     if (uid == 0)
     {
-      LOG_WARNING("skip add date = %s, uid = %d pair", date.c_str(), uid);
+      LOG_WARNING("skip add date = %lld, uid = %d pair", (long long)timeStamp, uid);
       continue;
     }
 
-    LOG_DEBUG("add date = %s, uid = %d pair", date.c_str(), uid);
+    LOG_DEBUG("add date = %lld, uid = %d pair", (long long)timeStamp, uid);
+
+    msgDateUids.Insert(timeStamp, uid);
 
-    auto ret = msgDateUids.insert(std::pair<std::string, uint32_t>(dateUid, uid));
-    if (ret.second)
+    if (hit != headers.end())
     {
-      msgUidDates.insert(std::pair<uint32_t, std::string>(uid, dateUid));
+      Header& header = hit->second;
+      threadIndex.Add(uid, timeStamp, header.GetMessageId(), header.GetReferences(),
+                      header.GetSubject());
     }
   }  
 }
@@ -3457,86 +4237,86 @@ void Ui::AddUidDate(const std::string& p_Folder, const std::map<uint32_t, Header
 void Ui::RemoveUidDate(const std::string& p_Folder, const std::set<uint32_t>& p_Uids)
 {
   auto& msgDateUids = m_MsgDateUids[p_Folder];
-  auto& msgUidDates = m_MsgUidDates[p_Folder];
+  ThreadIndex& threadIndex = m_ThreadIndexes[p_Folder];
+  std::set<uint32_t>& taggedUids = m_TaggedUids[p_Folder];
 
   for (auto it = p_Uids.begin(); it != p_Uids.end(); ++it)
   {
     const uint32_t uid = *it;
-    const std::string& date = m_Headers[p_Folder][uid].GetDateTime();
-    std::string dateUid = date + std::to_string(uid);
 
     if (uid == 0)
     {
-      LOG_WARNING("skip del date = %s, uid = %d pair", date.c_str(), uid);
+      LOG_WARNING("skip del uid = %d", uid);
       continue;
     }
 
-    LOG_DEBUG("del date = %s, uid = %d pair", date.c_str(), uid);
+    LOG_DEBUG("del uid = %d", uid);
 
-    auto msgDateUid = msgDateUids.find(dateUid);
-    if (msgDateUid != msgDateUids.end())
-    {
-      msgDateUids.erase(msgDateUid);
-    }
+    msgDateUids.Remove(uid);
+    threadIndex.Remove(uid);
+    taggedUids.erase(uid);
+  }
 
-    auto msgUidDate = msgUidDates.find(uid);
-    if (msgUidDate != msgUidDates.end())
-    {
-      msgUidDates.erase(msgUidDate);
-    }
+  InvalidateMessageListRows(p_Folder, p_Uids);
+}
+
+void Ui::InvalidateMessageListRows(const std::string& p_Folder, const std::set<uint32_t>& p_Uids)
+{
+  auto fit = m_MessageListRows.find(p_Folder);
+  if (fit == m_MessageListRows.end()) return;
+
+  for (auto& uid : p_Uids)
+  {
+    fit->second.erase(uid);
   }
 }
 
-void Ui::ComposeMessagePrevLine()
+void Ui::SearchMessages()
 {
-  if (m_ComposeMessageWrapLine > 0)
+  std::string query = m_SearchQuery;
+  if (PromptString("Search: ", query))
   {
-    if ((int)m_ComposeMessageLines[m_ComposeMessageWrapLine - 1].size() >
-        m_ComposeMessageWrapPos)
+    query = Util::Trim(query);
+    if (!query.empty())
     {
-      int stepsBack = m_ComposeMessageWrapPos + 1 +
-        (m_ComposeMessageLines[m_ComposeMessageWrapLine - 1].size() -
-         m_ComposeMessageWrapPos);
-      m_ComposeMessagePos = Util::Bound(0, m_ComposeMessagePos - stepsBack,
-                                        (int)m_ComposeMessageStr.size());
+      {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_SearchQuery = query;
+        m_SearchUids.clear();
+        m_SearchDateUids.Clear();
+        m_SearchListCurrentIndex = 0;
+      }
+
+      ImapManager::Request request;
+      request.m_Folder = m_CurrentFolder;
+      request.m_SearchQuery = query;
+      LOG_DEBUG_VAR("async request search =", query);
+      m_ImapManager->AsyncRequest(request);
+
+      SetState(StateViewSearchList);
     }
     else
     {
-      int stepsBack = m_ComposeMessageWrapPos + 1;
-      m_ComposeMessagePos = Util::Bound(0, m_ComposeMessagePos - stepsBack,
-                                        (int)m_ComposeMessageStr.size());
+      SetDialogMessage("Search cancelled (empty query)");
     }
   }
   else
   {
-    m_IsComposeHeader = true;
+    SetDialogMessage("Search cancelled");
   }
 }
 
-void Ui::ComposeMessageNextLine()
+void Ui::UpdateSearchDateUids()
 {
-  if ((m_ComposeMessageWrapLine + 1) < (int)m_ComposeMessageLines.size())
+  m_SearchDateUids.Clear();
+  const DateUidIndex& msgDateUids = m_MsgDateUids[m_CurrentFolder];
+  for (auto& uid : m_SearchUids)
   {
-    int stepsForward = m_ComposeMessageLines[m_ComposeMessageWrapLine].size() -
-      m_ComposeMessageWrapPos + 1;
-    if ((int)m_ComposeMessageLines[m_ComposeMessageWrapLine + 1].size() >
-        m_ComposeMessageWrapPos)
-    {
-      stepsForward += m_ComposeMessageWrapPos;
-    }
-    else
+    int64_t timeStamp = 0;
+    if (msgDateUids.GetTimeStamp(uid, timeStamp))
     {
-      stepsForward += m_ComposeMessageLines[m_ComposeMessageWrapLine + 1].size();
+      m_SearchDateUids.Insert(timeStamp, uid);
     }
-    m_ComposeMessagePos = Util::Bound(0, m_ComposeMessagePos + stepsForward,
-                                      (int)m_ComposeMessageStr.size());
-  }
-  else if ((int)m_ComposeMessageLines.size() > 0)
-  {
-    int stepsForward = m_ComposeMessageLines[m_ComposeMessageWrapLine].size() -
-      m_ComposeMessageWrapPos;
-    m_ComposeMessagePos = Util::Bound(0, m_ComposeMessagePos + stepsForward,
-                                      (int)m_ComposeMessageStr.size());
   }
 }
 
@@ -3678,16 +4458,67 @@ bool Ui::CurrentMessageBodyAvailable()
   return (bit != bodys.end());
 }
 
+bool Ui::CurrentMessagePartsAvailable()
+{
+  // parts of a partially fetched message are requested when first needed
+  uint32_t uid = 0;
+  std::set<ssize_t> unfetchedParts;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    uid = m_MessageListCurrentUid[m_CurrentFolder];
+    const std::map<uint32_t, Body>& bodys = m_Bodys[m_CurrentFolder];
+    std::map<uint32_t, Body>::const_iterator bit = bodys.find(uid);
+    if (bit != bodys.end())
+    {
+      unfetchedParts = bit->second.GetUnfetchedParts();
+    }
+  }
+
+  if (unfetchedParts.empty())
+  {
+    return true;
+  }
+
+  RequestBodyParts(uid, unfetchedParts);
+  return false;
+}
+
+void Ui::WritePartFile(const std::string& p_Path, const Part& p_Part)
+{
+  // large parts are streamed to file when fetched, and copied from there
+  if (p_Part.m_Path.empty())
+  {
+    Util::WriteFile(p_Path, p_Part.m_Data);
+  }
+  else
+  {
+    Util::CopyFile(p_Part.m_Path, p_Path);
+  }
+}
+
+void Ui::RequestBodyParts(uint32_t p_Uid, const std::set<ssize_t>& p_Parts)
+{
+  ImapManager::Request request;
+  request.m_Folder = m_CurrentFolder;
+  request.m_Priority = ImapManager::RequestPriorityCurrentMessage;
+  request.m_GetBodyParts[p_Uid] = p_Parts;
+  LOG_DEBUG_VAR("request body parts =", p_Parts);
+  m_ImapManager->AsyncRequest(request);
+  SetDialogMessage("Fetching message parts, please retry when done");
+}
+
 void Ui::InvalidateUiCache(const std::string& p_Folder)
 {
   std::lock_guard<std::mutex> lock(m_Mutex);
   m_HasRequestedUids[p_Folder] = false;
   m_Flags[p_Folder].clear();
   m_RequestedFlags[p_Folder].clear();
+  m_MessageListRows.erase(p_Folder);
 }
 
-void Ui::ExternalEditor(std::wstring& p_ComposeMessageStr, int& p_ComposeMessagePos)
+bool Ui::ExternalEditor(std::wstring& p_ComposeMessageStr)
 {
+  bool result = false;
   endwin();
   const std::string& tempPath = Util::GetTempFilename(".txt");
   Util::WriteWFile(tempPath, p_ComposeMessageStr);
@@ -3699,7 +4530,7 @@ void Ui::ExternalEditor(std::wstring& p_ComposeMessageStr, int& p_ComposeMessage
   {
     LOG_DEBUG("external editor exited successfully");
     p_ComposeMessageStr = Util::ReadWFile(tempPath);
-    p_ComposeMessagePos = 0;
+    result = true;
   }
   else
   {
@@ -3715,6 +4546,8 @@ void Ui::ExternalEditor(std::wstring& p_ComposeMessageStr, int& p_ComposeMessage
   {
     // Discard any remaining input
   }
+
+  return result;
 }
 
 void Ui::ExternalPager()
@@ -3751,7 +4584,7 @@ void Ui::SetLastStateOrMessageList()
   bool isMsgDateUidsEmpty = false;
   {
     std::lock_guard<std::mutex> lock(m_Mutex);
-    isMsgDateUidsEmpty = m_MsgDateUids[m_CurrentFolder].empty();
+    isMsgDateUidsEmpty = m_MsgDateUids[m_CurrentFolder].Empty();
   }
 
   if (isMsgDateUidsEmpty)
@@ -3774,7 +4607,20 @@ void Ui::ExportMessage()
     {
       std::unique_lock<std::mutex> lock(m_Mutex);
       const std::map<uint32_t, Body>& bodys = m_Bodys[m_CurrentFolder];
-      if (bodys.find(currentUid) != bodys.end())
+      if ((bodys.find(currentUid) != bodys.end()) && bodys.at(currentUid).IsPartial())
+      {
+        // the raw message is needed for export, and fetched bypassing partial fetch
+        lock.unlock();
+        ImapManager::Request request;
+        request.m_Folder = m_CurrentFolder;
+        request.m_Priority = ImapManager::RequestPriorityCurrentMessage;
+        request.m_GetBodys.insert(currentUid);
+        request.m_FullBodys = true;
+        LOG_DEBUG_VAR("async request full bodys =", request.m_GetBodys);
+        m_ImapManager->AsyncRequest(request);
+        SetDialogMessage("Fetching full message, please retry export when done");
+      }
+      else if (bodys.find(currentUid) != bodys.end())
       {
         Util::WriteFile(filename, m_Bodys[m_CurrentFolder][currentUid].GetData());
         lock.unlock();
@@ -3804,14 +4650,12 @@ void Ui::ImportMessage()
   {
     if (!filename.empty())
     {
+      // a message file, mbox file, maildir or directory of message files
       if (Util::NotEmpty(filename))
       {
-        const std::string& msg = Util::ReadFile(filename);
-
         ImapManager::Action imapAction;
-        imapAction.m_UploadMessage = true;
         imapAction.m_Folder = m_CurrentFolder;
-        imapAction.m_Msg = msg;
+        imapAction.m_ImportPath = Util::AbsolutePath(filename);
         m_ImapManager->AsyncAction(imapAction);
         m_HasRequestedUids[m_CurrentFolder] = false;
       }
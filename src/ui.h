@@ -13,9 +13,13 @@
 
 #include <ncursesw/ncurses.h>
 
+#include "composebuffer.h"
 #include "config.h"
+#include "dateuidindex.h"
 #include "imapmanager.h"
 #include "smtpmanager.h"
+#include "threadindex.h"
+#include "wraplayout.h"
 
 class Ui
 {
@@ -32,6 +36,7 @@ public:
     StateAddressList = 7,
     StateFileList = 8,
     StateViewPartList = 9,
+    StateViewSearchList = 10,
   };
 
   enum UiRequest
@@ -39,6 +44,8 @@ public:
     UiRequestNone = 0,
     UiRequestDrawAll = (1 << 0),
     UiRequestDrawError = (1 << 1),
+    UiRequestDrawDamaged = (1 << 2),
+    UiRequestDrawTop = (1 << 3),
   };
 
   enum PrefetchLevel
@@ -87,12 +94,19 @@ private:
   void DrawAddressList();
   void DrawFileList();
   void DrawMessageList();
+  std::wstring GetMessageListRow(uint32_t p_Uid, const std::string& p_SubjectPrefix,
+                                 const std::string& p_CurrentDate);
   void DrawMessage();
   void DrawComposeMessage();
   void DrawPartList();
 
   void AsyncUiRequest(char p_UiRequest);
   void PerformUiRequest(char p_UiRequest);
+  bool IsDamageVisible();
+  void GetMessageListWindow(int32_t p_CurrentIndex, int32_t p_Count, int& p_IdxOffs,
+                            int& p_IdxMax);
+  int32_t GetMessageListCount(bool p_IsSearch);
+  uint32_t GetMessageListUid(bool p_IsSearch, int32_t p_Index);
   void SetDialogMessage(const std::string& p_DialogMessage, bool p_Warn = false);
 
   void ViewFolderListKeyHandler(int p_Key);
@@ -102,8 +116,10 @@ private:
   void ViewMessageKeyHandler(int p_Key);
   void ComposeMessageKeyHandler(int p_Key);
   void ViewPartListKeyHandler(int p_Key);
+  void ViewSearchListKeyHandler(int p_Key);
 
   void SetState(State p_State);
+  void RequestFolderStatuses();
   bool IsConnected();
 
   std::string GetKeyDisplay(int p_Key);
@@ -115,21 +131,32 @@ private:
   void UploadDraftMessage();
   bool DeleteMessage();
   void MoveMessage(uint32_t p_Uid, const std::string& p_From, const std::string& p_To);
-  void DeleteMessage(uint32_t p_Uid, const std::string& p_Folder);
+  void MoveMessages(const std::set<uint32_t>& p_Uids, const std::string& p_From,
+                    const std::string& p_To);
+  void DeleteMessages(const std::set<uint32_t>& p_Uids, const std::string& p_Folder);
+  std::set<uint32_t> GetActionUids(bool p_Tagged);
+  void ToggleTag();
+  void TagMatching();
+  void ToggleTagAll();
   void ToggleSeen();
   void MarkSeen();
   void UpdateUidFromIndex(bool p_UserTriggered);
   void UpdateIndexFromUid();
+  void SetThreadExpanded(bool p_Expanded);
   void AddUidDate(const std::string& p_Folder, const std::map<uint32_t, Header>& p_UidHeaders);
   void RemoveUidDate(const std::string& p_Folder, const std::set<uint32_t>& p_Uids);
-  void ComposeMessagePrevLine();
-  void ComposeMessageNextLine();
+  void InvalidateMessageListRows(const std::string& p_Folder, const std::set<uint32_t>& p_Uids);
+  void SearchMessages();
+  void UpdateSearchDateUids();
   int ReadKeyBlocking();
   bool PromptYesNo(const std::string& p_Prompt);
   bool PromptString(const std::string& p_Prompt, std::string& p_Entry);
   bool CurrentMessageBodyAvailable();
+  bool CurrentMessagePartsAvailable();
+  void RequestBodyParts(uint32_t p_Uid, const std::set<ssize_t>& p_Parts);
+  void WritePartFile(const std::string& p_Path, const Part& p_Part);
   void InvalidateUiCache(const std::string& p_Folder);
-  void ExternalEditor(std::wstring& p_ComposeMessageStr, int& p_ComposeMessagePos);
+  bool ExternalEditor(std::wstring& p_ComposeMessageStr);
   void ExternalPager();
   void SetLastStateOrMessageList();
   void ExportMessage();
@@ -158,16 +185,22 @@ private:
   std::map<std::string, std::map<uint32_t, Header>> m_Headers;
   std::map<std::string, std::map<uint32_t, uint32_t>> m_Flags;
   std::map<std::string, std::map<uint32_t, Body>> m_Bodys;
-  std::map<std::string, std::map<std::string, uint32_t>> m_MsgDateUids;
-  std::map<std::string, std::map<uint32_t, std::string>> m_MsgUidDates;
+  std::map<std::string, DateUidIndex> m_MsgDateUids;
+  std::map<std::string, ThreadIndex> m_ThreadIndexes;
   std::map<std::string, std::set<uint32_t>> m_NewUids;
+  std::map<std::string, std::set<uint32_t>> m_TaggedUids;
 
   bool m_HasRequestedFolders = false;
   bool m_HasPrefetchRequestedFolders = false;
+  std::map<std::string, FolderStatus> m_FolderStatuses;
+  bool m_HasRequestedFolderStatuses = false;
+  bool m_FolderStatusesStale = true;
+  std::chrono::time_point<std::chrono::steady_clock> m_FolderStatusesTime;
   std::map<std::string, bool> m_HasRequestedUids;
   std::map<std::string, bool> m_HasPrefetchRequestedUids;
   std::map<std::string, std::set<uint32_t>> m_PrefetchedHeaders;
   std::map<std::string, std::set<uint32_t>> m_RequestedHeaders;
+  std::map<std::string, std::set<uint32_t>> m_RequestedFullHeaders;
   std::map<std::string, std::set<uint32_t>> m_PrefetchedBodys;
   std::map<std::string, std::set<uint32_t>> m_RequestedBodys;
   std::map<std::string, std::set<uint32_t>> m_RequestedFlags;
@@ -188,11 +221,25 @@ private:
 
   std::string m_DialogMessage;
   std::chrono::time_point<std::chrono::system_clock> m_DialogMessageTime;
+  std::chrono::time_point<std::chrono::steady_clock> m_DrawTime;
+
+  std::set<uint32_t> m_DamagedUids;
+  std::vector<uint32_t> m_DrawnUids;
+  int32_t m_DrawnCurrentIndex = -1;
   
   std::map<std::string, int32_t> m_MessageListCurrentIndex;
   std::map<std::string, int32_t> m_MessageListCurrentUid;
   std::map<std::string, bool> m_MessageListUidSet;
 
+  std::map<std::string, std::map<uint32_t, std::wstring>> m_MessageListRows;
+  int m_MessageListRowsWidth = 0;
+  std::string m_MessageListRowsDate;
+
+  std::string m_SearchQuery;
+  std::set<uint32_t> m_SearchUids;
+  DateUidIndex m_SearchDateUids;
+  int32_t m_SearchListCurrentIndex = 0;
+
   int m_AddressListCurrentIndex = 0;
   std::string m_AddressListCurrentAddress;
 
@@ -201,10 +248,13 @@ private:
 
   int m_PartListCurrentIndex = 0;
   Part m_PartListCurrentPart;
+  ssize_t m_PartListCurrentPartIndex = -1;
   
   int m_MessageViewLineOffset = 0;
   bool m_PersistFolderFilter = true;
   bool m_Plaintext = true;
+  bool m_ThreadView = false;
+  int m_FolderStatusInterval = 60;
   
   int m_FolderListCurrentIndex = 0;
   std::string m_FolderListCurrentFolder;
@@ -239,6 +289,11 @@ private:
   int m_KeyOtherCmdHelp = 0;
   int m_KeyExport = 0;
   int m_KeyImport = 0;
+  int m_KeySearch = 0;
+  int m_KeyToggleThreads = 0;
+  int m_KeyTag = 0;
+  int m_KeyTagMatching = 0;
+  int m_KeyTagAll = 0;
   bool m_ShowProgress = false;
   bool m_NewMsgBell = false;
   bool m_QuitWithoutConfirm = true;
@@ -267,11 +322,7 @@ private:
   std::string m_ComposeHeaderRef;
   std::string m_ComposeTempDirectory;
 
-  std::wstring m_ComposeMessageStr;
-  int m_ComposeMessagePos = 0;
-  std::vector<std::wstring> m_ComposeMessageLines;
-  int m_ComposeMessageWrapLine = 0;
-  int m_ComposeMessageWrapPos = 0;
+  ComposeBuffer m_ComposeMessageBuffer;
   int m_ComposeMessageOffsetY = 0;
   uint32_t m_ComposeDraftUid = 0;
 
@@ -288,6 +339,8 @@ private:
   bool m_MessageViewToggledSeen = false;
 
   std::string m_CurrentMessageViewText;
+  WrapLayout m_MessageViewLayout;
+  std::string m_MessageViewLayoutKey;
 
   int m_MaxLineLength = 0;
   
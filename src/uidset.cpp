@@ -0,0 +1,97 @@
+// uidset.cpp
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "uidset.h"
+
+UidSet::UidSet()
+{
+}
+
+UidSet::UidSet(const std::set<uint32_t>& p_Uids)
+{
+  for (auto& uid : p_Uids)
+  {
+    if (!m_Ranges.empty() && (m_Ranges.back().second != UINT32_MAX) &&
+        (uid == (m_Ranges.back().second + 1)))
+    {
+      m_Ranges.back().second = uid;
+    }
+    else
+    {
+      m_Ranges.push_back(std::make_pair(uid, uid));
+    }
+  }
+}
+
+UidSet::~UidSet()
+{
+}
+
+bool UidSet::Empty() const
+{
+  return m_Ranges.empty();
+}
+
+const std::vector<std::pair<uint32_t, uint32_t>>& UidSet::GetRanges() const
+{
+  return m_Ranges;
+}
+
+std::string UidSet::ToString() const
+{
+  std::string str;
+  for (auto& range : m_Ranges)
+  {
+    if (!str.empty())
+    {
+      str += ",";
+    }
+
+    str += std::to_string(range.first);
+    if (range.second != range.first)
+    {
+      str += ":" + std::to_string(range.second);
+    }
+  }
+
+  return str;
+}
+
+std::vector<UidSet> UidSet::Split(size_t p_MaxLength) const
+{
+  // a single range always fits, as it is the smallest unit of splitting
+  std::vector<UidSet> uidSets;
+  size_t length = 0;
+  for (auto& range : m_Ranges)
+  {
+    const size_t rangeLength = GetLength(range);
+    if (uidSets.empty() || ((length + 1 + rangeLength) > p_MaxLength))
+    {
+      uidSets.push_back(UidSet());
+      length = rangeLength;
+    }
+    else
+    {
+      length += 1 + rangeLength;
+    }
+
+    uidSets.back().m_Ranges.push_back(range);
+  }
+
+  return uidSets;
+}
+
+size_t UidSet::GetLength(const std::pair<uint32_t, uint32_t>& p_Range)
+{
+  size_t length = std::to_string(p_Range.first).size();
+  if (p_Range.second != p_Range.first)
+  {
+    length += 1 + std::to_string(p_Range.second).size();
+  }
+
+  return length;
+}
@@ -0,0 +1,37 @@
+// uidset.h
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+// IMAP uid set, stored as sorted runs of consecutive uids and emitted in sequence set syntax,
+// e.g. "1:500,502,510:900". Can be split into parts of limited length, for servers limiting
+// command line length.
+class UidSet
+{
+public:
+  UidSet();
+  explicit UidSet(const std::set<uint32_t>& p_Uids);
+  virtual ~UidSet();
+
+  bool Empty() const;
+  const std::vector<std::pair<uint32_t, uint32_t>>& GetRanges() const;
+  std::string ToString() const;
+  std::vector<UidSet> Split(size_t p_MaxLength) const;
+
+private:
+  static size_t GetLength(const std::pair<uint32_t, uint32_t>& p_Range);
+
+private:
+  std::vector<std::pair<uint32_t, uint32_t>> m_Ranges;
+};
@@ -73,6 +73,26 @@ void Util::WriteFile(const std::string &p_Path, const std::string &p_Str)
   file << p_Str;
 }
 
+bool Util::CopyFile(const std::string& p_SrcPath, const std::string& p_DstPath)
+{
+  MkDir(DirName(p_DstPath));
+  std::ifstream srcFile(p_SrcPath, std::ios::binary);
+  std::ofstream dstFile(p_DstPath, std::ios::binary);
+  if (!srcFile.is_open() || !dstFile.is_open())
+  {
+    return false;
+  }
+
+  dstFile << srcFile.rdbuf();
+  return true;
+}
+
+uint64_t Util::GetFileSize(const std::string& p_Path)
+{
+  struct stat sb;
+  return (stat(p_Path.c_str(), &sb) == 0) ? static_cast<uint64_t>(sb.st_size) : 0;
+}
+
 std::wstring Util::ReadWFile(const std::string &p_Path)
 {
   std::locale::global(std::locale(""));
@@ -287,11 +307,7 @@ time_t Util::MailtimeToTimet(mailimf_date_time *p_Dt)
 
 std::string Util::GetHtmlConvertCmd()
 {
-  if (!m_HtmlConvertCmd.empty()) return m_HtmlConvertCmd;
-
-  static std::string defaultHtmlConvertCmd = GetDefaultHtmlConvertCmd();
-  
-  return defaultHtmlConvertCmd;
+  return m_HtmlConvertCmd;
 }
 
 void Util::SetHtmlConvertCmd(const std::string &p_HtmlConvertCmd)
@@ -299,38 +315,6 @@ void Util::SetHtmlConvertCmd(const std::string &p_HtmlConvertCmd)
   m_HtmlConvertCmd = p_HtmlConvertCmd;
 }
 
-std::string Util::GetDefaultHtmlConvertCmd()
-{
-  std::string result;
-  const std::string& commandOutPath = Util::GetTempFilename(".txt");
-  const std::string& command =
-    std::string("which lynx elinks links 2> /dev/null | head -1 > ") + commandOutPath;
-  if (system(command.c_str()) == 0)
-  {
-    std::string output = Util::ReadFile(commandOutPath);
-    output.erase(std::remove(output.begin(), output.end(), '\n'), output.end());
-    if (!output.empty())
-    {
-      if (output.find("/lynx") != std::string::npos)
-      {
-        result = "lynx -assume_charset=utf-8 -display_charset=utf-8 -dump";
-      }
-      else if (output.find("/elinks") != std::string::npos)
-      {
-        result = "elinks -dump-charset utf-8 -dump";
-      }
-      else if (output.find("/links") != std::string::npos)
-      {
-        result = "links -codepage utf-8 -dump";
-      }
-    }
-  }
-
-  Util::DeleteFile(commandOutPath);
-
-  return result;
-}
-
 std::string Util::GetExtViewerCmd()
 {
   if (!m_ExtViewerCmd.empty()) return m_ExtViewerCmd;
@@ -8,6 +8,7 @@
 #pragma once
 
 #include <csignal>
+#include <cstdint>
 #include <map>
 #include <mutex>
 #include <set>
@@ -114,6 +115,8 @@ public:
   static bool NotEmpty(const std::string& p_Path);
   static std::string ReadFile(const std::string& p_Path);
   static void WriteFile(const std::string& p_Path, const std::string& p_Str);
+  static bool CopyFile(const std::string& p_SrcPath, const std::string& p_DstPath);
+  static uint64_t GetFileSize(const std::string& p_Path);
   static std::wstring ReadWFile(const std::string &p_Path);
   static void WriteWFile(const std::string &p_Path, const std::wstring &p_WStr);
   static std::string BaseName(const std::string& p_Path); 
@@ -141,7 +144,6 @@ public:
   static time_t MailtimeToTimet(struct mailimf_date_time* p_Dt);
   static std::string GetHtmlConvertCmd();
   static void SetHtmlConvertCmd(const std::string& p_HtmlConvertCmd);
-  static std::string GetDefaultHtmlConvertCmd();
   static std::string GetExtViewerCmd();
   static void SetExtViewerCmd(const std::string& p_ExtViewerCmd);
   static std::string GetDefaultExtViewerCmd();
@@ -0,0 +1,118 @@
+// wraplayout.cpp
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#include "wraplayout.h"
+
+#include <algorithm>
+
+WrapLayout::WrapLayout()
+{
+}
+
+WrapLayout::~WrapLayout()
+{
+}
+
+void WrapLayout::SetText(std::wstring p_Text, unsigned p_LineLength, bool p_WrapQuoteLines)
+{
+  Clear();
+  m_Text.swap(p_Text);
+  m_LineLength = std::max(p_LineLength, 1u);
+  m_WrapQuoteLines = p_WrapQuoteLines;
+}
+
+void WrapLayout::Clear()
+{
+  m_Text.clear();
+  m_Lines.clear();
+  m_TextPos = 0;
+  m_LinePos = 0;
+  m_LineEnd = 0;
+  m_InLine = false;
+}
+
+void WrapLayout::Layout(size_t p_LineCount)
+{
+  while ((m_Lines.size() < p_LineCount) && WrapNext())
+  {
+  }
+}
+
+bool WrapLayout::IsComplete() const
+{
+  return !m_InLine && (m_TextPos >= m_Text.size());
+}
+
+size_t WrapLayout::GetLineCount() const
+{
+  return m_Lines.size();
+}
+
+std::wstring WrapLayout::GetLine(size_t p_Index) const
+{
+  if (p_Index >= m_Lines.size()) return std::wstring();
+
+  return m_Text.substr(m_Lines[p_Index].first, m_Lines[p_Index].second);
+}
+
+bool WrapLayout::WrapNext()
+{
+  if (!m_InLine)
+  {
+    if (m_TextPos >= m_Text.size()) return false;
+
+    size_t newlinePos = m_Text.find(L'\n', m_TextPos);
+    m_LinePos = m_TextPos;
+    m_LineEnd = (newlinePos != std::wstring::npos) ? newlinePos : m_Text.size();
+    m_TextPos = (newlinePos != std::wstring::npos) ? (newlinePos + 1) : m_Text.size();
+    m_InLine = true;
+  }
+
+  std::pair<size_t, size_t> line;
+  m_InLine = WrapSegment(m_Text, m_LinePos, m_LineEnd, m_LineLength, m_WrapQuoteLines, line);
+  m_Lines.push_back(line);
+  return true;
+}
+
+bool WrapLayout::WrapSegment(const std::wstring& p_Text, size_t& p_Pos, size_t p_End,
+                             unsigned p_LineLength, bool p_WrapQuoteLines,
+                             std::pair<size_t, size_t>& p_Line)
+{
+  // one wrapped line, split at the last space within the line length, returns true if the
+  // source line continues on a following wrapped line
+  const size_t length = p_End - p_Pos;
+  if ((length >= p_LineLength) && (p_WrapQuoteLines || (p_Text[p_Pos] != L'>')))
+  {
+    size_t spacePos = std::wstring::npos;
+    for (size_t i = p_Pos + std::min((size_t)p_LineLength, length - 1); ; --i)
+    {
+      if (p_Text[i] == L' ')
+      {
+        spacePos = i;
+        break;
+      }
+
+      if (i == p_Pos) break;
+    }
+
+    if (spacePos != std::wstring::npos)
+    {
+      p_Line = std::make_pair(p_Pos, spacePos - p_Pos);
+      p_Pos = std::min(spacePos + 1, p_End);
+    }
+    else
+    {
+      p_Line = std::make_pair(p_Pos, (size_t)p_LineLength);
+      p_Pos = std::min(p_Pos + p_LineLength, p_End);
+    }
+
+    return true;
+  }
+
+  p_Line = std::make_pair(p_Pos, length);
+  return false;
+}
@@ -0,0 +1,47 @@
+// wraplayout.h
+//
+// Copyright (c) 2019-2020 Kristofer Berggren
+// All rights reserved.
+//
+// nmail is distributed under the MIT license, see LICENSE for details.
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// Incremental word wrapping, producing the same lines as Util::WordWrap. Lines are stored as
+// offsets into the text and only laid out as far as requested, so showing the start of a long
+// text does not require wrapping all of it.
+class WrapLayout
+{
+public:
+  WrapLayout();
+  virtual ~WrapLayout();
+
+  void SetText(std::wstring p_Text, unsigned p_LineLength, bool p_WrapQuoteLines);
+  void Clear();
+  void Layout(size_t p_LineCount);
+  bool IsComplete() const;
+  size_t GetLineCount() const;
+  std::wstring GetLine(size_t p_Index) const;
+
+  static bool WrapSegment(const std::wstring& p_Text, size_t& p_Pos, size_t p_End,
+                          unsigned p_LineLength, bool p_WrapQuoteLines,
+                          std::pair<size_t, size_t>& p_Line);
+
+private:
+  bool WrapNext();
+
+private:
+  std::wstring m_Text;
+  unsigned m_LineLength = 1;
+  bool m_WrapQuoteLines = true;
+  std::vector<std::pair<size_t, size_t>> m_Lines;
+
+  size_t m_TextPos = 0;
+  size_t m_LinePos = 0;
+  size_t m_LineEnd = 0;
+  bool m_InLine = false;
+};